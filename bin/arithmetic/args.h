@@ -194,6 +194,25 @@ struct argp_option program_options[] =
       GAL_OPTIONS_NOT_SET
     },
 
+
+
+
+
+    /* Operating mode. */
+    {
+      "stream",
+      UI_KEY_STREAM,
+      "INT",
+      0,
+      "Stream element-wise expressions (INT pixels).",
+      GAL_OPTIONS_GROUP_OPERATING_MODE,
+      &p->stream,
+      GAL_TYPE_SIZE_T,
+      GAL_OPTIONS_RANGE_GT_0,
+      GAL_OPTIONS_NOT_MANDATORY,
+      GAL_OPTIONS_NOT_SET
+    },
+
     {0}
   };
 
@@ -44,6 +44,8 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 
 #include "main.h"
 
+#include "fuse.h"
+#include "stream.h"
 #include "operands.h"
 #include "arithmetic.h"
 
@@ -194,6 +196,7 @@ struct arithmetic_filter_p
   size_t        *hnfsize;       /* Negative Half-filter size.            */
   float     sclip_multip;       /* Sigma multiple in sigma-clipping.     */
   float      sclip_param;       /* Termination critera in sigma-cliping. */
+  size_t            nseg;       /* Segments in each line (sliding).      */
   gal_data_t      *input;       /* Input dataset.                        */
   gal_data_t        *out;       /* Output dataset.                       */
 };
@@ -202,6 +205,81 @@ struct arithmetic_filter_p
 
 
 
+/* Measure the desired statistic over the given window. */
+static gal_data_t *
+arithmetic_filter_statistic(struct arithmetic_filter_p *afp,
+                            gal_data_t *window, int inplace)
+{
+  size_t sind=-1;
+  int clipflags=0;
+  size_t one=1;
+  gal_data_t *sigclip, *result=NULL;
+
+  /* Do the necessary calculation. */
+  switch(afp->operator)
+    {
+    case ARITHMETIC_OP_FILTER_MEDIAN:
+      result=gal_statistics_median(window, inplace);
+      break;
+
+
+    case ARITHMETIC_OP_FILTER_MEAN:
+      result=gal_statistics_mean(window);
+      break;
+
+
+    case ARITHMETIC_OP_FILTER_SIGCLIP_MEAN:
+    case ARITHMETIC_OP_FILTER_SIGCLIP_MEDIAN:
+      /* The median is always available with a sigma-clip, but the mean
+         needs to be explicitly requested. */
+      if(afp->operator == ARITHMETIC_OP_FILTER_SIGCLIP_MEAN)
+        clipflags = GAL_STATISTICS_CLIP_OUTCOL_OPTIONAL_MEAN;
+      sigclip=gal_statistics_clip_sigma(window, afp->sclip_multip,
+                                        afp->sclip_param, clipflags,
+                                        inplace, 1);
+
+      /* Set the required index. */
+      switch(afp->operator)
+        {
+        case ARITHMETIC_OP_FILTER_SIGCLIP_MEAN:
+          sind = GAL_STATISTICS_CLIP_OUTCOL_MEAN; break;
+        case ARITHMETIC_OP_FILTER_SIGCLIP_MEDIAN:
+          sind = GAL_STATISTICS_CLIP_OUTCOL_MEDIAN; break;
+        default:
+          error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at "
+                "%s to fix the problem. The 'afp->operator' value "
+                "%d is not recognized as sigma-clipped median or "
+                "mean", __func__, PACKAGE_BUGREPORT, afp->operator);
+        }
+
+      /* Allocate the output and write the value into it. */
+      result=gal_data_alloc(NULL, GAL_TYPE_FLOAT32, 1, &one, NULL,
+                            0, -1, 1, NULL, NULL, NULL);
+      ((float *)(result->array))[0] =
+        ((float *)(sigclip->array))[sind];
+
+      /* Clean up. */
+      gal_data_free(sigclip);
+      break;
+
+
+    default:
+      error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s "
+            "to fix the problem. 'afp->operator' code %d is not "
+            "recognized", PACKAGE_BUGREPORT, __func__,
+            afp->operator);
+    }
+
+  /* Make sure the output array type and result's type are the same. */
+  if(result->type!=afp->out->type)
+    result=gal_data_copy_to_new_type_free(result, afp->out->type);
+  return result;
+}
+
+
+
+
+
 /* Main filtering work function. */
 static void *
 arithmetic_filter(void *in_prm)
@@ -210,10 +288,8 @@ arithmetic_filter(void *in_prm)
   struct arithmetic_filter_p *afp=(struct arithmetic_filter_p *)tprm->params;
   gal_data_t *input=afp->input;
 
-  size_t sind=-1;
-  int clipflags=0;
-  size_t ind, index, one=1;
-  gal_data_t *sigclip, *result=NULL;
+  gal_data_t *result;
+  size_t ind, index;
   size_t *hpfsize=afp->hpfsize, *hnfsize=afp->hnfsize;
   size_t *tsize, *dsize=input->dsize, *fsize=afp->fsize;
   size_t i, j, coord[ARITHMETIC_FILTER_DIM], ndim=input->ndim;
@@ -275,81 +351,625 @@ arithmetic_filter(void *in_prm)
       tile->array=gal_pointer_increment(input->array, index, input->type);
 
       /* Do the necessary calculation. */
-      switch(afp->operator)
-        {
-        case ARITHMETIC_OP_FILTER_MEDIAN:
-          result=gal_statistics_median(tile, 0);
-          break;
+      result=arithmetic_filter_statistic(afp, tile, 0);
 
+      /* Copy the result into the output array. */
+      memcpy(gal_pointer_increment(afp->out->array, ind, afp->out->type),
+             result->array, gal_type_sizeof(afp->out->type));
 
-        case ARITHMETIC_OP_FILTER_MEAN:
-          result=gal_statistics_mean(tile);
-          break;
+      /* Clean up for this pixel. */
+      gal_data_free(result);
+    }
 
 
-        case ARITHMETIC_OP_FILTER_SIGCLIP_MEAN:
-        case ARITHMETIC_OP_FILTER_SIGCLIP_MEDIAN:
-          /* The median is always available with a sigma-clip, but the mean
-             needs to be explicitly requested. */
-          if(afp->operator == ARITHMETIC_OP_FILTER_SIGCLIP_MEAN)
-            clipflags = GAL_STATISTICS_CLIP_OUTCOL_OPTIONAL_MEAN;
-          sigclip=gal_statistics_clip_sigma(tile, afp->sclip_multip,
-                                            afp->sclip_param, clipflags,
-                                            0, 1);
-
-          /* Set the required index. */
-          switch(afp->operator)
-            {
-            case ARITHMETIC_OP_FILTER_SIGCLIP_MEAN:
-              sind = GAL_STATISTICS_CLIP_OUTCOL_MEAN; break;
-            case ARITHMETIC_OP_FILTER_SIGCLIP_MEDIAN:
-              sind = GAL_STATISTICS_CLIP_OUTCOL_MEDIAN; break;
-            default:
-              error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at "
-                    "%s to fix the problem. The 'afp->operator' value "
-                    "%d is not recognized as sigma-clipped median or "
-                    "mean", __func__, PACKAGE_BUGREPORT, afp->operator);
-            }
+  /* Clean up for this thread. */
+  tile->array=NULL;
+  tile->block=NULL;
+  gal_data_free(tile);
 
-          /* Allocate the output and write the value into it. */
-          result=gal_data_alloc(NULL, GAL_TYPE_FLOAT32, 1, &one, NULL,
-                                0, -1, 1, NULL, NULL, NULL);
-          ((float *)(result->array))[0] =
-            ((float *)(sigclip->array))[sind];
 
-          /* Clean up. */
-          gal_data_free(sigclip);
-          break;
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
 
 
-        default:
-          error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s "
-                "to fix the problem. 'afp->operator' code %d is not "
-                "recognized", PACKAGE_BUGREPORT, __func__,
-                afp->operator);
-        }
 
-      /* Make sure the output array type and result's type are the
-         same. */
-      if(result->type!=afp->out->type)
-        result=gal_data_copy_to_new_type_free(result, afp->out->type);
 
 
-      /* Copy the result into the output array. */
-      memcpy(gal_pointer_increment(afp->out->array, ind, afp->out->type),
-             result->array, gal_type_sizeof(afp->out->type));
+/* Copy the non-blank elements of the given columns of the window (over
+   the fastest dimension, from 'c0' to 'c1') into 'col'. 'colind' keeps
+   the index of the first column's elements in the input (one for each
+   combination of the slower dimensions in the window). */
+#define FILTER_GATHER(IT) {                                             \
+    IT b, v, *o=col->array, *in=input->array;                           \
+    gal_blank_write(&b, input->type);                                   \
+    for(c=c0;c<c1;++c)                                                  \
+      for(t=0;t<ncolind;++t)                                            \
+        {                                                               \
+          v=in[ colind[t]+c ];                                          \
+          if( v==v && v!=b ) o[n++]=v; /* 'v==v' is false for NaN. */   \
+        }                                                               \
+  }
 
-      /* Clean up for this pixel. */
-      gal_data_free(result);
+static void
+arithmetic_filter_gather(gal_data_t *input, size_t *colind,
+                         size_t ncolind, size_t c0, size_t c1,
+                         gal_data_t *col)
+{
+  size_t c, t, n=0;
+
+  switch(input->type)
+    {
+    case GAL_TYPE_UINT8:   FILTER_GATHER( uint8_t  );   break;
+    case GAL_TYPE_INT8:    FILTER_GATHER( int8_t   );   break;
+    case GAL_TYPE_UINT16:  FILTER_GATHER( uint16_t );   break;
+    case GAL_TYPE_INT16:   FILTER_GATHER( int16_t  );   break;
+    case GAL_TYPE_UINT32:  FILTER_GATHER( uint32_t );   break;
+    case GAL_TYPE_INT32:   FILTER_GATHER( int32_t  );   break;
+    case GAL_TYPE_UINT64:  FILTER_GATHER( uint64_t );   break;
+    case GAL_TYPE_INT64:   FILTER_GATHER( int64_t  );   break;
+    case GAL_TYPE_FLOAT32: FILTER_GATHER( float    );   break;
+    case GAL_TYPE_FLOAT64: FILTER_GATHER( double   );   break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, input->type);
+    }
+
+  /* Set the size and sort the gathered elements. */
+  col->flag=0;
+  col->size=col->dsize[0]=n;
+  gal_statistics_sort_increasing(col, 1);
+}
+
+
+
+
+
+/* Make the new sorted window ('out') from the old one ('win') by removing
+   the (sorted) elements in 'rem' and adding the (sorted) elements in
+   'add'. Every element of 'rem' is also in 'win', so for each element of
+   'rem', one equal element of 'win' is ignored. */
+#define FILTER_MERGE(IT) {                                              \
+    IT *w=win->array, *r=rem->array, *a=add->array, *o=out->array;      \
+    while(i<win->size || k<add->size)                                   \
+      {                                                                 \
+        if( i<win->size && j<rem->size && w[i]==r[j] )                  \
+          { ++i; ++j; }                                                 \
+        else if( k<add->size && (i==win->size || a[k]<w[i]) )           \
+          o[n++]=a[k++];                                                \
+        else                                                            \
+          o[n++]=w[i++];                                                \
+      }                                                                 \
+  }
+
+static void
+arithmetic_filter_merge(gal_data_t *win, gal_data_t *rem, gal_data_t *add,
+                        gal_data_t *out)
+{
+  size_t i=0, j=0, k=0, n=0;
+
+  switch(win->type)
+    {
+    case GAL_TYPE_UINT8:   FILTER_MERGE( uint8_t  );   break;
+    case GAL_TYPE_INT8:    FILTER_MERGE( int8_t   );   break;
+    case GAL_TYPE_UINT16:  FILTER_MERGE( uint16_t );   break;
+    case GAL_TYPE_INT16:   FILTER_MERGE( int16_t  );   break;
+    case GAL_TYPE_UINT32:  FILTER_MERGE( uint32_t );   break;
+    case GAL_TYPE_INT32:   FILTER_MERGE( int32_t  );   break;
+    case GAL_TYPE_UINT64:  FILTER_MERGE( uint64_t );   break;
+    case GAL_TYPE_INT64:   FILTER_MERGE( int64_t  );   break;
+    case GAL_TYPE_FLOAT32: FILTER_MERGE( float    );   break;
+    case GAL_TYPE_FLOAT64: FILTER_MERGE( double   );   break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, win->type);
     }
 
+  /* The window is sorted and has no blank elements. */
+  out->size=out->dsize[0]=n;
+  out->flag = ( GAL_DATA_FLAG_BLANK_CH | GAL_DATA_FLAG_SORT_CH
+                | GAL_DATA_FLAG_SORTED_I );
+}
+
+
+
+
+
+/* Each action of the sliding-window filters is a segment of a line along
+   the fastest dimension. For the given action ('index'), set the line,
+   the range of the segment along the line ('x0' to 'x1') and the input
+   index of the elements in the window's first column ('colind', over the
+   fastest dimension it is at zero). The number of elements in each
+   column of the window is returned. */
+static size_t
+arithmetic_filter_sliding_line(struct arithmetic_filter_p *afp,
+                               size_t index, size_t *colind, size_t *line,
+                               size_t *x0, size_t *x1)
+{
+  gal_data_t *input=afp->input;
+  size_t *dsize=input->dsize, ndim=input->ndim;
+  size_t *hpfsize=afp->hpfsize, *hnfsize=afp->hnfsize;
+  size_t j, t, ind, ncolind, len=dsize[ndim-1], seg=index % afp->nseg;
+  size_t coord[ARITHMETIC_FILTER_DIM], start[ARITHMETIC_FILTER_DIM];
+  size_t tsize[ARITHMETIC_FILTER_DIM];
+
+  /* Find the line and the range of elements along the line. */
+  *line = index / afp->nseg;
+  *x0   = seg     * len / afp->nseg;
+  *x1   = (seg+1) * len / afp->nseg;
+
+  /* Coordinates of the line's first element and the window's range over
+     the slower dimensions (similar to 'arithmetic_filter'). */
+  gal_dimension_index_to_coord(*line*len, ndim, dsize, coord);
+  for(j=0;j<ndim-1;++j)
+    {
+      start[j] = ( coord[j] - hnfsize[j] > dsize[j]
+                   ? 0 : coord[j] - hnfsize[j] );
+      tsize[j] = ( coord[j] + hpfsize[j] >= dsize[j]
+                   ? dsize[j]
+                   : coord[j] + hpfsize[j] + 1 ) - start[j];
+    }
+
+  /* Index of all the elements of the window's first column. */
+  ncolind=1;
+  for(j=0;j<ndim-1;++j) ncolind*=tsize[j];
+  for(t=0;t<ncolind;++t)
+    {
+      ind=t;
+      coord[ndim-1]=0;
+      for(j=ndim-1;j-->0;)
+        { coord[j] = start[j] + ind%tsize[j]; ind/=tsize[j]; }
+      colind[t]=gal_dimension_coord_to_index(ndim, dsize, coord);
+    }
+  return ncolind;
+}
+
+
+
+
+
+/* Sliding-window filtering for sigma-clipping: instead of copying and
+   sorting the full window for every pixel, a sorted copy of the window's
+   non-blank elements is kept while sliding along the fastest dimension.
+   When moving to the next pixel, only the column (over the fastest
+   dimension) that leaves the window and the one that enters it are
+   sorted and merged into the window. The statistics are then measured
+   directly on the sorted window (without any further copying or
+   sorting). */
+static void *
+arithmetic_filter_sliding(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct arithmetic_filter_p *afp=(struct arithmetic_filter_p *)tprm->params;
+  gal_data_t *input=afp->input;
+
+  gal_data_t *result, *tmp;
+  size_t *hpfsize=afp->hpfsize, *hnfsize=afp->hnfsize;
+  size_t i, line, x, x0, x1, s, e, ps, pe, n, ncolind, colsize, *colind;
+  size_t ndim=input->ndim, len=input->dsize[ndim-1];
+  size_t winsize=gal_dimension_total_size(ndim, afp->fsize);
+  gal_data_t *win=gal_data_alloc(NULL, input->type, 1, &winsize, NULL, 0,
+                                 -1, 1, NULL, NULL, NULL);
+  gal_data_t *next=gal_data_alloc(NULL, input->type, 1, &winsize, NULL,
+                                  0, -1, 1, NULL, NULL, NULL);
+  gal_data_t *add=gal_data_alloc(NULL, input->type, 1, &winsize, NULL, 0,
+                                 -1, 1, NULL, NULL, NULL);
+  gal_data_t *rem=gal_data_alloc(NULL, input->type, 1, &winsize, NULL, 0,
+                                 -1, 1, NULL, NULL, NULL);
+
+  /* Number of elements in one column of the window (over the slower
+     dimensions) and space to keep their indexs. */
+  colsize=winsize/afp->fsize[ndim-1];
+  colind=gal_pointer_allocate(GAL_TYPE_SIZE_T, colsize, 0, __func__,
+                              "colind");
+
+  /* Go over all the line segments that were assigned to this thread. */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Set the line, the segment's range and the window's columns. */
+      ncolind=arithmetic_filter_sliding_line(afp, tprm->indexs[i], colind,
+                                             &line, &x0, &x1);
+
+      /* Go over the elements of the segment. */
+      win->size=0;
+      ps=pe=x0;
+      for(x=x0;x<x1;++x)
+        {
+          /* The range of the window along the fastest dimension. */
+          s = x - hnfsize[ndim-1] > len ? 0 : x - hnfsize[ndim-1];
+          e = x + hpfsize[ndim-1] >= len ? len : x + hpfsize[ndim-1] + 1;
+
+          /* Update the sorted window: on the first element of the
+             segment, all the columns are added. */
+          if(x==x0) ps=pe=s;
+          arithmetic_filter_gather(input, colind, ncolind, ps, s, rem);
+          arithmetic_filter_gather(input, colind, ncolind, pe, e, add);
+          arithmetic_filter_merge(win, rem, add, next);
+          tmp=win; win=next; next=tmp;
+          ps=s;
+          pe=e;
+
+          /* Measure the statistic on the sorted window and write it in
+             the output. Note that the statistics functions may change
+             the size of the window (while clipping), so it is reset
+             afterwards. */
+          n=win->size;
+          result=arithmetic_filter_statistic(afp, win, 1);
+          memcpy(gal_pointer_increment(afp->out->array, line*len+x,
+                                       afp->out->type),
+                 result->array, gal_type_sizeof(afp->out->type));
+          gal_data_free(result);
+          win->size=win->dsize[0]=n;
+        }
+    }
 
   /* Clean up for this thread. */
-  tile->array=NULL;
-  tile->block=NULL;
-  gal_data_free(tile);
+  free(colind);
+  gal_data_free(win);
+  gal_data_free(add);
+  gal_data_free(rem);
+  gal_data_free(next);
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Two binary heaps to keep the running median of a sliding window: 'lo'
+   is a max-heap over the smaller half of the window's elements and 'hi'
+   is a min-heap over its larger half. Every element of the window has a
+   fixed "slot" (see 'arithmetic_filter_median_sliding') and the heaps
+   only keep slots: the value of each slot is in 'vals', the heap it
+   belongs to is in 'side' and its position in that heap is in 'pos'. */
+#define FILTER_HEAP_NONE 0
+#define FILTER_HEAP_LO   1
+#define FILTER_HEAP_HI   2
+struct arithmetic_filter_heaps
+{
+  uint8_t           type;   /* Type of the values.                    */
+  void             *vals;   /* Value of each slot.                    */
+  uint8_t          *side;   /* Heap of each slot ('FILTER_HEAP_*').   */
+  size_t            *pos;   /* Position of each slot in its heap.     */
+  size_t             *lo;   /* Max-heap of the smaller half.          */
+  size_t             *hi;   /* Min-heap of the larger half.           */
+  size_t             nlo;   /* Number of elements in 'lo'.            */
+  size_t             nhi;   /* Number of elements in 'hi'.            */
+};
+
+
+
+
+
+/* If slot 'a' should be above slot 'b' in the given heap. */
+#define FILTER_HEAP_ABOVE(IT) {                                         \
+    IT *v=h->vals;                                                      \
+    out = side==FILTER_HEAP_LO ? v[a]>v[b] : v[a]<v[b];                 \
+  }
+static int
+arithmetic_filter_heap_above(struct arithmetic_filter_heaps *h, int side,
+                             size_t a, size_t b)
+{
+  int out=0;
+  switch(h->type)
+    {
+    case GAL_TYPE_UINT8:   FILTER_HEAP_ABOVE( uint8_t  );   break;
+    case GAL_TYPE_INT8:    FILTER_HEAP_ABOVE( int8_t   );   break;
+    case GAL_TYPE_UINT16:  FILTER_HEAP_ABOVE( uint16_t );   break;
+    case GAL_TYPE_INT16:   FILTER_HEAP_ABOVE( int16_t  );   break;
+    case GAL_TYPE_UINT32:  FILTER_HEAP_ABOVE( uint32_t );   break;
+    case GAL_TYPE_INT32:   FILTER_HEAP_ABOVE( int32_t  );   break;
+    case GAL_TYPE_UINT64:  FILTER_HEAP_ABOVE( uint64_t );   break;
+    case GAL_TYPE_INT64:   FILTER_HEAP_ABOVE( int64_t  );   break;
+    case GAL_TYPE_FLOAT32: FILTER_HEAP_ABOVE( float    );   break;
+    case GAL_TYPE_FLOAT64: FILTER_HEAP_ABOVE( double   );   break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, h->type);
+    }
+  return out;
+}
+
+
+
+
+
+/* Move the slot at position 'i' of the given heap up or down until the
+   heap property is restored. */
+static void
+arithmetic_filter_heap_fix(struct arithmetic_filter_heaps *h, int side,
+                           size_t i)
+{
+  size_t c, top, tmp;
+  size_t *heap = side==FILTER_HEAP_LO ? h->lo  : h->hi;
+  size_t n     = side==FILTER_HEAP_LO ? h->nlo : h->nhi;
+
+  /* Move it up while it should be above its parent. */
+  while( i && arithmetic_filter_heap_above(h, side, heap[i],
+                                           heap[(i-1)/2]) )
+    {
+      tmp=heap[i]; heap[i]=heap[(i-1)/2]; heap[(i-1)/2]=tmp;
+      h->pos[heap[i]]=i;
+      i=(i-1)/2;
+      h->pos[heap[i]]=i;
+    }
+
+  /* Move it down while one of its children should be above it. */
+  while(1)
+    {
+      top=i;
+      c=2*i+1;
+      if( c<n && arithmetic_filter_heap_above(h, side, heap[c],
+                                              heap[top]) )
+        top=c;
+      if( c+1<n && arithmetic_filter_heap_above(h, side, heap[c+1],
+                                                heap[top]) )
+        top=c+1;
+      if(top==i) break;
+      tmp=heap[i]; heap[i]=heap[top]; heap[top]=tmp;
+      h->pos[heap[i]]=i;
+      h->pos[heap[top]]=top;
+      i=top;
+    }
+}
+
+
+
+
+
+/* Put the given slot in the given heap. */
+static void
+arithmetic_filter_heap_push(struct arithmetic_filter_heaps *h, int side,
+                            size_t slot)
+{
+  size_t *heap = side==FILTER_HEAP_LO ? h->lo   : h->hi;
+  size_t *n    = side==FILTER_HEAP_LO ? &h->nlo : &h->nhi;
+
+  heap[*n]=slot;
+  h->pos[slot]=*n;
+  h->side[slot]=side;
+  arithmetic_filter_heap_fix(h, side, (*n)++);
+}
+
+
+
+
+
+/* Remove the given slot from the heap it is in. */
+static void
+arithmetic_filter_heap_remove(struct arithmetic_filter_heaps *h,
+                              size_t slot)
+{
+  int side=h->side[slot];
+  size_t i=h->pos[slot];
+  size_t *heap = side==FILTER_HEAP_LO ? h->lo   : h->hi;
+  size_t *n    = side==FILTER_HEAP_LO ? &h->nlo : &h->nhi;
+
+  h->side[slot]=FILTER_HEAP_NONE;
+  if( i != --(*n) )
+    {
+      heap[i]=heap[*n];
+      h->pos[heap[i]]=i;
+      arithmetic_filter_heap_fix(h, side, i);
+    }
+}
+
+
+
+
+
+/* Make the number of elements in 'lo' equal to (or one more than) the
+   number of elements in 'hi' by moving the top of one to the other. */
+static void
+arithmetic_filter_heap_balance(struct arithmetic_filter_heaps *h)
+{
+  size_t slot;
+
+  while(h->nlo > h->nhi+1)
+    {
+      slot=h->lo[0];
+      arithmetic_filter_heap_remove(h, slot);
+      arithmetic_filter_heap_push(h, FILTER_HEAP_HI, slot);
+    }
+  while(h->nhi > h->nlo)
+    {
+      slot=h->hi[0];
+      arithmetic_filter_heap_remove(h, slot);
+      arithmetic_filter_heap_push(h, FILTER_HEAP_LO, slot);
+    }
+}
+
+
+
+
+
+/* Add the non-blank elements of column 'c' of the window (over the
+   fastest dimension) to the heaps (the first slot of the column is
+   'slot0'). Each element goes into 'lo' when it is not larger than the
+   top of 'lo' (or, when 'lo' is empty, the top of 'hi'), so all the
+   elements of 'lo' are never larger than those of 'hi'. The heaps may
+   not be balanced afterwards (see 'arithmetic_filter_heap_balance'). */
+#define FILTER_HEAP_ADD(IT) {                                           \
+    IT b, v, *in=input->array, *o=h->vals;                              \
+    gal_blank_write(&b, input->type);                                   \
+    for(t=0;t<ncolind;++t)                                              \
+      {                                                                 \
+        v=in[ colind[t]+c ];                                            \
+        if( v==v && v!=b ) /* 'v==v' is false for NaN. */               \
+          {                                                             \
+            o[slot0+t]=v;                                               \
+            if(h->nlo)                                                  \
+              side = v>o[h->lo[0]] ? FILTER_HEAP_HI : FILTER_HEAP_LO;   \
+            else                                                        \
+              side = ( h->nhi && v>o[h->hi[0]]                          \
+                       ? FILTER_HEAP_HI : FILTER_HEAP_LO );             \
+            arithmetic_filter_heap_push(h, side, slot0+t);              \
+          }                                                             \
+      }                                                                 \
+  }
+static void
+arithmetic_filter_heap_add(struct arithmetic_filter_heaps *h,
+                           gal_data_t *input, size_t *colind,
+                           size_t ncolind, size_t c, size_t slot0)
+{
+  int side;
+  size_t t;
+
+  switch(input->type)
+    {
+    case GAL_TYPE_UINT8:   FILTER_HEAP_ADD( uint8_t  );   break;
+    case GAL_TYPE_INT8:    FILTER_HEAP_ADD( int8_t   );   break;
+    case GAL_TYPE_UINT16:  FILTER_HEAP_ADD( uint16_t );   break;
+    case GAL_TYPE_INT16:   FILTER_HEAP_ADD( int16_t  );   break;
+    case GAL_TYPE_UINT32:  FILTER_HEAP_ADD( uint32_t );   break;
+    case GAL_TYPE_INT32:   FILTER_HEAP_ADD( int32_t  );   break;
+    case GAL_TYPE_UINT64:  FILTER_HEAP_ADD( uint64_t );   break;
+    case GAL_TYPE_INT64:   FILTER_HEAP_ADD( int64_t  );   break;
+    case GAL_TYPE_FLOAT32: FILTER_HEAP_ADD( float    );   break;
+    case GAL_TYPE_FLOAT64: FILTER_HEAP_ADD( double   );   break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, input->type);
+    }
+}
+
+
 
 
+
+/* Write the median of the heaps into 'out'. Similar to
+   'gal_statistics_median', when the number of elements is even, the
+   median is the mean of the two middle elements and when there are no
+   elements, it is blank. */
+#define FILTER_HEAP_MEDIAN(IT) {                                        \
+    IT *v=h->vals;                                                      \
+    *(IT *)out = ( h->nlo==h->nhi                                       \
+                   ? (v[h->hi[0]]+v[h->lo[0]])/2                        \
+                   : v[h->lo[0]] );                                     \
+  }
+static void
+arithmetic_filter_heap_median(struct arithmetic_filter_heaps *h,
+                              void *out)
+{
+  if(h->nlo==0) { gal_blank_write(out, h->type); return; }
+  switch(h->type)
+    {
+    case GAL_TYPE_UINT8:   FILTER_HEAP_MEDIAN( uint8_t  );   break;
+    case GAL_TYPE_INT8:    FILTER_HEAP_MEDIAN( int8_t   );   break;
+    case GAL_TYPE_UINT16:  FILTER_HEAP_MEDIAN( uint16_t );   break;
+    case GAL_TYPE_INT16:   FILTER_HEAP_MEDIAN( int16_t  );   break;
+    case GAL_TYPE_UINT32:  FILTER_HEAP_MEDIAN( uint32_t );   break;
+    case GAL_TYPE_INT32:   FILTER_HEAP_MEDIAN( int32_t  );   break;
+    case GAL_TYPE_UINT64:  FILTER_HEAP_MEDIAN( uint64_t );   break;
+    case GAL_TYPE_INT64:   FILTER_HEAP_MEDIAN( int64_t  );   break;
+    case GAL_TYPE_FLOAT32: FILTER_HEAP_MEDIAN( float    );   break;
+    case GAL_TYPE_FLOAT64: FILTER_HEAP_MEDIAN( double   );   break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, h->type);
+    }
+}
+
+
+
+
+
+/* Sliding-window median filter: the window's non-blank elements are kept
+   in two heaps (see 'struct arithmetic_filter_heaps') while sliding along
+   the fastest dimension. When moving to the next pixel, only the
+   elements of the column that leaves the window are removed from the
+   heaps and those of the column that enters it are added (each in
+   logarithmic time). The median is then read from the top of the heaps.
+
+   Element 't' of column 'c' (over the fastest dimension) of the input is
+   kept in slot '(c%W)*ncolind+t' of the heaps (where 'W' is the filter's
+   width along the fastest dimension). The window never has more than 'W'
+   columns, so no two elements of the window share a slot. */
+static void *
+arithmetic_filter_median_sliding(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct arithmetic_filter_p *afp=(struct arithmetic_filter_p *)tprm->params;
+  gal_data_t *input=afp->input;
+
+  struct arithmetic_filter_heaps h;
+  size_t *hpfsize=afp->hpfsize, *hnfsize=afp->hnfsize;
+  size_t i, t, c, line, x, x0, x1, s, e, ps, pe, ncolind, colsize;
+  size_t ndim=input->ndim, len=input->dsize[ndim-1], *colind;
+  size_t W=afp->fsize[ndim-1];
+  size_t winsize=gal_dimension_total_size(ndim, afp->fsize);
+
+  /* Number of elements in one column of the window (over the slower
+     dimensions) and space to keep their indexs. */
+  colsize=winsize/W;
+  colind=gal_pointer_allocate(GAL_TYPE_SIZE_T, colsize, 0, __func__,
+                              "colind");
+
+  /* Allocate the heaps. */
+  h.type=input->type;
+  h.vals=gal_pointer_allocate(input->type, winsize, 0, __func__,
+                              "h.vals");
+  h.side=gal_pointer_allocate(GAL_TYPE_UINT8, winsize, 0, __func__,
+                              "h.side");
+  h.pos=gal_pointer_allocate(GAL_TYPE_SIZE_T, winsize, 0, __func__,
+                             "h.pos");
+  h.lo=gal_pointer_allocate(GAL_TYPE_SIZE_T, winsize, 0, __func__,
+                            "h.lo");
+  h.hi=gal_pointer_allocate(GAL_TYPE_SIZE_T, winsize, 0, __func__,
+                            "h.hi");
+
+  /* Go over all the line segments that were assigned to this thread. */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Set the line, the segment's range and the window's columns. */
+      ncolind=arithmetic_filter_sliding_line(afp, tprm->indexs[i], colind,
+                                             &line, &x0, &x1);
+
+      /* Empty the heaps. */
+      h.nlo=h.nhi=0;
+      memset(h.side, FILTER_HEAP_NONE, winsize);
+
+      /* Go over the elements of the segment. */
+      ps=pe=x0;
+      for(x=x0;x<x1;++x)
+        {
+          /* The range of the window along the fastest dimension. */
+          s = x - hnfsize[ndim-1] > len ? 0 : x - hnfsize[ndim-1];
+          e = x + hpfsize[ndim-1] >= len ? len : x + hpfsize[ndim-1] + 1;
+
+          /* Update the heaps: on the first element of the segment, all
+             the columns are added. */
+          if(x==x0) ps=pe=s;
+          for(c=ps;c<s;++c)
+            for(t=0;t<ncolind;++t)
+              if( h.side[(c%W)*ncolind+t]!=FILTER_HEAP_NONE )
+                arithmetic_filter_heap_remove(&h, (c%W)*ncolind+t);
+          for(c=pe;c<e;++c)
+            arithmetic_filter_heap_add(&h, input, colind, ncolind, c,
+                                       (c%W)*ncolind);
+          arithmetic_filter_heap_balance(&h);
+          ps=s;
+          pe=e;
+
+          /* Write the median into the output. */
+          arithmetic_filter_heap_median(&h,
+                      gal_pointer_increment(afp->out->array, line*len+x,
+                                            afp->out->type));
+        }
+    }
+
+  /* Clean up for this thread. */
+  free(h.hi);
+  free(h.lo);
+  free(h.pos);
+  free(h.side);
+  free(h.vals);
+  free(colind);
+
   /* Wait for all the other threads to finish, then return. */
   if(tprm->b) pthread_barrier_wait(tprm->b);
   return NULL;
@@ -363,8 +983,8 @@ static void
 wrapper_for_filter(struct arithmeticparams *p, char *token, int operator)
 {
   int type=GAL_TYPE_INVALID;
-  size_t i=0, ndim, nparams, one=1;
   struct arithmetic_filter_p afp={0};
+  size_t i=0, ndim, nparams, numlines, one=1;
   size_t fsize[ARITHMETIC_FILTER_DIM];
   gal_data_t *tmp, *tmp2, *zero, *comp, *params_list=NULL;
   size_t hnfsize[ARITHMETIC_FILTER_DIM], hpfsize[ARITHMETIC_FILTER_DIM];
@@ -532,10 +1152,30 @@ wrapper_for_filter(struct arithmeticparams *p, char *token, int operator)
                              NULL);
 
 
-      /* Spin off threads for each pixel. */
-      gal_threads_spin_off(arithmetic_filter, &afp, afp.input->size,
-                           p->cp.numthreads, p->cp.minmapsize,
-                           p->cp.quietmmap);
+      /* For the mean, spin off threads for each pixel. For the order
+         statistics, the window is updated while sliding over each line
+         (along the fastest dimension): two heaps for the median and a
+         sorted window for sigma-clipping. When there are fewer lines than
+         threads (for example in 1D datasets), each line is broken into
+         segments so all threads are used. */
+      if(operator==ARITHMETIC_OP_FILTER_MEAN)
+        gal_threads_spin_off(arithmetic_filter, &afp, afp.input->size,
+                             p->cp.numthreads, p->cp.minmapsize,
+                             p->cp.quietmmap);
+      else
+        {
+          numlines=afp.input->size/afp.input->dsize[ndim-1];
+          afp.nseg = ( numlines>=p->cp.numthreads
+                       ? 1
+                       : ( p->cp.numthreads+numlines-1 ) / numlines );
+          if(afp.nseg>afp.input->dsize[ndim-1])
+            afp.nseg=afp.input->dsize[ndim-1];
+          gal_threads_spin_off( ( operator==ARITHMETIC_OP_FILTER_MEDIAN
+                                  ? arithmetic_filter_median_sliding
+                                  : arithmetic_filter_sliding ), &afp,
+                                numlines*afp.nseg, p->cp.numthreads,
+                                p->cp.minmapsize, p->cp.quietmmap);
+        }
     }
 
 
@@ -680,7 +1320,7 @@ arithmetic_connected_components(struct arithmeticparams *p, char *token)
   conn_int=arithmetic_binary_sanity_checks(in, conn, token);
 
   /* Do the connected components labeling. */
-  gal_binary_connected_components(in, &out, conn_int);
+  gal_binary_connected_components(in, &out, conn_int, p->cp.numthreads);
 
   /* Push the result onto the stack. */
   operands_add(p, NULL, out);
@@ -835,7 +1475,8 @@ arithmetic_interpolate_region(struct arithmeticparams *p,
   /* Build a binary image with the blank regions masked and label them,
      then free the flagged array. */
   flag=gal_blank_flag(in);
-  numlabs=gal_binary_connected_components(flag, &lab, con[0]);
+  numlabs=gal_binary_connected_components(flag, &lab, con[0],
+                                          p->cp.numthreads);
   gal_data_free(flag);
 
   /* Allocate array to keep maximum values for each region. Just note that
@@ -936,9 +1577,15 @@ arithmetic_interpolate(struct arithmeticparams *p, int operator, char *token)
     }
 
   /* Call the interpolation function. */
-  interpolated=gal_interpolate_neighbors(in, NULL, p->cp.interpmetric,
-                                         num_int, p->cp.numthreads,
-                                         1, 0, interpop);
+  if(p->cp.interpkdtree)
+    interpolated=gal_interpolate_neighbors_kdtree(in, NULL,
+                                                  p->cp.interpmetric,
+                                                  num_int, p->cp.numthreads,
+                                                  1, 0, interpop);
+  else
+    interpolated=gal_interpolate_neighbors(in, NULL, p->cp.interpmetric,
+                                           num_int, p->cp.numthreads,
+                                           1, 0, interpop);
 
   /* Clean up and push the interpolated array onto the stack. */
   gal_data_free(in);
@@ -1438,7 +2085,7 @@ arithmetic_repeat(struct arithmeticparams *p, char *token, int operator)
 /***************************************************************/
 /*************      Reverse Polish algorithm       *************/
 /***************************************************************/
-static int
+int
 arithmetic_set_operator(char *string, size_t *num_operands, int *inlib)
 {
   /* Use the library's main function for its own operators. */
@@ -1582,7 +2229,7 @@ arithmetic_prepare_meta(gal_data_t *d1, gal_data_t *d2, gal_data_t *d3)
 
 
 
-static void
+void
 arithmetic_operator_run(struct arithmeticparams *p, int operator,
                         char *operator_string, size_t num_operands,
                         int inlib)
@@ -1596,8 +2243,14 @@ arithmetic_operator_run(struct arithmeticparams *p, int operator,
   if(p->cp.quiet) flags |= GAL_ARITHMETIC_FLAG_QUIET;
   if(p->envseed)  flags |= GAL_ARITHMETIC_FLAG_ENVSEED;
 
+  /* Element-wise operators are not evaluated immediately: they are kept
+     as an expression on the stack and evaluated in one pass when
+     necessary. */
+  if( inlib && fuse_operator_fusable(operator, num_operands) )
+    fuse_operator(p, operator, operator_string, num_operands);
+
   /* If this operator is in the library, we should pop everything here.  */
-  if(inlib)
+  else if(inlib)
     {
       /* Pop the necessary number of operators. Note that the
          operators are poped from a linked list (which is
@@ -1991,14 +2644,20 @@ reversepolish(struct arithmeticparams *p)
     error(EXIT_FAILURE, 0, "too many operands");
 
 
-  /* If the final operand has a filename, but its 'data' element is NULL,
-     then the file hasn't actually be read yet. In this case, we need to
-     read the contents of the file and put the resulting dataset into the
-     operands 'data' element. This can happen for example if no operators
-     are called and there is only one filename as an argument (which can
-     happen in scripts).*/
+  /* If the final operand is a fused expression, it should be evaluated
+     here. If the final operand has a filename, but its 'data' element is
+     NULL, then the file hasn't actually be read yet. In this case, we
+     need to read the contents of the file and put the resulting dataset
+     into the operands 'data' element. This can happen for example if no
+     operators are called and there is only one filename as an argument
+     (which can happen in scripts).*/
   for(otmp=p->operands; otmp!=NULL; otmp=otmp->next)
-    if(otmp->data==NULL && otmp->filename)
+    if(otmp->fused)
+      {
+        otmp->data=fuse_evaluate(p, otmp->fused);
+        otmp->fused=NULL;
+      }
+    else if(otmp->data==NULL && otmp->filename)
       arithmetic_final_read_file(p, otmp);
 
 
@@ -2087,6 +2746,9 @@ reversepolish(struct arithmeticparams *p)
 void
 arithmetic(struct arithmeticparams *p)
 {
+  /* If streaming is requested and possible, the job is done there. */
+  if(p->stream && arithmetic_stream(p)) return;
+
   /* Parse the arguments */
   reversepolish(p);
 }
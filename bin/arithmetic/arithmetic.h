@@ -81,6 +81,14 @@ enum arithmetic_prog_operators
 
 
 
+int
+arithmetic_set_operator(char *string, size_t *num_operands, int *inlib);
+
+void
+arithmetic_operator_run(struct arithmeticparams *p, int operator,
+                        char *operator_string, size_t num_operands,
+                        int inlib);
+
 void
 arithmetic(struct arithmeticparams *p);
 
@@ -0,0 +1,506 @@
+/*********************************************************************
+Arithmetic - Do arithmetic operations on images.
+Arithmetic is part of GNU Astronomy Utilities (Gnuastro) package.
+
+Original author:
+     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+Contributing author(s):
+Copyright (C) 2024 Free Software Foundation, Inc.
+
+Gnuastro is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Gnuastro is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <gnuastro/wcs.h>
+#include <gnuastro/data.h>
+#include <gnuastro/blank.h>
+#include <gnuastro/threads.h>
+#include <gnuastro/pointer.h>
+#include <gnuastro/dimension.h>
+#include <gnuastro/arithmetic.h>
+
+#include "main.h"
+
+#include "fuse.h"
+#include "operands.h"
+
+
+
+
+/* Number of elements that are evaluated together when a fused expression
+   is evaluated. It is small enough for the intermediate results of the
+   whole tree to stay in the CPU cache. */
+#define FUSE_TILE_SIZE 16384
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************        Building the expression         **************/
+/**********************************************************************/
+/* Element-wise operators that can be merged into a single pass over the
+   data: the value of each output element only depends on the same element
+   of the input(s) and the output type only depends on the input types. */
+int
+fuse_operator_fusable(int operator, size_t num_operands)
+{
+  /* Only unary and binary operators are fused. */
+  if(num_operands!=1 && num_operands!=2) return 0;
+
+  switch(operator)
+    {
+    case GAL_ARITHMETIC_OP_PLUS:
+    case GAL_ARITHMETIC_OP_MINUS:
+    case GAL_ARITHMETIC_OP_MULTIPLY:
+    case GAL_ARITHMETIC_OP_DIVIDE:
+    case GAL_ARITHMETIC_OP_MODULO:
+    case GAL_ARITHMETIC_OP_LT:
+    case GAL_ARITHMETIC_OP_LE:
+    case GAL_ARITHMETIC_OP_GT:
+    case GAL_ARITHMETIC_OP_GE:
+    case GAL_ARITHMETIC_OP_EQ:
+    case GAL_ARITHMETIC_OP_NE:
+    case GAL_ARITHMETIC_OP_AND:
+    case GAL_ARITHMETIC_OP_OR:
+    case GAL_ARITHMETIC_OP_NOT:
+    case GAL_ARITHMETIC_OP_ISBLANK:
+    case GAL_ARITHMETIC_OP_ISNOTBLANK:
+    case GAL_ARITHMETIC_OP_BITAND:
+    case GAL_ARITHMETIC_OP_BITOR:
+    case GAL_ARITHMETIC_OP_BITXOR:
+    case GAL_ARITHMETIC_OP_BITLSH:
+    case GAL_ARITHMETIC_OP_BITRSH:
+    case GAL_ARITHMETIC_OP_BITNOT:
+    case GAL_ARITHMETIC_OP_ABS:
+    case GAL_ARITHMETIC_OP_POW:
+    case GAL_ARITHMETIC_OP_SQRT:
+    case GAL_ARITHMETIC_OP_LOG:
+    case GAL_ARITHMETIC_OP_LOG10:
+    case GAL_ARITHMETIC_OP_SIN:
+    case GAL_ARITHMETIC_OP_COS:
+    case GAL_ARITHMETIC_OP_TAN:
+    case GAL_ARITHMETIC_OP_ASIN:
+    case GAL_ARITHMETIC_OP_ACOS:
+    case GAL_ARITHMETIC_OP_ATAN:
+    case GAL_ARITHMETIC_OP_ATAN2:
+    case GAL_ARITHMETIC_OP_SINH:
+    case GAL_ARITHMETIC_OP_COSH:
+    case GAL_ARITHMETIC_OP_TANH:
+    case GAL_ARITHMETIC_OP_ASINH:
+    case GAL_ARITHMETIC_OP_ACOSH:
+    case GAL_ARITHMETIC_OP_ATANH:
+    case GAL_ARITHMETIC_OP_TO_UINT8:
+    case GAL_ARITHMETIC_OP_TO_INT8:
+    case GAL_ARITHMETIC_OP_TO_UINT16:
+    case GAL_ARITHMETIC_OP_TO_INT16:
+    case GAL_ARITHMETIC_OP_TO_UINT32:
+    case GAL_ARITHMETIC_OP_TO_INT32:
+    case GAL_ARITHMETIC_OP_TO_UINT64:
+    case GAL_ARITHMETIC_OP_TO_INT64:
+    case GAL_ARITHMETIC_OP_TO_FLOAT32:
+    case GAL_ARITHMETIC_OP_TO_FLOAT64:
+      return 1;
+    }
+
+  /* If control reaches here, the operator can't be fused. */
+  return 0;
+}
+
+
+
+
+
+static int
+fuse_flags(struct arithmeticparams *p)
+{
+  int flags = GAL_ARITHMETIC_FLAGS_BASIC;
+  if(p->cp.quiet) flags |= GAL_ARITHMETIC_FLAG_QUIET;
+  if(p->envseed)  flags |= GAL_ARITHMETIC_FLAG_ENVSEED;
+  return flags;
+}
+
+
+
+
+
+static struct fusenode *
+fuse_node_alloc(int operator, gal_data_t *data, struct fusenode *left,
+                struct fusenode *right)
+{
+  struct fusenode *out;
+
+  /* Allocate the node. */
+  errno=0;
+  out=malloc(sizeof *out);
+  if(out==NULL)
+    error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for 'out'",
+          __func__, sizeof *out);
+
+  /* Set its basic properties. */
+  out->data=data;
+  out->left=left;
+  out->right=right;
+  out->operator=operator;
+
+  /* The reference array of the tree: the first leaf that isn't a single
+     number. */
+  if(data) out->ref = data->size>1 ? data : NULL;
+  else     out->ref = ( left->ref
+                        ? left->ref
+                        : (right ? right->ref : NULL) );
+  return out;
+}
+
+
+
+
+
+/* Only plain numeric datasets (that are not tiles of a larger block) can
+   be evaluated in pieces. */
+static int
+fuse_leaf_usable(gal_data_t *data)
+{
+  return ( data->type!=GAL_TYPE_STRING
+           && data->type!=GAL_TYPE_STRLL
+           && data->size>0
+           && data->block==NULL );
+}
+
+
+
+
+
+/* Pop one operand for a fused operator: if the top of the stack is
+   already a fused expression, its tree is used directly. Otherwise, the
+   dataset is popped as a leaf. The returned value is 1 if the operand can
+   be part of a fused tree. */
+static int
+fuse_pop(struct arithmeticparams *p, char *operator_string,
+         struct fusenode **node)
+{
+  gal_data_t *data;
+
+  *node=operands_pop_fused(p);
+  if(*node) return 1;
+
+  data=operands_pop(p, operator_string);
+  *node=fuse_node_alloc(GAL_ARITHMETIC_OP_INVALID, data, NULL, NULL);
+  return fuse_leaf_usable(data);
+}
+
+
+
+
+
+/* Instead of evaluating the element-wise operator now (and allocating a
+   full-sized intermediate array), keep it in an expression tree on the
+   stack. It is evaluated (tile by tile, and in parallel) when a non-fused
+   operator needs it, or at the end. */
+void
+fuse_operator(struct arithmeticparams *p, int operator,
+              char *operator_string, size_t num_operands)
+{
+  int usable;
+  gal_data_t *d1, *d2=NULL;
+  struct fusenode *left, *right=NULL;
+
+  /* Pop the operands (the first popped operand is the right one). */
+  if(num_operands==2)
+    {
+      usable  = fuse_pop(p, operator_string, &right);
+      usable &= fuse_pop(p, operator_string, &left);
+    }
+  else
+    usable = fuse_pop(p, operator_string, &left);
+
+  /* The arrays of the two sides must have the same size to be evaluated
+     in parallel tiles. */
+  if( usable && right && left->ref && right->ref
+      && gal_dimension_is_different(left->ref, right->ref) )
+    usable=0;
+
+  /* Keep the operator on the stack for later evaluation. */
+  if(usable)
+    operands_add_fused(p, fuse_node_alloc(operator, NULL, left, right));
+
+  /* The operands can't be fused, evaluate each side separately and give
+     them to the library (which will also report any possible error). */
+  else
+    {
+      d1=fuse_evaluate(p, left);
+      if(right) d2=fuse_evaluate(p, right);
+      operands_add(p, NULL, gal_arithmetic(operator, p->cp.numthreads,
+                                           fuse_flags(p), d1, d2));
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************       Evaluating the expression        **************/
+/**********************************************************************/
+struct fuseparams
+{
+  int                  flags;  /* Flags to pass to the library.       */
+  size_t            numtiles;  /* Number of tiles.                    */
+  gal_data_t            *out;  /* Output dataset.                     */
+  struct fusenode      *root;  /* Root of the expression tree.        */
+};
+
+
+
+
+
+/* Evaluate the tree directly (operator by operator over the full
+   arrays), exactly like the non-fused operators. The leaves are freed by
+   the library and the nodes are freed here. */
+static gal_data_t *
+fuse_evaluate_direct(struct arithmeticparams *p, struct fusenode *node,
+                     int flags)
+{
+  gal_data_t *l, *r=NULL, *out;
+
+  if(node->operator==GAL_ARITHMETIC_OP_INVALID) out=node->data;
+  else
+    {
+      l=fuse_evaluate_direct(p, node->left, flags);
+      if(node->right) r=fuse_evaluate_direct(p, node->right, flags);
+      out=gal_arithmetic(node->operator, p->cp.numthreads, flags, l, r);
+    }
+  free(node);
+  return out;
+}
+
+
+
+
+
+/* Free the nodes and leaves of a tree. */
+static void
+fuse_free(struct fusenode *node)
+{
+  if(node->left)  fuse_free(node->left);
+  if(node->right) fuse_free(node->right);
+  if(node->data)  gal_data_free(node->data);
+  free(node);
+}
+
+
+
+
+
+/* Find an array leaf with the given type (to be used as the output). */
+static struct fusenode *
+fuse_find_leaf(struct fusenode *node, uint8_t type)
+{
+  struct fusenode *out=NULL;
+
+  if(node->operator==GAL_ARITHMETIC_OP_INVALID)
+    return ( node->data->size>1 && node->data->type==type
+             ? node : NULL );
+
+  out=fuse_find_leaf(node->left, type);
+  if(out==NULL && node->right) out=fuse_find_leaf(node->right, type);
+  return out;
+}
+
+
+
+
+
+/* Evaluate the expression over 'size' elements starting from 'start'. All
+   the intermediate datasets only have 'size' elements and are freed by
+   the library as soon as they are used. */
+static gal_data_t *
+fuse_evaluate_tile(struct fusenode *node, size_t start, size_t size,
+                   int flags)
+{
+  gal_data_t *l, *r=NULL, *out;
+
+  /* A leaf: numbers are used as they are, for arrays, only the desired
+     part is copied (the library will modify its inputs in place). */
+  if(node->operator==GAL_ARITHMETIC_OP_INVALID)
+    {
+      if(node->data->size==1) out=gal_data_copy(node->data);
+      else
+        {
+          out=gal_data_alloc(NULL, node->data->type, 1, &size, NULL, 0,
+                             -1, 1, NULL, NULL, NULL);
+          memcpy(out->array,
+                 gal_pointer_increment(node->data->array, start,
+                                       node->data->type),
+                 size*gal_type_sizeof(node->data->type));
+        }
+    }
+
+  /* An operator. */
+  else
+    {
+      l=fuse_evaluate_tile(node->left, start, size, flags);
+      if(node->right)
+        r=fuse_evaluate_tile(node->right, start, size, flags);
+      out=gal_arithmetic(node->operator, 1, flags, l, r);
+    }
+
+  /* Return the output. */
+  return out;
+}
+
+
+
+
+
+/* Tile 'tind' covers 'FUSE_TILE_SIZE' elements, except the last one that
+   also contains the remainder (so no tile has a single element, which
+   would be interpreted as a number by the library). */
+static void
+fuse_evaluate_one_tile(struct fuseparams *fprm, size_t tind)
+{
+  gal_data_t *tile, *out=fprm->out;
+  size_t start=tind*FUSE_TILE_SIZE;
+  size_t size = ( tind==fprm->numtiles-1
+                  ? out->size-start
+                  : FUSE_TILE_SIZE );
+
+  /* Evaluate the tile; for all but the first tile, warnings have already
+     been printed. */
+  tile=fuse_evaluate_tile(fprm->root, start, size,
+                          ( tind
+                            ? fprm->flags | GAL_ARITHMETIC_FLAG_QUIET
+                            : fprm->flags ) );
+
+  /* Sanity check. */
+  if(tile->type!=out->type || tile->size!=size)
+    error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+          "the problem. The evaluated tile %zu doesn't have the expected "
+          "type or size", __func__, PACKAGE_BUGREPORT, tind);
+
+  /* Copy the tile's values into the output. */
+  memcpy(gal_pointer_increment(out->array, start, out->type),
+         tile->array, size*gal_type_sizeof(out->type));
+  gal_data_free(tile);
+}
+
+
+
+
+
+static void *
+fuse_evaluate_on_thread(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct fuseparams *fprm=(struct fuseparams *)(tprm->params);
+
+  size_t i;
+
+  /* The first tile was evaluated before spinning off the threads. */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    fuse_evaluate_one_tile(fprm, tprm->indexs[i]+1);
+
+  /* Wait for all threads to finish and return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Evaluate a fused expression and return the resulting dataset. The tree
+   (and all its leaves) are freed. */
+gal_data_t *
+fuse_evaluate(struct arithmeticparams *p, struct fusenode *node)
+{
+  struct fusenode *leaf;
+  gal_data_t *ref=node->ref, *tile;
+  struct fuseparams fprm={fuse_flags(p), 0, NULL, node};
+
+  /* A leaf (only possible when the operands of a fused operator could not
+     be fused), or a small/numeric expression: evaluate it directly. */
+  if(node->operator==GAL_ARITHMETIC_OP_INVALID
+     || ref==NULL || ref->size<2*FUSE_TILE_SIZE)
+    return fuse_evaluate_direct(p, node, fprm.flags);
+
+  /* Evaluate the first tile to find the output type. Each tile only
+     reads the same elements of the leaves that it writes in the output,
+     so if one of the input arrays has the same type as the output, it can
+     be used as the output (similar to the in-place operations of the
+     library). Otherwise, allocate the output with the same dimensions as
+     the input arrays. */
+  fprm.numtiles=ref->size/FUSE_TILE_SIZE;
+  tile=fuse_evaluate_tile(node, 0, FUSE_TILE_SIZE, fprm.flags);
+  leaf=fuse_find_leaf(node, tile->type);
+  if(leaf)
+    {
+      fprm.out=leaf->data;
+      fprm.out->flag=0;
+    }
+  else
+    fprm.out=gal_data_alloc(NULL, tile->type, ref->ndim, ref->dsize,
+                            ref->wcs, 0, p->cp.minmapsize,
+                            p->cp.quietmmap, NULL, NULL, NULL);
+  memcpy(fprm.out->array, tile->array,
+         FUSE_TILE_SIZE*gal_type_sizeof(tile->type));
+  gal_data_free(tile);
+
+  /* Evaluate the rest of the tiles on separate threads. */
+  gal_threads_spin_off(fuse_evaluate_on_thread, &fprm, fprm.numtiles-1,
+                       p->cp.numthreads, p->cp.minmapsize,
+                       p->cp.quietmmap);
+
+  /* Clean up and return (the leaf that is used as output should not be
+     freed). */
+  if(leaf) leaf->data=NULL;
+  fuse_free(node);
+  return fprm.out;
+}
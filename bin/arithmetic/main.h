@@ -53,11 +53,28 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 /* In every node of the operand linked list, only one of the 'filename' or
    'data' should be non-NULL. Otherwise it will be a bug and will cause
    problems. All the operands operate on this premise. */
+/* Node of a not-yet-evaluated (fused) element-wise expression. Leaves
+   have an operator of 'GAL_ARITHMETIC_OP_INVALID' and keep their dataset
+   in 'data'. */
+struct fusenode
+{
+  int             operator;  /* Operator code (or INVALID for leaves).  */
+  gal_data_t         *data;  /* Dataset of a leaf.                      */
+  gal_data_t          *ref;  /* First array (size>1) leaf of the tree.  */
+  struct fusenode    *left;  /* First (or only) operand.                */
+  struct fusenode   *right;  /* Second operand (binary operators).      */
+};
+
+
+
+
+
 struct operand
 {
   char       *filename;    /* !=NULL if the operand is a filename. */
   char            *hdu;    /* !=NULL if the operand is a filename. */
   gal_data_t     *data;    /* !=NULL if the operand is a dataset.  */
+  struct fusenode *fused;  /* !=NULL if the operand is not evaluated.*/
   struct operand *next;    /* Pointer to next operand.             */
 };
 
@@ -91,6 +108,7 @@ struct arithmeticparams
 
   /* Operating mode: */
   int        wcs_collapsed;  /* If the internal WCS is already collapsed.*/
+  size_t            stream;  /* Pixels to read in each streaming block.  */
 
   /* Internal: */
   uint8_t          envseed;  /* To setup the random number generator.   */
@@ -38,6 +38,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 
 #include "main.h"
 
+#include "fuse.h"
 #include "operands.h"
 
 
@@ -108,6 +109,7 @@ operands_add_list(struct arithmeticparams *p, gal_data_t *data)
       /* Set the basic parameters. */
       newnode->data=tmp;
       newnode->hdu=NULL;
+      newnode->fused=NULL;
       newnode->filename=NULL;
       newnode->data->next=NULL;
 
@@ -148,6 +150,9 @@ operands_add(struct arithmeticparams *p, char *filename, gal_data_t *data)
         error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for 'newnode'",
               __func__, sizeof *newnode);
 
+      /* This operand is already evaluated. */
+      newnode->fused=NULL;
+
       /* If the 'filename' is the name of a dataset, then use a copy of it.
          otherwise, do the basic analysis. */
       if( filename
@@ -234,6 +239,14 @@ operands_pop(struct arithmeticparams *p, char *operator)
     error(EXIT_FAILURE, 0, "not enough operands for the '%s' operator",
           operator);
 
+  /* If the top operand is a fused expression that hasn't been evaluated
+     yet, evaluate it now (the result is a normal dataset). */
+  if(operands->fused)
+    {
+      operands->data=fuse_evaluate(p, operands->fused);
+      operands->fused=NULL;
+    }
+
   /* Set the dataset. If filename is present then read the file
      and fill in the array, if not then just set the array. */
   if(operands->filename)
@@ -299,6 +312,52 @@ operands_pop(struct arithmeticparams *p, char *operator)
 
 
 
+/* Add a fused (not yet evaluated) expression to the top of the stack. */
+void
+operands_add_fused(struct arithmeticparams *p, struct fusenode *fused)
+{
+  struct operand *newnode;
+
+  /* Allocate space for the new operand. */
+  errno=0;
+  newnode=malloc(sizeof *newnode);
+  if(newnode==NULL)
+    error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for 'newnode'",
+          __func__, sizeof *newnode);
+
+  /* Set the basic parameters and put it on the top of the stack. */
+  newnode->hdu=NULL;
+  newnode->data=NULL;
+  newnode->fused=fused;
+  newnode->filename=NULL;
+  newnode->next=p->operands;
+  p->operands=newnode;
+}
+
+
+
+
+
+/* If the top operand is a fused expression, remove it from the stack and
+   return its tree (without evaluating it). Otherwise, return NULL and
+   leave the stack untouched. */
+struct fusenode *
+operands_pop_fused(struct arithmeticparams *p)
+{
+  struct fusenode *out;
+  struct operand *operands=p->operands;
+
+  if(operands==NULL || operands->fused==NULL) return NULL;
+  out=operands->fused;
+  p->operands=operands->next;
+  free(operands);
+  return out;
+}
+
+
+
+
+
 /* Wrapper to use the 'operands_pop' function with the 'set-' operator. */
 gal_data_t *
 operands_pop_wrapper_set(void *in)
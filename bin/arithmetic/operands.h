@@ -32,6 +32,12 @@ operands_add(struct arithmeticparams *p, char *filename, gal_data_t *data);
 gal_data_t *
 operands_pop(struct arithmeticparams *p, char *operator);
 
+void
+operands_add_fused(struct arithmeticparams *p, struct fusenode *fused);
+
+struct fusenode *
+operands_pop_fused(struct arithmeticparams *p);
+
 gal_data_t *
 operands_pop_wrapper_set(void *in);
 
@@ -0,0 +1,593 @@
+/*********************************************************************
+Arithmetic - Do arithmetic operations on images.
+Arithmetic is part of GNU Astronomy Utilities (Gnuastro) package.
+
+Original author:
+     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+Contributing author(s):
+Copyright (C) 2024 Free Software Foundation, Inc.
+
+Gnuastro is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Gnuastro is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <gnuastro/wcs.h>
+#include <gnuastro/fits.h>
+#include <gnuastro/blank.h>
+#include <gnuastro/array.h>
+#include <gnuastro/pointer.h>
+#include <gnuastro/dimension.h>
+#include <gnuastro/arithmetic.h>
+
+#include <gnuastro-internal/checkset.h>
+#include <gnuastro-internal/arithmetic-set.h>
+
+#include "main.h"
+
+#include "fuse.h"
+#include "operands.h"
+#include "arithmetic.h"
+
+
+
+
+/* Information about each input image in the streaming mode. */
+struct streaminput
+{
+  char            *filename;  /* Name of input file.                   */
+  char                 *hdu;  /* HDU of input.                         */
+  fitsfile            *fptr;  /* CFITSIO pointer to the opened HDU.    */
+  uint8_t              type;  /* Type of the image.                    */
+  size_t              fndim;  /* Number of dimensions in the FITS HDU. */
+  size_t             *fsize;  /* Size of each dimension (C order).     */
+  size_t              saxis;  /* Slowest non-degenerate axis (C order).*/
+  void               *blank;  /* Blank value of the image's type.      */
+  struct streaminput  *next;  /* Next input (in order of tokens).      */
+};
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************           Checking the tokens          **************/
+/**********************************************************************/
+/* Streaming is only possible when the output only depends on the same
+   pixel of the inputs: all operands must be FITS images or numbers and all
+   the operators must be fused element-wise operators. The stack is also
+   simulated to make sure only one operand remains at the end (otherwise,
+   the non-streaming mode will report the problem). */
+static int
+stream_possible(struct arithmeticparams *p, size_t *numfiles)
+{
+  int inlib, operator;
+  gal_data_t *number;
+  gal_list_str_t *token;
+  size_t num_operands, depth=0;
+
+  *numfiles=0;
+  for(token=p->tokens;token!=NULL;token=token->next)
+    {
+      /* Operators that need special treatment (writing files, naming
+         operands or reading columns). */
+      if( !strncmp(OPERATOR_PREFIX_TOFILE, token->v,
+                   OPERATOR_PREFIX_LENGTH_TOFILE)
+          || !strncmp(OPERATOR_PREFIX_TOFILEFREE, token->v,
+                      OPERATOR_PREFIX_LENGTH_TOFILEFREE)
+          || !strncmp(token->v, GAL_ARITHMETIC_SET_PREFIX,
+                      GAL_ARITHMETIC_SET_PREFIX_LENGTH)
+          || !strncmp(token->v, GAL_ARITHMETIC_OPSTR_LOADCOL_PREFIX,
+                      GAL_ARITHMETIC_OPSTR_LOADCOL_PREFIX_LEN) )
+        return 0;
+
+      /* FITS images (other array formats are not read in pieces). */
+      else if( gal_fits_file_recognized(token->v) )
+        { ++depth; ++*numfiles; }
+      else if( gal_array_file_recognized(token->v) )
+        return 0;
+
+      /* Numbers. */
+      else if( (number=gal_data_copy_string_to_number(token->v)) )
+        { ++depth; gal_data_free(number); }
+
+      /* Operators. */
+      else
+        {
+          operator=arithmetic_set_operator(token->v, &num_operands,
+                                           &inlib);
+          if( inlib==0
+              || fuse_operator_fusable(operator, num_operands)==0
+              || depth<num_operands )
+            return 0;
+          depth=depth-num_operands+1;
+        }
+    }
+
+  /* Only one operand should remain at the end and at least one image
+     should be given. */
+  return depth==1 && *numfiles>0;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************           Preparing the inputs         **************/
+/**********************************************************************/
+static struct streaminput *
+stream_inputs_open(struct arithmeticparams *p, size_t *ndim,
+                   size_t **dsize)
+{
+  gal_list_str_t *token;
+  int readwcs, type;
+  size_t rndim, *rsize;
+  struct streaminput *in, *first=NULL, *last=NULL;
+
+  /* Go over the tokens (in order) and open the images. */
+  for(token=p->tokens;token!=NULL;token=token->next)
+    if( gal_fits_file_recognized(token->v) )
+      {
+        /* Allocate the structure and add it to the end of the list. */
+        errno=0;
+        in=malloc(sizeof *in);
+        if(in==NULL)
+          error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for 'in'",
+                __func__, sizeof *in);
+        in->next=NULL;
+        if(last) last->next=in; else first=in;
+        last=in;
+
+        /* Set the HDU (similar to 'operands_add'). */
+        in->filename=token->v;
+        if(p->globalhdu)
+          gal_checkset_allocate_copy(p->globalhdu, &in->hdu);
+        else
+          in->hdu=gal_list_str_pop(&p->hdus);
+
+        /* Open the HDU and read the basic information. */
+        in->fptr=gal_fits_hdu_open_format(in->filename, in->hdu, 0,
+                                          "--hdu");
+        gal_fits_img_info(in->fptr, &type, &in->fndim, &in->fsize, NULL,
+                          NULL);
+        in->type=type;
+        in->blank=gal_blank_alloc_write(in->type);
+
+        /* The slowest axis that is not degenerate (has a length larger
+           than one): the blocks are defined over this axis. */
+        for(in->saxis=0; in->saxis<in->fndim-1; ++in->saxis)
+          if(in->fsize[in->saxis]>1) break;
+
+        /* Remove the extra dimensions and compare with the first
+           input. */
+        rsize=gal_pointer_allocate(GAL_TYPE_SIZE_T, in->fndim, 0,
+                                   __func__, "rsize");
+        memcpy(rsize, in->fsize, in->fndim*sizeof *rsize);
+        rndim=gal_dimension_remove_extra(in->fndim, rsize, NULL);
+        if(in==first) { *ndim=rndim; *dsize=rsize; }
+        else
+          {
+            if(rndim!=*ndim || memcmp(rsize, *dsize, rndim*sizeof *rsize))
+              error(EXIT_FAILURE, 0, "%s (hdu %s): doesn't have the same "
+                    "size as %s (hdu %s)", in->filename, in->hdu,
+                    first->filename, first->hdu);
+            free(rsize);
+          }
+
+        /* If no WCS is set yet, use the WCS of this image (similar to
+           'operands_add'). */
+        readwcs = (p->wcsfile && !strcmp(p->wcsfile,"none")) ? 0 : 1;
+        if(readwcs && p->refdata.wcs==NULL)
+          {
+            p->refdata.wcs=gal_wcs_read(in->filename, in->hdu,
+                                        p->cp.wcslinearmatrix, 0, 0,
+                                        &p->refdata.nwcs, "--hdu");
+            rsize=gal_pointer_allocate(GAL_TYPE_SIZE_T, in->fndim, 0,
+                                       __func__, "rsize");
+            memcpy(rsize, in->fsize, in->fndim*sizeof *rsize);
+            gal_dimension_remove_extra(in->fndim, rsize, p->refdata.wcs);
+            free(rsize);
+            if(p->refdata.wcs && !p->cp.quiet)
+              printf(" - WCS: %s (hdu %s).\n", in->filename, in->hdu);
+          }
+
+        /* Report the opened image. */
+        if(!p->cp.quiet)
+          printf(" - Stream: %s (hdu %s).\n", in->filename, in->hdu);
+      }
+
+  /* Return the list of inputs. */
+  return first;
+}
+
+
+
+
+
+static void
+stream_inputs_free(struct streaminput *in)
+{
+  int status=0;
+  struct streaminput *tmp;
+
+  while(in)
+    {
+      tmp=in->next;
+      fits_close_file(in->fptr, &status);
+      gal_fits_io_error(status, NULL);
+      free(in->blank);
+      free(in->fsize);
+      free(in->hdu);
+      free(in);
+      in=tmp;
+    }
+}
+
+
+
+
+
+/* Set the first and last pixels (in FITS order, counting from 1) of the
+   block starting from row 'row0' (over the slowest non-degenerate axis)
+   with 'nrows' rows. */
+static void
+stream_pixels(size_t ndim, size_t *dsize, size_t saxis, size_t row0,
+              size_t nrows, long *fpixel, long *lpixel)
+{
+  size_t i;
+  for(i=0;i<ndim;++i)
+    {
+      fpixel[ndim-1-i] = i==saxis ? row0+1     : 1;
+      lpixel[ndim-1-i] = i==saxis ? row0+nrows : dsize[i];
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************             Streaming blocks           **************/
+/**********************************************************************/
+/* Read the given rows of the input into a dataset with the (extra
+   dimension removed) size of the image. */
+static gal_data_t *
+stream_read_block(struct arithmeticparams *p, struct streaminput *in,
+                  size_t ndim, size_t *dsize, size_t row0, size_t nrows)
+{
+  gal_data_t *out;
+  int anyblank, status=0;
+  long fpixel[10], lpixel[10], inc[10];
+  size_t i, full=dsize[0], maxdim=sizeof fpixel/sizeof *fpixel;
+
+  /* Sanity check. */
+  if(in->fndim>maxdim)
+    error(EXIT_FAILURE, 0, "%s (hdu %s): streaming is only supported "
+          "for images with a maximum of %zu dimensions", in->filename,
+          in->hdu, maxdim);
+
+  /* Allocate the output. */
+  dsize[0]=nrows;
+  out=gal_data_alloc(NULL, in->type, ndim, dsize, NULL, 0,
+                     p->cp.minmapsize, p->cp.quietmmap, NULL, NULL, NULL);
+  dsize[0]=full;
+
+  /* Read the block. */
+  for(i=0;i<in->fndim;++i) inc[i]=1;
+  stream_pixels(in->fndim, in->fsize, in->saxis, row0, nrows, fpixel,
+                lpixel);
+  if( fits_read_subset(in->fptr, gal_fits_type_to_datatype(in->type),
+                       fpixel, lpixel, inc, in->blank, out->array,
+                       &anyblank, &status) )
+    gal_fits_io_error(status, NULL);
+
+  /* Return the block. */
+  return out;
+}
+
+
+
+
+
+/* Evaluate the expression over the given block by parsing the tokens as
+   in the non-streaming mode, but with the images replaced by the blocks
+   that are read from them. */
+static gal_data_t *
+stream_evaluate_block(struct arithmeticparams *p, struct streaminput *in,
+                      size_t ndim, size_t *dsize, size_t row0,
+                      size_t nrows)
+{
+  gal_data_t *data;
+  gal_list_str_t *token;
+  size_t num_operands=0;
+  int inlib, operator=GAL_ARITHMETIC_OP_INVALID;
+
+  /* Go over the tokens and put them on the stack. */
+  for(token=p->tokens;token!=NULL;token=token->next)
+    if( gal_fits_file_recognized(token->v) )
+      {
+        operands_add(p, NULL, stream_read_block(p, in, ndim, dsize,
+                                                row0, nrows));
+        in=in->next;
+      }
+    else if( (data=gal_data_copy_string_to_number(token->v)) )
+      {
+        data->quietmmap=p->cp.quietmmap;
+        data->minmapsize=p->cp.minmapsize;
+        operands_add(p, NULL, data);
+      }
+    else
+      {
+        operator=arithmetic_set_operator(token->v, &num_operands,
+                                         &inlib);
+        arithmetic_operator_run(p, operator, token->v, num_operands,
+                                inlib);
+      }
+
+  /* Evaluate the final operand and return it. */
+  data=operands_pop(p, "stream");
+  if(p->operands || data->size!=nrows*(gal_dimension_total_size(ndim,
+                                                                dsize)
+                                       /dsize[0]))
+    error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+          "the problem. The output of the expression over the block "
+          "doesn't have the expected size", __func__, PACKAGE_BUGREPORT);
+  return data;
+}
+
+
+
+
+
+/* Write the first block in the output: the full header (with WCS and
+   metadata) is written with the first block, then the image is resized
+   to its final size. */
+static fitsfile *
+stream_write_first(struct arithmeticparams *p, gal_data_t *block,
+                   size_t ndim, size_t *dsize)
+{
+  size_t i;
+  fitsfile *fptr;
+  int status=0;
+  long naxes[10];
+
+  /* Sanity checks. */
+  if(block->type==GAL_TYPE_UINT64)
+    error(EXIT_FAILURE, 0, "the '--stream' mode doesn't support outputs "
+          "with an unsigned 64-bit integer type (which need special "
+          "treatment in FITS). Please convert the output to another "
+          "type (for example with the 'int64' or 'float64' operators)");
+  if(ndim>sizeof naxes/sizeof *naxes)
+    error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+          "the problem. The output has too many dimensions", __func__,
+          PACKAGE_BUGREPORT);
+
+  /* Set the metadata of the output. */
+  if(p->metaname)
+    gal_checkset_allocate_copy(p->metaname, &block->name);
+  if(p->metaunit)
+    gal_checkset_allocate_copy(p->metaunit, &block->unit);
+  if(p->metacomment)
+    gal_checkset_allocate_copy(p->metacomment, &block->comment);
+
+  /* Write the 0-th HDU keywords and the first block. */
+  block->wcs=p->refdata.wcs;
+  gal_fits_key_write(p->cp.ckeys, p->cp.output, "0", "NONE", 1, 1);
+  fptr=gal_fits_img_write_to_ptr(block, p->cp.output, NULL, 0);
+  block->wcs=NULL;
+
+  /* Resize the image to the full size. */
+  for(i=0;i<ndim;++i) naxes[ndim-1-i]=dsize[i];
+  if( fits_resize_img(fptr, gal_fits_type_to_bitpix(block->type), ndim,
+                      naxes, &status) )
+    gal_fits_io_error(status, NULL);
+  return fptr;
+}
+
+
+
+
+
+static void
+stream_write_block(fitsfile *fptr, gal_data_t *block, size_t ndim,
+                   size_t *dsize, size_t row0, size_t nrows,
+                   int *blankwritten)
+{
+  void *blank;
+  int status=0, datatype=gal_fits_type_to_datatype(block->type);
+  long fpixel[10], lpixel[10];
+
+  /* For integer types, the BLANK keyword is only written when the first
+     block has blank values. So if this block has blank values, but it
+     wasn't written, write it now. */
+  if( *blankwritten==0
+      && block->type!=GAL_TYPE_FLOAT32
+      && block->type!=GAL_TYPE_FLOAT64
+      && gal_blank_present(block, 0) )
+    {
+      blank=gal_fits_key_img_blank(block->type);
+      if(fits_write_key(fptr, datatype, "BLANK", blank,
+                        "Pixels with no data.", &status) )
+        gal_fits_io_error(status, "adding the BLANK keyword");
+      free(blank);
+      *blankwritten=1;
+    }
+
+  /* Write the block. */
+  stream_pixels(ndim, dsize, 0, row0, nrows, fpixel, lpixel);
+  if( fits_write_subset(fptr, datatype, fpixel, lpixel, block->array,
+                        &status) )
+    gal_fits_io_error(status, NULL);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************         High-level function            **************/
+/**********************************************************************/
+/* Evaluate the expression in blocks of rows (over the slowest dimension)
+   that are read, evaluated and written one by one. Therefore the memory
+   usage only depends on the size of the blocks (set by the value given to
+   '--stream'), not the size of the images. The returned value is 1 if
+   the job was done here and 0 if streaming isn't possible (and the
+   non-streaming mode should be used). */
+int
+arithmetic_stream(struct arithmeticparams *p)
+{
+  uint8_t outtype;
+  fitsfile *ofptr=NULL;
+  gal_data_t *block;
+  struct streaminput *in;
+  int quiet=p->cp.quiet, blankwritten=0, status=0;
+  size_t ndim, *dsize, rowsize, numrows, nrows, row0, numfiles;
+
+  /* See if streaming is possible. */
+  if( stream_possible(p, &numfiles)==0 )
+    {
+      if(!p->cp.quiet)
+        error(EXIT_SUCCESS, 0, "WARNING: '--stream' is only possible "
+              "when all the operands are FITS images or numbers and all "
+              "the operators are element-wise (for example '+', 'lt' or "
+              "'sqrt'), and only one operand remains at the end. "
+              "Continuing without streaming");
+      return 0;
+    }
+
+  /* Open the inputs and set the number of rows in each block (over the
+     slowest dimension). One-dimensional outputs are written as tables
+     by default, which can't be streamed. */
+  in=stream_inputs_open(p, &ndim, &dsize);
+  if(ndim==1 && p->onedasimage==0)
+    error(EXIT_FAILURE, 0, "the '--stream' mode can't be used on "
+          "one-dimensional inputs unless '--onedasimage' is also called");
+  numrows=dsize[0];
+  rowsize=gal_dimension_total_size(ndim, dsize)/numrows;
+  nrows = p->stream>rowsize ? p->stream/rowsize : 1;
+
+  /* Go over the blocks. */
+  for(row0=0; row0<numrows; row0+=nrows)
+    {
+      /* The last block may be smaller. */
+      if(row0+nrows>numrows) nrows=numrows-row0;
+
+      /* Evaluate the block. Any warnings by the operators have already
+         been printed in the first block. */
+      block=stream_evaluate_block(p, in, ndim, dsize, row0, nrows);
+      p->cp.quiet=1;
+
+      /* Write the block into the output. */
+      if(row0==0)
+        {
+          outtype=block->type;
+          ofptr=stream_write_first(p, block, ndim, dsize);
+          blankwritten = ( block->type!=GAL_TYPE_FLOAT32
+                           && block->type!=GAL_TYPE_FLOAT64
+                           && gal_blank_present(block, 0) );
+        }
+      else
+        {
+          if(block->type!=outtype)
+            error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s "
+                  "to fix the problem. The type of the output changes "
+                  "between the blocks", __func__, PACKAGE_BUGREPORT);
+          stream_write_block(ofptr, block, ndim, dsize, row0, nrows,
+                             &blankwritten);
+        }
+      gal_data_free(block);
+    }
+  p->cp.quiet=quiet;
+
+  /* Close the output and let the user know that the job is done. */
+  fits_close_file(ofptr, &status);
+  gal_fits_io_error(status, NULL);
+  if(!p->cp.quiet)
+    printf(" - Write (final, streamed): %s\n", p->cp.output);
+
+  /* Clean up. Note that the tokens were taken from the command-line
+     arguments, so the string within each token linked list must not be
+     freed. */
+  free(dsize);
+  stream_inputs_free(in);
+  gal_wcs_free(p->refdata.wcs);
+  gal_list_str_free(p->tokens, 0);
+  return 1;
+}
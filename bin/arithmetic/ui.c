@@ -157,7 +157,8 @@ ui_initialize_options(struct arithmeticparams *p,
       switch(cp->coptions[i].group)
         {
         case GAL_OPTIONS_GROUP_TESSELLATION:
-          if(cp->coptions[i].key!=GAL_OPTIONS_KEY_INTERPMETRIC)
+          if(cp->coptions[i].key!=GAL_OPTIONS_KEY_INTERPMETRIC
+             && cp->coptions[i].key!=GAL_OPTIONS_KEY_INTERPKDTREE)
             cp->coptions[i].flags=OPTION_HIDDEN;
           break;
         }
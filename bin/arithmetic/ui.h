@@ -53,6 +53,7 @@ enum option_keys_enum
   UI_KEY_APPEND          = 1000,
   UI_KEY_ENVSEED,
   UI_KEY_ARGUMENTS,
+  UI_KEY_STREAM,
 };
 
 
@@ -200,6 +200,19 @@ struct argp_option program_options[] =
       GAL_OPTIONS_NOT_MANDATORY,
       GAL_OPTIONS_NOT_SET
     },
+    {
+      "fftwisdom",
+      UI_KEY_FFTWISDOM,
+      "STR",
+      0,
+      "File to keep FFTW's plans (frequency domain).",
+      GAL_OPTIONS_GROUP_OPERATING_MODE,
+      &p->fftwisdom,
+      GAL_TYPE_STRING,
+      GAL_OPTIONS_RANGE_ANY,
+      GAL_OPTIONS_NOT_MANDATORY,
+      GAL_OPTIONS_NOT_SET
+    },
 
 
     {0}
@@ -36,6 +36,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 #include <gnuastro/threads.h>
 #include <gnuastro/convolve.h>
 
+#include <gnuastro-internal/fft.h>
 #include <gnuastro-internal/timing.h>
 
 #include "main.h"
@@ -634,6 +635,67 @@ twodimensionfft(struct convolveparams *p, struct fftonthreadparams *fp,
 
 
 
+/* When the intermediate steps aren't necessary (to check them or for
+   deconvolution), the convolution is done with the library's FFT
+   functions: they use FFTW's real-to-complex transforms in single
+   precision when Gnuastro is configured with FFTW, otherwise they use
+   GSL (like the functions above). Like the functions above, the input
+   is padded with zeros (so the convolution isn't circular) and the
+   result is cropped to the input's size. But with FFTW the transforms
+   are in single precision (the functions above use double precision), so
+   the output is only equal to theirs within floating-point round-off. */
+static void
+convolve_frequency_direct(struct convolveparams *p)
+{
+  float d, *o, *pimg, *pker;
+  struct timeval t1;
+  size_t i, j, ps0, ps1;
+  float *input=p->input->array, *kernel=p->kernel->array;
+  size_t is0=p->input->dsize[0],  is1=p->input->dsize[1];
+  size_t ks0=p->kernel->dsize[0], ks1=p->kernel->dsize[1];
+
+  /* Make the padded arrays: to speed up the transforms, the padded sizes
+     are chosen to only have small prime factors. */
+  if(!p->cp.quiet) gettimeofday(&t1, NULL);
+  ps0=gal_fft_good_size(is0+ks0-1);
+  ps1=gal_fft_good_size(is1+ks1-1);
+  pimg=gal_pointer_allocate(GAL_TYPE_FLOAT32, ps0*ps1, 1, __func__, "pimg");
+  pker=gal_pointer_allocate(GAL_TYPE_FLOAT32, ps0*ps1, 1, __func__, "pker");
+  for(i=0;i<is0;++i)
+    for(j=0;j<is1;++j) pimg[i*ps1+j]=input[i*is1+j];
+  for(i=0;i<ks0;++i)
+    for(j=0;j<ks1;++j) pker[i*ps1+j]=kernel[i*ks1+j];
+  if(!p->cp.quiet)
+    gal_timing_report(&t1, "Input and Kernel images padded.", 1);
+
+  /* Do the convolution. */
+  if(!p->cp.quiet) gettimeofday(&t1, NULL);
+  gal_fft_convolve_2d(&pimg, 1, pker, ps0, ps1, p->cp.numthreads,
+                      p->cp.minmapsize, p->cp.quietmmap, p->fftwisdom);
+  if(!p->cp.quiet)
+    gal_timing_report(&t1, "Convolved in the frequency domain.", 1);
+
+  /* Remove the padding and correct the round-off errors (see
+     'removepaddingcorrectroundoff'). */
+  o=input;
+  for(i=0;i<is0;++i)
+    for(j=0;j<is1;++j)
+      {
+        d=pimg[ (i+(ks0-1)/2)*ps1 + j+(ks1-1)/2 ];
+        *o++ = ( d<-CONVFLOATINGPOINTERR || d>CONVFLOATINGPOINTERR )
+          ? d
+          : 0.0f;
+      }
+
+  /* Clean up. */
+  free(pimg);
+  free(pker);
+}
+
+
+
+
+
 void
 convolve_frequency(struct convolveparams *p)
 {
@@ -644,6 +706,11 @@ convolve_frequency(struct convolveparams *p)
   struct fftonthreadparams *fp;
 
 
+  /* Without the intermediate steps, use the library's FFT functions. */
+  if(p->makekernel==0 && p->checkfreqsteps==0)
+    { convolve_frequency_direct(p); return; }
+
+
   /* Make the padded arrays. */
   if(!p->cp.quiet) gettimeofday(&t1, NULL);
   frequency_make_padded_complex(p);
@@ -84,6 +84,7 @@ struct convolveparams
   size_t          makekernel;  /* Make a kernel to create input.          */
   uint8_t   noedgecorrection;  /* Do not correct spatial edge effects.    */
   uint8_t      conv_on_blank;  /* Do convolution on blank pixels also.    */
+  char            *fftwisdom;  /* File to keep FFTW's plans.              */
 
   /* Internal */
   int                 isfits;  /* Input is a FITS file.                   */
@@ -131,6 +131,7 @@ ui_initialize_options(struct convolveparams *p,
       case GAL_OPTIONS_KEY_LOG:
       case GAL_OPTIONS_KEY_IGNORECASE:
       case GAL_OPTIONS_KEY_INTERPNUMNGB:
+      case GAL_OPTIONS_KEY_INTERPKDTREE:
       case GAL_OPTIONS_KEY_INTERPONLYBLANK:
         cp->coptions[i].flags=OPTION_HIDDEN;
         break;
@@ -802,6 +803,7 @@ ui_free_report(struct convolveparams *p, struct timeval *t1)
 {
   /* Free the allocated arrays: */
   free(p->khdu);
+  free(p->fftwisdom);
   free(p->cp.hdu);
   free(p->cp.output);
   gal_data_free(p->input);
@@ -161,7 +161,7 @@ struct argp_option program_options[] =
       UI_KEY_KDTREE,
       "STR",
       0,
-      "build, internal, disable, CUSTOM-FITS-FILE.",
+      "build(-index), internal, disable, partition, FITS/index.",
       UI_GROUP_CATALOGMATCH,
       &p->kdtree,
       GAL_TYPE_STRING,
@@ -182,6 +182,32 @@ struct argp_option program_options[] =
       GAL_OPTIONS_NOT_MANDATORY,
       GAL_OPTIONS_NOT_SET,
     },
+    {
+      "knn",
+      UI_KEY_KNN,
+      "INT",
+      0,
+      "Nearest INT rows of first input to each second.",
+      UI_GROUP_CATALOGMATCH,
+      &p->knn,
+      GAL_TYPE_SIZE_T,
+      GAL_OPTIONS_RANGE_GE_0,
+      GAL_OPTIONS_NOT_MANDATORY,
+      GAL_OPTIONS_NOT_SET,
+    },
+    {
+      "range",
+      UI_KEY_RANGE,
+      0,
+      0,
+      "All rows of first input within aperture of second.",
+      UI_GROUP_CATALOGMATCH,
+      &p->range,
+      GAL_OPTIONS_NO_ARG_TYPE,
+      GAL_OPTIONS_RANGE_0_OR_1,
+      GAL_OPTIONS_NOT_MANDATORY,
+      GAL_OPTIONS_NOT_SET,
+    },
 
 
 
@@ -51,6 +51,8 @@ enum kdtree_modes
   MATCH_KDTREE_INTERNAL,
   MATCH_KDTREE_DISABLE,
   MATCH_KDTREE_FILE,
+  MATCH_KDTREE_INDEX,
+  MATCH_KDTREE_PARTITION,
 };
 
 
@@ -72,6 +74,8 @@ struct matchparams
   char             *kdtreehdu;  /* k-d tree HDU when its a (FITS) file. */
   uint8_t         logasoutput;  /* Don't rearrange inputs, out is log.  */
   uint8_t          notmatched;  /* Output is rows that don't match.     */
+  size_t                  knn;  /* Number of nearest neighbours.        */
+  uint8_t               range;  /* All neighbours within the aperture.  */
 
   /* Internal */
   int                    mode;  /* Mode of operation: image or catalog. */
@@ -88,6 +92,7 @@ struct matchparams
   int              kdtreemode;  /* The k-d tree mode.                   */
   gal_data_t      *kdtreedata;  /* The k-d tree data.                   */
   size_t           kdtreeroot;  /* The root node of the k-d tree.       */
+  uint8_t         kdtreeindex;  /* Build a k-d tree index (not FITS).   */
 
   /* Output: */
   time_t              rawtime;  /* Starting time of the program.        */
@@ -23,6 +23,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 **********************************************************************/
 #include <config.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <errno.h>
 #include <error.h>
@@ -227,6 +228,7 @@ static void
 match_arrange_in_new_col(struct matchparams *p, gal_data_t *in,
                          size_t *permutation, size_t nummatched)
 {
+  char **strarr;
   size_t c=0, i, n;
   size_t istart=p->notmatched ? nummatched : 0;
   size_t iend=p->notmatched ? in->dsize[0] : nummatched;
@@ -247,10 +249,17 @@ match_arrange_in_new_col(struct matchparams *p, gal_data_t *in,
            gal_pointer_increment(in->array, n*permutation[i], in->type),
            gal_type_sizeof(in->type) * n);
 
-  /**********************************/
-  /* Add a check so if the column is a string, we free the strings that
-     aren't included in the output. */
-  /**********************************/
+  /* For strings, only the pointers were copied above, but the same row
+     may be repeated in the output (with '--knn' or '--range'). So each
+     output row gets its own copy and the input strings are freed. */
+  if(in->type==GAL_TYPE_STRING)
+    {
+      strarr=out;
+      for(i=0;i<outrows*n;++i)
+        gal_checkset_allocate_copy(strarr[i], &strarr[i]);
+      strarr=in->array;
+      for(i=0;i<in->size;++i) free(strarr[i]);
+    }
 
   /* Free the existing array, and correct the sizes. */
   free(in->array);
@@ -559,6 +568,54 @@ match_catalog_write_one_col(struct matchparams *p, gal_data_t *a,
 
 
 
+/* The DATASUM of the first input's HDU: a k-d tree index file is tied to
+   it. When the HDU has a 'DATASUM' keyword, it is used (so the whole
+   table doesn't have to be read), otherwise it is calculated. */
+static unsigned long
+match_kdtree_index_datasum(struct matchparams *p)
+{
+  char *tailptr;
+  unsigned long datasum;
+  gal_data_t *keysll;
+
+  /* The index can only be tied to a FITS file. */
+  if( p->input1name==NULL || gal_fits_name_is_fits(p->input1name)==0 )
+    error(EXIT_FAILURE, 0, "a k-d tree index (built with "
+          "'--kdtree=build-index', or a non-FITS file given to "
+          "'--kdtree') can only "
+          "be used when the first input is a FITS file: the index is "
+          "tied to the DATASUM of the first input. Please use a FITS "
+          "k-d tree ('--kdtree=build') instead");
+
+  /* Read the 'DATASUM' keyword. */
+  keysll=gal_data_array_calloc(1);
+  keysll[0].type=GAL_TYPE_STRING;
+  keysll[0].name="DATASUM";
+  gal_fits_key_read(p->input1name, p->cp.hdu, keysll, 0, 0, "--hdu");
+
+  /* Use the keyword if it could be read, otherwise calculate it. */
+  datasum=0;
+  tailptr=NULL;
+  if(keysll[0].status==0)
+    datasum=strtoul(((char **)(keysll[0].array))[0], &tailptr, 10);
+  if(tailptr==NULL || *tailptr!='\0')
+    datasum=gal_fits_hdu_datasum(p->input1name, p->cp.hdu, "--hdu");
+
+  /* Clean up: since the 'name' component wasn't allocated, we should set
+     it to NULL before calling 'gal_data_array_free'. */
+  keysll[0].name=NULL;
+  gal_data_array_free(keysll, 1, 1);
+  return datasum;
+}
+
+
+
+
+
+/* Build the k-d tree of the first input and write it into the output.
+   With '--kdtree=build', the classic k-d tree is written as a FITS table.
+   With '--kdtree=build-index', a flat k-d tree is written as an index
+   file (that is memory-mapped when given to '--kdtree'). */
 static void
 match_catalog_kdtree_build(struct matchparams *p)
 {
@@ -566,16 +623,25 @@ match_catalog_kdtree_build(struct matchparams *p)
   size_t root;
   struct timeval t1;
   gal_data_t *kdtree;
+  unsigned long datasum=0;
   gal_fits_list_key_t *keylist=NULL;
+  int index=p->kdtreeindex;
 
   /* Meta-data in the output fits file. */
   char *unit = "index";
   char *comment = "k-d tree root index (counting from 0).";
 
+  /* The index is tied to the DATASUM of the first input (it is found
+     before building the tree to abort early on non-FITS inputs). */
+  if(index) datasum=match_kdtree_index_datasum(p);
+
   /* Construct a k-d tree from 'p->cols1': the index of root is stored in
      'root'. */
   if(!p->cp.quiet) gettimeofday(&t1, NULL);
-  kdtree = gal_kdtree_create(p->cols1, &root);
+  kdtree = ( index
+             ? gal_kdtree_flat_create(p->cols1, p->cp.numthreads,
+                                      p->cp.minmapsize, p->cp.quietmmap)
+             : gal_kdtree_create(p->cols1, p->cp.numthreads, &root) );
   if(!p->cp.quiet)
     {
       if( asprintf(&msg, "k-d tree constructed (%zu rows).",
@@ -587,18 +653,114 @@ match_catalog_kdtree_build(struct matchparams *p)
 
   /* Write the k-d tree to a file and write root index and input name
      as FITS keywords ('gal_table_write' frees 'keylist'). */
-  gal_fits_key_list_title_add(&keylist, "k-d tree parameters", 0);
-  gal_fits_key_write_filename("KDTIN", p->input1name, &keylist, 0,
-                              p->cp.quiet);
-  gal_fits_key_list_add_end(&keylist, GAL_TYPE_SIZE_T,
-                            MATCH_KDTREE_ROOT_KEY, 0, &root, 0,
-                            comment, 0, unit, 0);
-  gal_table_write(kdtree, keylist, NULL, GAL_TABLE_FORMAT_BFITS,
-                  p->out1name, "kdtree", 0, 1);
+  if(index)
+    gal_kdtree_flat_index_write(p->cols1, kdtree, datasum, p->out1name);
+  else
+    {
+      gal_fits_key_list_title_add(&keylist, "k-d tree parameters", 0);
+      gal_fits_key_write_filename("KDTIN", p->input1name, &keylist, 0,
+                                  p->cp.quiet);
+      gal_fits_key_list_add_end(&keylist, GAL_TYPE_SIZE_T,
+                                MATCH_KDTREE_ROOT_KEY, 0, &root, 0,
+                                comment, 0, unit, 0);
+      gal_table_write(kdtree, keylist, NULL, GAL_TABLE_FORMAT_BFITS,
+                      p->out1name, "kdtree", 0, 1);
+    }
+  gal_list_data_free(kdtree);
 
   /* Let the user know that the k-d tree has been built. */
   if(!p->cp.quiet)
-    fprintf(stdout, "  - Output (k-d tree): %s\n", p->out1name);
+    fprintf(stdout, "  - Output (k-d tree%s): %s\n",
+            index ? " index" : "", p->out1name);
+}
+
+
+
+
+
+/* Find the neighbours of each second input row within the first input
+   ('--knn' or '--range'). The output has the same format as
+   'gal_match_kdtree', but a row of either input may be repeated. */
+static gal_data_t *
+match_catalog_kdtree_neighbours(struct matchparams *p, size_t *nummatched)
+{
+  size_t i, c, *ind, *aind, *bind;
+  gal_data_t *res, *tmp, *out=NULL;
+  double *dist, *odist, maxdist=( p->aperture
+                                  ? ((double *)(p->aperture->array))[0]
+                                  : INFINITY );
+
+  /* When the first input is empty, there is no k-d tree. */
+  if(p->kdtreedata==NULL) { *nummatched=0; return NULL; }
+
+  /* k-nearest neighbours: each row of the output has 'p->knn' columns,
+     only the neighbours within the aperture (if given) are kept. */
+  if(p->knn)
+    {
+      res=gal_kdtree_knn(p->cols1, p->kdtreedata, p->kdtreeroot, p->cols2,
+                         p->knn, p->cp.numthreads, p->cp.minmapsize,
+                         p->cp.quietmmap);
+      ind=res->array;
+      dist=res->next->array;
+
+      /* Count the good neighbours and allocate the output. */
+      c=0;
+      for(i=0;i<res->size;++i)
+        if(ind[i]!=GAL_BLANK_SIZE_T && dist[i]<maxdist) ++c;
+      if(c)
+        {
+          out=gal_data_alloc(NULL, GAL_TYPE_SIZE_T, 1, &c, NULL, 0,
+                             p->cp.minmapsize, p->cp.quietmmap,
+                             "CAT1_ROW", "counter", "Row index in "
+                             "first catalog (counting from 0).");
+          out->next=gal_data_alloc(NULL, GAL_TYPE_SIZE_T, 1, &c, NULL, 0,
+                                   p->cp.minmapsize, p->cp.quietmmap,
+                                   "CAT2_ROW", "counter", "Row index in "
+                                   "second catalog (counting from 0).");
+          out->next->next=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &c,
+                                         NULL, 0, p->cp.minmapsize,
+                                         p->cp.quietmmap, "MATCH_DIST",
+                                         NULL, "Distance between the "
+                                         "match.");
+
+          /* Fill the output. */
+          aind=out->array;
+          bind=out->next->array;
+          odist=out->next->next->array;
+          for(c=i=0;i<res->size;++i)
+            if(ind[i]!=GAL_BLANK_SIZE_T && dist[i]<maxdist)
+              {
+                aind[c]=ind[i];
+                bind[c]=i/p->knn;
+                odist[c++]=dist[i];
+              }
+        }
+      gal_list_data_free(res);
+    }
+
+  /* All neighbours within the aperture: the library's output only needs
+     to be re-ordered (the neighbour's row should be first). */
+  else
+    {
+      res=gal_kdtree_range(p->cols1, p->kdtreedata, p->kdtreeroot,
+                           p->cols2, maxdist, p->cp.numthreads,
+                           p->cp.minmapsize, p->cp.quietmmap);
+      if(res)
+        {
+          out=res->next;
+          tmp=out->next;
+          out->next=res;
+          res->next=tmp;
+          free(out->name);
+          free(res->name);
+          gal_checkset_allocate_copy("CAT1_ROW", &out->name);
+          gal_checkset_allocate_copy("CAT2_ROW", &res->name);
+        }
+    }
+
+  /* Return the output. */
+  *nummatched = out ? out->size : 0;
+  return out;
 }
 
 
@@ -611,7 +773,9 @@ static gal_data_t *
 match_catalog_kdtree(struct matchparams *p, size_t *nummatched)
 {
   char *msg;
+  size_t ndim;
   struct timeval t1;
+  unsigned long datasum;
   gal_data_t *out=NULL;
 
   /* Operate according to the required mode. */
@@ -624,29 +788,80 @@ match_catalog_kdtree(struct matchparams *p, size_t *nummatched)
 
     /* Do the k-d tree matching. */
     case MATCH_KDTREE_FILE:
+    case MATCH_KDTREE_INDEX:
     case MATCH_KDTREE_INTERNAL:
 
       /* If the k-d tree should be constructed internally, build it,
          otherwise, we have already read an checked the k-d tree in 'ui.c',
-         so go directly to the matching. */
+         so go directly to the matching. The internal k-d tree is never
+         written, so the (faster to search) flat k-d tree is used. */
       if(p->kdtreemode==MATCH_KDTREE_INTERNAL)
         {
           if(!p->cp.quiet) gettimeofday(&t1, NULL);
-          p->kdtreedata = gal_kdtree_create(p->cols1, &p->kdtreeroot);
+          p->kdtreeroot=0;
+          p->kdtreedata = gal_kdtree_flat_create(p->cols1,
+                                                 p->cp.numthreads,
+                                                 p->cp.minmapsize,
+                                                 p->cp.quietmmap);
           if(!p->cp.quiet)
             gal_timing_report(&t1, "Internal k-d tree constructed.", 1);
         }
 
+      /* A k-d tree index is memory-mapped (it is only read from the disk
+         as the search needs it). */
+      else if(p->kdtreemode==MATCH_KDTREE_INDEX)
+        {
+          p->kdtreeroot=0;
+          ndim=gal_list_data_number(p->cols1);
+          datasum=match_kdtree_index_datasum(p);
+          p->kdtreedata=gal_kdtree_flat_index_read(p->kdtree, p->cols1,
+                                                   datasum);
+          if( p->kdtreedata
+              && ( p->kdtreedata->dsize[0]!=p->cols1->size
+                   || p->kdtreedata->dsize[1]!=ndim ) )
+            error(EXIT_FAILURE, 0, "%s: the k-d tree index has %zu "
+                  "points in %zu dimensions, but the first input has %zu "
+                  "rows and %zu coordinate columns", p->kdtree,
+                  p->kdtreedata->dsize[0], p->kdtreedata->dsize[1],
+                  p->cols1->size, ndim);
+        }
+
       /* Do k-d tree based match. */
       if(!p->cp.quiet)
         {
           gettimeofday(&t1, NULL);
           printf("  - Match using the k-d tree ...\n");
         }
-      out = gal_match_kdtree(p->cols1, p->cols2, p->kdtreedata,
-                             p->kdtreeroot, p->aperture->array,
-                             p->cp.numthreads, p->cp.minmapsize,
-                             p->cp.quietmmap, nummatched);
+      out = ( p->knn || p->range
+              ? match_catalog_kdtree_neighbours(p, nummatched)
+              : gal_match_kdtree(p->cols1, p->cols2, p->kdtreedata,
+                                 p->kdtreeroot, p->aperture->array,
+                                 p->cp.numthreads, p->cp.minmapsize,
+                                 p->cp.quietmmap, nummatched) );
+      if(!p->cp.quiet)
+        {
+          if( asprintf(&msg, "... %zu matches found, done!",
+                       *nummatched)<0 )
+            error(EXIT_FAILURE, errno, "asprintf allocation");
+          gal_timing_report(&t1, msg, 1);
+          free(msg);
+        }
+      if(p->kdtreemode==MATCH_KDTREE_INDEX)
+        gal_kdtree_flat_index_free(p->kdtreedata);
+      else
+        gal_list_data_free(p->kdtreedata);
+      break;
+
+    /* Match the two inputs in separate partitions of the space. */
+    case MATCH_KDTREE_PARTITION:
+      if(!p->cp.quiet)
+        {
+          gettimeofday(&t1, NULL);
+          printf("  - Match in partitions (with a k-d tree in each) ...\n");
+        }
+      out=gal_match_partitioned(p->cols1, p->cols2, p->aperture->array,
+                                p->cp.numthreads, p->cp.minmapsize,
+                                p->cp.quietmmap, nummatched);
       if(!p->cp.quiet)
         {
           if( asprintf(&msg, "... %zu matches found, done!",
@@ -655,7 +870,6 @@ match_catalog_kdtree(struct matchparams *p, size_t *nummatched)
           gal_timing_report(&t1, msg, 1);
           free(msg);
         }
-      gal_list_data_free(p->kdtreedata);
       break;
 
     /* Abort if the mode isn't recognized (its a bug!). */
@@ -689,8 +903,8 @@ match_catalog_sort_based(struct matchparams *p, size_t *nummatched)
 
   /* Do the matching. */
   mcols=gal_match_sort_based(p->cols1, p->cols2, p->aperture->array,
-                             0, 1, p->cp.minmapsize, p->cp.quietmmap,
-                             nummatched);
+                             0, 1, p->cp.numthreads, p->cp.minmapsize,
+                             p->cp.quietmmap, nummatched);
 
   /* Let the user know that it finished. */
   if(!p->cp.quiet)
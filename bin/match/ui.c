@@ -223,25 +223,44 @@ ui_check_only_options(struct matchparams *p)
   {
     /* Set the k-d tree mode. */
     if(      !strcmp(p->kdtree,"build")    ) p->kdtreemode=MATCH_KDTREE_BUILD;
+    else if( !strcmp(p->kdtree,"build-index") )
+      { p->kdtreemode=MATCH_KDTREE_BUILD; p->kdtreeindex=1; }
     else if( !strcmp(p->kdtree,"internal") ) p->kdtreemode=MATCH_KDTREE_INTERNAL;
     else if( !strcmp(p->kdtree,"disable")  ) p->kdtreemode=MATCH_KDTREE_DISABLE;
+    else if( !strcmp(p->kdtree,"partition") )
+      p->kdtreemode=MATCH_KDTREE_PARTITION;
     else if( gal_fits_name_is_fits(p->kdtree) ) p->kdtreemode=MATCH_KDTREE_FILE;
+    else if( gal_checkset_check_file_return(p->kdtree) )
+      p->kdtreemode=MATCH_KDTREE_INDEX;
     else
       error(EXIT_FAILURE, 0, "'%s' is not valid for '--kdtree'. The "
             "following values are accepted: 'build' (to build the k-d tree in "
-            "the file given to '--output'), 'internal' (to force internal "
+            "the FITS file given to '--output'), 'build-index' (to build a "
+            "memory-mappable k-d tree index in the file given to "
+            "'--output'), 'internal' (to force internal "
             "usage of a k-d tree for the matching), 'disable' (to not use a "
-            "k-d tree at all), a FITS file name (the file to read a created "
-            "k-d tree from)", p->kdtree);
+            "k-d tree at all), 'partition' (to match the inputs in "
+            "separate partitions of the space), a FITS file name (the file "
+            "to read a created k-d tree from), or an existing k-d tree "
+            "index file (that was built with '--kdtree=build-index')",
+            p->kdtree);
 
     /* Make sure that the k-d tree build mode is not called with
        '--outcols'. */
     if( p->kdtreemode==MATCH_KDTREE_BUILD && (p->outcols || p->coord) )
-      error(EXIT_FAILURE, 0, "the '--kdtree=build' option is incompatible "
+      error(EXIT_FAILURE, 0, "the '--kdtree=%s' option is incompatible "
             "with the '--outcols' or '--coord' options (because in the k-d "
             "tree building mode doesn't involve actual matching. It will "
             "only build k-d tree and write it to a file so it can be used "
-            "in future matches)");
+            "in future matches)", p->kdtree);
+
+    /* The k-d tree index is not a FITS file. */
+    if( p->kdtreeindex && p->cp.output
+        && gal_fits_name_is_fits(p->cp.output) )
+      error(EXIT_FAILURE, 0, "%s: the output of '--kdtree=build-index' "
+            "is not a FITS file, so it shouldn't have a FITS suffix. To "
+            "build a FITS k-d tree, please use '--kdtree=build'",
+            p->cp.output);
 
     /* Make sure that a HDU is also specified for the k-d tree when its an
        external file. */
@@ -254,6 +273,25 @@ ui_check_only_options(struct matchparams *p)
             "you can use the 'astfits %s' command to see the full list",
             p->kdtree);
   }
+
+  /* Neighbour searches ('--knn' and '--range') are only done with a k-d
+     tree and each second input row can have many neighbours. */
+  if(p->knn || p->range)
+    {
+      if(p->knn && p->range)
+        error(EXIT_FAILURE, 0, "'--knn' and '--range' cannot be called "
+              "together");
+      if( p->kdtreemode==MATCH_KDTREE_BUILD
+          || p->kdtreemode==MATCH_KDTREE_DISABLE
+          || p->kdtreemode==MATCH_KDTREE_PARTITION )
+        error(EXIT_FAILURE, 0, "'--%s' needs a k-d tree for the "
+              "search, so it cannot be used with '--kdtree=%s'",
+              p->knn ? "knn" : "range", p->kdtree);
+      if(p->notmatched)
+        error(EXIT_FAILURE, 0, "'--%s' cannot be used with "
+              "'--notmatched' (the same row can be a neighbour of many "
+              "rows)", p->knn ? "knn" : "range");
+    }
 }
 
 
@@ -273,7 +311,7 @@ ui_check_options_and_arguments(struct matchparams *p)
       /* Make sure no second argument is given. */
       if(p->input2name)
         error(EXIT_FAILURE, 0, "only one argument can be given with the "
-              "'--coord' or '--kdtree=build' options");
+              "'--coord' or '--kdtree=build' (or 'build-index') options");
 
       /* In case '--ccol2' is given. */
       if(p->ccol2 && p->cp.quiet==0)
@@ -622,6 +660,7 @@ ui_read_columns_aperture_3d(struct matchparams *p)
 static size_t
 ui_set_columns_sanity_check_read_aperture(struct matchparams *p)
 {
+  double *aper;
   size_t ccol1n=0, ccol2n=0;
 
   /* Make sure the columns to match are given. */
@@ -675,13 +714,24 @@ ui_set_columns_sanity_check_read_aperture(struct matchparams *p)
               "dimensions is deduced from the number of values given to "
               "'--ccol1' (or '--coord') and '--ccol2'", ccol1n);
       }
-  else if ( p->kdtreemode != MATCH_KDTREE_BUILD )
+  else if ( p->kdtreemode != MATCH_KDTREE_BUILD && p->knn==0 )
     error(EXIT_FAILURE, 0, "no matching aperture specified. Please use "
           "the '--aperture' option to define the acceptable aperture for "
           "matching the coordinates (in the same units as each "
           "dimension). Please run the following command for more "
           "information.\n\n    $ info %s\n", PROGRAM_EXEC);
 
+  /* With '--knn' or '--range', the aperture is only used as a radius, so
+     it must be circular (or spherical). */
+  if( (p->knn || p->range) && p->aperture )
+    {
+      aper=p->aperture->array;
+      if( (ccol1n>1 && aper[1]!=1.0) || (ccol1n==3 && aper[2]!=1.0) )
+        error(EXIT_FAILURE, 0, "with '--%s', the aperture should be "
+              "circular (or spherical in 3D): only its radius is used",
+              p->knn ? "knn" : "range");
+    }
+
   /* Return the number of dimensions. */
   return ccol1n;
 }
@@ -894,8 +944,10 @@ ui_read_columns(struct matchparams *p)
      than the first, print a warning to let the user know that the speed
      can be greatly improved if they swap the two. */
   if( !p->cp.quiet
+      && p->knn==0 && p->range==0
       && p->kdtreemode!=MATCH_KDTREE_BUILD
       && p->kdtreemode!=MATCH_KDTREE_DISABLE
+      && p->kdtreemode!=MATCH_KDTREE_PARTITION
       && p->cols1->size > (2*p->cols2->size) )
     error(EXIT_SUCCESS, 0, "TIP: the matching speed will GREATLY IMPROVE "
           "if you swap the two inputs. Currently the second input has "
@@ -1043,7 +1095,8 @@ ui_preparations_out_name(struct matchparams *p)
           else
             {
               suffix = ( p->kdtreemode==MATCH_KDTREE_BUILD
-                         ? "-kdtree.fits"
+                         ? ( p->kdtreeindex ? "-kdtree.kdidx"
+                                            : "-kdtree.fits" )
                          : ( p->cp.tableformat==GAL_TABLE_FORMAT_TXT
                              ? UI_OUT_SUFFNAME".txt"
                              : UI_OUT_SUFFNAME".fits") );
@@ -1229,19 +1282,30 @@ ui_read_check_inputs_setup(int argc, char *argv[], struct matchparams *p)
     {
       printf(PROGRAM_NAME" "PACKAGE_VERSION" started on %s",
              ctime(&p->rawtime));
-      nthreads=p->kdtreemode==MATCH_KDTREE_DISABLE ? 1 : p->cp.numthreads;
-      printf("  - Using %zu CPU thread%s%s\n", nthreads,
-             nthreads==1 ? "." : "s.",
-             ( p->kdtreemode==MATCH_KDTREE_DISABLE
-               ? " (sort-based match only uses a single thread)" : ""));
+      nthreads=p->cp.numthreads;
+      printf("  - Using %zu CPU thread%s\n", nthreads,
+             nthreads==1 ? "." : "s.");
       printf("  - Match algorithm: %s\n",
-             p->kdtree ? "k-d tree" : "sort-based");
+             ( p->kdtreemode==MATCH_KDTREE_PARTITION
+               ? "partitioned (k-d tree in each partition)"
+               : p->kdtree ? "k-d tree" : "sort-based" ));
+      if(p->kdtreemode==MATCH_KDTREE_BUILD)
+        printf("  - Output k-d tree format: %s\n",
+               ( p->kdtreeindex
+                 ? "memory-mappable index (--kdtree=build-index)"
+                 : "FITS table (--kdtree=build)" ));
+      if(p->knn)
+        printf("  - Neighbours: %zu nearest\n", p->knn);
+      if(p->range)
+        printf("  - Neighbours: all within aperture\n");
       printf("  - Input-1: %s; %zu rows\n",
              gal_fits_name_save_as_string(p->input1name, p->cp.hdu),
              p->cols1->size);
       if(p->kdtreemode==MATCH_KDTREE_FILE)
         printf("  - Input-1 k-d tree: %s\n",
                gal_fits_name_save_as_string(p->kdtree, p->kdtreehdu));
+      if(p->kdtreemode==MATCH_KDTREE_INDEX)
+        printf("  - Input-1 k-d tree index: %s\n", p->kdtree);
       if(p->kdtreemode!=MATCH_KDTREE_BUILD)
         printf("  - Input-2: %s; %zu rows\n",
                p->coord ? "from --coord"
@@ -198,22 +198,21 @@ mkcatalog_single_object(void *in_prm)
   struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
   struct mkcatalogparams *p=(struct mkcatalogparams *)(tprm->params);
 
-  size_t i;
+  size_t i, ind;
   struct mkcatalog_passparams pp;
 
   /* Initialize and allocate all the necessary values. */
   mkcatalog_single_object_init(p, &pp);
 
-  /* Fill the desired columns for all the objects given to this thread. */
-  for(i=0; tprm->indexs[i]!=GAL_BLANK_SIZE_T; ++i)
+  /* Fill the desired columns for all the objects given to this thread
+     (objects are taken dynamically, see 'mkcatalog'). */
+  for(i=0; (ind=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
     {
       /* For easy reading. Note that the object IDs start from one while
          the array positions start from 0. */
       pp.ci       = NULL;
-      pp.object   = ( p->outlabs
-                      ? p->outlabs[ tprm->indexs[i] ]
-                      : tprm->indexs[i] + 1 );
-      pp.tile     = &p->tiles[   tprm->indexs[i] ];
+      pp.object   = p->outlabs ? p->outlabs[ind] : ind + 1;
+      pp.tile     = &p->tiles[ind];
 
       /* Initialize the parameters for this object/tile. */
       parse_initialize(&pp);
@@ -796,10 +795,12 @@ mkcatalog(struct mkcatalogparams *p)
      it to assign a column to the clumps in the final catalog. */
   if( p->cp.numthreads > 1 ) pthread_mutex_init(&p->mutex, NULL);
 
-  /* Do the processing on each thread. */
-  gal_threads_spin_off(mkcatalog_single_object, p, p->numobjects,
-                       p->cp.numthreads, p->cp.minmapsize,
-                       p->cp.quietmmap);
+  /* Do the processing on each thread. The objects can have very
+     different sizes (and thus processing times), so each thread takes
+     the next object when it is done with the previous one (and one
+     thread doesn't end up with most of the large objects). */
+  gal_threads_spin_off_dynamic(mkcatalog_single_object, p,
+                               p->numobjects, p->cp.numthreads);
 
   /* Post-thread processing, for example to convert image coordinates to RA
      and Dec. */
@@ -1203,7 +1203,7 @@ parse_area_of_frac_sum(struct mkcatalog_passparams *pp, gal_data_t *values,
 
   /* Sort the desired labels and find the number of elements where we reach
      half the total sum. */
-  gal_statistics_sort_decreasing(sorted_d);
+  gal_statistics_sort_decreasing(sorted_d, 1);
 
   /* Set the required fractions. */
   if(flag[ o1c0 ? OCOL_HALFSUMNUM : CCOL_HALFSUMNUM ])
@@ -169,7 +169,8 @@ detection_initial(struct noisechiselparams *p)
 
   /* Label the connected components. */
   p->numinitialdets=gal_binary_connected_components(p->binary, &p->olabel,
-                                                    p->binary->ndim);
+                                                    p->binary->ndim,
+                                                    p->cp.numthreads);
   if(p->detectionname)
     {
       p->olabel->name="OPENED-AND-LABELED";
@@ -480,7 +481,8 @@ detection_pseudo_find(struct noisechiselparams *p, gal_data_t *workbin,
       do if(*b==GAL_BLANK_UINT8) *b = !s0d1; while(++b<bf);
     }
   */
-  return gal_binary_connected_components(workbin, &worklab, con);
+  return gal_binary_connected_components(workbin, &worklab, con,
+                                         p->cp.numthreads);
 }
 
 
@@ -1086,7 +1088,8 @@ detection_quantile_expand(struct noisechiselparams *p, gal_data_t *workbin)
 
       /* Get the labeled image. */
       numexpanded=gal_binary_connected_components(workbin, &p->olabel,
-                                                  workbin->ndim);
+                                                  workbin->ndim,
+                                                  p->cp.numthreads);
 
       /* Set all the input's blank pixels to blank in the labeled and
          binary arrays. */
@@ -279,10 +279,16 @@ threshold_interp_smooth(struct noisechiselparams *p, gal_data_t **first,
   /* Do the interpolation of both arrays. */
   (*first)->next = *second;
   if(third) (*second)->next = *third;
-  tmp=gal_interpolate_neighbors(*first, tl, cp->interpmetric,
-                                cp->interpnumngb, cp->numthreads,
-                                cp->interponlyblank, 1,
-                                GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN);
+  if(cp->interpkdtree)
+    tmp=gal_interpolate_neighbors_kdtree(*first, tl, cp->interpmetric,
+                                         cp->interpnumngb, cp->numthreads,
+                                         cp->interponlyblank, 1,
+                                      GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN);
+  else
+    tmp=gal_interpolate_neighbors(*first, tl, cp->interpmetric,
+                                  cp->interpnumngb, cp->numthreads,
+                                  cp->interponlyblank, 1,
+                                  GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN);
   gal_data_free(*first);
   gal_data_free(*second);
   if(third) gal_data_free(*third);
@@ -395,6 +401,7 @@ qthresh_on_tile(void *in_prm)
   struct qthreshparams *qprm=(struct qthreshparams *)tprm->params;
   struct noisechiselparams *p=qprm->p;
 
+  double quants[3];
   void *tarray=NULL;
   int type=qprm->erode_th->type;
   gal_data_t *meanconv = p->wconv ? p->wconv : p->conv;
@@ -467,28 +474,24 @@ qthresh_on_tile(void *in_prm)
               tile->array=tarray; tile->block=tblock;
             }
 
-          /* Get the erosion quantile for this tile and save it. Note that
-             the type of 'qvalue' is the same as the input dataset. */
-          qvalue=gal_statistics_quantile(usage, p->qthresh, 1);
+          /* Get the erosion, no-erode and expansion quantiles for this
+             tile (they are all found together, without sorting the tile)
+             and save them. Note that the type of 'qvalue' is the same as
+             the input dataset. */
+          quants[0]=p->qthresh;
+          quants[1]=p->noerodequant;
+          quants[2]=p->detgrowquant;
+          qvalue=gal_statistics_quantiles(usage, quants,
+                                          qprm->expand_th ? 3 : 2, 1);
           memcpy(gal_pointer_increment(qprm->erode_th->array, tind, type),
                  qvalue->array, twidth);
-          gal_data_free(qvalue);
-
-          /* Same for the no-erode quantile. */
-          qvalue=gal_statistics_quantile(usage, p->noerodequant, 1);
           memcpy(gal_pointer_increment(qprm->noerode_th->array, tind, type),
-                 qvalue->array, twidth);
-          gal_data_free(qvalue);
-
-          /* Same for the expansion quantile. */
+                 gal_pointer_increment(qvalue->array, 1, type), twidth);
           if(qprm->expand_th)
-            {
-              qvalue=gal_statistics_quantile(usage, p->detgrowquant, 1);
-              memcpy(gal_pointer_increment(qprm->expand_th->array, tind,
-                                            type),
-                     qvalue->array, twidth);
-              gal_data_free(qvalue);
-            }
+            memcpy(gal_pointer_increment(qprm->expand_th->array, tind,
+                                          type),
+                   gal_pointer_increment(qvalue->array, 2, type), twidth);
+          gal_data_free(qvalue);
         }
       else
         {
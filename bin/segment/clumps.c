@@ -319,11 +319,12 @@ clumps_find_make_sn_table(void *in_prm)
   cltprm.topinds = NULL;
 
 
-  /* Go over all the tiles/detections given to this thread. */
-  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+  /* Go over all the tiles/detections given to this thread (they are taken
+     dynamically, see 'clumps_true_find_sn_thresh'). */
+  for(i=0; (tind=gal_threads_next_action(tprm, i)) != GAL_BLANK_SIZE_T; ++i)
     {
       /* IDs. */
-      cltprm.id = tind  = tprm->indexs[i];
+      cltprm.id = tind;
       tile = &p->ltl.tiles[tind];
 
 
@@ -641,9 +642,8 @@ clumps_true_find_sn_thresh(struct segmentparams *p)
                    claborig->size*gal_type_sizeof(claborig->type));
 
           /* Do this step. */
-          gal_threads_spin_off(clumps_find_make_sn_table, &clprm,
-                               p->ltl.tottiles, p->cp.numthreads,
-                               p->cp.minmapsize, p->cp.quietmmap);
+          gal_threads_spin_off_dynamic(clumps_find_make_sn_table, &clprm,
+                                       p->ltl.tottiles, p->cp.numthreads);
 
           /* Set the extension name. */
           switch(clprm.step)
@@ -674,9 +674,8 @@ clumps_true_find_sn_thresh(struct segmentparams *p)
   else
     {
       clprm.step=0;
-      gal_threads_spin_off(clumps_find_make_sn_table, &clprm,
-                           p->ltl.tottiles, p->cp.numthreads,
-                           p->cp.minmapsize, p->cp.quietmmap);
+      gal_threads_spin_off_dynamic(clumps_find_make_sn_table, &clprm,
+                                   p->ltl.tottiles, p->cp.numthreads);
     }
 
 
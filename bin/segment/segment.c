@@ -793,7 +793,7 @@ segment_on_threads(void *in_prm)
   struct clumps_params *clprm=(struct clumps_params *)(tprm->params);
   struct segmentparams *p=clprm->p;
 
-  size_t i, *s, *sf;
+  size_t i, ind, *s, *sf;
   gal_data_t *topinds;
   struct clumps_thread_params cltprm;
   int32_t *clabel=p->clabel->array, *olabel=p->olabel->array;
@@ -801,13 +801,14 @@ segment_on_threads(void *in_prm)
   /* Initialize the general parameters for this thread. */
   cltprm.clprm = clprm;
 
-  /* Go over all the detections given to this thread (counting from zero.) */
-  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+  /* Go over all the detections given to this thread (counting from zero;
+     the detections are taken dynamically, see 'segment_detections'). */
+  for(i=0; (ind=gal_threads_next_action(tprm, i)) != GAL_BLANK_SIZE_T; ++i)
     {
       /* Set the ID of this detection, note that for the threads, we
          counted from zero, but the IDs start from 1, so we'll add a 1 to
          the ID given to this thread. */
-      cltprm.id     = tprm->indexs[i]+1;
+      cltprm.id     = ind+1;
       cltprm.indexs = &clprm->labindexs[ cltprm.id ];
       cltprm.numinitclumps = cltprm.numtrueclumps = cltprm.numobjects = 0;
 
@@ -1197,9 +1198,9 @@ segment_detections(struct segmentparams *p)
                    claborig->size*gal_type_sizeof(claborig->type));
 
           /* (Re-)do everything until this step. */
-          gal_threads_spin_off(segment_on_threads, &clprm,
-                               p->numdetections, p->cp.numthreads,
-                               p->cp.minmapsize, p->cp.quietmmap);
+          gal_threads_spin_off_dynamic(segment_on_threads, &clprm,
+                                       p->numdetections,
+                                       p->cp.numthreads);
 
           /* Set the extension name. */
           switch(clprm.step)
@@ -1325,9 +1326,8 @@ segment_detections(struct segmentparams *p)
   else
     {
       clprm.step=0;
-      gal_threads_spin_off(segment_on_threads, &clprm, p->numdetections,
-                           p->cp.numthreads, p->cp.minmapsize,
-                           p->cp.quietmmap);
+      gal_threads_spin_off_dynamic(segment_on_threads, &clprm,
+                                   p->numdetections, p->cp.numthreads);
     }
 
 
@@ -137,6 +137,7 @@ ui_initialize_options(struct segmentparams *p,
         case GAL_OPTIONS_KEY_SEARCHIN:
         case GAL_OPTIONS_KEY_IGNORECASE:
         case GAL_OPTIONS_KEY_STDINTIMEOUT:
+        case GAL_OPTIONS_KEY_INTERPKDTREE:
           cp->coptions[i].flags=OPTION_HIDDEN;
           break;
 
@@ -514,7 +515,8 @@ ui_prepare_inputs(struct segmentparams *p)
         {
           ccin=gal_data_copy_to_new_type_free(p->olabel, GAL_TYPE_UINT8);
           p->numdetections=gal_binary_connected_components(ccin, &ccout,
-                                                           ccin->ndim);
+                                                           ccin->ndim,
+                                                        p->cp.numthreads);
           gal_data_free(ccin);
           p->olabel=ccout;
         }
@@ -577,6 +577,19 @@ struct argp_option program_options[] =
       GAL_OPTIONS_NOT_MANDATORY,
       GAL_OPTIONS_NOT_SET
     },
+    {
+      "stream",
+      UI_KEY_STREAM,
+      "INT",
+      0,
+      "Read input in blocks of INT elements (one pass).",
+      UI_GROUP_PARTICULAR_STAT,
+      &p->stream,
+      GAL_TYPE_SIZE_T,
+      GAL_OPTIONS_RANGE_GT_0,
+      GAL_OPTIONS_NOT_MANDATORY,
+      GAL_OPTIONS_NOT_SET
+    },
     {
       "sky",
       UI_KEY_SKY,
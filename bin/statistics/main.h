@@ -75,6 +75,7 @@ struct statisticsparams
   float           quantmin;  /* Quantile min or range: from Q to 1-Q.    */
   float           quantmax;  /* Quantile maximum.                        */
   uint8_t           ontile;  /* Do single value calculations on tiles.   */
+  size_t            stream;  /* Elements to read in each streaming block.*/
   uint8_t      interpolate;  /* Use interpolation to fill blank tiles.   */
   char            *fitname;  /* Name of fitting function to use.         */
   char          *fitweight;  /* Input weight is 'std' or 'invvar'.       */
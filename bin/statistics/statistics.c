@@ -50,6 +50,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 
 #include "ui.h"
 #include "sky.h"
+#include "stream.h"
 #include "contour.h"
 #include "statistics.h"
 
@@ -128,7 +129,7 @@ statistics_print_one_row(struct statisticsparams *p)
   gal_list_i32_t *tmp, *ttmp;
   gal_data_t *sclip=NULL, *mclip=NULL;
   gal_data_t *sum=NULL, *meanstd=NULL, *modearr=NULL;
-  gal_data_t *tmpv, *out=NULL, *num=NULL, *min=NULL, *max=NULL;
+  gal_data_t *tmpv, *out=NULL, *num=NULL, *minmax=NULL;
 
   /* The user can ask for any of the operators more than once, also some
      operators might return more than one usable value (like mode). So we
@@ -143,15 +144,19 @@ statistics_print_one_row(struct statisticsparams *p)
       case UI_KEY_NUMBER:
         num = num ? num : gal_statistics_number(p->input);           break;
       case UI_KEY_MINIMUM:
-        min = min ? min : gal_statistics_minimum(p->input);          break;
       case UI_KEY_MAXIMUM:
-        max = max ? max : gal_statistics_maximum(p->input);          break;
+        minmax = ( minmax
+                   ? minmax
+                   : gal_statistics_minmax(p->input, p->cp.numthreads) );
+        break;
       case UI_KEY_SUM:
         sum = sum ? sum : gal_statistics_sum(p->input);              break;
       case UI_KEY_STD:
       case UI_KEY_MEAN:
       case UI_KEY_QUANTOFMEAN:
-        meanstd = meanstd ? meanstd : gal_statistics_mean_std(p->input);
+        meanstd = ( meanstd
+                    ? meanstd
+                    : gal_statistics_mean_std(p->input, p->cp.numthreads) );
         break;
       case UI_KEY_MAD:
       case UI_KEY_MEDIAN:
@@ -235,8 +240,10 @@ statistics_print_one_row(struct statisticsparams *p)
         {
         /* Previously calculated values. */
         case UI_KEY_NUMBER:     out=num;                  break;
-        case UI_KEY_MINIMUM:    out=min;                  break;
-        case UI_KEY_MAXIMUM:    out=max;                  break;
+        case UI_KEY_MINIMUM:
+          out=statistics_pull_out_element(minmax, 0);  mustfree=1; break;
+        case UI_KEY_MAXIMUM:
+          out=statistics_pull_out_element(minmax, 1);  mustfree=1; break;
         case UI_KEY_SUM:        out=sum;                  break;
         case UI_KEY_MEDIAN:
           out=statistics_pull_out_element(medmad, 0);  mustfree=1; break;
@@ -353,8 +360,7 @@ statistics_print_one_row(struct statisticsparams *p)
 
   /* Clean any of the allocated arrays. */
   if(num)     gal_data_free(num);
-  if(min)     gal_data_free(min);
-  if(max)     gal_data_free(max);
+  if(minmax)  gal_data_free(minmax);
   if(sum)     gal_data_free(sum);
   if(sclip)   gal_data_free(sclip);
   if(medmad)  gal_data_free(medmad);
@@ -395,12 +401,19 @@ statistics_interpolate_and_write(struct statisticsparams *p,
   if( p->interpolate
       && !(p->cp.interponlyblank && gal_blank_present(values, 1)==0) )
     {
-      interpd=gal_interpolate_neighbors(values, &cp->tl,
+      interpd=( cp->interpkdtree
+                ? gal_interpolate_neighbors_kdtree(values, &cp->tl,
+                              cp->interpmetric,
+                              cp->interpnumngb,
+                              cp->numthreads,
+                              cp->interponlyblank, 0,
+                              GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN)
+                : gal_interpolate_neighbors(values, &cp->tl,
                               cp->interpmetric,
                               cp->interpnumngb,
                               cp->numthreads,
                               cp->interponlyblank, 0,
-                              GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN);
+                              GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN) );
       gal_data_free(values);
       values=interpd;
     }
@@ -633,28 +646,37 @@ static gal_data_t *
 set_bin_range_params(struct statisticsparams *p, size_t dim)
 {
   size_t rsize=2;
-  gal_data_t *range=NULL;
+  double *r, *mm;
+  gal_data_t *range, *minmax;
 
+  /* Allocate the range data structure. */
+  range=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &rsize, NULL,
+                       0, -1, 1, NULL, NULL, NULL);
+  r=range->array;
   if(p->manualbinrange)
+    switch(dim)
+      {
+      case 1: r[0]=p->greaterequal;  r[1]=p->lessthan;  break;
+      case 2: r[0]=p->greaterequal2; r[1]=p->lessthan2; break;
+      default:
+        error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to "
+              "address the problem. The value %zu for 'dim' isn't "
+              "recogized", __func__, PACKAGE_BUGREPORT, dim);
+      }
+  else r[0]=r[1]=NAN;
+
+  /* The range limits that aren't given are the minimum and maximum of
+     the respective column. We'll find them here (on all the threads), so
+     'gal_statistics_regular_bins' doesn't have to. */
+  if( isnan(r[0]) || isnan(r[1]) )
     {
-      /* Allocate the range data structure. */
-      range=gal_data_alloc(NULL, GAL_TYPE_FLOAT32, 1, &rsize, NULL,
-                           0, -1, 1, NULL, NULL, NULL);
-      switch(dim)
-        {
-        case 1:
-          ((float *)(range->array))[0]=p->greaterequal;
-          ((float *)(range->array))[1]=p->lessthan;
-          break;
-        case 2:
-          ((float *)(range->array))[0]=p->greaterequal2;
-          ((float *)(range->array))[1]=p->lessthan2;
-          break;
-        default:
-          error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to "
-                "address the problem. The value %zu for 'dim' isn't "
-                "recogized", __func__, PACKAGE_BUGREPORT, dim);
-        }
+      minmax=gal_statistics_minmax(dim==1 ? p->input : p->input->next,
+                                   p->cp.numthreads);
+      minmax=gal_data_copy_to_new_type_free(minmax, GAL_TYPE_FLOAT64);
+      mm=minmax->array;
+      if( isnan(r[0]) ) r[0]=mm[0];
+      if( isnan(r[1]) ) r[1]=mm[1];
+      gal_data_free(minmax);
     }
   return range;
 }
@@ -671,7 +693,7 @@ ascii_plots(struct statisticsparams *p)
   /* Make the bins and the respective plot. */
   range=set_bin_range_params(p, 1);
   bins=gal_statistics_regular_bins(p->input, range, p->numasciibins, NAN);
-  hist=gal_statistics_histogram(p->input, bins, 0, 0);
+  hist=gal_statistics_histogram(p->input, bins, 0, 0, p->cp.numthreads);
   if(p->asciicfp)
     {
       bins->next=hist;
@@ -819,7 +841,8 @@ save_hist_and_or_cfp(struct statisticsparams *p)
   range=set_bin_range_params(p, 1);
   bins=gal_statistics_regular_bins(p->input, range, p->numbins,
                                    p->onebinstart);
-  hist=gal_statistics_histogram(p->input, bins, p->normalize, p->maxbinone);
+  hist=gal_statistics_histogram(p->input, bins, p->normalize, p->maxbinone,
+                                p->cp.numthreads);
 
 
   /* Set the histogram as the next pointer of bins. This is again necessary
@@ -923,7 +946,7 @@ histogram_2d(struct statisticsparams *p)
                                          nb2, p->onebinstart2);
 
   /* Build the 2D histogram. */
-  hist2d=gal_statistics_histogram2d(p->input, bins);
+  hist2d=gal_statistics_histogram2d(p->input, bins, p->cp.numthreads);
 
   /* Write the histogram into a 2D FITS image. Note that in the FITS image
      standard, the first axis is the fastest array (unlike the default
@@ -1118,23 +1141,20 @@ print_basics(struct statisticsparams *p)
   /* Print the number: */
   printf("  %-*s %zu\n", namewidth, "Number of elements:", p->input->size);
 
-  /* Minimum: */
-  tmp=gal_statistics_minimum(p->input);
+  /* Minimum and maximum: */
+  tmp=gal_statistics_minmax(p->input, p->cp.numthreads);
   str=gal_type_to_string(tmp->array, tmp->type, 0);
   printf("  %-*s %s\n", namewidth, "Minimum:", str);
-  gal_data_free(tmp);
   free(str);
-
-  /* Maximum: */
-  tmp=gal_statistics_maximum(p->input);
-  str=gal_type_to_string(tmp->array, tmp->type, 0);
+  str=gal_type_to_string(gal_pointer_increment(tmp->array, 1, tmp->type),
+                         tmp->type, 0);
   printf("  %-*s %s\n", namewidth, "Maximum:", str);
   gal_data_free(tmp);
   free(str);
 
   /* Find the mean and standard deviation, but don't print them, see
      explanations under median. */
-  tmp=gal_statistics_mean_std(p->input);
+  tmp=gal_statistics_mean_std(p->input, p->cp.numthreads);
   mean = ((double *)(tmp->array))[0];
   std  = ((double *)(tmp->array))[1];
   gal_data_free(tmp);
@@ -1177,7 +1197,8 @@ print_basics(struct statisticsparams *p)
       p->numasciibins = p->numasciibins ? p->numasciibins : 70;
       bins=gal_statistics_regular_bins(p->input, range, p->numasciibins,
                                        NAN);
-      hist=gal_statistics_histogram(p->input, bins, 0, 0);
+      hist=gal_statistics_histogram(p->input, bins, 0, 0,
+                                    p->cp.numthreads);
       print_ascii_plot(p, hist, bins, 1, 0);
       gal_data_free(bins);
       gal_data_free(hist);
@@ -1916,6 +1937,9 @@ statistics(struct statisticsparams *p)
 {
   int print_basic_info=1;
 
+  /* In the streaming mode, everything is done there. */
+  if(p->stream) { statistics_stream(p); return; }
+
   /* Print the one-row numbers if the user asked for them. */
   if(p->singlevalue)
     {
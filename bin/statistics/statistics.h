@@ -23,6 +23,10 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 #ifndef STATISTICS_H
 #define STATISTICS_H
 
+void
+write_output_table(struct statisticsparams *p, gal_data_t *table,
+                   char *suf, char *contents);
+
 void
 statistics(struct statisticsparams *p);
 
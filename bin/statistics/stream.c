@@ -0,0 +1,512 @@
+/*********************************************************************
+Statistics - Statistical analysis on input dataset.
+Statistics is part of GNU Astronomy Utilities (Gnuastro) package.
+
+Original author:
+     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+Contributing author(s):
+Copyright (C) 2024 Free Software Foundation, Inc.
+
+Gnuastro is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Gnuastro is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <gnuastro/fits.h>
+#include <gnuastro/blank.h>
+#include <gnuastro/threads.h>
+#include <gnuastro/pointer.h>
+#include <gnuastro/dimension.h>
+#include <gnuastro/statistics.h>
+
+#include "main.h"
+
+#include "ui.h"
+#include "stream.h"
+#include "statistics.h"
+
+
+
+
+/* Parameters of the streaming mode. */
+struct streamparams
+{
+  struct statisticsparams *p;   /* Main program parameters.           */
+  gal_data_t          *block;   /* Block of the input (float64).      */
+  size_t           numpieces;   /* Number of pieces in each block.    */
+  struct gal_statistics_sketch **sketch; /* Sketch of each piece.     */
+  gal_data_t           *bins;   /* Bins of the histogram.             */
+  gal_data_t          **hist;   /* Histogram of each piece.           */
+};
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*******************************************************************/
+/**************           Reading the blocks         ***************/
+/*******************************************************************/
+/* Each block is divided into 'numpieces' pieces and each piece is always
+   added to the same sketch and histogram. Therefore the outputs don't
+   depend on the thread that processes each piece. */
+static void *
+stream_on_thread(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct streamparams *sp=(struct streamparams *)tprm->params;
+  struct statisticsparams *p=sp->p;
+
+  gal_data_t *piece;
+  double *d, *df, ge=p->greaterequal, lt=p->lessthan;
+  size_t i, r, start, size, n=sp->block->size;
+
+  /* Go over all the pieces that are assigned to this thread. */
+  for(i=0; (r=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Set the range of this piece. */
+      start=n*r/sp->numpieces;
+      size=n*(r+1)/sp->numpieces-start;
+      if(size==0) continue;
+      d=(double *)(sp->block->array)+start;
+
+      /* Set the out-of-range values to blank (similar to
+         'ui_out_of_range_to_blank'). */
+      if( !isnan(ge) || !isnan(lt) )
+        for(df=d+size; d<df; ++d)
+          if( *d<ge || *d>=lt ) *d=NAN;
+
+      /* Add this piece into its sketch and histogram. Note that the
+         dataset is only a wrapper over the block's array. */
+      piece=gal_data_alloc((double *)(sp->block->array)+start,
+                           GAL_TYPE_FLOAT64, 1, &size, NULL, 0, -1, 1,
+                           NULL, NULL, NULL);
+      if(sp->sketch) gal_statistics_sketch_add(sp->sketch[r], piece);
+      if(sp->hist)
+        gal_statistics_histogram_add(piece, sp->bins, sp->hist[r]);
+      piece->array=NULL;
+      gal_data_free(piece);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Read the input in blocks of (at most) '--stream' elements, and pass
+   each block to the threads. The elements are read in double precision
+   (with blank values set to NaN) by CFITSIO, independent of the type of
+   the image. */
+static void
+stream_pass(struct streamparams *sp, fitsfile *fptr, size_t total)
+{
+  struct statisticsparams *p=sp->p;
+
+  double nulval=NAN;
+  int anynul, status=0;
+  size_t first, num=p->stream;
+
+  for(first=0; first<total; first+=num)
+    {
+      /* The last block may be smaller. */
+      if(first+num>total) num=total-first;
+      sp->block->size=sp->block->dsize[0]=num;
+
+      /* Read the block and process it. */
+      if( fits_read_img(fptr, TDOUBLE, first+1, num, &nulval,
+                        sp->block->array, &anynul, &status) )
+        gal_fits_io_error(status, NULL);
+      gal_threads_spin_off(stream_on_thread, sp, sp->numpieces,
+                           p->cp.numthreads, p->cp.minmapsize,
+                           p->cp.quietmmap);
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/* Allocate the histogram of each piece (once the bins are known). */
+static void
+stream_hist_alloc(struct streamparams *sp)
+{
+  size_t i;
+  struct statisticsparams *p=sp->p;
+
+  errno=0;
+  sp->hist=malloc(sp->numpieces*sizeof *sp->hist);
+  if(sp->hist==NULL)
+    error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for 'sp->hist'",
+          __func__, sp->numpieces*sizeof *sp->hist);
+  for(i=0;i<sp->numpieces;++i)
+    sp->hist[i]=gal_data_alloc(NULL, GAL_TYPE_SIZE_T, 1, sp->bins->dsize,
+                               NULL, 1, p->cp.minmapsize, p->cp.quietmmap,
+                               "hist_number", "counts", "Number of data "
+                               "points within each bin.");
+}
+
+
+
+
+
+/* Add the histograms of all the pieces into the first one, and return
+   it. */
+static gal_data_t *
+stream_hist_merge(struct streamparams *sp)
+{
+  size_t i, j, *h, *o;
+  gal_data_t *out=sp->hist[0];
+
+  o=out->array;
+  for(i=1;i<sp->numpieces;++i)
+    {
+      h=sp->hist[i]->array;
+      for(j=0;j<out->size;++j) o[j]+=h[j];
+      gal_data_free(sp->hist[i]);
+    }
+  free(sp->hist);
+  sp->hist=NULL;
+  return out;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*******************************************************************/
+/**************             Final outputs            ***************/
+/*******************************************************************/
+/* A single-element dataset with the given value and type. */
+static gal_data_t *
+stream_value(double value, uint8_t type)
+{
+  size_t one=1;
+  gal_data_t *out=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &one, NULL,
+                                 0, -1, 1, NULL, NULL, NULL);
+  *((double *)(out->array))=value;
+  return ( type==GAL_TYPE_FLOAT64
+           ? out
+           : gal_data_copy_to_new_type_free(out, type) );
+}
+
+
+
+
+
+/* Print the requested single-value measurements in one row (similar to
+   'statistics_print_one_row'). The minimum, maximum and quantiles are
+   elements of the input, so they are printed in the input's type. */
+static void
+stream_print_one_row(struct statisticsparams *p,
+                     struct gal_statistics_sketch *sk, uint8_t type)
+{
+  char *toprint;
+  double arg, mean;
+  size_t counter=0;
+  gal_list_i32_t *tmp;
+  gal_data_t *out=NULL;
+
+  mean = sk->number ? sk->mean : NAN;
+  for(tmp=p->singlevalue; tmp!=NULL; tmp=tmp->next)
+    {
+      switch(tmp->v)
+        {
+        case UI_KEY_NUMBER:
+          out=stream_value(sk->number, GAL_TYPE_SIZE_T);         break;
+        case UI_KEY_MINIMUM:
+          out=stream_value(sk->minimum, type);                   break;
+        case UI_KEY_MAXIMUM:
+          out=stream_value(sk->maximum, type);                   break;
+        case UI_KEY_SUM:
+          out=stream_value(sk->sum+sk->sumc, GAL_TYPE_FLOAT64);  break;
+        case UI_KEY_MEAN:
+          out=stream_value(mean, GAL_TYPE_FLOAT64);              break;
+        case UI_KEY_STD:
+          out=stream_value( sk->number ? sqrt(sk->m2/sk->number) : NAN,
+                            GAL_TYPE_FLOAT64 );
+          break;
+        case UI_KEY_MEDIAN:
+          arg=0.5f;
+          out=gal_data_copy_to_new_type_free(
+                gal_statistics_sketch_quantiles(sk, &arg, 1), type);
+          break;
+        case UI_KEY_QUANTILE:
+          arg=gal_list_f64_pop(&p->tp_args);
+          out=gal_data_copy_to_new_type_free(
+                gal_statistics_sketch_quantiles(sk, &arg, 1), type);
+          break;
+        case UI_KEY_QUANTFUNC:
+          arg=gal_list_f64_pop(&p->tp_args);
+          out=stream_value(gal_statistics_sketch_quantile_function(sk, arg),
+                           GAL_TYPE_FLOAT64);
+          break;
+        case UI_KEY_QUANTOFMEAN:
+          out=stream_value(gal_statistics_sketch_quantile_function(sk,
+                                                                   mean),
+                           GAL_TYPE_FLOAT64);
+          break;
+        default:
+          error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s so "
+                "we can address the problem. Operation code %d not "
+                "recognized", __func__, PACKAGE_BUGREPORT, tmp->v);
+        }
+
+      /* Print the value (see 'statistics_print_one_row'). */
+      toprint=gal_type_to_string(out->array, out->type, 0);
+      printf("%s%s", counter++ ? " " : "", toprint);
+      gal_data_free(out);
+      free(toprint);
+    }
+  printf("\n");
+}
+
+
+
+
+
+/* Write the histogram and/or cumulative frequency plot (similar to
+   'save_hist_and_or_cfp'). */
+static void
+stream_hist_and_or_cfp(struct statisticsparams *p, gal_data_t *bins,
+                       gal_data_t *hist)
+{
+  char *suf, *contents;
+  gal_data_t *cfp=NULL;
+
+  /* The CFP is built from the counts in the histogram, so it is made
+     before the histogram is normalized. */
+  bins->next=hist;
+  if(p->cumulative)
+    cfp=gal_statistics_cfp(NULL, bins, p->normalize || p->maxbinone);
+  hist=gal_statistics_histogram_normalize(hist, p->normalize,
+                                          p->maxbinone);
+
+  /* FITS tables don't accept 'uint64_t' (see 'save_hist_and_or_cfp'). */
+  if(hist->type==GAL_TYPE_UINT64)
+    hist=gal_data_copy_to_new_type_free(hist, GAL_TYPE_UINT32);
+  if(cfp && cfp->type==GAL_TYPE_UINT64)
+    cfp=gal_data_copy_to_new_type_free(cfp, GAL_TYPE_UINT32);
+
+  /* Only keep the requested columns. */
+  if(p->histogram) { bins->next=hist; hist->next=cfp; }
+  else             { bins->next=cfp;  gal_data_free(hist); }
+
+  /* Write the table. */
+  if(p->histogram && p->cumulative)
+    { suf="-hist-cfp"; contents="Histogram and cumulative frequency plot"; }
+  else if(p->histogram)
+    { suf="-hist";     contents="Histogram"; }
+  else
+    { suf="-cfp";      contents="Cumulative frequency plot"; }
+  write_output_table(p, bins, suf, contents);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*******************************************************************/
+/**************          Top-level function          ***************/
+/*******************************************************************/
+/* Measure the statistics by reading the input in blocks of '--stream'
+   elements, so the memory usage doesn't depend on the size of the
+   input. The number, minimum, maximum, sum, mean and standard deviation
+   are exact, and so are the histogram and CFP (but when the range of the
+   bins isn't fully given, a second pass over the input is necessary to
+   build them). The median and quantiles are taken from a sketch of the
+   distribution (see 'gal_statistics_sketch_alloc'), with the error that
+   is reported in the non-quiet mode. */
+void
+statistics_stream(struct statisticsparams *p)
+{
+  int type, status=0;
+  fitsfile *fptr;
+  char *name=NULL, *unit=NULL;
+  size_t i, ndim, total, *dsize, two=2;
+  struct streamparams sp={NULL, NULL, 0, NULL, NULL, NULL};
+  struct gal_statistics_sketch *sk;
+  gal_data_t *range=NULL, *minmax, *hist;
+
+  /* Open the image and find its size. */
+  fptr=gal_fits_hdu_open_format(p->inputname, p->cp.hdu, 0, "--hdu");
+  gal_fits_img_info(fptr, &type, &ndim, &dsize, &name, &unit);
+  total=gal_dimension_total_size(ndim, dsize);
+
+  /* Allocate the block and the sketches of each piece. */
+  sp.p=p;
+  sp.numpieces=p->cp.numthreads;
+  sp.block=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1,
+                          p->stream<total ? &p->stream : &total, NULL, 0,
+                          p->cp.minmapsize, p->cp.quietmmap, NULL, NULL,
+                          NULL);
+  errno=0;
+  sp.sketch=malloc(sp.numpieces*sizeof *sp.sketch);
+  if(sp.sketch==NULL)
+    error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for "
+          "'sp.sketch'", __func__, sp.numpieces*sizeof *sp.sketch);
+  for(i=0;i<sp.numpieces;++i)
+    sp.sketch[i]=gal_statistics_sketch_alloc(GAL_STATISTICS_SKETCH_K);
+
+  /* The range of the bins (similar to 'set_bin_range_params'). When both
+     ends of the range are known, the histogram can be built in the same
+     pass as the sketches. */
+  if( (p->histogram || p->cumulative) && p->manualbinrange )
+    {
+      range=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &two, NULL, 0, -1,
+                           1, NULL, unit, NULL);
+      ((double *)(range->array))[0]=p->greaterequal;
+      ((double *)(range->array))[1]=p->lessthan;
+      if( !isnan(p->greaterequal) && !isnan(p->lessthan) )
+        {
+          sp.bins=gal_statistics_regular_bins(range, range, p->numbins,
+                                              p->onebinstart);
+          stream_hist_alloc(&sp);
+        }
+    }
+
+  /* First pass over the input. */
+  stream_pass(&sp, fptr, total);
+
+  /* Merge the sketches (in order). */
+  sk=sp.sketch[0];
+  for(i=1;i<sp.numpieces;++i)
+    gal_statistics_sketch_merge(sk, sp.sketch[i]);
+  if(sk->number==0)
+    error(EXIT_FAILURE, 0, "%s: no usable (non-blank) data. If there is "
+          "data in the input, maybe the '--greaterequal' or '--lessthan' "
+          "options need to be adjusted",
+          gal_fits_name_save_as_string(p->inputname, p->cp.hdu));
+
+  /* Print the single-value measurements. */
+  if(p->singlevalue)
+    {
+      stream_print_one_row(p, sk, type);
+      if(!p->cp.quiet && sk->variance>0.0f)
+        error(EXIT_SUCCESS, 0, "the quantiles are from a sketch of the "
+              "%zu elements, with a maximum error of %g in the quantile "
+              "(with 99%% probability). Use '--quiet' to not print this "
+              "message", sk->number, gal_statistics_sketch_error(sk));
+    }
+
+  /* The histogram and CFP. If the bins weren't known in the first pass,
+     set them from the minimum and maximum and read the input again. */
+  if(p->histogram || p->cumulative)
+    {
+      if(sp.bins==NULL)
+        {
+          minmax=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &two, NULL, 0,
+                                -1, 1, NULL, unit, NULL);
+          ((double *)(minmax->array))[0]=sk->minimum;
+          ((double *)(minmax->array))[1]=sk->maximum;
+          sp.bins=gal_statistics_regular_bins(minmax, range, p->numbins,
+                                              p->onebinstart);
+          gal_data_free(minmax);
+
+          /* The sketches aren't necessary in the second pass. */
+          for(i=0;i<sp.numpieces;++i)
+            gal_statistics_sketch_free(sp.sketch[i]);
+          free(sp.sketch);
+          sp.sketch=NULL;
+          stream_hist_alloc(&sp);
+          stream_pass(&sp, fptr, total);
+        }
+      hist=stream_hist_merge(&sp);
+      stream_hist_and_or_cfp(p, sp.bins, hist);
+      gal_list_data_free(sp.bins);
+    }
+
+  /* Clean up. */
+  if(sp.sketch)
+    {
+      for(i=0;i<sp.numpieces;++i)
+        gal_statistics_sketch_free(sp.sketch[i]);
+      free(sp.sketch);
+    }
+  fits_close_file(fptr, &status);
+  gal_fits_io_error(status, NULL);
+  gal_data_free(sp.block);
+  gal_data_free(range);
+  free(dsize);
+  free(name);
+  free(unit);
+}
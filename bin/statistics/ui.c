@@ -441,6 +441,42 @@ ui_check_only_options(struct statisticsparams *p)
     }
 
 
+  /* The streaming mode only reads the input once (or twice for the
+     histogram), so it can't be used with the options that need the full
+     input in memory. */
+  if( p->stream )
+    {
+      if( p->ontile || p->sky || p->contour || p->asciihist
+          || p->asciicfp || p->histogram2d || p->sigmaclip || p->madclip
+          || p->fitname || !isnan(p->mirror) || !isnan(p->quantmin) )
+        error(EXIT_FAILURE, 0, "'--stream' can only be called with "
+              "'--histogram', '--cumulative' and some of the single-value "
+              "measurements (see below). The other operations (for "
+              "example '--sigmaclip' or '--qrange') need the full input "
+              "in memory");
+      for(tmp=p->singlevalue; tmp!=NULL; tmp=tmp->next)
+        switch(tmp->v)
+          {
+          case UI_KEY_NUMBER:    case UI_KEY_MINIMUM:
+          case UI_KEY_MAXIMUM:   case UI_KEY_SUM:
+          case UI_KEY_MEAN:      case UI_KEY_STD:
+          case UI_KEY_MEDIAN:    case UI_KEY_QUANTILE:
+          case UI_KEY_QUANTFUNC: case UI_KEY_QUANTOFMEAN:
+            break;
+          default:
+            error(EXIT_FAILURE, 0, "the only single-value measurements "
+                  "that can be called with '--stream' are: '--number', "
+                  "'--minimum', '--maximum', '--sum', '--mean', '--std', "
+                  "'--median', '--quantile', '--quantfunc' and "
+                  "'--quantofmean'");
+          }
+      if( p->singlevalue==NULL && p->histogram==0 && p->cumulative==0 )
+        error(EXIT_FAILURE, 0, "no output requested with '--stream'. "
+              "Please call '--histogram', '--cumulative' or a single-value "
+              "measurement (for example '--median')");
+    }
+
+
   /* In Sky mode, several options are mandatory. */
   if( p->sky )
     {
@@ -658,6 +694,11 @@ ui_check_options_and_arguments(struct statisticsparams *p)
                   "to tables.", p->inputname, p->cp.hdu);
         }
     }
+
+  /* The streaming mode is only implemented for FITS images. */
+  if( p->stream && (p->isfits==0 || p->hdu_type!=IMAGE_HDU) )
+    error(EXIT_FAILURE, 0, "'--stream' is currently only available for "
+          "FITS images");
 }
 
 
@@ -858,7 +899,7 @@ ui_make_sorted_if_necessary(struct statisticsparams *p)
       else
         {
           p->sorted=gal_data_copy(p->input);
-          gal_statistics_sort_increasing(p->sorted);
+          gal_statistics_sort_increasing(p->sorted, p->cp.numthreads);
         }
     }
 }
@@ -1163,6 +1204,16 @@ ui_preparations(struct statisticsparams *p)
   struct gal_tile_two_layer_params *tl=&cp->tl;
   char *checkbasename = p->cp.output ? p->cp.output : p->inputname;
 
+  /* In the streaming mode, the input is read in blocks later (see
+     'stream.c'), so only the output needs to be checked here. */
+  if(p->stream)
+    {
+      if( p->histogram || p->cumulative ) ++p->numoutfiles;
+      gal_checkset_writable_remove(p->cp.output, p->inputname, p->cp.keep,
+                                   p->cp.dontdelete);
+      return;
+    }
+
   /* Change 'keepinputdir' based on if an output name was given. */
   p->cp.keepinputdir = p->cp.output ? 1 : 0;
 
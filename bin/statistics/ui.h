@@ -129,6 +129,7 @@ enum option_keys_enum
   UI_KEY_FITESTIMATECOL,
   UI_KEY_FITROBUST,
   UI_KEY_CONCENTRATION,
+  UI_KEY_STREAM,
 };
 
 
@@ -117,7 +117,7 @@ table_bring_to_top(gal_data_t *table, gal_data_t *rowids)
   size_t i, n, *ids=rowids->array;
 
   /* Make sure the rowids are sorted by increasing index.
-  gal_statistics_sort_increasing(rowids);
+  gal_statistics_sort_increasing(rowids, 1);
   */
 
   /* Go over each column and move the desired rows to the top. */
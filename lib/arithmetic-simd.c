@@ -0,0 +1,365 @@
+/*********************************************************************
+Arithmetic operations on data structures.
+This is part of GNU Astronomy Utilities (Gnuastro) package.
+
+Original author:
+     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+Contributing author(s):
+Copyright (C) 2024 Free Software Foundation, Inc.
+
+Gnuastro is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Gnuastro is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+
+#include <gnuastro/type.h>
+#include <gnuastro/blank.h>
+#include <gnuastro/arithmetic.h>
+
+#include <gnuastro-internal/arithmetic-simd.h>
+#include <gnuastro-internal/arithmetic-internal.h>
+
+
+
+
+
+/* The generic binary operators (in the 'arithmetic-*.c' files) are built
+   from the deep macros of 'arithmetic-binary.h' to cover all the type
+   combinations. Their loops have a check for blank values on every
+   element (and increment the pointers based on the operand sizes), so
+   the compiler can't vectorize them.
+
+   But in practice, most of the time, the operands of the most common
+   operators have the same type, and that type is one of 'float32',
+   'float64' or 'int32'. The functions here are dedicated kernels for
+   these cases: each is a simple loop over indexs with the blank checks
+   converted to a mask (selecting the output blank value without any
+   branch). The compiler can therefore vectorize them. When the compiler
+   supports function multi-versioning (checked at configure time), each
+   kernel is also compiled for the AVX2 and AVX-512 instruction sets and
+   the best one for the running CPU is chosen at run-time (the default is
+   the architecture's baseline; for example SSE2 on x86_64). */
+#if GAL_CONFIG_HAVE_TARGET_CLONES == 1
+#define SIMD_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define SIMD_CLONES
+#endif
+
+/* Layout of the two operands. */
+enum arithmetic_simd_layouts
+{
+  SIMD_ARRAY_ARRAY,         /* Both operands are arrays.  */
+  SIMD_ARRAY_NUMBER,        /* Right operand is a number. */
+  SIMD_NUMBER_ARRAY,        /* Left operand is a number.  */
+};
+
+/* "Not-blank" conditions for the different types (the '&' in the loops
+   below is intentional: unlike '&&' it doesn't need a branch). */
+#define SIMD_NB_FLT(X) ( (X)==(X) )
+#define SIMD_NB_I32(X) ( (X)!=GAL_BLANK_INT32 )
+
+/* The loops for each layout. When 'mask' is zero, no blank checking is
+   done. */
+#define SIMD_LOOPS(T, OP, NB) {                                         \
+    size_t i;                                                           \
+    T lv=*l, rv=*r;                                                     \
+    switch(layout)                                                      \
+      {                                                                 \
+      case SIMD_ARRAY_ARRAY:                                            \
+        if(mask)                                                        \
+          for(i=0;i<n;++i)                                              \
+            o[i] = ( NB(l[i]) & NB(r[i]) ) ? l[i] OP r[i] : ob;         \
+        else                                                            \
+          for(i=0;i<n;++i) o[i] = l[i] OP r[i];                         \
+        break;                                                          \
+      case SIMD_ARRAY_NUMBER:                                           \
+        if(mask) for(i=0;i<n;++i) o[i] = NB(l[i]) ? l[i] OP rv : ob;    \
+        else     for(i=0;i<n;++i) o[i] = l[i] OP rv;                    \
+        break;                                                          \
+      case SIMD_NUMBER_ARRAY:                                           \
+        if(mask) for(i=0;i<n;++i) o[i] = NB(r[i]) ? lv OP r[i] : ob;    \
+        else     for(i=0;i<n;++i) o[i] = lv OP r[i];                    \
+        break;                                                          \
+      default:                                                          \
+        error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s "    \
+              "to fix the problem. The layout code %d isn't "           \
+              "recognized", "SIMD_LOOPS", PACKAGE_BUGREPORT, layout);   \
+      }                                                                 \
+  }
+
+/* Define a kernel function. */
+#define SIMD_KERNEL(NAME, T, OT, OP, NB)                                \
+  static void SIMD_CLONES                                               \
+  NAME(T *l, T *r, OT *o, size_t n, int layout, int mask, OT ob)        \
+  SIMD_LOOPS(T, OP, NB)
+
+SIMD_KERNEL(simd_plus_f32,     float,   float,   +,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_minus_f32,    float,   float,   -,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_multiply_f32, float,   float,   *,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_divide_f32,   float,   float,   /,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_lt_f32,       float,   uint8_t, <,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_le_f32,       float,   uint8_t, <=, SIMD_NB_FLT)
+SIMD_KERNEL(simd_gt_f32,       float,   uint8_t, >,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_ge_f32,       float,   uint8_t, >=, SIMD_NB_FLT)
+SIMD_KERNEL(simd_eq_f32,       float,   uint8_t, ==, SIMD_NB_FLT)
+SIMD_KERNEL(simd_ne_f32,       float,   uint8_t, !=, SIMD_NB_FLT)
+
+SIMD_KERNEL(simd_plus_f64,     double,  double,  +,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_minus_f64,    double,  double,  -,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_multiply_f64, double,  double,  *,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_divide_f64,   double,  double,  /,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_lt_f64,       double,  uint8_t, <,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_le_f64,       double,  uint8_t, <=, SIMD_NB_FLT)
+SIMD_KERNEL(simd_gt_f64,       double,  uint8_t, >,  SIMD_NB_FLT)
+SIMD_KERNEL(simd_ge_f64,       double,  uint8_t, >=, SIMD_NB_FLT)
+SIMD_KERNEL(simd_eq_f64,       double,  uint8_t, ==, SIMD_NB_FLT)
+SIMD_KERNEL(simd_ne_f64,       double,  uint8_t, !=, SIMD_NB_FLT)
+
+/* Integer division is not included: it can't be done speculatively on
+   masked elements (division by zero or overflow may trap). */
+SIMD_KERNEL(simd_plus_i32,     int32_t, int32_t, +,  SIMD_NB_I32)
+SIMD_KERNEL(simd_minus_i32,    int32_t, int32_t, -,  SIMD_NB_I32)
+SIMD_KERNEL(simd_multiply_i32, int32_t, int32_t, *,  SIMD_NB_I32)
+SIMD_KERNEL(simd_lt_i32,       int32_t, uint8_t, <,  SIMD_NB_I32)
+SIMD_KERNEL(simd_le_i32,       int32_t, uint8_t, <=, SIMD_NB_I32)
+SIMD_KERNEL(simd_gt_i32,       int32_t, uint8_t, >,  SIMD_NB_I32)
+SIMD_KERNEL(simd_ge_i32,       int32_t, uint8_t, >=, SIMD_NB_I32)
+SIMD_KERNEL(simd_eq_i32,       int32_t, uint8_t, ==, SIMD_NB_I32)
+SIMD_KERNEL(simd_ne_i32,       int32_t, uint8_t, !=, SIMD_NB_I32)
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/**********************************************************************/
+/****************         High-level function         *****************/
+/**********************************************************************/
+/* Read the single value of 'num' into 'value' (of C type 'T'). This is
+   exactly the conversion that C does internally when the two operands
+   have different types ("usual arithmetic conversions"), so the result
+   is identical to the generic operators. */
+#define SIMD_NUMBER_READ(T) {                                           \
+    T *v=value;                                                         \
+    switch(num->type)                                                   \
+      {                                                                 \
+      case GAL_TYPE_UINT8:   *v=*(uint8_t  *)(num->array); break;       \
+      case GAL_TYPE_INT8:    *v=*(int8_t   *)(num->array); break;       \
+      case GAL_TYPE_UINT16:  *v=*(uint16_t *)(num->array); break;       \
+      case GAL_TYPE_INT16:   *v=*(int16_t  *)(num->array); break;       \
+      case GAL_TYPE_UINT32:  *v=*(uint32_t *)(num->array); break;       \
+      case GAL_TYPE_INT32:   *v=*(int32_t  *)(num->array); break;       \
+      case GAL_TYPE_UINT64:  *v=*(uint64_t *)(num->array); break;       \
+      case GAL_TYPE_INT64:   *v=*(int64_t  *)(num->array); break;       \
+      case GAL_TYPE_FLOAT32: *v=*(float    *)(num->array); break;       \
+      case GAL_TYPE_FLOAT64: *v=*(double   *)(num->array); break;       \
+      default: return 0;                                                \
+      }                                                                 \
+  }
+
+/* Put the value of the single-element operand 'num' into 'value' (which
+   has type 'type'). If the conversion can't be done identically to the
+   generic operators, return 0. */
+static int
+arithmetic_simd_number(gal_data_t *num, uint8_t type, void *value)
+{
+  /* Only accept the conversion if C would also convert the number to
+     the array's type (not the other way around). For example
+     'int32' and 'uint32' would both be converted to 'uint32' by C. */
+  if( num->type!=type && gal_type_out(type, num->type)!=type )
+    return 0;
+
+  /* A blank number makes all outputs blank: leave it to the generic
+     operators. */
+  if( gal_blank_is(num->array, num->type) ) return 0;
+
+  /* Read the number into the desired type. */
+  switch(type)
+    {
+    case GAL_TYPE_INT32:   SIMD_NUMBER_READ(int32_t); break;
+    case GAL_TYPE_FLOAT32: SIMD_NUMBER_READ(float);   break;
+    case GAL_TYPE_FLOAT64: SIMD_NUMBER_READ(double);  break;
+    default: return 0;
+    }
+  return 1;
+}
+
+
+
+
+
+/* Call the kernel of the operator for a given type (except division,
+   which is only defined for the floating point types). */
+#define SIMD_CALL(SUFFIX, OB)                                           \
+  switch(operator)                                                      \
+    {                                                                   \
+    case GAL_ARITHMETIC_OP_PLUS:                                        \
+      simd_plus_##SUFFIX(la, ra, o->array, o->size, layout, mask, OB);  \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_MINUS:                                       \
+      simd_minus_##SUFFIX(la, ra, o->array, o->size, layout, mask, OB); \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_MULTIPLY:                                    \
+      simd_multiply_##SUFFIX(la, ra, o->array, o->size, layout, mask,   \
+                             OB);                                       \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_LT:                                          \
+      simd_lt_##SUFFIX(la, ra, o->array, o->size, layout, mask,         \
+                       GAL_BLANK_UINT8);                                \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_LE:                                          \
+      simd_le_##SUFFIX(la, ra, o->array, o->size, layout, mask,         \
+                       GAL_BLANK_UINT8);                                \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_GT:                                          \
+      simd_gt_##SUFFIX(la, ra, o->array, o->size, layout, mask,         \
+                       GAL_BLANK_UINT8);                                \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_GE:                                          \
+      simd_ge_##SUFFIX(la, ra, o->array, o->size, layout, mask,         \
+                       GAL_BLANK_UINT8);                                \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_EQ:                                          \
+      simd_eq_##SUFFIX(la, ra, o->array, o->size, layout, mask,         \
+                       GAL_BLANK_UINT8);                                \
+      break;                                                            \
+    case GAL_ARITHMETIC_OP_NE:                                          \
+      simd_ne_##SUFFIX(la, ra, o->array, o->size, layout, mask,         \
+                       GAL_BLANK_UINT8);                                \
+      break;                                                            \
+    default:                                                            \
+      error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to "   \
+            "fix the problem. Operator code %d isn't recognized",       \
+            "SIMD_CALL", PACKAGE_BUGREPORT, operator);                  \
+    }
+
+
+
+
+
+/* If the operator and operands can be processed by one of the dedicated
+   kernels above, do the operation and return 1. Otherwise, don't touch
+   anything and return 0 (so the generic operators are called). */
+int
+arithmetic_simd_binary(int operator, gal_data_t *l, gal_data_t *r,
+                       gal_data_t *o)
+{
+  void *la, *ra;
+  int layout, mask, iscomp;
+  uint8_t type=GAL_TYPE_INVALID;
+  union { int32_t i32; float f32; double f64; } lnum, rnum;
+
+  /* Set the layout and the type of the array operand(s). The number
+     operand (if any) is converted to the array's type. */
+  if(l->size>1 && r->size>1)
+    {
+      if(l->type!=r->type) return 0;
+      type=l->type; la=l->array; ra=r->array; layout=SIMD_ARRAY_ARRAY;
+    }
+  else if(l->size>1)
+    {
+      type=l->type; la=l->array; ra=&rnum; layout=SIMD_ARRAY_NUMBER;
+      if( arithmetic_simd_number(r, type, &rnum)==0 ) return 0;
+    }
+  else if(r->size>1)
+    {
+      type=r->type; la=&lnum; ra=r->array; layout=SIMD_NUMBER_ARRAY;
+      if( arithmetic_simd_number(l, type, &lnum)==0 ) return 0;
+    }
+  else return 0;
+
+  /* Only the types with dedicated kernels. */
+  if(    type!=GAL_TYPE_INT32
+      && type!=GAL_TYPE_FLOAT32
+      && type!=GAL_TYPE_FLOAT64 ) return 0;
+
+  /* Only the operators with dedicated kernels (and only when the output
+     has the expected type). */
+  switch(operator)
+    {
+    case GAL_ARITHMETIC_OP_DIVIDE:
+      if(type==GAL_TYPE_INT32) return 0;
+      /* Fall through */
+    case GAL_ARITHMETIC_OP_PLUS:
+    case GAL_ARITHMETIC_OP_MINUS:
+    case GAL_ARITHMETIC_OP_MULTIPLY:
+      if(o->type!=type) return 0;
+      iscomp=0;
+      break;
+
+    case GAL_ARITHMETIC_OP_LT:
+    case GAL_ARITHMETIC_OP_LE:
+    case GAL_ARITHMETIC_OP_GT:
+    case GAL_ARITHMETIC_OP_GE:
+    case GAL_ARITHMETIC_OP_EQ:
+    case GAL_ARITHMETIC_OP_NE:
+      if(o->type!=GAL_TYPE_UINT8) return 0;
+      iscomp=1;
+      break;
+
+    default: return 0;
+    }
+
+  /* Blank values should be checked in the same conditions as the generic
+     operators. But in floating point arithmetic, NaN is already
+     propagated by the hardware, so the mask is only necessary for the
+     comparison operators (where the output is an integer). */
+  mask = ( gal_arithmetic_binary_checkblank(l, r)
+           && (iscomp || type==GAL_TYPE_INT32) );
+
+  /* Call the kernel. */
+  switch(type)
+    {
+    case GAL_TYPE_FLOAT32:
+      if(operator==GAL_ARITHMETIC_OP_DIVIDE)
+        simd_divide_f32(la, ra, o->array, o->size, layout, mask, NAN);
+      else
+        SIMD_CALL(f32, NAN);
+      break;
+    case GAL_TYPE_FLOAT64:
+      if(operator==GAL_ARITHMETIC_OP_DIVIDE)
+        simd_divide_f64(la, ra, o->array, o->size, layout, mask, NAN);
+      else
+        SIMD_CALL(f64, NAN);
+      break;
+    case GAL_TYPE_INT32:
+      SIMD_CALL(i32, GAL_BLANK_INT32);
+      break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+            "the problem. Type code %d isn't recognized", __func__,
+            PACKAGE_BUGREPORT, type);
+    }
+
+  /* The operation was done. */
+  return 1;
+}
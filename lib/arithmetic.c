@@ -68,6 +68,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 #include <gnuastro-internal/arithmetic-or.h>
 #include <gnuastro-internal/arithmetic-and.h>
 #include <gnuastro-internal/arithmetic-plus.h>
+#include <gnuastro-internal/arithmetic-simd.h>
 #include <gnuastro-internal/arithmetic-minus.h>
 #include <gnuastro-internal/arithmetic-bitor.h>
 #include <gnuastro-internal/arithmetic-bitand.h>
@@ -135,6 +136,147 @@ arithmetic_check_float_input(gal_data_t *in, int operator, char *numstr)
 
 
 
+/***********************************************************************/
+/***************      Element-wise operators on threads    *************/
+/***********************************************************************/
+/* Element-wise operators (where each output element only depends on the
+   same element of the input(s)) are independent of each other. So when
+   the output is large, we can break the arrays into contiguous chunks and
+   process each chunk on a separate thread. For small arrays (for example
+   table columns or single numbers) the overhead of spinning-off the
+   threads is larger than the benefit, so below this size, the operator
+   is called directly on the calling thread. */
+#define ARITHMETIC_ELEMENTWISE_MIN_THREAD_SIZE 50000
+
+/* Parameters to pass to each thread. */
+struct arithmetic_elementwise_params
+{
+  int          operator;  /* Operator code.                             */
+  size_t      chunksize;  /* Number of elements to process in each job. */
+  gal_data_t         *l;  /* Left (or only) operand.                    */
+  gal_data_t         *r;  /* Right operand (NULL for unary operators).  */
+  gal_data_t         *o;  /* Output dataset (already allocated).        */
+  void (*run)(int, gal_data_t *, gal_data_t *, gal_data_t *);
+};
+
+
+
+
+
+/* Fill 'chunk' with the information of 'full', but pointing to 'size'
+   elements starting from 'start'. Single-valued operands (numbers) are
+   used as they are in all chunks. Note that the chunk is always a
+   separate structure (even for numbers): the operators may update the
+   flags (for example the blank check flags) of their inputs and each
+   thread should only write into its own structure. The chunk doesn't own
+   any allocated space, so it should not be freed. */
+static void
+arithmetic_elementwise_chunk(gal_data_t *full, gal_data_t *chunk,
+                             size_t start, size_t *size)
+{
+  *chunk=*full;
+  chunk->next=chunk->block=NULL;
+  if(full->size>1)
+    {
+      chunk->ndim=1;
+      chunk->size=*size;
+      chunk->dsize=size;
+      chunk->array=gal_pointer_increment(full->array, start, full->type);
+    }
+}
+
+
+
+
+
+static void *
+arithmetic_elementwise_on_thread(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct arithmetic_elementwise_params *p=
+    (struct arithmetic_elementwise_params *)tprm->params;
+
+  size_t i, start, size;
+  gal_data_t lchunk, rchunk, ochunk;
+
+  /* Go over all the chunks that were assigned to this thread. */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Set the starting element and size of this chunk (the last chunk
+         may be smaller). */
+      start=tprm->indexs[i]*p->chunksize;
+      size = ( start+p->chunksize > p->o->size
+               ? p->o->size-start
+               : p->chunksize );
+
+      /* Set the chunks and call the operator on them. */
+      arithmetic_elementwise_chunk(p->o, &ochunk, start, &size);
+      arithmetic_elementwise_chunk(p->l, &lchunk, start, &size);
+      if(p->r) arithmetic_elementwise_chunk(p->r, &rchunk, start, &size);
+      p->run(p->operator, &lchunk, p->r ? &rchunk : NULL, &ochunk);
+    }
+
+  /* Wait for all threads to finish and return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Run the element-wise operator function 'run' over the (already
+   allocated) output 'o'. If 'numthreads' is larger than one and the
+   output is large enough, the job will be distributed between the
+   threads. 'r' should be NULL for unary operators. */
+static void
+arithmetic_elementwise(void (*run)(int, gal_data_t *, gal_data_t *,
+                                   gal_data_t *),
+                       int operator, gal_data_t *l, gal_data_t *r,
+                       gal_data_t *o, size_t numthreads)
+{
+  size_t numchunks;
+  struct arithmetic_elementwise_params p;
+
+  /* If a single thread is enough, just call the function. */
+  if( numthreads<=1 || o->size<ARITHMETIC_ELEMENTWISE_MIN_THREAD_SIZE )
+    { run(operator, l, r, o); return; }
+
+  /* Each thread will work on one contiguous chunk of the output. The
+     number of chunks is recalculated in case the division makes the last
+     chunks empty. */
+  p.l=l;
+  p.r=r;
+  p.o=o;
+  p.run=run;
+  p.operator=operator;
+  p.chunksize = o->size/numthreads + (o->size%numthreads ? 1 : 0);
+  numchunks   = o->size/p.chunksize + (o->size%p.chunksize ? 1 : 0);
+
+  /* Spin-off the threads. */
+  gal_threads_spin_off(arithmetic_elementwise_on_thread, &p, numchunks,
+                       numthreads, o->minmapsize, o->quietmmap);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 /***********************************************************************/
 /***************        Unary functions/operators         **************/
 /***********************************************************************/
@@ -544,55 +686,14 @@ arithmetic_units_degree_to_dec(double decimal)
     do *oa++ = OP(*ia++); while(ia<iaf);                                \
 }
 
-static gal_data_t *
-arithmetic_function_unary(int operator, int flags, gal_data_t *in)
+/* Run the unary function operator over all the elements of 'in' and
+   write the results in 'o'. The third argument is only present to have
+   the same signature as the binary operators (for
+   'arithmetic_elementwise'). */
+static void
+arithmetic_function_unary_run(int operator, gal_data_t *in,
+                              gal_data_t *notused, gal_data_t *o)
 {
-  uint8_t otype;
-  int inplace=0;
-  gal_data_t *o;
-
-  /* The dataset may be empty. In this case, the output should also be
-     empty (we can have tables and images with 0 rows or pixels!). */
-  if(in->size==0 || in->array==NULL) return in;
-
-  /* See if the operation should be done in place. The output of these
-     operators is defined in the floating point space. So even if the input
-     is an integer type and user requested in place operation, if it's not
-     a floating point type, it will not be in place. */
-  if( (flags & GAL_ARITHMETIC_FLAG_INPLACE)
-      && ( in->type==GAL_TYPE_FLOAT32 || in->type==GAL_TYPE_FLOAT64 )
-      && ( operator != GAL_ARITHMETIC_OP_RA_TO_DEGREE
-      &&   operator != GAL_ARITHMETIC_OP_DEC_TO_DEGREE
-      &&   operator != GAL_ARITHMETIC_OP_DEGREE_TO_RA
-      &&   operator != GAL_ARITHMETIC_OP_DEGREE_TO_DEC ) )
-    inplace=1;
-
-  /* Set the output pointer. */
-  if(inplace)
-    {
-      o = in;
-      otype=in->type;
-    }
-  else
-    {
-      /* Check for operators which have fixed output types. */
-      if(         operator == GAL_ARITHMETIC_OP_RA_TO_DEGREE
-               || operator == GAL_ARITHMETIC_OP_DEC_TO_DEGREE )
-        otype = GAL_TYPE_FLOAT64;
-      else if(    operator == GAL_ARITHMETIC_OP_DEGREE_TO_RA
-               || operator == GAL_ARITHMETIC_OP_DEGREE_TO_DEC )
-        otype = GAL_TYPE_STRING;
-      else
-        otype = ( in->type==GAL_TYPE_FLOAT64
-                  ? GAL_TYPE_FLOAT64
-                  : GAL_TYPE_FLOAT32 );
-
-      /* Set the final output type. */
-      o = gal_data_alloc(NULL, otype, in->ndim, in->dsize, in->wcs,
-                         0, in->minmapsize, in->quietmmap,
-                         NULL, NULL, NULL);
-    }
-
   /* Start setting the operator and operands. The mathematical constant
      'PI' is imported from the GSL as M_PI. */
   switch(operator)
@@ -659,6 +760,70 @@ arithmetic_function_unary(int operator, int flags, gal_data_t *in)
       error(EXIT_FAILURE, 0, "%s: operator code %d not recognized",
             __func__, operator);
     }
+}
+
+
+
+
+
+static gal_data_t *
+arithmetic_function_unary(int operator, int flags, gal_data_t *in,
+                          size_t numthreads)
+{
+  uint8_t otype;
+  int inplace=0;
+  gal_data_t *o;
+
+  /* The dataset may be empty. In this case, the output should also be
+     empty (we can have tables and images with 0 rows or pixels!). */
+  if(in->size==0 || in->array==NULL) return in;
+
+  /* See if the operation should be done in place. The output of these
+     operators is defined in the floating point space. So even if the input
+     is an integer type and user requested in place operation, if it's not
+     a floating point type, it will not be in place. */
+  if( (flags & GAL_ARITHMETIC_FLAG_INPLACE)
+      && ( in->type==GAL_TYPE_FLOAT32 || in->type==GAL_TYPE_FLOAT64 )
+      && ( operator != GAL_ARITHMETIC_OP_RA_TO_DEGREE
+      &&   operator != GAL_ARITHMETIC_OP_DEC_TO_DEGREE
+      &&   operator != GAL_ARITHMETIC_OP_DEGREE_TO_RA
+      &&   operator != GAL_ARITHMETIC_OP_DEGREE_TO_DEC ) )
+    inplace=1;
+
+  /* Set the output pointer. */
+  if(inplace)
+    {
+      o = in;
+      otype=in->type;
+    }
+  else
+    {
+      /* Check for operators which have fixed output types. */
+      if(         operator == GAL_ARITHMETIC_OP_RA_TO_DEGREE
+               || operator == GAL_ARITHMETIC_OP_DEC_TO_DEGREE )
+        otype = GAL_TYPE_FLOAT64;
+      else if(    operator == GAL_ARITHMETIC_OP_DEGREE_TO_RA
+               || operator == GAL_ARITHMETIC_OP_DEGREE_TO_DEC )
+        otype = GAL_TYPE_STRING;
+      else
+        otype = ( in->type==GAL_TYPE_FLOAT64
+                  ? GAL_TYPE_FLOAT64
+                  : GAL_TYPE_FLOAT32 );
+
+      /* Set the final output type. */
+      o = gal_data_alloc(NULL, otype, in->ndim, in->dsize, in->wcs,
+                         0, in->minmapsize, in->quietmmap,
+                         NULL, NULL, NULL);
+    }
+
+  /* Do the operation (possibly on multiple threads). The string
+     conversion operators are not thread-safe ('strtok' is used to parse
+     the sexagesimal strings) and are mostly used on table columns, so
+     they are always done on a single thread. */
+  if(in->type==GAL_TYPE_STRING || otype==GAL_TYPE_STRING) numthreads=1;
+  arithmetic_elementwise(arithmetic_function_unary_run, operator, in,
+                         NULL, o, numthreads);
+
 
   /* Clean up. Note that if the input arrays can be freed, and any of right
      or left arrays needed conversion, 'UNIFUNC_CONVERT_TO_COMPILED_TYPE'
@@ -2798,8 +2963,53 @@ arithmetic_binary_int_sanity_check(gal_data_t *l, gal_data_t *r,
 
 
 
+/* Call the proper function for the operator. Since they heavily involve
+   macros, their compilation can be very large if they are in a single
+   function and file. So there is a separate C source and header file for
+   each of these functions. */
+static void
+arithmetic_binary_run(int operator, gal_data_t *l, gal_data_t *r,
+                      gal_data_t *o)
+{
+  /* The most common operators and types have dedicated (vectorized)
+     kernels. If they can't be used, the generic operators are called. */
+  if( arithmetic_simd_binary(operator, l, r, o) ) return;
+
+  /* Generic operators. */
+  switch(operator)
+    {
+    case GAL_ARITHMETIC_OP_PLUS:     arithmetic_plus(l, r, o);     break;
+    case GAL_ARITHMETIC_OP_MINUS:    arithmetic_minus(l, r, o);    break;
+    case GAL_ARITHMETIC_OP_MULTIPLY: arithmetic_multiply(l, r, o); break;
+    case GAL_ARITHMETIC_OP_DIVIDE:   arithmetic_divide(l, r, o);   break;
+    case GAL_ARITHMETIC_OP_LT:       arithmetic_lt(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_LE:       arithmetic_le(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_GT:       arithmetic_gt(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_GE:       arithmetic_ge(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_EQ:       arithmetic_eq(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_NE:       arithmetic_ne(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_AND:      arithmetic_and(l, r, o);      break;
+    case GAL_ARITHMETIC_OP_OR:       arithmetic_or(l, r, o);       break;
+    case GAL_ARITHMETIC_OP_BITAND:   arithmetic_bitand(l, r, o);   break;
+    case GAL_ARITHMETIC_OP_BITOR:    arithmetic_bitor(l, r, o);    break;
+    case GAL_ARITHMETIC_OP_BITXOR:   arithmetic_bitxor(l, r, o);   break;
+    case GAL_ARITHMETIC_OP_BITLSH:   arithmetic_bitlsh(l, r, o);   break;
+    case GAL_ARITHMETIC_OP_BITRSH:   arithmetic_bitrsh(l, r, o);   break;
+    case GAL_ARITHMETIC_OP_MODULO:   arithmetic_modulo(l, r, o);   break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: a bug! please contact us at %s to address "
+            "the problem. %d is not a valid operator code", __func__,
+            PACKAGE_BUGREPORT, operator);
+    }
+}
+
+
+
+
+
 static gal_data_t *
-arithmetic_binary(int operator, int flags, gal_data_t *l, gal_data_t *r)
+arithmetic_binary(int operator, int flags, gal_data_t *l, gal_data_t *r,
+                  size_t numthreads)
 {
   /* Read the variable arguments. 'lo' and 'ro' keep the original data, in
      case their type isn't built (based on configure options are configure
@@ -2880,35 +3090,9 @@ arithmetic_binary(int operator, int flags, gal_data_t *l, gal_data_t *r)
                        0, minmapsize, quietmmap, NULL, NULL, NULL );
 
 
-  /* Call the proper function for the operator. Since they heavily involve
-     macros, their compilation can be very large if they are in a single
-     function and file. So there is a separate C source and header file for
-     each of these functions. */
-  switch(operator)
-    {
-    case GAL_ARITHMETIC_OP_PLUS:     arithmetic_plus(l, r, o);     break;
-    case GAL_ARITHMETIC_OP_MINUS:    arithmetic_minus(l, r, o);    break;
-    case GAL_ARITHMETIC_OP_MULTIPLY: arithmetic_multiply(l, r, o); break;
-    case GAL_ARITHMETIC_OP_DIVIDE:   arithmetic_divide(l, r, o);   break;
-    case GAL_ARITHMETIC_OP_LT:       arithmetic_lt(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_LE:       arithmetic_le(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_GT:       arithmetic_gt(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_GE:       arithmetic_ge(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_EQ:       arithmetic_eq(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_NE:       arithmetic_ne(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_AND:      arithmetic_and(l, r, o);      break;
-    case GAL_ARITHMETIC_OP_OR:       arithmetic_or(l, r, o);       break;
-    case GAL_ARITHMETIC_OP_BITAND:   arithmetic_bitand(l, r, o);   break;
-    case GAL_ARITHMETIC_OP_BITOR:    arithmetic_bitor(l, r, o);    break;
-    case GAL_ARITHMETIC_OP_BITXOR:   arithmetic_bitxor(l, r, o);   break;
-    case GAL_ARITHMETIC_OP_BITLSH:   arithmetic_bitlsh(l, r, o);   break;
-    case GAL_ARITHMETIC_OP_BITRSH:   arithmetic_bitrsh(l, r, o);   break;
-    case GAL_ARITHMETIC_OP_MODULO:   arithmetic_modulo(l, r, o);   break;
-    default:
-      error(EXIT_FAILURE, 0, "%s: a bug! please contact us at %s to address "
-            "the problem. %d is not a valid operator code", __func__,
-            PACKAGE_BUGREPORT, operator);
-    }
+  /* Do the operation (possibly on multiple threads). */
+  arithmetic_elementwise(arithmetic_binary_run, operator, l, r, o,
+                         numthreads);
 
 
   /* Clean up if necessary. Note that if the operation was requested to be
@@ -2984,9 +3168,48 @@ arithmetic_binary(int operator, int flags, gal_data_t *l, gal_data_t *r)
     }
 
 
+/* Run the binary function operator over all the elements of 'l' and
+   'r' and write the results in 'o'. */
+static void
+arithmetic_function_binary_flt_run(int operator, gal_data_t *l,
+                                   gal_data_t *r, gal_data_t *o)
+{
+  /* Start setting the operator and operands. */
+  switch(operator)
+    {
+    case GAL_ARITHMETIC_OP_POW:
+      BINFUNC_F_OPERATOR_SET( pow,   +0 );         break;
+    case GAL_ARITHMETIC_OP_ATAN2:
+      BINFUNC_F_OPERATOR_SET( atan2, *180.0f/M_PI ); break;
+    case GAL_ARITHMETIC_OP_SB_TO_MAG:
+      BINFUNC_F_OPERATOR_SET( gal_units_sb_to_mag, +0 ); break;
+    case GAL_ARITHMETIC_OP_MAG_TO_SB:
+      BINFUNC_F_OPERATOR_SET( gal_units_mag_to_sb, +0 ); break;
+    case GAL_ARITHMETIC_OP_COUNTS_TO_MAG:
+      BINFUNC_F_OPERATOR_SET( gal_units_counts_to_mag, +0 ); break;
+    case GAL_ARITHMETIC_OP_MAG_TO_COUNTS:
+      BINFUNC_F_OPERATOR_SET( gal_units_mag_to_counts, +0 ); break;
+    case GAL_ARITHMETIC_OP_COUNTS_TO_JY:
+      BINFUNC_F_OPERATOR_SET( gal_units_counts_to_jy, +0 ); break;
+    case GAL_ARITHMETIC_OP_JY_TO_COUNTS:
+      BINFUNC_F_OPERATOR_SET( gal_units_jy_to_counts, +0 ); break;
+    case GAL_ARITHMETIC_OP_COUNTS_TO_NANOMAGGY:
+      BINFUNC_F_OPERATOR_SET( gal_units_counts_to_nanomaggy, +0 ); break;
+    case GAL_ARITHMETIC_OP_NANOMAGGY_TO_COUNTS:
+      BINFUNC_F_OPERATOR_SET( gal_units_nanomaggy_to_counts, +0 ); break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: operator code %d not recognized",
+            __func__, operator);
+    }
+}
+
+
+
+
+
 static gal_data_t *
 arithmetic_function_binary_flt(int operator, int flags, gal_data_t *il,
-                               gal_data_t *ir)
+                               gal_data_t *ir, size_t numthreads)
 {
   int final_otype;
   size_t out_size, minmapsize;
@@ -3053,33 +3276,9 @@ arithmetic_function_binary_flt(int operator, int flags, gal_data_t *il,
                        quietmmap, NULL, NULL, NULL);
 
 
-  /* Start setting the operator and operands. */
-  switch(operator)
-    {
-    case GAL_ARITHMETIC_OP_POW:
-      BINFUNC_F_OPERATOR_SET( pow,   +0 );         break;
-    case GAL_ARITHMETIC_OP_ATAN2:
-      BINFUNC_F_OPERATOR_SET( atan2, *180.0f/M_PI ); break;
-    case GAL_ARITHMETIC_OP_SB_TO_MAG:
-      BINFUNC_F_OPERATOR_SET( gal_units_sb_to_mag, +0 ); break;
-    case GAL_ARITHMETIC_OP_MAG_TO_SB:
-      BINFUNC_F_OPERATOR_SET( gal_units_mag_to_sb, +0 ); break;
-    case GAL_ARITHMETIC_OP_COUNTS_TO_MAG:
-      BINFUNC_F_OPERATOR_SET( gal_units_counts_to_mag, +0 ); break;
-    case GAL_ARITHMETIC_OP_MAG_TO_COUNTS:
-      BINFUNC_F_OPERATOR_SET( gal_units_mag_to_counts, +0 ); break;
-    case GAL_ARITHMETIC_OP_COUNTS_TO_JY:
-      BINFUNC_F_OPERATOR_SET( gal_units_counts_to_jy, +0 ); break;
-    case GAL_ARITHMETIC_OP_JY_TO_COUNTS:
-      BINFUNC_F_OPERATOR_SET( gal_units_jy_to_counts, +0 ); break;
-    case GAL_ARITHMETIC_OP_COUNTS_TO_NANOMAGGY:
-      BINFUNC_F_OPERATOR_SET( gal_units_counts_to_nanomaggy, +0 ); break;
-    case GAL_ARITHMETIC_OP_NANOMAGGY_TO_COUNTS:
-      BINFUNC_F_OPERATOR_SET( gal_units_nanomaggy_to_counts, +0 ); break;
-    default:
-      error(EXIT_FAILURE, 0, "%s: operator code %d not recognized",
-            __func__, operator);
-    }
+  /* Do the operation (possibly on multiple threads). */
+  arithmetic_elementwise(arithmetic_function_binary_flt_run, operator,
+                         l, r, o, numthreads);
 
 
   /* Clean up. Note that if the input arrays can be freed, and any of right
@@ -3126,7 +3325,8 @@ arithmetic_function_binary_flt(int operator, int flags, gal_data_t *il,
      d3: Area.      */
 static gal_data_t *
 arithmetic_counts_to_from_sb(int operator, int flags, gal_data_t *d1,
-                             gal_data_t *d2, gal_data_t *d3)
+                             gal_data_t *d2, gal_data_t *d3,
+                             size_t numthreads)
 {
   gal_data_t *tmp, *out=NULL;
 
@@ -3134,16 +3334,20 @@ arithmetic_counts_to_from_sb(int operator, int flags, gal_data_t *d1,
     {
     case GAL_ARITHMETIC_OP_COUNTS_TO_SB:
       tmp=arithmetic_function_binary_flt(GAL_ARITHMETIC_OP_COUNTS_TO_MAG,
-                                         flags, d1, d2); /* d2=zeropoint */
+                                         flags, d1, d2, /* d2=zeropoint */
+                                         numthreads);
       out=arithmetic_function_binary_flt(GAL_ARITHMETIC_OP_MAG_TO_SB,
-                                         flags, tmp, d3); /* d3=area */
+                                         flags, tmp, d3, /* d3=area */
+                                         numthreads);
       break;
 
     case GAL_ARITHMETIC_OP_SB_TO_COUNTS:
       tmp=arithmetic_function_binary_flt(GAL_ARITHMETIC_OP_SB_TO_MAG,
-                                         flags, d1, d3); /* d3-->area */
+                                         flags, d1, d3, /* d3-->area */
+                                         numthreads);
       out=arithmetic_function_binary_flt(GAL_ARITHMETIC_OP_MAG_TO_COUNTS,
-                                         flags, tmp, d2); /* d2=zeropoint */
+                                         flags, tmp, d2, /* d2=zeropoint */
+                                         numthreads);
       break;
 
     default:
@@ -4526,7 +4730,7 @@ gal_arithmetic(int operator, size_t numthreads, int flags, ...)
     case GAL_ARITHMETIC_OP_OR:
       d1 = va_arg(va, gal_data_t *);
       d2 = va_arg(va, gal_data_t *);
-      out=arithmetic_binary(operator, flags, d1, d2);
+      out=arithmetic_binary(operator, flags, d1, d2, numthreads);
       break;
 
     case GAL_ARITHMETIC_OP_NOT:
@@ -4580,7 +4784,7 @@ gal_arithmetic(int operator, size_t numthreads, int flags, ...)
     case GAL_ARITHMETIC_OP_DEGREE_TO_RA:
     case GAL_ARITHMETIC_OP_DEGREE_TO_DEC:
       d1 = va_arg(va, gal_data_t *);
-      out=arithmetic_function_unary(operator, flags, d1);
+      out=arithmetic_function_unary(operator, flags, d1, numthreads);
       break;
 
     /* 2-component unit conversion. */
@@ -4632,7 +4836,8 @@ gal_arithmetic(int operator, size_t numthreads, int flags, ...)
     case GAL_ARITHMETIC_OP_COUNTS_TO_NANOMAGGY:
       d1 = va_arg(va, gal_data_t *);
       d2 = va_arg(va, gal_data_t *);
-      out=arithmetic_function_binary_flt(operator, flags, d1, d2);
+      out=arithmetic_function_binary_flt(operator, flags, d1, d2,
+                                         numthreads);
       break;
 
     /* More complex operators. */
@@ -4641,7 +4846,8 @@ gal_arithmetic(int operator, size_t numthreads, int flags, ...)
       d1 = va_arg(va, gal_data_t *);
       d2 = va_arg(va, gal_data_t *);
       d3 = va_arg(va, gal_data_t *);
-      out=arithmetic_counts_to_from_sb(operator, flags, d1, d2, d3);
+      out=arithmetic_counts_to_from_sb(operator, flags, d1, d2, d3,
+                                       numthreads);
 
       break;
 
@@ -4704,7 +4910,7 @@ gal_arithmetic(int operator, size_t numthreads, int flags, ...)
     case GAL_ARITHMETIC_OP_MODULO:
       d1 = va_arg(va, gal_data_t *);
       d2 = va_arg(va, gal_data_t *);
-      out=arithmetic_binary(operator, flags, d1, d2);
+      out=arithmetic_binary(operator, flags, d1, d2, numthreads);
       break;
     case GAL_ARITHMETIC_OP_BITNOT:
       d1 = va_arg(va, gal_data_t *);
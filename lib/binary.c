@@ -33,6 +33,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 #include <gnuastro/blank.h>
 #include <gnuastro/binary.h>
 #include <gnuastro/pointer.h>
+#include <gnuastro/threads.h>
 #include <gnuastro/dimension.h>
 
 
@@ -485,17 +486,188 @@ gal_binary_number_neighbors(gal_data_t *input, int connectivity, int inplace)
 /*********************************************************************/
 /*****************      Connected components      ********************/
 /*********************************************************************/
-/* Find connected components in an intput dataset. */
+/* Minimum number of elements in each strip of the input for labeling
+   connected components on multiple threads. */
+#define BINARY_CONNECTED_STRIP_MIN 100000
+
+
+
+
+
+/* Parameters for labeling connected components on threads. */
+struct binary_connected_params
+{
+  uint8_t                     *b;  /* Input binary array.                */
+  int32_t                     *l;  /* Output labels array.               */
+  int                   hasblank;  /* Input has blank values.            */
+  int               connectivity;  /* Connectivity of the neighbors.     */
+  size_t                   *dinc;  /* Increments along each dimension.   */
+  gal_data_t             *binary;  /* Input dataset.                     */
+  size_t                  *start;  /* First element of each strip.       */
+  size_t                    *num;  /* Number of labels in each strip.    */
+  size_t                 *newlab;  /* Final label of each strip's label. */
+};
+
+
+
+
+
+/* Label the connected components of the elements 'start' to 'end' (not
+   inclusive) with a breadth-first search: any element that is not
+   labeled is used to label the full component (only within this range)
+   by checking neighbors before going onto the next elements. So the
+   labels are sorted by the first element of each component. The number
+   of labels is returned. */
+static size_t
+binary_connected_components_range(struct binary_connected_params *p,
+                                  size_t start, size_t end)
+{
+  size_t i, pix;
+  int32_t curlab=1;
+  uint8_t *b=p->b;
+  int32_t *l=p->l;
+  gal_list_sizet_t *Q=NULL;
+  gal_data_t *binary=p->binary;
+
+  /* Initialize the labels. If we have blank pixels in the byte array,
+     then give them the blank label. Note that since their value will not
+     be 0, they will also not be labeled. */
+  if(p->hasblank)
+    for(i=start;i<end;++i) l[i] = b[i]==GAL_BLANK_UINT8 ? GAL_BLANK_INT32 : 0;
+  else
+    memset(l+start, 0, (end-start)*sizeof *l);
+
+  /* Go over all the pixels. */
+  for(i=start;i<end;++i)
+
+    /* Check if this pixel is already labeled. */
+    if( b[i] && l[i]==0 )
+      {
+        /* This is the first pixel of this connected region that we have
+           got to. */
+        l[i]=curlab;
+
+        /* Add this pixel to the queue of pixels to work with. */
+        gal_list_sizet_add(&Q, i);
+
+        /* While a pixel remains in the queue, continue labelling and
+           searching for neighbors. */
+        while(Q!=NULL)
+          {
+            /* Pop an element from the queue. */
+            pix=gal_list_sizet_pop(&Q);
+
+            /* Go over all its neighbors (within the range) and add them
+               to the list if they haven't already been labeled. */
+            GAL_DIMENSION_NEIGHBOR_OP(pix, binary->ndim, binary->dsize,
+                                      p->connectivity, p->dinc,
+              {
+                if( nind>=start && nind<end && b[nind] && l[nind]==0 )
+                  {
+                    l[ nind ] = curlab;
+                    gal_list_sizet_add(&Q, nind);
+                  }
+              } );
+          }
+
+        /* This object has been fully labeled, so increment the current
+           label. */
+        ++curlab;
+      }
+
+  /* Return the number of labels. */
+  return curlab-1;
+}
+
+
+
+
+
+/* Label the connected components within each strip. */
+static void *
+binary_connected_components_label(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct binary_connected_params *p=
+    (struct binary_connected_params *)(tprm->params);
+
+  size_t i, s;
+
+  /* Go over the strips given to this thread. */
+  for(i=0; (s=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    p->num[s]=binary_connected_components_range(p, p->start[s],
+                                                p->start[s+1]);
+
+  /* Wait for all the other threads to finish and return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Replace the labels of each strip with their final label. */
+static void *
+binary_connected_components_relabel(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct binary_connected_params *p=
+    (struct binary_connected_params *)(tprm->params);
+
+  int32_t *l, *lf;
+  size_t i, s, *newlab;
+
+  /* Go over the strips given to this thread. */
+  for(i=0; (s=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      newlab=p->newlab+p->num[s];
+      lf=(l=p->l+p->start[s])+(p->start[s+1]-p->start[s]);
+      do if(*l>0) *l=newlab[*l]; while(++l<lf);
+    }
+
+  /* Wait for all the other threads to finish and return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Root of a label in the union-find forest (the parent of a label is
+   never larger than it, so the root is the smallest label of the set). */
+static size_t
+binary_connected_components_root(size_t *parent, size_t lab)
+{
+  while(parent[lab]!=lab)
+    lab = parent[lab] = parent[ parent[lab] ];
+  return lab;
+}
+
+
+
+
+
+/* Find connected components in an intput dataset.
+
+   With more than one thread (and a large enough input), the input is
+   divided into strips along its slowest dimension and the components in
+   each strip are labeled independently (on separate threads). The labels
+   of every strip are then given a unique global label (the labels of
+   the strips before it come first) and the labels that touch across the
+   boundary of two strips are merged with a union-find. The smallest
+   label of each merged set belongs to the component's first element, so
+   numbering the sets by their smallest label gives exactly the same
+   labels as labeling the whole input in one pass. */
 size_t
 gal_binary_connected_components(gal_data_t *binary, gal_data_t **out,
-                                int connectivity)
+                                int connectivity, size_t numthreads)
 {
   int32_t *l;
-  uint8_t *b, *bf;
   gal_data_t *lab;
-  size_t p, i, curlab=1;
-  gal_list_sizet_t *Q=NULL;
-  size_t *dinc=gal_dimension_increment(binary->ndim, binary->dsize);
+  struct binary_connected_params p;
+  size_t a, r, i, s, nlab, slice, nstrips, *parent;
 
   /* Two small sanity checks. */
   if(binary->type!=GAL_TYPE_UINT8)
@@ -506,7 +678,8 @@ gal_binary_connected_components(gal_data_t *binary, gal_data_t **out,
           "must not be a tile", __func__);
 
 
-  /* Prepare the dataset for the labels. */
+  /* Prepare the dataset for the labels. Its values are initialized while
+     labeling. */
   if(*out)
     {
       /* Use the given dataset.  */
@@ -522,72 +695,94 @@ gal_binary_connected_components(gal_data_t *binary, gal_data_t **out,
         error(EXIT_FAILURE, 0, "%s: the 'out' dataset must have 'int32' type"
               "but the array you have given is '%s' type", __func__,
               gal_type_name(lab->type, 1));
-
-      /* Reset all its values to zero. */
-      memset(lab->array, 0, lab->size * gal_type_sizeof(lab->type));
     }
   else
     lab=*out=gal_data_alloc(NULL, GAL_TYPE_INT32, binary->ndim,
-                            binary->dsize, binary->wcs, 1,
+                            binary->dsize, binary->wcs, 0,
                             binary->minmapsize, binary->quietmmap,
                             NULL, "labels", NULL);
 
 
-  /* Initialize the labels array. If we have blank pixels in the byt
-     array, then give them the blank labeled array. Note that since
-     their value will not be 0, they will also not be labeled. */
-  l=lab->array;
-  bf=(b=binary->array)+binary->size; /* Library must have no side effect:*/
-  if( gal_blank_present(binary, 0) ) /* blank flag should not be changed.*/
-    do *l++ = *b==GAL_BLANK_UINT8 ? GAL_BLANK_INT32 : 0; while(++b<bf);
-
-
-  /* Go over all the pixels and do a breadth-first: any pixel that is not
-     labeled is used to label the full object by checking neighbors before
-     going onto the next pixels. */
-  l=lab->array;
-  b=binary->array;
-  for(i=0;i<binary->size;++i)
-
-    /* Check if this pixel is already labeled. */
-    if( b[i] && l[i]==0 )
-      {
-        /* This is the first pixel of this connected region that we have
-           got to. */
-        l[i]=curlab;
-
-        /* Add this pixel to the queue of pixels to work with. */
-        gal_list_sizet_add(&Q, i);
-
-        /* While a pixel remains in the queue, continue labelling and
-           searching for neighbors. */
-        while(Q!=NULL)
-          {
-            /* Pop an element from the queue. */
-            p=gal_list_sizet_pop(&Q);
-
-            /* Go over all its neighbors and add them to the list if they
-               haven't already been labeled. */
-            GAL_DIMENSION_NEIGHBOR_OP(p, binary->ndim, binary->dsize,
-                                      connectivity, dinc,
+  /* Set the strips: each strip has an integer number of slices (elements
+     with the same coordinate along the slowest dimension). */
+  slice=binary->size/binary->dsize[0];
+  nstrips=binary->size/BINARY_CONNECTED_STRIP_MIN;
+  if(nstrips>numthreads)        nstrips=numthreads;
+  if(nstrips>binary->dsize[0])  nstrips=binary->dsize[0];
+  if(nstrips==0)                nstrips=1;
+
+
+  /* Label each strip. Library must have no side effect: blank flag of the
+     input should not be changed (so the '0' in 'gal_blank_present'). */
+  p.b=binary->array;
+  p.l=lab->array;
+  p.binary=binary;
+  p.connectivity=connectivity;
+  p.hasblank=gal_blank_present(binary, 0);
+  p.dinc=gal_dimension_increment(binary->ndim, binary->dsize);
+  p.num=gal_pointer_allocate(GAL_TYPE_SIZE_T, nstrips, 0, __func__,
+                             "p.num");
+  p.start=gal_pointer_allocate(GAL_TYPE_SIZE_T, nstrips+1, 0, __func__,
+                               "p.start");
+  for(s=0;s<=nstrips;++s) p.start[s]=binary->dsize[0]*s/nstrips*slice;
+  gal_threads_spin_off_dynamic(binary_connected_components_label, &p,
+                               nstrips, numthreads);
+
+
+  /* With a single strip, the labels are already final. */
+  if(nstrips==1) nlab=p.num[0];
+  else
+    {
+      /* Keep the number of labels before each strip in 'p.num' (so label
+         'L' of strip 's' has the global label 'p.num[s]+L'). */
+      for(s=nlab=0;s<nstrips;++s) { a=p.num[s]; p.num[s]=nlab; nlab+=a; }
+
+      /* Each global label is initially its own set. */
+      parent=gal_pointer_allocate(GAL_TYPE_SIZE_T, nlab+1, 0, __func__,
+                                  "parent");
+      for(i=0;i<=nlab;++i) parent[i]=i;
+
+      /* Merge the sets of the labels that touch across the boundary of
+         two strips: the neighbors of the first slice of each strip in the
+         previous strip. The root of the larger set is attached to the
+         smaller one, so the parent of a label is never larger than it. */
+      l=p.l;
+      for(s=1;s<nstrips;++s)
+        for(i=p.start[s]; i<p.start[s]+slice; ++i)
+          if(l[i]>0)
+            GAL_DIMENSION_NEIGHBOR_OP(i, binary->ndim, binary->dsize,
+                                      connectivity, p.dinc,
               {
-                if( b[ nind ] && l[ nind ]==0 )
+                if( nind<p.start[s] && l[nind]>0 )
                   {
-                    l[ nind ] = curlab;
-                    gal_list_sizet_add(&Q, nind);
+                    a=binary_connected_components_root(parent,
+                                                       p.num[s]+l[i]);
+                    r=binary_connected_components_root(parent,
+                                                     p.num[s-1]+l[nind]);
+                    if(a<r) parent[r]=a; else parent[a]=r;
                   }
               } );
-          }
 
-        /* This object has been fully labeled, so increment the current
-           label. */
-        ++curlab;
-      }
+      /* Number the sets by their smallest label. Since the parent of a
+         label is smaller than it, the parent's final label is already
+         known when we get to a label that isn't a root. */
+      for(i=1, a=0; i<=nlab; ++i)
+        parent[i] = parent[i]==i ? ++a : parent[ parent[i] ];
+      p.newlab=parent;
+
+      /* Write the final labels of all the strips. */
+      gal_threads_spin_off_dynamic(binary_connected_components_relabel,
+                                   &p, nstrips, numthreads);
+      nlab=a;
+      free(parent);
+    }
 
 
   /* Clean up and return the total number. */
-  free(dinc);
-  return curlab-1;
+  free(p.num);
+  free(p.dinc);
+  free(p.start);
+  return nlab;
 }
 
 
@@ -958,7 +1153,8 @@ gal_binary_holes_label(gal_data_t *input, int connectivity,
 
   /* Label the holes. Recall that the first label is just the undetected
      regions, so we should subtract that from the total number.*/
-  *numholes=gal_binary_connected_components(inv, &holelabs, connectivity);
+  *numholes=gal_binary_connected_components(inv, &holelabs, connectivity,
+                                            1);
   *numholes -= 1;
 
 
@@ -1057,7 +1253,8 @@ gal_binary_holes_fill(gal_data_t *input, int connectivity, size_t maxsize)
   inv=binary_make_padded_inverse(input, &tile);
 
   /* Label the holes */
-  numholes=gal_binary_connected_components(inv, &holelabs, connectivity);
+  numholes=gal_binary_connected_components(inv, &holelabs, connectivity,
+                                           1);
 
   /* Any pixel with a label that is not touching the edges is a hole in the
      input image and we should invert the respective pixel. To do it, we'll
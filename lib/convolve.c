@@ -22,6 +22,8 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 **********************************************************************/
 #include <config.h>
 
+#include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <errno.h>
 #include <error.h>
@@ -30,11 +32,13 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 
 #include <gnuastro/list.h>
 #include <gnuastro/tile.h>
+#include <gnuastro/blank.h>
 #include <gnuastro/threads.h>
 #include <gnuastro/pointer.h>
 #include <gnuastro/convolve.h>
 #include <gnuastro/dimension.h>
 
+#include <gnuastro-internal/fft.h>
 #include <gnuastro-internal/checkset.h>
 
 
@@ -70,6 +74,59 @@ convolve_tile_is_on_edge(size_t *h, size_t *start_end_coord, size_t *k,
 
 
 
+/* See if a 2D kernel is separable (rank-1: the outer product of two 1D
+   kernels). If so, the two 1D kernels are allocated and put in 'sepk'
+   ('sepk[0]' is along the first/slow dimension and 'sepk[1]' along the
+   second/fast dimension) and 1 is returned. Otherwise, 0 is returned and
+   'sepk' is not touched.
+
+   The element with the largest absolute value is used as the pivot: its
+   column becomes the first 1D kernel and its row (divided by the pivot)
+   becomes the second. The kernel is only considered separable when the
+   product of the two reproduces every element to within float precision,
+   so the result of convolution is not affected by this choice. */
+static int
+convolve_separable(gal_data_t *kernel, float **sepk)
+{
+  float *k=kernel->array;
+  double max=0.0f, tol, d;
+  size_t a, b, p=0, q=0, n0, n1;
+
+  /* Only 2D kernels are checked. */
+  if(kernel->ndim!=2) return 0;
+  n0=kernel->dsize[0];
+  n1=kernel->dsize[1];
+
+  /* Find the pivot (also see if there are any blank elements). */
+  for(a=0;a<kernel->size;++a)
+    {
+      if( isnan(k[a]) ) return 0;
+      if( fabs(k[a])>max ) { max=fabs(k[a]); p=a/n1; q=a%n1; }
+    }
+  if(max==0.0f) return 0;
+
+  /* Check if all the elements can be reproduced by the outer product of
+     the pivot's column and row. */
+  tol = 10 * FLT_EPSILON * max;
+  for(a=0;a<n0;++a)
+    for(b=0;b<n1;++b)
+      {
+        d = k[a*n1+b] - (double)k[a*n1+q] * k[p*n1+b] / k[p*n1+q];
+        if( !(fabs(d)<=tol) ) return 0;
+      }
+
+  /* The kernel is separable, allocate and fill the 1D kernels. */
+  sepk[0]=gal_pointer_allocate(GAL_TYPE_FLOAT32, n0, 0, __func__, "sepk[0]");
+  sepk[1]=gal_pointer_allocate(GAL_TYPE_FLOAT32, n1, 0, __func__, "sepk[1]");
+  for(a=0;a<n0;++a) sepk[0][a]=k[a*n1+q];
+  for(b=0;b<n1;++b) sepk[1][b]=k[p*n1+b]/k[p*n1+q];
+  return 1;
+}
+
+
+
+
+
 
 
 
@@ -103,6 +160,8 @@ struct per_thread_spatial_prm
                              /* Later, just the pixel being convolved.    */
   int           on_edge;     /* If the tile is on the edge or not.        */
   gal_data_t      *host;     /* Size of host (channel or block).          */
+  double        *sepbuf;     /* Scratch space for separable convolution.  */
+  size_t     sepbufsize;     /* Number of elements in 'sepbuf'.           */
   struct spatial_params *cprm; /* Link to main structure for all threads. */
 };
 
@@ -121,6 +180,7 @@ struct spatial_params
   int        convoverch;     /* Ignore channel edges in convolution.      */
   int    edgecorrection;     /* Correct convolution's edge effects.       */
   uint8_t conv_on_blank;     /* Do convolution over blank pixels also.    */
+  float        *sepk[2];     /* 1D kernels when kernel is separable.      */
   struct per_thread_spatial_prm *pprm; /* Array of per-thread parameters. */
 };
 
@@ -292,6 +352,146 @@ convolve_spatial_overlap(struct per_thread_spatial_prm *pprm, int tocorrect)
 
 
 
+/* For tiles that are not on the edge (where the kernel fully overlaps
+   with the host for all pixels), 'convolve_spatial_tile' would still have
+   to find the overlap region for every pixel and parse it with the
+   generic tile macros. The functions below are a dedicated kernel for
+   this case (in 2D): the output pixels of each row are convolved in
+   blocks of 'CONVOLVE_INTERIOR_BLOCK' together, so every kernel element
+   is only read once for all the pixels of a block and the innermost loop
+   (over the block's pixels) can be vectorized by the compiler. Blank
+   input pixels are handled with a mask (not a branch). Like the kernels
+   of 'arithmetic-simd.c', when the compiler supports function
+   multi-versioning, it is also built for the AVX2 and AVX-512 instruction
+   sets and the best one is chosen at run-time.
+
+   The order of the operations is the same as 'convolve_spatial_tile', so
+   the outputs are identical. */
+#define CONVOLVE_INTERIOR_BLOCK 8
+#if GAL_CONFIG_HAVE_TARGET_CLONES == 1
+#define CONVOLVE_CLONES __attribute__((target_clones("avx512f","avx2",\
+                                                     "default")))
+#else
+#define CONVOLVE_CLONES
+#endif
+
+
+
+
+
+/* Convolve 'nb' pixels of one row that start at 'out'. 'in' points to
+   the input pixel under the first kernel element for the first output
+   pixel and 'w' is the length of the input's rows. */
+static inline void
+convolve_interior_block(float *in, float *out, size_t w, size_t nb,
+                        float *kernel, size_t k0, size_t k1,
+                        int edgecorrection, int conv_on_blank)
+{
+  float d, kv, *iv, *cv;
+  size_t a, b, j, nan_out;
+  double sum[CONVOLVE_INTERIOR_BLOCK], ksum[CONVOLVE_INTERIOR_BLOCK];
+
+  /* Initialize the accumulators. */
+  for(j=0;j<nb;++j) sum[j]=ksum[j]=0.0f;
+
+  /* Parse the kernel: for each kernel element, the pixels of all the
+     outputs are read from contiguous input elements. */
+  for(a=0;a<k0;++a)
+    {
+      iv=in+a*w;
+      for(b=0;b<k1;++b)
+        {
+          kv=kernel[a*k1+b];
+          for(j=0;j<nb;++j)
+            {
+              d=iv[b+j];
+              sum[j]  += d==d ? d*kv : 0.0f;
+              ksum[j] += d==d ? kv   : 0.0f;
+            }
+        }
+    }
+
+  /* Write the outputs. 'cv' points to the input pixel of the first
+     output. */
+  cv=in+(k0/2)*w+k1/2;
+  for(j=0;j<nb;++j)
+    {
+      nan_out = cv[j]!=cv[j] && conv_on_blank==0;
+      if(edgecorrection==0) ksum[j]=1.0f;
+      out[j] = ( nan_out || ksum[j]==0.0f ) ? NAN : sum[j]/ksum[j];
+    }
+}
+
+
+
+
+
+/* Convolve 'n' pixels along one row (see 'convolve_interior_block'). */
+static void CONVOLVE_CLONES
+convolve_interior_row(float *in, float *out, size_t w, size_t n,
+                      float *kernel, size_t k0, size_t k1,
+                      int edgecorrection, int conv_on_blank)
+{
+  size_t x;
+
+  /* Full blocks (with a constant size, so the innermost loop can be
+     unrolled and vectorized). */
+  for(x=0; x+CONVOLVE_INTERIOR_BLOCK<=n; x+=CONVOLVE_INTERIOR_BLOCK)
+    convolve_interior_block(in+x, out+x, w, CONVOLVE_INTERIOR_BLOCK,
+                            kernel, k0, k1, edgecorrection,
+                            conv_on_blank);
+
+  /* The remaining pixels (fewer than a block). */
+  if(x<n)
+    convolve_interior_block(in+x, out+x, w, n-x, kernel, k0, k1,
+                            edgecorrection, conv_on_blank);
+}
+
+
+
+
+
+/* Convolve a 2D tile that is not on the edge. If most pixels of the tile
+   are blank (and blank pixels should not be convolved), the generic
+   function is faster (it ignores blank pixels), so 0 is returned and
+   nothing is done. Otherwise, 1 is returned. */
+static int
+convolve_spatial_interior(struct per_thread_spatial_prm *pprm)
+{
+  struct spatial_params *cprm=pprm->cprm;
+  gal_data_t *tile=pprm->tile, *block=cprm->block;
+  size_t k0=cprm->kernel->dsize[0], k1=cprm->kernel->dsize[1];
+
+  float *in=block->array, *out=cprm->out->array, *iv;
+  size_t y, x, nblank=0, ind, w=block->dsize[1], *pix=pprm->pix;
+
+  /* See if the tile is blank-heavy. */
+  if(cprm->conv_on_blank==0)
+    {
+      for(y=0;y<tile->dsize[0];++y)
+        {
+          iv = ( in + (pprm->host_start[0]+pix[0]+y)*w
+                 + pprm->host_start[1] + pix[1] );
+          for(x=0;x<tile->dsize[1];++x) nblank += iv[x]!=iv[x];
+        }
+      if(nblank > tile->size/2) return 0;
+    }
+
+  /* Convolve each row of the tile. */
+  for(y=0;y<tile->dsize[0];++y)
+    {
+      ind = (pprm->host_start[0]+pix[0]+y)*w + pprm->host_start[1] + pix[1];
+      convolve_interior_row(in + ind - (k0/2)*w - k1/2, out + ind, w,
+                            tile->dsize[1], cprm->kernel->array, k0, k1,
+                            cprm->edgecorrection, cprm->conv_on_blank);
+    }
+  return 1;
+}
+
+
+
+
+
 /* Convolve over one tile that is not touching the edge. */
 static void
 convolve_spatial_tile(struct per_thread_spatial_prm *pprm)
@@ -341,6 +541,11 @@ convolve_spatial_tile(struct per_thread_spatial_prm *pprm)
   if(cprm->tocorrect && pprm->on_edge==0) return;
 
 
+  /* For 2D tiles that aren't on the edge, use the dedicated kernel. */
+  if( pprm->on_edge==0 && ndim==2 && convolve_spatial_interior(pprm) )
+    return;
+
+
   /* Parse over all the tile elements. */
   i_inc=0; i_ninc=1;
   i_start=gal_tile_start_end_ind_inclusive(tile, block, i_st_en);
@@ -414,6 +619,141 @@ convolve_spatial_tile(struct per_thread_spatial_prm *pprm)
 
 
 
+/* Convolve over one tile with a separable 2D kernel: instead of the full
+   'k0 x k1' multiply-accumulate for every pixel, a 1D pass along the fast
+   dimension is first done on all the rows that the tile (and half of the
+   kernel around it) covers. The second 1D pass along the slow dimension
+   is then done on this intermediate array.
+
+   The NaN-aware edge correction is preserved exactly: blank pixels are
+   set to zero in the data and a second (mask) array (one for non-blank
+   pixels within the host, zero otherwise) is convolved in the same
+   way. Since the kernel is separable, convolution of the mask is equal to
+   the sum of the kernel elements that overlap with usable pixels (what
+   'convolve_spatial_tile' calls 'ksum'). */
+static void
+convolve_separable_tile(struct per_thread_spatial_prm *pprm)
+{
+  struct spatial_params *cprm=pprm->cprm;
+  gal_data_t *tile=pprm->tile, *block=cprm->block;
+  float *u=cprm->sepk[0], *v=cprm->sepk[1];
+  float *in=block->array, *out=cprm->out->array;
+  size_t k0=cprm->kernel->dsize[0], k1=cprm->kernel->dsize[1];
+
+  float *iv, *ov;
+  size_t bsize, ind;
+  double *rd, *rm, *hd, *hm, sum, ksum;
+  size_t h0, h1, x0, x1, y0, y1, ry0, ry1, cx0, cx1, tw, nr;
+  size_t a, b, bs, be, r, x, y, w=block->dsize[1], *pix=pprm->pix;
+  int edgecorrection=cprm->edgecorrection;
+
+
+  /* Set the host and the starting/ending coordinates of the tile within
+     it (see 'convolve_spatial_tile'). */
+  pprm->host=cprm->convoverch ? block : tile->block;
+  gal_tile_start_coord(pprm->host, pprm->host_start);
+  gal_tile_start_end_coord(tile, pix, cprm->convoverch);
+  h0=pprm->host->dsize[0];  y0=pix[0];  y1=pix[2];
+  h1=pprm->host->dsize[1];  x0=pix[1];  x1=pix[3];
+
+
+  /* Rows and columns of the host that contribute to this tile. */
+  ry0 = y0 > k0/2 ? y0-k0/2 : 0;
+  cx0 = x0 > k1/2 ? x0-k1/2 : 0;
+  ry1 = y1+k0-1-k0/2 < h0 ? y1+k0-1-k0/2 : h0;
+  cx1 = x1+k1-1-k1/2 < h1 ? x1+k1-1-k1/2 : h1;
+  tw=x1-x0;
+  nr=ry1-ry0;
+
+
+  /* Make sure the scratch space is large enough: two rows of input (data
+     and mask) and two intermediate arrays (data and mask). */
+  bsize = 2*(cx1-cx0) + 2*nr*tw;
+  if(bsize>pprm->sepbufsize)
+    {
+      free(pprm->sepbuf);
+      pprm->sepbufsize=bsize;
+      pprm->sepbuf=gal_pointer_allocate(GAL_TYPE_FLOAT64, bsize, 0,
+                                        __func__, "pprm->sepbuf");
+    }
+  rd=pprm->sepbuf;
+  rm=rd+(cx1-cx0);
+  hd=rm+(cx1-cx0);
+  hm=hd+nr*tw;
+
+
+  /* First pass: along the fast dimension. */
+  for(r=0;r<nr;++r)
+    {
+      /* Copy this row into the scratch space (NaN pixels are zero in the
+         data and the mask). */
+      iv = in + (pprm->host_start[0]+ry0+r)*w + pprm->host_start[1] + cx0;
+      for(x=0;x<cx1-cx0;++x)
+        if( isnan(iv[x]) ) rd[x]=rm[x]=0.0f;
+        else             { rd[x]=iv[x]; rm[x]=1.0f; }
+
+      /* Convolve each pixel of the tile's columns in this row. */
+      for(x=x0;x<x1;++x)
+        {
+          /* Range of the kernel that overlaps with the host. */
+          bs = x<k1/2 ? k1/2-x : 0;
+          be = x+k1-k1/2 <= h1 ? k1 : h1+k1/2-x;
+
+          /* Do the multiply-accumulate. 'ind' is the position of the
+             first used kernel element in the row's scratch space. */
+          sum=ksum=0.0;
+          ind=x+bs-k1/2-cx0;
+          for(b=bs;b<be;++b)
+            {
+              sum  += rd[ind] * v[b];
+              ksum += rm[ind] * v[b];
+              ++ind;
+            }
+          hd[r*tw+x-x0]=sum;
+          hm[r*tw+x-x0]=ksum;
+        }
+    }
+
+
+  /* Second pass: along the slow dimension. */
+  for(y=y0;y<y1;++y)
+    {
+      /* Range of the kernel that overlaps with the host and pointers to
+         this row in the input and output. */
+      bs = y<k0/2 ? k0/2-y : 0;
+      be = y+k0-k0/2 <= h0 ? k0 : h0+k0/2-y;
+      ind = (pprm->host_start[0]+y)*w + pprm->host_start[1] + x0;
+      iv=in+ind;
+      ov=out+ind;
+
+      /* Go over the pixels in this row. */
+      for(x=0;x<tw;++x)
+        {
+          /* If the input is blank, the output should also be blank. */
+          if( isnan(iv[x]) && cprm->conv_on_blank==0 )
+            { ov[x]=NAN; continue; }
+
+          /* Do the multiply-accumulate. */
+          sum=ksum=0.0;
+          for(a=bs;a<be;++a)
+            {
+              r=(y+a-k0/2-ry0)*tw+x;
+              sum += hd[r] * u[a];
+              if(edgecorrection) ksum += hm[r] * u[a];
+            }
+
+          /* Set the output value (exactly like 'convolve_spatial_tile'
+             when no kernel elements overlap with usable pixels). */
+          if(edgecorrection==0) ksum=1.0;
+          ov[x] = ksum==0.0 ? NAN : sum/ksum;
+        }
+    }
+}
+
+
+
+
+
 /* Do spatial convolution on each mesh. */
 static void *
 convolve_spatial_on_thread(void *inparam)
@@ -436,6 +776,8 @@ convolve_spatial_on_thread(void *inparam)
 
   /* Initialize/Allocate necessary items for this thread. */
   pprm->cprm          = cprm;
+  pprm->sepbuf        = NULL;
+  pprm->sepbufsize    = 0;
   pprm->pix           = gal_pointer_allocate(GAL_TYPE_SIZE_T, 2*ndim, 0,
                                              __func__, "pprm->pix");
   pprm->host_start    = gal_pointer_allocate(GAL_TYPE_SIZE_T, ndim, 0,
@@ -463,13 +805,15 @@ convolve_spatial_on_thread(void *inparam)
       pprm->tile = &cprm->tiles[ pprm->id ];
 
       /* Do the convolution on this tile. */
-      convolve_spatial_tile(pprm);
+      if(cprm->sepk[0]) convolve_separable_tile(pprm);
+      else              convolve_spatial_tile(pprm);
     }
 
 
   /* Clean up, wait until all other threads finish, then return. In a
      single thread situation, 'tprm->b==NULL'. */
   free(pprm->pix);
+  free(pprm->sepbuf);
   free(pprm->host_start);
   free(pprm->kernel_start);
   free(pprm->overlap_start);
@@ -489,8 +833,9 @@ static gal_data_t *
 gal_convolve_spatial_general(gal_data_t *tiles, gal_data_t *kernel,
                              size_t numthreads, int edgecorrection,
                              int convoverch, uint8_t conv_on_blank,
-                             gal_data_t *tocorrect)
+                             gal_data_t *tocorrect, float **sepk)
 {
+  int sepfree=0;
   struct spatial_params params;
   gal_data_t *out, *block=gal_tile_block(tiles);
 
@@ -542,6 +887,17 @@ gal_convolve_spatial_general(gal_data_t *tiles, gal_data_t *kernel,
   params.edgecorrection=edgecorrection;
 
 
+  /* If the kernel is separable (or the two 1D kernels were given), use
+     the two-pass 1D convolution. When correcting the channel edges, only
+     a small fraction of the pixels are convolved, so this isn't done. */
+  params.sepk[0]=params.sepk[1]=NULL;
+  if(tocorrect==NULL)
+    {
+      if(sepk) { params.sepk[0]=sepk[0]; params.sepk[1]=sepk[1]; }
+      else     sepfree=convolve_separable(kernel, params.sepk);
+    }
+
+
   /* Allocate the per-thread parameters. */
   errno=0;
   params.pprm=malloc(numthreads * sizeof *params.pprm);
@@ -557,6 +913,7 @@ gal_convolve_spatial_general(gal_data_t *tiles, gal_data_t *kernel,
 
 
   /* Clean up and return the output array. */
+  if(sepfree) { free(params.sepk[0]); free(params.sepk[1]); }
   free(params.pprm);
   return out;
 }
@@ -582,7 +939,61 @@ gal_convolve_spatial(gal_data_t *tiles, gal_data_t *kernel,
   /* Call the general function. */
   return gal_convolve_spatial_general(tiles, kernel, numthreads,
                                       edgecorrection, convoverch,
-                                      conv_on_blank, NULL);
+                                      conv_on_blank, NULL, NULL);
+}
+
+
+
+
+
+/* Similar to 'gal_convolve_spatial', but for a 2D kernel that is the
+   outer product of two 1D kernels: 'kernel0' (along the first/slow
+   dimension) and 'kernel1' (along the second/fast dimension). The
+   convolution will be done as two 1D passes. Note that
+   'gal_convolve_spatial' also checks if a 2D kernel is separable, so this
+   function is only necessary when the 1D kernels are already at hand. */
+gal_data_t *
+gal_convolve_spatial_separable(gal_data_t *tiles, gal_data_t *kernel0,
+                               gal_data_t *kernel1, size_t numthreads,
+                               int edgecorrection, int convoverch,
+                               int conv_on_blank)
+{
+  size_t a, b, dsize[2];
+  gal_data_t *kernel, *out;
+  float *k, *k0=kernel0->array, *k1=kernel1->array, *sepk[2];
+
+  /* Sanity checks. */
+  if(tiles->ndim!=2)
+    error(EXIT_FAILURE, 0, "%s: only 2D inputs are currently supported, "
+          "the input has %zu dimensions", __func__, tiles->ndim);
+  if(kernel0->ndim!=1 || kernel1->ndim!=1)
+    error(EXIT_FAILURE, 0, "%s: the two kernels should be 1D", __func__);
+  if( kernel0->type!=GAL_TYPE_FLOAT32 || kernel1->type!=GAL_TYPE_FLOAT32 )
+    error(EXIT_FAILURE, 0, "%s: only accepts 'float32' type kernels "
+          "currently", __func__);
+
+  /* Build the 2D kernel: it is used to find the tiles on the edge and
+     for correcting the channel edges later (if necessary). */
+  dsize[0]=kernel0->size;
+  dsize[1]=kernel1->size;
+  kernel=gal_data_alloc(NULL, GAL_TYPE_FLOAT32, 2, dsize, NULL, 0, -1, 1,
+                        NULL, NULL, NULL);
+  k=kernel->array;
+  for(a=0;a<dsize[0];++a)
+    for(b=0;b<dsize[1];++b)
+      k[a*dsize[1]+b]=k0[a]*k1[b];
+
+  /* Do the convolution (see 'gal_convolve_spatial'). */
+  sepk[0]=k0;
+  sepk[1]=k1;
+  if(tiles->block==NULL) convoverch=1;
+  out=gal_convolve_spatial_general(tiles, kernel, numthreads,
+                                   edgecorrection, convoverch,
+                                   conv_on_blank, NULL, sepk);
+
+  /* Clean up and return. */
+  gal_data_free(kernel);
+  return out;
 }
 
 
@@ -615,5 +1026,462 @@ gal_convolve_spatial_correct_ch_edge(gal_data_t *tiles, gal_data_t *kernel,
   /* Call the general function, which will do the correction. */
   gal_convolve_spatial_general(tiles, kernel, numthreads,
                                edgecorrection, 0, conv_on_blank,
-                               tocorrect);
+                               tocorrect, NULL);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*********************************************************************/
+/********************    Frequency convolution    ********************/
+/*********************************************************************/
+/* In the frequency domain, convolution is circular. To have the same
+   output as the spatial domain, each host region (the channel, or the
+   full dataset when 'convoverch' is non-zero) is convolved with the
+   "overlap-save" method: the host is broken into blocks (large compared
+   to the kernel, or the full host if it isn't too large) and each block
+   (along with its surrounding pixels that overlap with the kernel) is
+   copied into a zero-padded array and convolved. Pixels outside the host
+   are set to zero, so they are not used (same as the spatial domain).
+   The parts of the convolved array that are affected by the circular
+   wrapping are not used, so each block's output is independent of the
+   others and the blocks can be convolved on different threads.
+
+   If the padded array's first pixel corresponds to the pixel that is
+   'h=k/2' pixels before the block's first pixel, the kernel has to be
+   put (flipped) around the first pixel of the padded array (its elements
+   with negative coordinates are wrapped around to the end). In this way,
+   the output pixels are at the start of the padded array and the result
+   is equivalent to spatial convolution (where the kernel isn't flipped,
+   see 'convolve_spatial_tile').
+
+   Blank pixels are set to zero before the transform. When edge
+   correction is requested, a mask (1 for non-blank pixels and 0 for the
+   blank pixels and the padding) is also convolved: this is the sum of
+   the kernel elements that overlap with usable pixels. Since the
+   frequency domain has round-off errors, when it is smaller than
+   'CONVOLVE_FREQUENCY_MINKSUM' of the absolute sum of the kernel, the
+   output is set to blank (the equivalent of 'ksum==0' in the spatial
+   domain). */
+#define CONVOLVE_FREQUENCY_MINKSUM 1e-5
+
+/* The size of the padded arrays along each dimension will be at least
+   'CONVOLVE_FREQUENCY_KFACTOR' times the kernel's width and not smaller
+   than 'CONVOLVE_FREQUENCY_MINFFT'. If the host (with its padding) is
+   smaller than two times this, it will be convolved as one block. */
+#define CONVOLVE_FREQUENCY_KFACTOR 4
+#define CONVOLVE_FREQUENCY_MINFFT  256
+
+/* Parameters for each host region. */
+struct frequency_params
+{
+  float                   *in;  /* Start of host in the input array.  */
+  float                  *out;  /* Start of host in the output array. */
+  size_t                    w;  /* Length of a row in full arrays.    */
+  size_t               n0, n1;  /* Size of host region.               */
+  size_t               b0, b1;  /* Size of each block.                */
+  size_t               k0, k1;  /* Size of the kernel.                */
+  size_t              nblock1;  /* Number of blocks along 2nd dim.    */
+  double              minksum;  /* Minimum sum of kernel (see above). */
+  int          edgecorrection;  /* Correct the edges.                 */
+  int           conv_on_blank;  /* Convolve over the blank pixels.    */
+  struct gal_fft_convolve *fc;  /* Prepared FFT convolution.          */
+};
+
+
+
+
+
+/* Size of the blocks and padded arrays along one dimension of a host
+   with 'n' pixels and a kernel with 'k' pixels (see above). */
+static void
+convolve_frequency_block_size(size_t n, size_t k, size_t *b, size_t *p)
+{
+  size_t t;
+
+  /* Minimum size of the padded array along this dimension. */
+  t = CONVOLVE_FREQUENCY_KFACTOR * k;
+  if(t<CONVOLVE_FREQUENCY_MINFFT) t=CONVOLVE_FREQUENCY_MINFFT;
+
+  /* If the full host is not much larger, use it as one block. */
+  if( n+k-1 <= 2*t ) { *p=gal_fft_good_size(n+k-1); *b=n; }
+  else               { *p=gal_fft_good_size(t);     *b=*p-(k-1); }
+}
+
+
+
+
+
+/* Convolve the blocks that are assigned to this thread. */
+static void *
+convolve_frequency_on_thread(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct frequency_params *fprm=(struct frequency_params *)tprm->params;
+
+  float v, *in, *out, *imgs[2];
+  size_t i, j, u, y, x, bn0, bn1, c0, c1, numimgs, size;
+  size_t w=fprm->w, p0=fprm->fc->ps0, p1=fprm->fc->ps1;
+  size_t h0=fprm->k0/2, h1=fprm->k1/2, k0=fprm->k0, k1=fprm->k1;
+
+  /* Allocate the padded arrays of this thread. */
+  size=p0*p1;
+  numimgs = fprm->edgecorrection ? 2 : 1;
+  for(i=0;i<numimgs;++i)
+    imgs[i]=gal_pointer_allocate(GAL_TYPE_FLOAT32, size, 0, __func__,
+                                 "imgs[i]");
+
+  /* Go over all the blocks. */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Position and size of this block within the host. */
+      y = ( tprm->indexs[i] / fprm->nblock1 ) * fprm->b0;
+      x = ( tprm->indexs[i] % fprm->nblock1 ) * fprm->b1;
+      bn0 = y+fprm->b0 <= fprm->n0 ? fprm->b0 : fprm->n0-y;
+      bn1 = x+fprm->b1 <= fprm->n1 ? fprm->b1 : fprm->n1-x;
+
+      /* Fill the padded arrays: 'u' is the padded array's row, the
+         columns of the host that should be copied are the same for all
+         rows: from 'c0' to 'c1'. */
+      for(u=0;u<numimgs;++u) memset(imgs[u], 0, size*sizeof *imgs[u]);
+      c0 = x>h1 ? x-h1 : 0;
+      c1 = x+bn1+k1-1-h1 < fprm->n1 ? x+bn1+k1-1-h1 : fprm->n1;
+      for(u=0; u<bn0+k0-1; ++u)
+        if( y+u >= h0 && y+u-h0 < fprm->n0 )
+          {
+            in = fprm->in + (y+u-h0)*w;
+            for(j=c0;j<c1;++j)
+              {
+                v=in[j];
+                if( isnan(v)==0 )
+                  {
+                    imgs[0][u*p1 + j+h1-x]=v;
+                    if(numimgs>1) imgs[1][u*p1 + j+h1-x]=1.0f;
+                  }
+              }
+          }
+
+      /* Convolve the arrays. */
+      gal_fft_convolve_run(fprm->fc, imgs, numimgs);
+
+      /* Write the output pixels. */
+      for(u=0;u<bn0;++u)
+        {
+          in  = fprm->in  + (y+u)*w + x;
+          out = fprm->out + (y+u)*w + x;
+          for(j=0;j<bn1;++j)
+            {
+              if( isnan(in[j]) && fprm->conv_on_blank==0 ) v=NAN;
+              else if(numimgs>1)
+                v = ( fabs(imgs[1][u*p1+j])<=fprm->minksum
+                      ? NAN
+                      : imgs[0][u*p1+j]/imgs[1][u*p1+j] );
+              else v=imgs[0][u*p1+j];
+              out[j]=v;
+            }
+        }
+    }
+
+  /* Clean up, wait until all other threads finish, then return. In a
+     single thread situation, 'tprm->b==NULL'. */
+  for(i=0;i<numimgs;++i) free(imgs[i]);
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Convolve one host region in the frequency domain. When there are more
+   blocks than threads, each block is convolved on one thread, otherwise
+   the blocks are convolved one after the other (and each transform is
+   done on multiple threads). */
+static void
+convolve_frequency_host(gal_data_t *block, gal_data_t *host,
+                        gal_data_t *out, gal_data_t *kernel,
+                        size_t numthreads, int edgecorrection,
+                        int conv_on_blank, char *wisdom)
+{
+  float *pker, *k=kernel->array;
+  double kabs=0.0f;
+  size_t a, b, p0, p1, start, nblocks, fftthreads;
+  struct frequency_params fprm;
+
+  /* Set the host region. */
+  start=gal_pointer_num_between(block->array, host->array, block->type);
+  fprm.in=(float *)(block->array)+start;
+  fprm.out=(float *)(out->array)+start;
+  fprm.w=block->dsize[1];
+  fprm.n0=host->dsize[0];
+  fprm.n1=host->dsize[1];
+  fprm.k0=kernel->dsize[0];
+  fprm.k1=kernel->dsize[1];
+  fprm.conv_on_blank=conv_on_blank;
+  fprm.edgecorrection=edgecorrection;
+
+  /* Set the blocks. */
+  convolve_frequency_block_size(fprm.n0, fprm.k0, &fprm.b0, &p0);
+  convolve_frequency_block_size(fprm.n1, fprm.k1, &fprm.b1, &p1);
+  fprm.nblock1 = fprm.n1/fprm.b1 + (fprm.n1%fprm.b1 ? 1 : 0);
+  nblocks = fprm.nblock1 * ( fprm.n0/fprm.b0 + (fprm.n0%fprm.b0 ? 1 : 0) );
+  fftthreads = nblocks>=numthreads ? 1 : numthreads;
+
+  /* Put the kernel in the padded array and prepare the convolution. */
+  pker=gal_pointer_allocate(GAL_TYPE_FLOAT32, p0*p1, 1, __func__, "pker");
+  for(a=0;a<fprm.k0;++a)
+    for(b=0;b<fprm.k1;++b)
+      {
+        kabs += fabs(k[a*fprm.k1+b]);
+        pker[ ((p0-a)%p0)*p1 + (p1-b)%p1 ] = k[a*fprm.k1+b];
+      }
+  fprm.minksum=CONVOLVE_FREQUENCY_MINKSUM*kabs;
+  fprm.fc=gal_fft_convolve_prepare(pker, p0, p1, fftthreads,
+                                   block->minmapsize, block->quietmmap,
+                                   wisdom);
+  free(pker);
+
+  /* Convolve the blocks. */
+  gal_threads_spin_off(convolve_frequency_on_thread, &fprm, nblocks,
+                       fftthreads==1 ? numthreads : 1,
+                       block->minmapsize, block->quietmmap);
+
+  /* Clean up. */
+  gal_fft_convolve_free(fprm.fc);
+}
+
+
+
+
+
+/* Return the hosts of the convolution: the channels of the given tiles,
+   or the block when there are no channels (or 'convoverch' is
+   non-zero). The output is an array of pointers, its number of elements
+   is put in 'numhosts'. */
+static gal_data_t **
+convolve_hosts(gal_data_t *tiles, int convoverch, size_t *numhosts)
+{
+  size_t i, n=0;
+  gal_data_t *tile, *host, **hosts;
+
+  /* Allocate the array (there can't be more hosts than tiles). */
+  errno=0;
+  hosts=malloc(gal_list_data_number(tiles) * sizeof *hosts);
+  if(hosts==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't allocate 'hosts'", __func__);
+
+  /* Go over the tiles and keep the hosts that aren't already kept (the
+     tiles of a channel are contiguous in the list, so the check is
+     fast). */
+  for(tile=tiles; tile!=NULL; tile=tile->next)
+    {
+      host = ( tile->block
+               ? (convoverch ? gal_tile_block(tile) : tile->block)
+               : tile );
+      for(i=n; i>0; --i) if(hosts[i-1]==host) break;
+      if(i==0) hosts[n++]=host;
+    }
+
+  /* Return the hosts. */
+  *numhosts=n;
+  return hosts;
+}
+
+
+
+
+
+/* Sanity checks for the frequency domain convolution. */
+static void
+convolve_frequency_sanity(gal_data_t *block, gal_data_t *kernel)
+{
+  if(block->ndim!=2 || kernel->ndim!=2)
+    error(EXIT_FAILURE, 0, "%s: only 2D inputs and kernels are currently "
+          "supported, the input and kernel have %zu and %zu dimensions",
+          __func__, block->ndim, kernel->ndim);
+  if( block->type!=GAL_TYPE_FLOAT32 || kernel->type!=GAL_TYPE_FLOAT32 )
+    error(EXIT_FAILURE, 0, "%s: only accepts 'float32' type input and "
+          "kernel currently", __func__);
+}
+
+
+
+
+
+/* Convolve the dataset with the kernel in the frequency domain. The
+   output is the same as 'gal_convolve_spatial' (to within the floating
+   point errors of the frequency domain), but for large kernels it is
+   much faster. Like 'gal_convolve_spatial', the input can be a list of
+   tiles (in that case, the tiles are only used to find the channels)
+   or a full dataset.
+
+   'wisdom' is the name of a file to keep the plans of FFTW (the
+   transforms are only done with FFTW when Gnuastro is built with it),
+   it can be NULL. */
+gal_data_t *
+gal_convolve_frequency(gal_data_t *tiles, gal_data_t *kernel,
+                       size_t numthreads, int edgecorrection,
+                       int convoverch, int conv_on_blank, char *wisdom)
+{
+  size_t i, numhosts;
+  gal_data_t *out, **hosts, *block=gal_tile_block(tiles);
+
+  /* Sanity checks. */
+  convolve_frequency_sanity(block, kernel);
+  if(tiles->block==NULL) convoverch=1;
+
+  /* Allocate the output (see 'gal_convolve_spatial_general'). */
+  out=gal_data_alloc(NULL, GAL_TYPE_FLOAT32, block->ndim, block->dsize,
+                     block->wcs, 0, block->minmapsize, block->quietmmap,
+                     NULL, block->unit, NULL);
+  out->flag = ( block->flag
+                | ( GAL_DATA_FLAG_BLANK_CH | GAL_DATA_FLAG_HASBLANK ) );
+
+  /* Convolve each host. */
+  hosts=convolve_hosts(tiles, convoverch, &numhosts);
+  for(i=0;i<numhosts;++i)
+    convolve_frequency_host(block, hosts[i], out, kernel, numthreads,
+                            edgecorrection, conv_on_blank, wisdom);
+
+  /* Clean up and return. */
+  free(hosts);
+  return out;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*********************************************************************/
+/********************    Automatic selection      ********************/
+/*********************************************************************/
+/* Relative cost of each 'N*log2(N)' operation of the Fourier transforms
+   compared to one multiplication and addition in the spatial domain. The
+   transforms of FFTW (real-to-complex, in single precision and
+   vectorized) are much faster than those of GSL (complex, in double
+   precision). */
+#ifdef HAVE_LIBFFTW3F
+#define CONVOLVE_AUTO_FFT_COST 1.0f
+#else
+#define CONVOLVE_AUTO_FFT_COST 4.0f
+#endif
+
+/* Select the domain that is expected to be faster for convolving the
+   given inputs. The number of operations in the spatial domain is the
+   number of (non-blank, unless 'conv_on_blank' is non-zero) pixels
+   multiplied by the number of kernel elements (or the sum of its sides
+   for separable kernels). In the frequency domain, it is the number of
+   forward and backward transforms of all the blocks (see the
+   "overlap-save" description above). */
+uint8_t
+gal_convolve_domain_select(gal_data_t *tiles, gal_data_t *kernel,
+                           int edgecorrection, int convoverch,
+                           int conv_on_blank)
+{
+  float *sepk[2];
+  double scost, fcost=0.0f;
+  gal_data_t **hosts, *block=gal_tile_block(tiles);
+  size_t i, b0, b1, p0, p1, nblocks, numhosts, ksize;
+
+  /* Frequency domain convolution is currently only for 2D 'float32'
+     datasets. */
+  if( block->ndim!=2 || kernel->ndim!=2
+      || block->type!=GAL_TYPE_FLOAT32 || kernel->type!=GAL_TYPE_FLOAT32 )
+    return GAL_CONVOLVE_DOMAIN_SPATIAL;
+
+  /* Cost of spatial convolution. */
+  if( convolve_separable(kernel, sepk) )
+    {
+      ksize=kernel->dsize[0]+kernel->dsize[1];
+      free(sepk[0]);
+      free(sepk[1]);
+    }
+  else ksize=kernel->size;
+  scost = (double)ksize * ( conv_on_blank
+                            ? block->size
+                            : block->size - gal_blank_number(block, 1) );
+
+  /* Cost of frequency domain convolution. */
+  if(tiles->block==NULL) convoverch=1;
+  hosts=convolve_hosts(tiles, convoverch, &numhosts);
+  for(i=0;i<numhosts;++i)
+    {
+      convolve_frequency_block_size(hosts[i]->dsize[0], kernel->dsize[0],
+                                    &b0, &p0);
+      convolve_frequency_block_size(hosts[i]->dsize[1], kernel->dsize[1],
+                                    &b1, &p1);
+      nblocks = ( ( hosts[i]->dsize[0]/b0 + (hosts[i]->dsize[0]%b0?1:0) )
+                  * ( hosts[i]->dsize[1]/b1 + (hosts[i]->dsize[1]%b1?1:0) ) );
+      fcost += ( nblocks * (edgecorrection ? 2 : 1) * 2
+                 * CONVOLVE_AUTO_FFT_COST * p0 * p1 * log2(p0*p1) );
+    }
+  free(hosts);
+
+  /* Return the cheaper domain. */
+  return fcost<scost ? GAL_CONVOLVE_DOMAIN_FREQUENCY
+                     : GAL_CONVOLVE_DOMAIN_SPATIAL;
+}
+
+
+
+
+
+/* Convolve the input in the domain that is expected to be faster (see
+   'gal_convolve_domain_select'). The arguments are the same as
+   'gal_convolve_spatial' and 'gal_convolve_frequency'. */
+gal_data_t *
+gal_convolve_auto(gal_data_t *tiles, gal_data_t *kernel, size_t numthreads,
+                  int edgecorrection, int convoverch, int conv_on_blank,
+                  char *wisdom)
+{
+  switch( gal_convolve_domain_select(tiles, kernel, edgecorrection,
+                                     convoverch, conv_on_blank) )
+    {
+    case GAL_CONVOLVE_DOMAIN_SPATIAL:
+      return gal_convolve_spatial(tiles, kernel, numthreads,
+                                  edgecorrection, convoverch,
+                                  conv_on_blank);
+    case GAL_CONVOLVE_DOMAIN_FREQUENCY:
+      return gal_convolve_frequency(tiles, kernel, numthreads,
+                                    edgecorrection, convoverch,
+                                    conv_on_blank, wisdom);
+    default:
+      error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+            "the problem. The selected domain is not recognized", __func__,
+            PACKAGE_BUGREPORT);
+    }
+
+  /* Control should not reach here. */
+  return NULL;
 }
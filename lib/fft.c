@@ -0,0 +1,573 @@
+/*********************************************************************
+Fast Fourier Transform functions (internal to the library).
+This is part of GNU Astronomy Utilities (Gnuastro) package.
+
+Original author:
+     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+Contributing author(s):
+Copyright (C) 2024 Free Software Foundation, Inc.
+
+Gnuastro is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Gnuastro is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef HAVE_LIBFFTW3F
+  #include <fftw3.h>
+#else
+  #include <gsl/gsl_fft_complex.h>
+#endif
+
+#include <gnuastro/type.h>
+#include <gnuastro/threads.h>
+#include <gnuastro/pointer.h>
+
+#include <gnuastro-internal/fft.h>
+
+
+
+
+/* The Fast Fourier Transform (FFT) can be done with one of two
+   libraries:
+
+   FFTW: when Gnuastro was configured with FFTW (its single-precision
+        library: 'libfftw3f'), its real-to-complex transforms are used
+        in single precision (the same as the 'float32' input images). If
+        FFTW's threads library is also present, the transforms are done
+        on multiple threads. The plans of FFTW are cached in memory (as
+        FFTW's "wisdom") during a run. When a wisdom file name is given,
+        the plans are also measured (not just estimated) and saved in
+        that file, so later runs on images of the same size will re-use
+        them.
+
+   GSL: otherwise, the complex transforms of the GNU Scientific Library
+        are used in double precision: the 2D transform is done as 1D
+        transforms over all the rows and then all the columns (that are
+        distributed between the threads).
+
+   Other parts of the library (and programs) should only use the
+   functions here, so they don't have to worry about which library is
+   used. */
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*********************************************************************/
+/********************          Utilities          ********************/
+/*********************************************************************/
+/* The FFT algorithms of both FFTW and GSL are fastest when the size only
+   has small prime factors. So return the smallest number that is larger
+   or equal to 'n' and only has 2, 3, 5 and 7 as factors. */
+size_t
+gal_fft_good_size(size_t n)
+{
+  size_t g, r;
+
+  if(n<=2) return 2;
+  for(g=n;;++g)
+    {
+      r=g;
+      while(r%2==0) r/=2;
+      while(r%3==0) r/=3;
+      while(r%5==0) r/=5;
+      while(r%7==0) r/=7;
+      if(r==1) return g;
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*********************************************************************/
+/********************      FFTW implementation    ********************/
+/*********************************************************************/
+#ifdef HAVE_LIBFFTW3F
+
+/* Except for the 'fftwf_execute' functions, FFTW's functions are not
+   thread-safe. But the library functions may be called from multiple
+   threads, so all the planning is done within this mutex. */
+static pthread_mutex_t fft_fftw_mutex=PTHREAD_MUTEX_INITIALIZER;
+static int fft_fftw_initialized=0;
+
+
+
+
+/* Create the forward (real-to-complex) and backward (complex-to-real)
+   plans. */
+static void
+fft_fftw_plans(struct gal_fft_convolve *fc, char *wisdom)
+{
+  float *r;
+  unsigned flags;
+  fftwf_complex *c;
+  size_t ps0=fc->ps0, ps1=fc->ps1;
+
+  /* Planning may over-write the arrays, so they are only used here. Since
+     the plans are later executed with other arrays (that are also
+     allocated by FFTW), they will have the same alignment. */
+  r=fftwf_alloc_real(ps0*ps1);
+  c=fftwf_alloc_complex(ps0*(ps1/2+1));
+  if(r==NULL || c==NULL)
+    error(EXIT_FAILURE, 0, "%s: couldn't allocate the FFTW arrays for a "
+          "%zux%zu transform", __func__, ps1, ps0);
+
+  /* Initialize FFTW (only once): use the threads if they are available
+     and read the system-wide wisdom (if it exists). */
+  pthread_mutex_lock(&fft_fftw_mutex);
+  if(fft_fftw_initialized==0)
+    {
+#ifdef HAVE_LIBFFTW3F_THREADS
+      fftwf_init_threads();
+#endif
+      fftwf_import_system_wisdom();
+      fft_fftw_initialized=1;
+    }
+#ifdef HAVE_LIBFFTW3F_THREADS
+  fftwf_plan_with_nthreads(fc->numthreads);
+#endif
+
+  /* Read the given wisdom file. It is not an error if it doesn't exist
+     (it will be created after the planning). When a wisdom file is
+     given, the user intends to re-use the plans, so it is worth
+     spending more time on measuring the best plan. */
+  if(wisdom) fftwf_import_wisdom_from_filename(wisdom);
+  flags = wisdom ? FFTW_MEASURE : FFTW_ESTIMATE;
+
+  /* Make the plans. */
+  fc->forward=fftwf_plan_dft_r2c_2d(ps0, ps1, r, c, flags);
+  fc->backward=fftwf_plan_dft_c2r_2d(ps0, ps1, c, r, flags);
+  if(fc->forward==NULL || fc->backward==NULL)
+    error(EXIT_FAILURE, 0, "%s: FFTW could not make the plans for a "
+          "%zux%zu transform", __func__, ps1, ps0);
+
+  /* Write the wisdom (if requested). */
+  if(wisdom && fftwf_export_wisdom_to_filename(wisdom)==0)
+    error(EXIT_SUCCESS, 0, "WARNING: %s: FFTW's wisdom could not be "
+          "written in '%s'", __func__, wisdom);
+  pthread_mutex_unlock(&fft_fftw_mutex);
+
+  /* Clean up. */
+  fftwf_free(c);
+  fftwf_free(r);
+}
+
+
+
+
+
+/* Make the plans and transform the kernel. */
+static void
+fft_fftw_prepare(struct gal_fft_convolve *fc, float *kernel, char *wisdom)
+{
+  float *r, norm;
+  fftwf_complex *c, *kc;
+  size_t j, rsize=fc->ps0*fc->ps1, csize=fc->ps0*(fc->ps1/2+1);
+
+  /* Make the plans. */
+  fft_fftw_plans(fc, wisdom);
+
+  /* Transform the kernel and keep it (normalized, since FFTW's
+     transforms are not normalized). */
+  r=fftwf_alloc_real(rsize);
+  c=fftwf_alloc_complex(csize);
+  kc=fftwf_alloc_complex(csize);
+  if(r==NULL || c==NULL || kc==NULL)
+    error(EXIT_FAILURE, 0, "%s: couldn't allocate the FFTW arrays for a "
+          "%zux%zu transform", __func__, fc->ps1, fc->ps0);
+  norm=1.0f/rsize;
+  memcpy(r, kernel, rsize*sizeof *r);
+  fftwf_execute_dft_r2c(fc->forward, r, c);
+  for(j=0;j<csize;++j)
+    { kc[j][0]=c[j][0]*norm; kc[j][1]=c[j][1]*norm; }
+  fc->kernel=kc;
+
+  /* Clean up. */
+  fftwf_free(c);
+  fftwf_free(r);
+}
+
+
+
+
+
+/* Convolve each image: transform it, multiply it with the kernel's
+   transform and transform it back. The plans are executed on arrays
+   that are allocated here, so this can be called from multiple threads
+   at the same time. */
+static void
+fft_fftw_run(struct gal_fft_convolve *fc, float **imgs, size_t numimgs)
+{
+  float *r, tmp;
+  fftwf_complex *c, *cp, *kp, *kc=fc->kernel;
+  size_t i, j, rsize=fc->ps0*fc->ps1, csize=fc->ps0*(fc->ps1/2+1);
+
+  /* Allocate the (aligned) arrays. */
+  r=fftwf_alloc_real(rsize);
+  c=fftwf_alloc_complex(csize);
+  if(r==NULL || c==NULL)
+    error(EXIT_FAILURE, 0, "%s: couldn't allocate the FFTW arrays for a "
+          "%zux%zu transform", __func__, fc->ps1, fc->ps0);
+
+  /* Convolve the images. */
+  for(i=0;i<numimgs;++i)
+    {
+      memcpy(r, imgs[i], rsize*sizeof *r);
+      fftwf_execute_dft_r2c(fc->forward, r, c);
+      for(j=0;j<csize;++j)
+        {
+          cp=c+j; kp=kc+j;
+          tmp      = (*cp)[0]*(*kp)[0] - (*cp)[1]*(*kp)[1];
+          (*cp)[1] = (*cp)[0]*(*kp)[1] + (*cp)[1]*(*kp)[0];
+          (*cp)[0] = tmp;
+        }
+      fftwf_execute_dft_c2r(fc->backward, c, r);
+      memcpy(imgs[i], r, rsize*sizeof *r);
+    }
+
+  /* Clean up. */
+  fftwf_free(c);
+  fftwf_free(r);
+}
+
+
+
+
+
+static void
+fft_fftw_free(struct gal_fft_convolve *fc)
+{
+  /* Destroying plans is also not thread-safe. */
+  pthread_mutex_lock(&fft_fftw_mutex);
+  fftwf_destroy_plan(fc->forward);
+  fftwf_destroy_plan(fc->backward);
+  pthread_mutex_unlock(&fft_fftw_mutex);
+  fftwf_free(fc->kernel);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*********************************************************************/
+/********************      GSL implementation     ********************/
+/*********************************************************************/
+#else
+
+struct fft_gsl_params
+{
+  double                     *data;  /* Complex array to transform.    */
+  size_t                       ps0;  /* Size along first C axis.       */
+  size_t                       ps1;  /* Size along second C axis.      */
+  int                         rows;  /* ==1: on rows, ==0: on columns. */
+  gsl_fft_direction           sign;  /* Forward or backward.           */
+  gsl_fft_complex_wavetable *wave0;  /* Wavetable along first axis.    */
+  gsl_fft_complex_wavetable *wave1;  /* Wavetable along second axis.   */
+};
+
+
+
+
+
+/* Do the 1D transforms on the rows or columns given to this thread. */
+static void *
+fft_gsl_on_thread(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct fft_gsl_params *p=(struct fft_gsl_params *)tprm->params;
+
+  size_t i, n, stride;
+  double *start, *data=p->data;
+  gsl_fft_complex_wavetable *wave;
+  gsl_fft_complex_workspace *work;
+
+  /* Set the parameters for rows or columns. */
+  if(p->rows) { n=p->ps1; stride=1;      wave=p->wave1; }
+  else        { n=p->ps0; stride=p->ps1; wave=p->wave0; }
+  work=gsl_fft_complex_workspace_alloc(n);
+
+  /* Go over all the rows/columns given to this thread ('2*' is because
+     the array is complex). */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    {
+      start = data + 2 * ( p->rows ? tprm->indexs[i]*p->ps1
+                                   : tprm->indexs[i] );
+      gsl_fft_complex_transform(start, stride, n, wave, work, p->sign);
+    }
+
+  /* Clean up, wait until all other threads finish, then return. In a
+     single thread situation, 'tprm->b==NULL'. */
+  gsl_fft_complex_workspace_free(work);
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* 2D transform: 1D transforms on all the rows, then all the columns. */
+static void
+fft_gsl_2d(struct gal_fft_convolve *fc, double *data,
+           gsl_fft_direction sign)
+{
+  struct fft_gsl_params p;
+
+  p.data=data;
+  p.sign=sign;
+  p.ps0=fc->ps0;
+  p.ps1=fc->ps1;
+  p.wave0=fc->wave0;
+  p.wave1=fc->wave1;
+  p.rows=1;
+  gal_threads_spin_off(fft_gsl_on_thread, &p, p.ps0, fc->numthreads,
+                       fc->minmapsize, fc->quietmmap);
+  p.rows=0;
+  gal_threads_spin_off(fft_gsl_on_thread, &p, p.ps1, fc->numthreads,
+                       fc->minmapsize, fc->quietmmap);
+}
+
+
+
+
+
+/* Make the wavetables and transform the kernel. */
+static void
+fft_gsl_prepare(struct gal_fft_convolve *fc, float *kernel)
+{
+  double *kc, norm;
+  size_t j, size=fc->ps0*fc->ps1;
+
+  /* The wavetables are only read during the transforms, so they can be
+     shared between all the threads. */
+  fc->wave0=gsl_fft_complex_wavetable_alloc(fc->ps0);
+  fc->wave1=gsl_fft_complex_wavetable_alloc(fc->ps1);
+
+  /* Transform the kernel (the normalization of the backward transform
+     is also applied here). */
+  norm=1.0f/size;
+  kc=gal_pointer_allocate(GAL_TYPE_FLOAT64, 2*size, 0, __func__, "kc");
+  for(j=0;j<size;++j) { kc[2*j]=kernel[j]*norm; kc[2*j+1]=0.0f; }
+  fft_gsl_2d(fc, kc, gsl_fft_forward);
+  fc->kernel=kc;
+}
+
+
+
+
+
+/* Convolve each image (the complex array is allocated here, so this can
+   be called from multiple threads at the same time). */
+static void
+fft_gsl_run(struct gal_fft_convolve *fc, float **imgs, size_t numimgs)
+{
+  double *c, r, *kc=fc->kernel;
+  size_t i, j, size=fc->ps0*fc->ps1;
+
+  c=gal_pointer_allocate(GAL_TYPE_FLOAT64, 2*size, 0, __func__, "c");
+  for(i=0;i<numimgs;++i)
+    {
+      for(j=0;j<size;++j) { c[2*j]=imgs[i][j]; c[2*j+1]=0.0f; }
+      fft_gsl_2d(fc, c, gsl_fft_forward);
+      for(j=0;j<size;++j)
+        {
+          r        = c[2*j]*kc[2*j]   - c[2*j+1]*kc[2*j+1];
+          c[2*j+1] = c[2*j]*kc[2*j+1] + c[2*j+1]*kc[2*j];
+          c[2*j]   = r;
+        }
+      fft_gsl_2d(fc, c, gsl_fft_backward);
+      for(j=0;j<size;++j) imgs[i][j]=c[2*j];
+    }
+  free(c);
+}
+
+
+
+
+
+static void
+fft_gsl_free(struct gal_fft_convolve *fc)
+{
+  gsl_fft_complex_wavetable_free(fc->wave0);
+  gsl_fft_complex_wavetable_free(fc->wave1);
+  free(fc->kernel);
+}
+
+#endif
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*********************************************************************/
+/********************       High-level API        ********************/
+/*********************************************************************/
+/* Prepare for circular convolution of real arrays with the real array
+   'kernel' (all have a size of 'ps0 x ps1'): the kernel is transformed
+   and the plans (when FFTW is used) are made only once here, so many
+   images (possibly on different threads) can be convolved with
+   'gal_fft_convolve_run'. Each transform will be done on 'numthreads'
+   threads. When 'gal_fft_convolve_run' is called from multiple threads,
+   'numthreads' should be 1.
+
+   'wisdom' is the name of a file to keep FFTW's measured plans (it is
+   ignored when Gnuastro isn't built with FFTW), it can be NULL. */
+struct gal_fft_convolve *
+gal_fft_convolve_prepare(float *kernel, size_t ps0, size_t ps1,
+                         size_t numthreads, size_t minmapsize,
+                         int quietmmap, char *wisdom)
+{
+  struct gal_fft_convolve *fc;
+
+  /* Allocate and initialize the structure. */
+  errno=0;
+  fc=calloc(1, sizeof *fc);
+  if(fc==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't allocate %zu bytes for 'fc'",
+          __func__, sizeof *fc);
+  fc->ps0=ps0;
+  fc->ps1=ps1;
+  fc->quietmmap=quietmmap;
+  fc->minmapsize=minmapsize;
+  fc->numthreads=numthreads;
+
+  /* Do the preparations of the respective library. */
+#ifdef HAVE_LIBFFTW3F
+  fft_fftw_prepare(fc, kernel, wisdom);
+#else
+  fft_gsl_prepare(fc, kernel);
+#endif
+  return fc;
+}
+
+
+
+
+
+/* Circular convolution of the 'numimgs' arrays in 'imgs' with the kernel
+   of 'fc'. The output is written in the same arrays. */
+void
+gal_fft_convolve_run(struct gal_fft_convolve *fc, float **imgs,
+                     size_t numimgs)
+{
+#ifdef HAVE_LIBFFTW3F
+  fft_fftw_run(fc, imgs, numimgs);
+#else
+  fft_gsl_run(fc, imgs, numimgs);
+#endif
+}
+
+
+
+
+
+void
+gal_fft_convolve_free(struct gal_fft_convolve *fc)
+{
+#ifdef HAVE_LIBFFTW3F
+  fft_fftw_free(fc);
+#else
+  fft_gsl_free(fc);
+#endif
+  free(fc);
+}
+
+
+
+
+
+/* Circular convolution of the 'numimgs' real arrays in 'imgs' with the
+   real array 'kernel' (all have a size of 'ps0 x ps1'). The output is
+   written in the same 'imgs' arrays. Since the kernel is only
+   transformed once, it is much more efficient to call this function once
+   with all the images that need to be convolved with the same kernel. */
+void
+gal_fft_convolve_2d(float **imgs, size_t numimgs, float *kernel,
+                    size_t ps0, size_t ps1, size_t numthreads,
+                    size_t minmapsize, int quietmmap, char *wisdom)
+{
+  struct gal_fft_convolve *fc;
+
+  fc=gal_fft_convolve_prepare(kernel, ps0, ps1, numthreads, minmapsize,
+                              quietmmap, wisdom);
+  gal_fft_convolve_run(fc, imgs, numimgs);
+  gal_fft_convolve_free(fc);
+}
@@ -225,6 +225,19 @@ struct argp_option gal_commonopts_options[] =
       GAL_OPTIONS_NOT_MANDATORY,
       GAL_OPTIONS_NOT_SET
     },
+    {
+      "interpkdtree",
+      GAL_OPTIONS_KEY_INTERPKDTREE,
+      0,
+      0,
+      "Find interpolation neighbors with a k-d tree.",
+      GAL_OPTIONS_GROUP_TESSELLATION,
+      &cp->interpkdtree,
+      GAL_OPTIONS_NO_ARG_TYPE,
+      GAL_OPTIONS_RANGE_0_OR_1,
+      GAL_OPTIONS_NOT_MANDATORY,
+      GAL_OPTIONS_NOT_SET
+    },
 
 
 
@@ -0,0 +1,90 @@
+/*********************************************************************
+Fast Fourier Transform functions (internal to the library).
+This is part of GNU Astronomy Utilities (Gnuastro) package.
+
+Original author:
+     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+Contributing author(s):
+Copyright (C) 2024 Free Software Foundation, Inc.
+
+Gnuastro is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Gnuastro is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+#ifndef __GAL_FFT_H__
+#define __GAL_FFT_H__
+
+/* Include other headers if necessary here. Note that other header files
+   must be included before the C++ preparations below */
+#include <stdlib.h>
+
+/* C++ Preparations */
+#undef __BEGIN_C_DECLS
+#undef __END_C_DECLS
+#ifdef __cplusplus
+# define __BEGIN_C_DECLS extern "C" {
+# define __END_C_DECLS }
+#else
+# define __BEGIN_C_DECLS                /* empty */
+# define __END_C_DECLS                  /* empty */
+#endif
+/* End of C++ preparations */
+
+/* Actual header contants (the above were for the Pre-processor). */
+__BEGIN_C_DECLS  /* From C++ preparations */
+
+
+
+/* Prepared convolution (see 'gal_fft_convolve_prepare'). The library
+   specific elements are kept as 'void *', so the headers of FFTW or GSL
+   are not necessary here. */
+struct gal_fft_convolve
+{
+  size_t         ps0;      /* Size of the arrays along first dimension.  */
+  size_t         ps1;      /* Size of the arrays along second dimension. */
+  size_t  numthreads;      /* Number of threads for each transform.      */
+  size_t  minmapsize;      /* Minimum size to use memory-mapping.        */
+  int      quietmmap;      /* Don't print memory-mapping warnings.       */
+  void       *kernel;      /* Transform of the kernel (normalized).      */
+  void      *forward;      /* FFTW: forward (real-to-complex) plan.      */
+  void     *backward;      /* FFTW: backward (complex-to-real) plan.     */
+  void        *wave0;      /* GSL: wavetable along first dimension.      */
+  void        *wave1;      /* GSL: wavetable along second dimension.     */
+};
+
+
+
+size_t
+gal_fft_good_size(size_t n);
+
+struct gal_fft_convolve *
+gal_fft_convolve_prepare(float *kernel, size_t ps0, size_t ps1,
+                         size_t numthreads, size_t minmapsize,
+                         int quietmmap, char *wisdom);
+
+void
+gal_fft_convolve_run(struct gal_fft_convolve *fc, float **imgs,
+                     size_t numimgs);
+
+void
+gal_fft_convolve_free(struct gal_fft_convolve *fc);
+
+void
+gal_fft_convolve_2d(float **imgs, size_t numimgs, float *kernel,
+                    size_t ps0, size_t ps1, size_t numthreads,
+                    size_t minmapsize, int quietmmap, char *wisdom);
+
+
+
+__END_C_DECLS    /* From C++ preparations */
+
+#endif           /* __GAL_FFT_H__ */
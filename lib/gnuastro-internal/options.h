@@ -122,6 +122,7 @@ enum options_common_keys
   GAL_OPTIONS_KEY_CHECKCONFIG,
   GAL_OPTIONS_KEY_ONLYVERSION,
   GAL_OPTIONS_KEY_CONFIGPREFIX,
+  GAL_OPTIONS_KEY_INTERPKDTREE,
   GAL_OPTIONS_KEY_INTERPMETRIC,
   GAL_OPTIONS_KEY_STDINTIMEOUT,
   GAL_OPTIONS_KEY_INTERPNUMNGB,
@@ -190,6 +191,7 @@ struct gal_options_common_params
   struct gal_tile_two_layer_params tl; /* Two layer tessellation params.  */
   uint8_t      interponlyblank; /* Only interpolate over blank values.    */
   uint8_t         interpmetric; /* Metric to use for nearest-ngb interp.  */
+  uint8_t         interpkdtree; /* Find interpolation ngbs with k-d tree. */
   size_t          interpnumngb; /* Number of neighbors for interpolation. */
 
   /* Input. */
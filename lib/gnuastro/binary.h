@@ -93,7 +93,7 @@ gal_binary_number_neighbors(gal_data_t *input, int connectivity, int inplace);
 /*********************************************************************/
 size_t
 gal_binary_connected_components(gal_data_t *binary, gal_data_t **out,
-                                int connectivity);
+                                int connectivity, size_t numthreads);
 
 gal_data_t *
 gal_binary_connected_indexs(gal_data_t *binary, int connectivity);
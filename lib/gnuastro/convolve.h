@@ -44,18 +44,50 @@ __BEGIN_C_DECLS  /* From C++ preparations */
 
 
 
+/* Convolution domains. */
+enum gal_convolve_domains
+{
+  GAL_CONVOLVE_DOMAIN_INVALID,
+
+  GAL_CONVOLVE_DOMAIN_SPATIAL,
+  GAL_CONVOLVE_DOMAIN_FREQUENCY,
+};
+
+
+
 gal_data_t *
 gal_convolve_spatial(gal_data_t *tiles, gal_data_t *kernel,
                      size_t numthreads, int edgecorrection,
                      int convoverch, int conv_on_blank);
 
 
+gal_data_t *
+gal_convolve_spatial_separable(gal_data_t *tiles, gal_data_t *kernel0,
+                               gal_data_t *kernel1, size_t numthreads,
+                               int edgecorrection, int convoverch,
+                               int conv_on_blank);
+
 void
 gal_convolve_spatial_correct_ch_edge(gal_data_t *tiles, gal_data_t *kernel,
                                      size_t numthreads, int edgecorrection,
                                      int conv_on_blank,
                                      gal_data_t *tocorrect);
 
+gal_data_t *
+gal_convolve_frequency(gal_data_t *tiles, gal_data_t *kernel,
+                       size_t numthreads, int edgecorrection,
+                       int convoverch, int conv_on_blank, char *wisdom);
+
+uint8_t
+gal_convolve_domain_select(gal_data_t *tiles, gal_data_t *kernel,
+                           int edgecorrection, int convoverch,
+                           int conv_on_blank);
+
+gal_data_t *
+gal_convolve_auto(gal_data_t *tiles, gal_data_t *kernel, size_t numthreads,
+                  int edgecorrection, int convoverch, int conv_on_blank,
+                  char *wisdom);
+
 
 
 __END_C_DECLS    /* From C++ preparations */
@@ -94,6 +94,13 @@ gal_interpolate_neighbors(gal_data_t *input,
                           size_t numthreads, int onlyblank,
                           int aslinkedlist, int function);
 
+gal_data_t *
+gal_interpolate_neighbors_kdtree(gal_data_t *input,
+                                 struct gal_tile_two_layer_params *tl,
+                                 uint8_t metric, size_t numneighbors,
+                                 size_t numthreads, int onlyblank,
+                                 int aslinkedlist, int function);
+
 gsl_spline *
 gal_interpolate_1d_make_gsl_spline(gal_data_t *X, gal_data_t *Y, int type_1d);
 
@@ -48,13 +48,47 @@ __BEGIN_C_DECLS  /* From C++ preparations */
 
 
 
+/* Maximum number of points in each leaf of a flat k-d tree. */
+#define GAL_KDTREE_FLAT_BUCKET 16
+
+
+
+gal_data_t *
+gal_kdtree_create(gal_data_t *coords_raw, size_t numthreads,
+                  size_t *root);
+
+gal_data_t *
+gal_kdtree_flat_create(gal_data_t *coords_raw, size_t numthreads,
+                       size_t minmapsize, int quietmmap);
+
+int
+gal_kdtree_is_flat(gal_data_t *kdtree);
+
+void
+gal_kdtree_flat_index_write(gal_data_t *coords, gal_data_t *kdtree,
+                            unsigned long datasum, char *filename);
+
 gal_data_t *
-gal_kdtree_create(gal_data_t *coords_raw, size_t *root);
+gal_kdtree_flat_index_read(char *filename, gal_data_t *coords,
+                           unsigned long datasum);
+
+void
+gal_kdtree_flat_index_free(gal_data_t *kdtree);
 
 size_t
 gal_kdtree_nearest_neighbour(gal_data_t *coords_raw, gal_data_t *kdtree,
                              size_t root, double *point, double *least_dist);
 
+gal_data_t *
+gal_kdtree_knn(gal_data_t *coords_raw, gal_data_t *kdtree, size_t root,
+               gal_data_t *query, size_t k, size_t numthreads,
+               size_t minmapsize, int quietmmap);
+
+gal_data_t *
+gal_kdtree_range(gal_data_t *coords_raw, gal_data_t *kdtree, size_t root,
+                 gal_data_t *query, double radius, size_t numthreads,
+                 size_t minmapsize, int quietmmap);
+
 
 
 __END_C_DECLS    /* From C++ preparations */
@@ -332,6 +332,38 @@ gal_list_dosizet_free(gal_list_dosizet_t *largest);
 
 
 
+/****************************************************************
+ ***************    Heap (priority queue) size_t   **************
+ ****************************************************************/
+typedef struct gal_list_hsizet_t
+{
+  size_t *v;                      /* Values (in the order of addition). */
+  float *s;                       /* The parameter to sort by.          */
+  size_t *heap;                   /* Heap of indexs in 'v' and 's'.     */
+  size_t size;                    /* Number of elements in the heap.    */
+  size_t added;                   /* Number of added elements.          */
+  size_t allocated;               /* Number of allocated elements.      */
+} gal_list_hsizet_t;
+
+gal_list_hsizet_t *
+gal_list_hsizet_alloc(size_t allocated);
+
+void
+gal_list_hsizet_add(gal_list_hsizet_t *heap, size_t value, float tosort);
+
+size_t
+gal_list_hsizet_pop_smallest(gal_list_hsizet_t *heap, float *tosort);
+
+void
+gal_list_hsizet_empty(gal_list_hsizet_t *heap);
+
+void
+gal_list_hsizet_free(gal_list_hsizet_t *heap);
+
+
+
+
+
 /****************************************************************
  *****************        gal_data_t         ********************
  ****************************************************************/
@@ -48,8 +48,8 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 gal_data_t *
 gal_match_sort_based(gal_data_t *coord1, gal_data_t *coord2,
                       double *aperture, int sorted_by_first,
-                      int inplace, size_t minmapsize, int quietmmap,
-                      size_t *nummatched);
+                      int inplace, size_t numthreads, size_t minmapsize,
+                      int quietmmap, size_t *nummatched);
 
 gal_data_t *
 gal_match_kdtree(gal_data_t *coord1, gal_data_t *coord2,
@@ -57,6 +57,12 @@ gal_match_kdtree(gal_data_t *coord1, gal_data_t *coord2,
                  double *aperture, size_t numthreads, size_t minmapsize,
                  int quietmmap, size_t *nummatched);
 
+gal_data_t *
+gal_match_partitioned(gal_data_t *coord1, gal_data_t *coord2,
+                      double *aperture, size_t numthreads,
+                      size_t minmapsize, int quietmmap,
+                      size_t *nummatched);
+
 
 
 
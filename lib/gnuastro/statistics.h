@@ -53,6 +53,9 @@ __BEGIN_C_DECLS  /* From C++ preparations */
 /* Least acceptable mode symmetricity.*/
 #define GAL_STATISTICS_MODE_GOOD_SYM         0.2f
 
+/* Default number of elements in each level of the streaming sketch. */
+#define GAL_STATISTICS_SKETCH_K              8192
+
 
 
 
@@ -96,6 +99,9 @@ gal_statistics_minimum(gal_data_t *input);
 gal_data_t *
 gal_statistics_maximum(gal_data_t *input);
 
+gal_data_t *
+gal_statistics_minmax(gal_data_t *input, size_t numthreads);
+
 gal_data_t *
 gal_statistics_sum(gal_data_t *input);
 
@@ -106,7 +112,7 @@ gal_data_t *
 gal_statistics_std(gal_data_t *input);
 
 gal_data_t *
-gal_statistics_mean_std(gal_data_t *input);
+gal_statistics_mean_std(gal_data_t *input, size_t numthreads);
 
 double
 gal_statistics_std_from_sums(double sum, double sump2, size_t num);
@@ -126,6 +132,10 @@ gal_statistics_quantile_index(size_t size, double quantile);
 gal_data_t *
 gal_statistics_quantile(gal_data_t *input, double quantile, int inplace);
 
+gal_data_t *
+gal_statistics_quantiles(gal_data_t *input, double *quantiles,
+                         size_t numquantiles, int inplace);
+
 size_t
 gal_statistics_quantile_function_index(gal_data_t *input, gal_data_t *value,
                                        int inplace);
@@ -166,10 +176,10 @@ int
 gal_statistics_is_sorted(gal_data_t *input, int updateflags);
 
 void
-gal_statistics_sort_increasing(gal_data_t *input);
+gal_statistics_sort_increasing(gal_data_t *input, size_t numthreads);
 
 void
-gal_statistics_sort_decreasing(gal_data_t *input);
+gal_statistics_sort_decreasing(gal_data_t *input, size_t numthreads);
 
 gal_data_t *
 gal_statistics_no_blank_sorted(gal_data_t *input, int inplace);
@@ -187,10 +197,19 @@ gal_statistics_regular_bins(gal_data_t *data, gal_data_t *range,
 
 gal_data_t *
 gal_statistics_histogram(gal_data_t *data, gal_data_t *bins,
-                         int normalize, int maxhistone);
+                         int normalize, int maxhistone, size_t numthreads);
+
+gal_data_t *
+gal_statistics_histogram2d(gal_data_t *input, gal_data_t *bins,
+                           size_t numthreads);
+
+gal_data_t *
+gal_statistics_histogram_add(gal_data_t *input, gal_data_t *bins,
+                             gal_data_t *hist);
 
 gal_data_t *
-gal_statistics_histogram2d(gal_data_t *input, gal_data_t *bins);
+gal_statistics_histogram_normalize(gal_data_t *hist, int normalize,
+                                   int maxone);
 
 gal_data_t *
 gal_statistics_cfp(gal_data_t *data, gal_data_t *bins, int normalize);
@@ -235,6 +254,58 @@ gal_statistics_outlier_flat_cfp(gal_data_t *input, size_t numprev,
 
 
 
+
+
+/****************************************************************
+ *****************      Streaming sketch     ********************
+ ****************************************************************/
+/* Summary of a distribution that is built in one pass over the elements
+   (see the comments above 'gal_statistics_sketch_alloc'). */
+struct gal_statistics_sketch
+{
+  size_t             k;   /* Number of elements to compact a level.    */
+  size_t     numlevels;   /* Number of levels.                         */
+  double      **levels;   /* Elements of each level (2^h weight).      */
+  size_t        *sizes;   /* Number of elements in each level.         */
+  double          *tmp;   /* Scratch space for sorting the levels.     */
+  size_t        number;   /* Number of (non-blank) input elements.     */
+  double       minimum;   /* Minimum of the inputs.                    */
+  double       maximum;   /* Maximum of the inputs.                    */
+  double           sum;   /* Sum of the inputs.                        */
+  double          sumc;   /* Compensation of the sum (Neumaier).       */
+  double          mean;   /* Mean of the inputs.                       */
+  double            m2;   /* Sum of squared differences from mean.     */
+  double      variance;   /* Sum of squared maximum rank errors.       */
+  uint64_t        seed;   /* State of the random number generator.     */
+};
+
+struct gal_statistics_sketch *
+gal_statistics_sketch_alloc(size_t k);
+
+void
+gal_statistics_sketch_free(struct gal_statistics_sketch *sk);
+
+void
+gal_statistics_sketch_add(struct gal_statistics_sketch *sk,
+                          gal_data_t *input);
+
+void
+gal_statistics_sketch_merge(struct gal_statistics_sketch *out,
+                            struct gal_statistics_sketch *in);
+
+double
+gal_statistics_sketch_error(struct gal_statistics_sketch *sk);
+
+gal_data_t *
+gal_statistics_sketch_quantiles(struct gal_statistics_sketch *sk,
+                                double *quantiles, size_t numquantiles);
+
+double
+gal_statistics_sketch_quantile_function(struct gal_statistics_sketch *sk,
+                                        double value);
+
+
+
 __END_C_DECLS    /* From C++ preparations */
 
 #endif           /* __GAL_STATISTICS_H__ */
@@ -123,6 +123,8 @@ struct gal_threads_params
   void         *params; /* Input structure for higher-level settings.    */
   size_t       *indexs; /* Indexes of actions to be done in this thread. */
   pthread_barrier_t *b; /* Pointer the barrier for all threads.          */
+  size_t         *next; /* Dynamic scheduling: next action (shared).     */
+  size_t    numactions; /* Dynamic scheduling: total number of actions.  */
 };
 
 void
@@ -130,6 +132,13 @@ gal_threads_spin_off(void *(*worker)(void *), void *caller_params,
                      size_t numactions, size_t numthreads,
                      size_t minmapsize, int quietmmap);
 
+void
+gal_threads_spin_off_dynamic(void *(*worker)(void *), void *caller_params,
+                             size_t numactions, size_t numthreads);
+
+size_t
+gal_threads_next_action(struct gal_threads_params *tprm, size_t i);
+
 
 __END_C_DECLS    /* From C++ preparations */
 
@@ -31,6 +31,7 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 #include <gnuastro/list.h>
 #include <gnuastro/fits.h>
 #include <gnuastro/blank.h>
+#include <gnuastro/kdtree.h>
 #include <gnuastro/pointer.h>
 #include <gnuastro/threads.h>
 #include <gnuastro/dimension.h>
@@ -68,6 +69,8 @@ struct interpolate_ngb_params
   uint8_t                *thread_flags;
   int                        onlyblank;
   gal_list_void_t            *ngb_vals;
+  size_t                     *queryrow;  /* k-d tree: row of each element. */
+  size_t                       *ngbind;  /* k-d tree: neighbors of rows.   */
   float (*metric)(size_t *, size_t *, size_t );
 
   struct gal_tile_two_layer_params *tl;
@@ -77,6 +80,100 @@ struct interpolate_ngb_params
 
 
 
+/* Put the space that was allocated for keeping the neighbor values of
+   this thread into a list of datasets (one for each input) for easy
+   processing. */
+static gal_data_t *
+interpolate_neighbors_nearest(struct interpolate_ngb_params *prm,
+                              size_t id)
+{
+  void *nv;
+  gal_list_void_t *tvll;
+  gal_data_t *tin=prm->input, *nearest=NULL;
+
+  for(tvll=prm->ngb_vals; tvll!=NULL; tvll=tvll->next)
+    {
+      nv=gal_pointer_increment(tvll->v, id*prm->numneighbors, tin->type);
+      gal_list_data_add_alloc(&nearest, nv, tin->type, 1,
+                              &prm->numneighbors, NULL, 0, -1, 1,
+                              NULL, NULL, NULL);
+      tin=tin->next;
+    }
+  gal_list_data_reverse(&nearest);
+  return nearest;
+}
+
+
+
+
+
+/* Copy the value of element 'ind' of the input(s) into the 'counter'th
+   element of the 'to' list of datasets. */
+static void
+interpolate_neighbors_copy(gal_data_t *input, size_t ind, gal_data_t *to,
+                           size_t counter)
+{
+  gal_data_t *tin=input, *tto;
+
+  for(tto=to; tto!=NULL; tto=tto->next)
+    {
+      memcpy(gal_pointer_increment(tto->array, counter, tin->type),
+             gal_pointer_increment(tin->array, ind,     tin->type),
+             gal_type_sizeof(tin->type));
+      tin=tin->next;
+    }
+}
+
+
+
+
+
+/* Calculate the desired statistic over the neighbor values in 'nearest',
+   and write it in the 'fullind' element of the output(s). */
+static void
+interpolate_neighbors_statistic(struct interpolate_ngb_params *prm,
+                                gal_data_t *nearest, size_t fullind)
+{
+  gal_data_t *tnear, *value=NULL, *tout=prm->out;
+
+  for(tnear=nearest; tnear!=NULL; tnear=tnear->next)
+    {
+      /* Find the desired statistic and copy it, but first, reset the
+         flags (which remain from the last time). */
+      tnear->flag &= ~(GAL_DATA_FLAG_SORT_CH | GAL_DATA_FLAG_BLANK_CH);
+      switch(prm->function)
+        {
+        case GAL_INTERPOLATE_NEIGHBORS_FUNC_MIN:
+          value=gal_statistics_minimum(tnear); break;
+          break;
+        case GAL_INTERPOLATE_NEIGHBORS_FUNC_MAX:
+          value=gal_statistics_maximum(tnear); break;
+          break;
+        case GAL_INTERPOLATE_NEIGHBORS_FUNC_MEAN:
+          value=gal_statistics_mean(tnear); /* Out can be a diff. type */
+          value=gal_data_copy_to_new_type_free(value, tnear->type);
+          break;
+        case GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN:
+          value=gal_statistics_median(tnear, 1); break;
+        default:
+          error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s "
+                "to fix the problem. The value %d is not a recognized "
+                "interpolation function identifier", __func__,
+                PACKAGE_BUGREPORT, prm->function);
+        }
+      memcpy(gal_pointer_increment(tout->array, fullind, tout->type),
+             value->array, gal_type_sizeof(tout->type));
+
+      /* Clean up and go to next array. */
+      gal_data_free(value);
+      tout=tout->next;
+    }
+}
+
+
+
+
+
 /* Run the interpolation on many threads. */
 static void *
 interpolate_neighbors_on_thread(void *in_prm)
@@ -92,15 +189,10 @@ interpolate_neighbors_on_thread(void *in_prm)
   gal_data_t *input=prm->input;
 
   /* Rest of variables. */
-  void *nv;
   float dist, pdist;
   uint8_t *b, *bf, *bb;
-  gal_list_void_t *tvll;
   size_t ngb_counter, pind;
-  gal_list_dosizet_t *lQ, *sQ;
-  size_t i, index, fullind, chstart=0, ndim=input->ndim;
-  gal_data_t *tin, *tout, *tnear, *value=NULL, *nearest=NULL;
-  size_t size = (correct_index ? tl->tottilesinch : input->size);
+  size_t i, j, index, fullind, chstart=0, ndim=input->ndim;
   size_t *dsize = (correct_index ? tl->numtilesinch : input->dsize);
   size_t *icoord=gal_pointer_allocate(GAL_TYPE_SIZE_T, ndim, 0, __func__,
                                       "icoord");
@@ -109,6 +201,8 @@ interpolate_neighbors_on_thread(void *in_prm)
   uint8_t *flag, *fullflag=&prm->thread_flags[tprm->id*input->size];
 
   /* Based on the above. */
+  gal_data_t *tnear, *nearest=interpolate_neighbors_nearest(prm, tprm->id);
+  gal_list_hsizet_t *queue=gal_list_hsizet_alloc(4*prm->numneighbors);
   size_t *dinc=gal_dimension_increment(ndim, dsize);
 
 
@@ -124,21 +218,6 @@ interpolate_neighbors_on_thread(void *in_prm)
   do *b = *bb++ ? INTERPOLATE_FLAGS_BLANK : 0; while(++b<bf);
 
 
-  /* Put the allocated space to keep the neighbor values into a structure
-     for easy processing. */
-  tin=input;
-  for(tvll=prm->ngb_vals; tvll!=NULL; tvll=tvll->next)
-    {
-      nv=gal_pointer_increment(tvll->v, tprm->id*prm->numneighbors,
-                               input->type);
-      gal_list_data_add_alloc(&nearest, nv, tin->type, 1,
-                              &prm->numneighbors, NULL, 0, -1, 1,
-                              NULL, NULL, NULL);
-      tin=tin->next;
-    }
-  gal_list_data_reverse(&nearest);
-
-
   /* Go over all the points given to this thread. */
   for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
     {
@@ -152,14 +231,7 @@ interpolate_neighbors_on_thread(void *in_prm)
          next element. */
       if(prm->onlyblank && !(fullflag[fullind] & INTERPOLATE_FLAGS_BLANK) )
         {
-          tin=input;
-          for(tout=prm->out; tout!=NULL; tout=tout->next)
-            {
-              memcpy(gal_pointer_increment(tout->array, fullind, tin->type),
-                     gal_pointer_increment(tin->array,  fullind, tin->type),
-                     gal_type_sizeof(tin->type));
-              tin=tin->next;
-            }
+          interpolate_neighbors_copy(input, fullind, prm->out, fullind);
           continue;
         }
 
@@ -189,49 +261,32 @@ interpolate_neighbors_on_thread(void *in_prm)
         }
 
 
-      /* Reset all checked bits in the flags array to 0. */
+      /* No neighbors have been found for this element yet. */
       ngb_counter=0;
-      bf=(b=flag)+size;
-      do *b &= ~(INTERPOLATE_FLAGS_NGB_CHECKED); while(++b<bf);
 
 
       /* Get the coordinates of this pixel (to be interpolated). */
       gal_dimension_index_to_coord(index, ndim, dsize, icoord);
 
 
-      /* Start parsing the neighbors. We will use a two-way ordered linked
-         list structure. To start from the nearest and go out to the
-         farthest. */
-      lQ=sQ=NULL;
-      gal_list_dosizet_add(&lQ, &sQ, index, 0.0f);
-      while(sQ)
+      /* Start parsing the neighbors. We will use a priority queue (heap)
+         to start from the nearest and go out to the farthest. */
+      gal_list_hsizet_add(queue, index, 0.0f);
+      while(queue->size)
         {
           /* Pop-out (p) an index from the queue: */
-          pind=gal_list_dosizet_pop_smallest(&lQ, &sQ, &pdist);
+          pind=gal_list_hsizet_pop_smallest(queue, &pdist);
 
           /* If this isn't a blank value then add its values to the list of
              neighbor values. Note that we didn't check whether the values
              were blank or not when adding this pixel to the queue. */
           if( !(flag[pind] & INTERPOLATE_FLAGS_BLANK) )
             {
-              tin=input;
-              for(tnear=nearest; tnear!=NULL; tnear=tnear->next)
-                {
-                  memcpy(gal_pointer_increment(tnear->array, ngb_counter,
-                                               tin->type),
-                         gal_pointer_increment(tin->array, chstart+pind,
-                                               tin->type),
-                         gal_type_sizeof(tin->type));
-                  tin=tin->next;
-                }
-
-              /* If we have filled all the elements clean up the linked
-                 list and break out. */
-              if(++ngb_counter>=prm->numneighbors)
-                {
-                  if(lQ) gal_list_dosizet_free(lQ);
-                  break;
-                }
+              interpolate_neighbors_copy(input, chstart+pind, nearest,
+                                         ngb_counter);
+
+              /* If we have filled all the elements, break out. */
+              if(++ngb_counter>=prm->numneighbors) break;
             }
 
           /* Go over all the neighbors of this popped pixel and add them to
@@ -251,7 +306,7 @@ interpolate_neighbors_on_thread(void *in_prm)
                  dist=prm->metric(icoord, ncoord, ndim);
 
                  /* Add this neighbor to the list. */
-                 gal_list_dosizet_add(&lQ, &sQ, nind, dist);
+                 gal_list_hsizet_add(queue, nind, dist);
 
                  /* Flag this neighbor as checked. */
                  flag[nind] |= INTERPOLATE_FLAGS_NGB_CHECKED;
@@ -262,53 +317,29 @@ interpolate_neighbors_on_thread(void *in_prm)
              shows, there were not enough points for
              interpolation. Normally, this loop should only be exited
              through the 'currentnum>=numnearest' check above. */
-          if(sQ==NULL)
+          if(queue->size==0)
             error(EXIT_FAILURE, 0, "%s: only %zu neighbors found while "
                   "you had asked to use %zu neighbors for close neighbor "
                   "interpolation", __func__, ngb_counter,
                   prm->numneighbors);
         }
 
-      /* Calculate the desired statistic, and write it in the output. */
-      tout=prm->out;
-      for(tnear=nearest; tnear!=NULL; tnear=tnear->next)
-        {
-          /* Find the desired statistic and copy it, but first, reset the
-             flags (which remain from the last time). */
-          tnear->flag &= ~(GAL_DATA_FLAG_SORT_CH | GAL_DATA_FLAG_BLANK_CH);
-          switch(prm->function)
-            {
-            case GAL_INTERPOLATE_NEIGHBORS_FUNC_MIN:
-              value=gal_statistics_minimum(tnear); break;
-              break;
-            case GAL_INTERPOLATE_NEIGHBORS_FUNC_MAX:
-              value=gal_statistics_maximum(tnear); break;
-              break;
-            case GAL_INTERPOLATE_NEIGHBORS_FUNC_MEAN:
-              value=gal_statistics_mean(tnear); /* Out can be a diff. type */
-              value=gal_data_copy_to_new_type_free(value, tnear->type);
-              break;
-            case GAL_INTERPOLATE_NEIGHBORS_FUNC_MEDIAN:
-              value=gal_statistics_median(tnear, 1); break;
-            default:
-              error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s "
-                    "to fix the problem. The value %d is not a recognized "
-                    "interpolation function identifier", __func__,
-                    PACKAGE_BUGREPORT, prm->function);
-            }
-          memcpy(gal_pointer_increment(tout->array, fullind, tout->type),
-                 value->array, gal_type_sizeof(tout->type));
+      /* Reset the checked flags of all the elements that were added to
+         the queue (the only ones that were checked), and empty the queue
+         for the next element. */
+      for(j=0;j<queue->added;++j)
+        flag[ queue->v[j] ] &= ~(INTERPOLATE_FLAGS_NGB_CHECKED);
+      gal_list_hsizet_empty(queue);
 
-          /* Clean up and go to next array. */
-          gal_data_free(value);
-          tout=tout->next;
-        }
+      /* Calculate the desired statistic, and write it in the output. */
+      interpolate_neighbors_statistic(prm, nearest, fullind);
     }
 
 
   /* Clean up. */
   for(tnear=nearest; tnear!=NULL; tnear=tnear->next) tnear->array=NULL;
   gal_list_data_free(nearest);
+  gal_list_hsizet_free(queue);
   free(icoord);
   free(ncoord);
   free(dinc);
@@ -323,6 +354,325 @@ interpolate_neighbors_on_thread(void *in_prm)
 
 
 
+/* Allocate a list of 'ndim' 64-bit floating point columns with 'size'
+   rows (to keep the coordinates of the points in a k-d tree search). */
+static gal_data_t *
+interpolate_kdtree_columns(size_t ndim, size_t size)
+{
+  size_t d;
+  gal_data_t *out=NULL;
+
+  for(d=0;d<ndim;++d)
+    gal_list_data_add_alloc(&out, NULL, GAL_TYPE_FLOAT64, 1, &size, NULL,
+                            0, -1, 1, NULL, NULL, NULL);
+  return out;
+}
+
+
+
+
+
+/* Write the coordinates of element 'index' (in a dataset of size 'dsize')
+   into row 'row' of the 'cols' columns. */
+static void
+interpolate_kdtree_coord(gal_data_t *cols, size_t row, size_t index,
+                         size_t ndim, size_t *dsize, size_t *coord)
+{
+  size_t d=0;
+  gal_data_t *tmp;
+
+  gal_dimension_index_to_coord(index, ndim, dsize, coord);
+  for(tmp=cols; tmp!=NULL; tmp=tmp->next)
+    ((double *)(tmp->array))[row]=coord[d++];
+}
+
+
+
+
+
+/* Parameters to select the neighbors of the elements of one channel from
+   the k-d tree's candidates. */
+struct interpolate_kdtree_params
+{
+  struct interpolate_ngb_params *prm;  /* Interpolation parameters.      */
+  size_t                    chstart;  /* First element of the channel.  */
+  size_t                     *dsize;  /* Size of channel along each dim.*/
+  size_t                      *vind;  /* Index of each k-d tree point.  */
+  size_t                      *pend;  /* Index of each pending element. */
+  size_t                      *rows;  /* Candidates of pending elements.*/
+  double                     *dists;  /* Radial distance of candidates. */
+  size_t                         kk;  /* Number of candidates.          */
+  int                           all;  /* Candidates are all the points. */
+  uint8_t                     *done;  /* Pending element is finished.   */
+};
+
+
+
+
+
+/* Keep the first 'numneighbors' candidates of each pending element (as
+   indexs in the full input). The candidates are sorted by their radial
+   distance, so with any other metric, they are first sorted by the metric
+   (with an insertion sort, so equal distances keep their radial
+   order). This is only accepted when the last kept candidate (by the
+   metric) is not farther than the radial distance of the last candidate:
+   the metrics here are never smaller than the radial distance, so no
+   element outside the candidates can be nearer. Otherwise, the element
+   remains pending. */
+static void *
+interpolate_kdtree_select(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct interpolate_kdtree_params *p=
+    (struct interpolate_kdtree_params *)(tprm->params);
+  struct interpolate_ngb_params *prm=p->prm;
+
+  float d;
+  double *dt;
+  size_t i, j, m, q, *r, *ngb;
+  size_t kk=p->kk, k=prm->numneighbors, ndim=prm->input->ndim;
+  int radial=prm->metric==gal_dimension_dist_radial;
+  float *mdist=gal_pointer_allocate(GAL_TYPE_FLOAT32, kk, 0, __func__,
+                                    "mdist");
+  size_t *order=gal_pointer_allocate(GAL_TYPE_SIZE_T, kk, 0, __func__,
+                                     "order");
+  size_t *icoord=gal_pointer_allocate(GAL_TYPE_SIZE_T, ndim, 0, __func__,
+                                      "icoord");
+  size_t *ncoord=gal_pointer_allocate(GAL_TYPE_SIZE_T, ndim, 0, __func__,
+                                      "ncoord");
+
+  /* Go over the pending elements given to this thread. */
+  for(i=0; (q=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      r=p->rows+q*kk;
+      dt=p->dists+q*kk;
+      ngb=prm->ngbind + prm->queryrow[p->chstart+p->pend[q]]*k;
+      if(radial)
+        {
+          for(j=0;j<k;++j) ngb[j]=p->chstart+p->vind[r[j]];
+          p->done[q]=1;
+        }
+      else
+        {
+          /* Sort the candidates by the metric. */
+          gal_dimension_index_to_coord(p->pend[q], ndim, p->dsize, icoord);
+          for(j=0;j<kk;++j)
+            {
+              gal_dimension_index_to_coord(p->vind[r[j]], ndim, p->dsize,
+                                           ncoord);
+              d=prm->metric(icoord, ncoord, ndim);
+              for(m=j; m>0 && mdist[m-1]>d; --m)
+                { mdist[m]=mdist[m-1]; order[m]=order[m-1]; }
+              mdist[m]=d;
+              order[m]=r[j];
+            }
+
+          /* Keep the first 'k' if no other element can be nearer. */
+          p->done[q] = p->all || mdist[k-1]<=dt[kk-1];
+          if(p->done[q])
+            for(j=0;j<k;++j) ngb[j]=p->chstart+p->vind[order[j]];
+        }
+    }
+
+  /* Clean up, wait for all the other threads to finish and return. */
+  free(mdist);
+  free(order);
+  free(icoord);
+  free(ncoord);
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Find the neighbors of all the elements that should be interpolated in
+   one channel: its first element is 'chstart' (within the input) and it
+   has 'chsize' elements (with a size of 'dsize' along each dimension).
+
+   A k-d tree is built over the non-blank elements of the channel and the
+   nearest neighbors of all the query elements are searched in parallel.
+   The k-d tree only knows radial distances, so with any other metric, the
+   elements whose neighbors couldn't be found among the candidates (see
+   'interpolate_kdtree_select') are searched again with twice the number
+   of candidates. */
+static void
+interpolate_kdtree_channel(struct interpolate_ngb_params *prm,
+                           size_t chstart, size_t chsize, size_t *dsize,
+                           size_t numthreads)
+{
+  gal_data_t *input=prm->input;
+  size_t *queryrow=prm->queryrow+chstart, k=prm->numneighbors;
+  uint8_t *blank=(uint8_t *)(prm->blanks->array)+chstart;
+
+  gal_data_t *coords, *tree, *query, *knn;
+  struct interpolate_kdtree_params p={0};
+  size_t i, n, q, v, nvalid, npend, ndim=input->ndim;
+  size_t *coord=gal_pointer_allocate(GAL_TYPE_SIZE_T, ndim, 0, __func__,
+                                     "coord");
+
+  /* Count the non-blank elements and the elements to interpolate. */
+  nvalid=npend=0;
+  for(i=0;i<chsize;++i)
+    {
+      if(blank[i]==0) ++nvalid;
+      if(queryrow[i]!=GAL_BLANK_SIZE_T) ++npend;
+    }
+  if(npend==0) { free(coord); return; }
+  if(nvalid<k)
+    error(EXIT_FAILURE, 0, "%s: only %zu neighbors found while you had "
+          "asked to use %zu neighbors for close neighbor interpolation",
+          __func__, nvalid, k);
+
+  /* Keep the coordinates of the non-blank elements for the k-d tree (and
+     their index in the channel), and the index of the elements to be
+     interpolated (that are "pending" until their neighbors are found). */
+  p.prm=prm;
+  p.dsize=dsize;
+  p.chstart=chstart;
+  coords=interpolate_kdtree_columns(ndim, nvalid);
+  p.vind=gal_pointer_allocate(GAL_TYPE_SIZE_T, nvalid, 0, __func__,
+                              "p.vind");
+  p.pend=gal_pointer_allocate(GAL_TYPE_SIZE_T, npend, 0, __func__,
+                              "p.pend");
+  p.done=gal_pointer_allocate(GAL_TYPE_UINT8, npend, 0, __func__,
+                              "p.done");
+  for(i=v=q=0;i<chsize;++i)
+    {
+      if(blank[i]==0)
+        {
+          interpolate_kdtree_coord(coords, v, i, ndim, dsize, coord);
+          p.vind[v++]=i;
+        }
+      if(queryrow[i]!=GAL_BLANK_SIZE_T) p.pend[q++]=i;
+    }
+  tree=gal_kdtree_flat_create(coords, numthreads, input->minmapsize,
+                              input->quietmmap);
+
+  /* Find the neighbors of the pending elements. */
+  for(p.kk=k; npend; p.kk = 2*p.kk<nvalid ? 2*p.kk : nvalid)
+    {
+      /* Search for the 'kk' nearest neighbors (by radial distance) of all
+         the pending elements. */
+      query=interpolate_kdtree_columns(ndim, npend);
+      for(q=0;q<npend;++q)
+        interpolate_kdtree_coord(query, q, p.pend[q], ndim, dsize, coord);
+      knn=gal_kdtree_knn(coords, tree, 0, query, p.kk, numthreads,
+                         input->minmapsize, input->quietmmap);
+
+      /* Select the neighbors of each pending element. */
+      p.rows=knn->array;
+      p.dists=knn->next->array;
+      p.all=p.kk==nvalid;
+      gal_threads_spin_off_dynamic(interpolate_kdtree_select, &p, npend,
+                                   numthreads);
+
+      /* Only keep the elements that are still pending. */
+      for(q=n=0;q<npend;++q) if(p.done[q]==0) p.pend[n++]=p.pend[q];
+      npend=n;
+
+      /* Clean up for the next round. */
+      gal_list_data_free(knn);
+      gal_list_data_free(query);
+    }
+
+  /* Clean up. */
+  gal_list_data_free(tree);
+  gal_list_data_free(coords);
+  free(p.vind);
+  free(p.pend);
+  free(p.done);
+  free(coord);
+}
+
+
+
+
+
+/* Find the neighbors of all the elements that should be interpolated with
+   a k-d tree. The row of each element (in 'prm->ngbind', that keeps the
+   indexs of its 'numneighbors' neighbors) is kept in 'prm->queryrow'
+   (which is blank for the elements that don't need interpolation). */
+static void
+interpolate_kdtree_neighbors(struct interpolate_ngb_params *prm,
+                             size_t numthreads)
+{
+  gal_data_t *input=prm->input;
+  struct gal_tile_two_layer_params *tl=prm->tl;
+  int correct_index=(tl && tl->totchannels>1 && !tl->workoverch);
+
+  /* Higher-level variables. */
+  uint8_t *blank=prm->blanks->array;
+  size_t i, c, nquery, k=prm->numneighbors;
+  size_t *dsize = correct_index ? tl->numtilesinch : input->dsize;
+  size_t nch    = correct_index ? tl->totchannels  : 1;
+  size_t chsize = correct_index ? tl->tottilesinch : input->size;
+
+  /* Set the row of each element that should be interpolated. */
+  prm->queryrow=gal_pointer_allocate(GAL_TYPE_SIZE_T, input->size, 0,
+                                     __func__, "prm->queryrow");
+  for(i=nquery=0;i<input->size;++i)
+    prm->queryrow[i] = ( prm->onlyblank && blank[i]==0
+                         ? GAL_BLANK_SIZE_T
+                         : nquery++ );
+
+  /* Find the neighbors within each channel. */
+  prm->ngbind = ( nquery
+                  ? gal_pointer_allocate(GAL_TYPE_SIZE_T, nquery*k, 0,
+                                         __func__, "prm->ngbind")
+                  : NULL );
+  for(c=0;c<nch;++c)
+    interpolate_kdtree_channel(prm, c*chsize, chsize, dsize, numthreads);
+}
+
+
+
+
+
+/* Run the interpolation on many threads (with the neighbors that were
+   found with a k-d tree). */
+static void *
+interpolate_neighbors_kdtree_on_thread(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct interpolate_ngb_params *prm=
+    (struct interpolate_ngb_params *)(tprm->params);
+
+  size_t i, j, row, fullind, k=prm->numneighbors;
+  gal_data_t *tnear, *nearest=interpolate_neighbors_nearest(prm, tprm->id);
+
+  /* Go over all the points given to this thread. */
+  for(i=0; tprm->indexs[i] != GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Elements that don't need interpolation are just copied. */
+      fullind=tprm->indexs[i];
+      row=prm->queryrow[fullind];
+      if(row==GAL_BLANK_SIZE_T)
+        {
+          interpolate_neighbors_copy(prm->input, fullind, prm->out,
+                                     fullind);
+          continue;
+        }
+
+      /* Copy the values of the neighbors and write the statistic. */
+      for(j=0;j<k;++j)
+        interpolate_neighbors_copy(prm->input, prm->ngbind[row*k+j],
+                                   nearest, j);
+      interpolate_neighbors_statistic(prm, nearest, fullind);
+    }
+
+  /* Clean up, wait for all the other threads to finish and return. */
+  for(tnear=nearest; tnear!=NULL; tnear=tnear->next) tnear->array=NULL;
+  gal_list_data_free(nearest);
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
 /* When no interpolation is needed, then we can just copy the input into
    the output. */
 static gal_data_t *
@@ -359,13 +709,15 @@ interpolate_copy_input(gal_data_t *input, int aslinkedlist)
 
 /* Interpolate blank values in an array. If the 'tl!=NULL', then it is
    assumed that the tile values correspond to given tessellation. Such that
-   'input[i]' corresponds to 'tiles[i]' in the tessellation. */
-gal_data_t *
-gal_interpolate_neighbors(gal_data_t *input,
-                          struct gal_tile_two_layer_params *tl,
-                          uint8_t metric, size_t numneighbors,
-                          size_t numthreads, int onlyblank,
-                          int aslinkedlist, int function)
+   'input[i]' corresponds to 'tiles[i]' in the tessellation. When 'kdtree'
+   is non-zero, the neighbors are found with a k-d tree (over the non-blank
+   elements) instead of parsing the neighbors of each element. */
+static gal_data_t *
+interpolate_neighbors(gal_data_t *input,
+                      struct gal_tile_two_layer_params *tl,
+                      uint8_t metric, size_t numneighbors,
+                      size_t numthreads, int onlyblank,
+                      int aslinkedlist, int function, int kdtree)
 {
   gal_data_t *tin, *tout;
   struct interpolate_ngb_params prm;
@@ -384,6 +736,9 @@ gal_interpolate_neighbors(gal_data_t *input,
   /* Initialize the constant parameters. */
   prm.tl           = tl;
   prm.ngb_vals     = NULL;
+  prm.ngbind       = NULL;
+  prm.queryrow     = NULL;
+  prm.thread_flags = NULL;
   prm.input        = input;
   prm.function     = function;
   prm.onlyblank    = onlyblank;
@@ -464,17 +819,24 @@ gal_interpolate_neighbors(gal_data_t *input,
   gal_list_void_reverse(&prm.ngb_vals);
 
 
-  /* Allocate space for all the flag values of all the threads here (memory
-     in each thread is limited) and this is cleaner. */
-  prm.thread_flags=gal_pointer_allocate(GAL_TYPE_UINT8,
-                                        numthreads*input->size, 0, __func__,
-                                        "prm.thread_flags");
+  /* With a k-d tree, the neighbors of all the elements are found before
+     spinning off the threads. Otherwise, allocate space for all the flag
+     values of all the threads here (memory in each thread is limited) and
+     this is cleaner. */
+  if(kdtree)
+    interpolate_kdtree_neighbors(&prm, numthreads);
+  else
+    prm.thread_flags=gal_pointer_allocate(GAL_TYPE_UINT8,
+                                          numthreads*input->size, 0,
+                                          __func__, "prm.thread_flags");
 
 
   /* Spin-off the threads. */
-  gal_threads_spin_off(interpolate_neighbors_on_thread, &prm,
-                       input->size, numthreads, input->minmapsize,
-                       input->quietmmap);
+  gal_threads_spin_off( ( kdtree
+                          ? interpolate_neighbors_kdtree_on_thread
+                          : interpolate_neighbors_on_thread ),
+                        &prm, input->size, numthreads, input->minmapsize,
+                        input->quietmmap);
 
 
   /* If the values were permuted for the interpolation, then re-order the
@@ -498,6 +860,8 @@ gal_interpolate_neighbors(gal_data_t *input,
 
 
   /* Clean up and return. */
+  free(prm.ngbind);
+  free(prm.queryrow);
   free(prm.thread_flags);
   gal_data_free(prm.blanks);
   gal_list_void_free(prm.ngb_vals, 1);
@@ -508,6 +872,36 @@ gal_interpolate_neighbors(gal_data_t *input,
 
 
 
+gal_data_t *
+gal_interpolate_neighbors(gal_data_t *input,
+                          struct gal_tile_two_layer_params *tl,
+                          uint8_t metric, size_t numneighbors,
+                          size_t numthreads, int onlyblank,
+                          int aslinkedlist, int function)
+{
+  return interpolate_neighbors(input, tl, metric, numneighbors, numthreads,
+                               onlyblank, aslinkedlist, function, 0);
+}
+
+
+
+
+
+gal_data_t *
+gal_interpolate_neighbors_kdtree(gal_data_t *input,
+                                 struct gal_tile_two_layer_params *tl,
+                                 uint8_t metric, size_t numneighbors,
+                                 size_t numthreads, int onlyblank,
+                                 int aslinkedlist, int function)
+{
+  return interpolate_neighbors(input, tl, metric, numneighbors, numthreads,
+                               onlyblank, aslinkedlist, function, 1);
+}
+
+
+
+
+
 
 
 
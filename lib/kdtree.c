@@ -23,15 +23,24 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 **********************************************************************/
 #include <config.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include <error.h>
 #include <float.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <gnuastro/data.h>
 #include <gnuastro/table.h>
 #include <gnuastro/blank.h>
+#include <gnuastro/kdtree.h>
+#include <gnuastro/threads.h>
 #include <gnuastro/pointer.h>
 #include <gnuastro/permutation.h>
 
@@ -67,8 +76,18 @@ struct kdtree_params
 
   /* The values of the left and right columns. */
   gal_data_t *left_col, *right_col;
+
+  /* Parallel construction. */
+  size_t numthreads;      /* Number of threads to use.                */
+  size_t *scratch;        /* Temporary space for parallel partitions. */
+  size_t taskdepth;       /* Depth to build the subtrees on threads.  */
+  size_t ntasks;          /* Number of subtrees to build on threads.  */
+  struct kdtree_task *tasks; /* The subtrees to build on threads.     */
 };
 
+/* Minimum number of nodes to partition on multiple threads. */
+#define KDTREE_PARALLEL_MIN 100000
+
 
 
 
@@ -127,6 +146,48 @@ kdtree_distance_find(struct kdtree_params *p, size_t node,
 
 
 
+/* Move the last element of the max-heap up to its proper place. */
+static void
+kdtree_knn_heap_up(size_t *hind, double *hdist, size_t i)
+{
+  size_t parent, ti;
+  double td;
+
+  while(i)
+    {
+      parent=(i-1)/2;
+      if(hdist[parent]>=hdist[i]) break;
+      td=hdist[parent]; hdist[parent]=hdist[i]; hdist[i]=td;
+      ti=hind[parent];  hind[parent]=hind[i];   hind[i]=ti;
+      i=parent;
+    }
+}
+
+
+
+
+
+/* Move the first element of the max-heap down to its proper place. */
+static void
+kdtree_knn_heap_down(size_t *hind, double *hdist, size_t num)
+{
+  double td;
+  size_t i=0, c, ti;
+
+  while( (c=2*i+1) < num )
+    {
+      if( c+1<num && hdist[c+1]>hdist[c] ) ++c;
+      if(hdist[i]>=hdist[c]) break;
+      td=hdist[c]; hdist[c]=hdist[i]; hdist[i]=td;
+      ti=hind[c];  hind[c]=hind[i];   hind[i]=ti;
+      i=c;
+    }
+}
+
+
+
+
+
 
 
 
@@ -331,6 +392,158 @@ kdtree_make_partition(struct kdtree_params *p, size_t node_left,
 
 
 
+/* Parameters for partitioning on multiple threads. */
+struct kdtree_partition_params
+{
+  struct kdtree_params *p;  /* General parameters.                     */
+  double      *coordinate;  /* Coordinates along the current axis.     */
+  size_t       node_left;   /* First node in the range (inclusive).    */
+  size_t      node_right;   /* Last node in the range (inclusive).     */
+  size_t          node_k;   /* The k'th node (used as pivot).          */
+  double     k_node_value;  /* Value of the k'th node.                 */
+  size_t           chunk;   /* Number of nodes in each chunk.          */
+  size_t          *nless;   /* Smaller nodes (start) in each chunk.    */
+  size_t          *nmore;   /* Other nodes (start) in each chunk.      */
+  int              phase;   /* 0: count, 1: distribute, 2: copy back.  */
+};
+
+
+
+
+
+/* Worker function for 'kdtree_make_partition_parallel': each action is
+   one chunk of the range. */
+static void *
+kdtree_make_partition_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct kdtree_partition_params *pp=tprm->params;
+
+  size_t i, j, c, start, end, less, more;
+  size_t *input_row=pp->p->input_row, *scratch=pp->p->scratch;
+
+  for(i=0; (c=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Range of this chunk ('end' is not inclusive). */
+      start=pp->node_left+c*pp->chunk;
+      end = ( start+pp->chunk > pp->node_right+1
+              ? pp->node_right+1 : start+pp->chunk );
+
+      /* Do the job of each phase. */
+      switch(pp->phase)
+        {
+        /* Count the nodes that are smaller than the k'th node (the k'th
+           node itself is not counted). */
+        case 0:
+          less=more=0;
+          for(j=start;j<end;++j)
+            if(j!=pp->node_k)
+              {
+                if(pp->coordinate[input_row[j]] < pp->k_node_value) ++less;
+                else                                               ++more;
+              }
+          pp->nless[c]=less;
+          pp->nmore[c]=more;
+          break;
+
+        /* Put the nodes in their place within the scratch array. */
+        case 1:
+          less=pp->nless[c];
+          more=pp->nmore[c];
+          for(j=start;j<end;++j)
+            if(j!=pp->node_k)
+              {
+                if(pp->coordinate[input_row[j]] < pp->k_node_value)
+                  scratch[less++]=input_row[j];
+                else
+                  scratch[more++]=input_row[j];
+              }
+          break;
+
+        /* Copy the scratch array back. */
+        case 2:
+          memcpy(input_row+start, scratch+(start-pp->node_left),
+                 (end-start)*sizeof *input_row);
+          break;
+
+        default:
+          error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to "
+                "fix the problem. The phase %d isn't recognized",
+                __func__, PACKAGE_BUGREPORT, pp->phase);
+        }
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Same as 'kdtree_make_partition', but on multiple threads: the range is
+   divided into chunks and each chunk is first counted, then distributed
+   into the scratch array (the smaller nodes first, then the k'th node,
+   then the rest).
+
+   Within a range that hasn't been partitioned yet, the left and right
+   subtrees are all blank (they are only set after the range's median is
+   found), so only the input rows need to be moved. */
+static size_t
+kdtree_make_partition_parallel(struct kdtree_params *p, size_t node_left,
+                               size_t node_right, size_t node_k,
+                               double *coordinate)
+{
+  size_t c, tmp, less, more, nchunks;
+  struct kdtree_partition_params pp;
+
+  /* Set the parameters: use a few chunks for each thread. */
+  nchunks=4*p->numthreads;
+  pp.p=p;
+  pp.node_k=node_k;
+  pp.node_left=node_left;
+  pp.node_right=node_right;
+  pp.coordinate=coordinate;
+  pp.k_node_value=coordinate[p->input_row[node_k]];
+  pp.chunk=(node_right-node_left+1+nchunks-1)/nchunks;
+  nchunks=(node_right-node_left+1+pp.chunk-1)/pp.chunk;
+  pp.nless=gal_pointer_allocate(GAL_TYPE_SIZE_T, nchunks, 0, __func__,
+                                "pp.nless");
+  pp.nmore=gal_pointer_allocate(GAL_TYPE_SIZE_T, nchunks, 0, __func__,
+                                "pp.nmore");
+
+  /* Count the nodes in each chunk. */
+  pp.phase=0;
+  gal_threads_spin_off_dynamic(kdtree_make_partition_worker, &pp,
+                               nchunks, p->numthreads);
+
+  /* Convert the counts into the starting position of each chunk in the
+     scratch array. */
+  less=0;
+  for(c=0;c<nchunks;++c) { tmp=pp.nless[c]; pp.nless[c]=less; less+=tmp; }
+  more=less+1;
+  for(c=0;c<nchunks;++c) { tmp=pp.nmore[c]; pp.nmore[c]=more; more+=tmp; }
+
+  /* Distribute the nodes and copy them back. */
+  pp.phase=1;
+  gal_threads_spin_off_dynamic(kdtree_make_partition_worker, &pp,
+                               nchunks, p->numthreads);
+  p->scratch[less]=p->input_row[node_k];
+  pp.phase=2;
+  gal_threads_spin_off_dynamic(kdtree_make_partition_worker, &pp,
+                               nchunks, p->numthreads);
+
+  /* Clean up and return the position of the k'th node. */
+  free(pp.nless);
+  free(pp.nmore);
+  return node_left+less;
+}
+
+
+
+
+
 /* Find the median node of the current axis. Instead of randomly
    choosing the median node, we use `quickselect alogorithm` to
    find median node in linear time between the left and right node.
@@ -367,9 +580,16 @@ kdtree_median_find(struct kdtree_params *p, size_t node_left,
   while(1)
     {
       /* Pivot node acts as a reference for the distance from the desired
-        (here median) node. */
-      node_pivot = kdtree_make_partition(p, node_left, node_right,
-                                         node_median, coordinate);
+        (here median) node. Large ranges are partitioned on multiple
+        threads. */
+      node_pivot = ( ( p->numthreads>1
+                       && node_right-node_left >= KDTREE_PARALLEL_MIN )
+                     ? kdtree_make_partition_parallel(p, node_left,
+                                                      node_right,
+                                                      node_median,
+                                                      coordinate)
+                     : kdtree_make_partition(p, node_left, node_right,
+                                             node_median, coordinate) );
       /* If median is found, break the loop and return median node. */
       if(node_median == node_pivot) break;
 
@@ -439,11 +659,139 @@ kdtree_fill_subtrees(struct kdtree_params *p, size_t node_left,
 
 
 
+/* A subtree that is built on one thread. */
+struct kdtree_task
+{
+  size_t node_left;       /* First node of the subtree.               */
+  size_t node_right;      /* Last node of the subtree.                */
+  size_t depth;           /* Depth of the subtree's root.             */
+  uint32_t *out;          /* Where to write the subtree's root.       */
+};
+
+
+
+
+
+/* Same as 'kdtree_fill_subtrees', but for the top levels of the tree
+   when building on multiple threads: the medians of the top levels are
+   found on multiple threads (for the large ranges), but the subtrees at
+   'p->taskdepth' are only kept as tasks (to be built independently on
+   separate threads afterwards). The different subtrees only touch their
+   own range of nodes, so they can be built at the same time. */
+static void
+kdtree_fill_top(struct kdtree_params *p, size_t node_left,
+                size_t node_right, size_t depth, uint32_t *out)
+{
+  size_t node_median;
+  struct kdtree_task *task;
+
+  /* Keep this subtree as a task. */
+  if(depth==p->taskdepth)
+    {
+      task=&p->tasks[p->ntasks++];
+      task->out=out;
+      task->depth=depth;
+      task->node_left=node_left;
+      task->node_right=node_right;
+      return;
+    }
+
+  /* Same as 'kdtree_fill_subtrees'. */
+  if(node_left==node_right) { *out=p->input_row[node_left]; return; }
+  node_median = kdtree_median_find(p, node_left, node_right,
+                                   p->coords[depth % p->ndim]->array);
+  if(node_median!=node_left)
+    kdtree_fill_top(p, node_left, node_median-1, depth+1,
+                    &p->left[node_median]);
+  kdtree_fill_top(p, node_median+1, node_right, depth+1,
+                  &p->right[node_median]);
+  *out=p->input_row[node_median];
+}
+
+
+
+
+
+/* Worker function to build the subtrees of 'kdtree_fill_top'. */
+static void *
+kdtree_fill_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct kdtree_params *p=(struct kdtree_params *)tprm->params;
+
+  size_t i, t;
+  struct kdtree_task *task;
+  struct kdtree_params tp=*p;
+
+  /* Each subtree is built on a single thread. */
+  tp.numthreads=1;
+  for(i=0; (t=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      task=&p->tasks[t];
+      *task->out=kdtree_fill_subtrees(&tp, task->node_left,
+                                      task->node_right, task->depth);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Build the tree on multiple threads: the top levels are built first
+   (with multi-threaded partitioning) and the subtrees under them are
+   built in parallel. The subtrees are given to the threads dynamically,
+   so there are a few of them for each thread. The output is the same as
+   building on a single thread, except for the order of equal
+   coordinates within a subtree. */
+static uint32_t
+kdtree_fill_parallel(struct kdtree_params *p, size_t numnodes)
+{
+  uint32_t root;
+  char *mmapname=NULL;
+
+  /* The depth of the tasks: at least four subtrees for each thread. */
+  for(p->taskdepth=0; ((size_t)1<<p->taskdepth) < 4*p->numthreads;
+      ++p->taskdepth);
+
+  /* Allocate the tasks and the scratch space for the partitions. */
+  errno=0;
+  p->ntasks=0;
+  p->tasks=malloc( ((size_t)1<<p->taskdepth) * sizeof *p->tasks );
+  if(p->tasks==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't allocate %zu bytes for "
+          "'p->tasks'", __func__,
+          ((size_t)1<<p->taskdepth) * sizeof *p->tasks);
+  p->scratch=gal_pointer_allocate_ram_or_mmap(GAL_TYPE_SIZE_T, numnodes,
+                                              0, p->left_col->minmapsize,
+                                              &mmapname,
+                                              p->left_col->quietmmap,
+                                              __func__, "p->scratch");
+
+  /* Build the top levels, then the subtrees. */
+  kdtree_fill_top(p, 0, numnodes-1, 0, &root);
+  gal_threads_spin_off_dynamic(kdtree_fill_worker, p, p->ntasks,
+                               p->numthreads);
+
+  /* Clean up and return the root. */
+  if(mmapname) gal_pointer_mmap_free(&mmapname, p->left_col->quietmmap);
+  else         free(p->scratch);
+  free(p->tasks);
+  return root;
+}
+
+
+
+
+
 /* High level function to construct the kd-tree. This function initilises
    and creates the tree in top-down manner. Returns a list containing the
    indexes of left and right subtrees. */
 gal_data_t *
-gal_kdtree_create(gal_data_t *coords_raw, size_t *root)
+gal_kdtree_create(gal_data_t *coords_raw, size_t numthreads, size_t *root)
 {
   struct kdtree_params p={0};
 
@@ -452,9 +800,12 @@ gal_kdtree_create(gal_data_t *coords_raw, size_t *root)
 
   /* Initialise the params structure. */
   kdtree_prepare(&p, coords_raw);
+  p.numthreads = numthreads ? numthreads : 1;
 
   /* Fill the kd-tree. */
-  *root=kdtree_fill_subtrees(&p, 0, coords_raw->size-1, 0);
+  *root = ( p.numthreads>1
+            ? kdtree_fill_parallel(&p, coords_raw->size)
+            : kdtree_fill_subtrees(&p, 0, coords_raw->size-1, 0) );
 
   /* For a check
   size_t i;
@@ -493,6 +844,680 @@ gal_kdtree_create(gal_data_t *coords_raw, size_t *root)
 
 
 
+/****************************************************************
+ ********        Flat k-d tree with leaf buckets          *******
+ ****************************************************************/
+/* The k-d tree above has one node for every point and its nodes are in
+   the input order, so every step of a search is a random access to the
+   memory. In the "flat" k-d tree, the points are re-ordered into the
+   tree order (with the coordinates of each point beside each other),
+   and the points are only divided until each leaf has at most
+   'GAL_KDTREE_FLAT_BUCKET' points. The tree itself is implicit: the
+   root is node 1 and the children of node 'i' are '2i' and '2i+1'. All
+   leaves are at the same depth, so the number of leaves is a power of
+   2, and node 'i' is a leaf when it is not smaller than the number of
+   leaves.
+
+   The flat tree is a list of four datasets:
+
+     coords: 2D 'double' array with one row for each point.
+     rows:   'size_t' row of each point in the input.
+     split:  'double' coordinate of the splitting plane of each node.
+     dim:    'uint8_t' dimension of the splitting plane of each node.
+
+   The last two have one element per leaf (element 0 is not used). */
+struct kdtree_flat
+{
+  size_t       ndim;     /* Number of dimensions.                    */
+  size_t     npoint;     /* Number of points.                        */
+  size_t      nleaf;     /* Number of leaves.                        */
+  double    *coords;     /* Coordinates of points (in tree order).   */
+  size_t      *rows;     /* Input row of each point.                 */
+  double     *split;     /* Splitting coordinate of each node.       */
+  uint8_t      *dim;     /* Splitting dimension of each node.        */
+  size_t   tasknode;     /* Subtrees from this node are built later. */
+};
+
+
+
+
+
+/* Return 1 if the given k-d tree is a flat tree (from
+   'gal_kdtree_flat_create') and 0 otherwise. */
+int
+gal_kdtree_is_flat(gal_data_t *kdtree)
+{
+  return ( kdtree
+           && kdtree->ndim==2
+           && kdtree->type==GAL_TYPE_FLOAT64
+           && gal_list_data_number(kdtree)==4 );
+}
+
+
+
+
+
+/* Set the pointers of the flat tree structure from the datasets. */
+static void
+kdtree_flat_read(gal_data_t *kdtree, struct kdtree_flat *f)
+{
+  gal_data_t *rows, *split, *dim;
+
+  /* Basic sanity checks. */
+  if( gal_kdtree_is_flat(kdtree)==0 )
+    error(EXIT_FAILURE, 0, "%s: the input is not a flat k-d tree",
+          __func__);
+  rows=kdtree->next;
+  split=rows->next;
+  dim=split->next;
+  if( rows->type!=GAL_TYPE_SIZE_T || split->type!=GAL_TYPE_FLOAT64
+      || dim->type!=GAL_TYPE_UINT8 || rows->size!=kdtree->dsize[0]
+      || split->size!=dim->size )
+    error(EXIT_FAILURE, 0, "%s: the flat k-d tree doesn't have the "
+          "expected format (see 'gal_kdtree_flat_create')", __func__);
+
+  /* Set the structure. */
+  f->ndim=kdtree->dsize[1];
+  f->npoint=kdtree->dsize[0];
+  f->nleaf=split->size;
+  f->coords=kdtree->array;
+  f->rows=rows->array;
+  f->split=split->array;
+  f->dim=dim->array;
+}
+
+
+
+
+
+/* Swap two points of the flat tree. */
+static void
+kdtree_flat_swap(struct kdtree_flat *f, size_t a, size_t b)
+{
+  size_t i, tr;
+  double t, *ca=f->coords+a*f->ndim, *cb=f->coords+b*f->ndim;
+
+  for(i=0;i<f->ndim;++i) { t=ca[i]; ca[i]=cb[i]; cb[i]=t; }
+  tr=f->rows[a]; f->rows[a]=f->rows[b]; f->rows[b]=tr;
+}
+
+
+
+
+
+/* Re-order the points within 'lo' and 'hi' (not inclusive) so the point
+   at 'k' is in its sorted position along 'dim': no point before it is
+   larger and no point after it is smaller (quickselect, with Hoare's
+   partitioning). */
+static void
+kdtree_flat_select(struct kdtree_flat *f, size_t lo, size_t hi, size_t k,
+                   size_t dim)
+{
+  double pivot;
+  size_t i, j, nd=f->ndim;
+  double *c=f->coords+dim;
+
+  /* 'hi' is inclusive from now on. */
+  --hi;
+  while(hi>lo)
+    {
+      /* Partition around the middle element. */
+      i=lo;
+      j=hi;
+      pivot=c[ (lo+(hi-lo)/2)*nd ];
+      while(i<=j)
+        {
+          while(c[i*nd]<pivot) ++i;
+          while(c[j*nd]>pivot) --j;
+          if(i<=j)
+            {
+              kdtree_flat_swap(f, i++, j);
+              if(j==0) break; else --j;
+            }
+        }
+
+      /* Continue in the part that contains 'k'. */
+      if(k<=j)      hi=j;
+      else if(k>=i) lo=i;
+      else          break;
+    }
+}
+
+
+
+
+
+/* Fill the flat tree under 'node' (containing the points from 'lo' to
+   'hi'). The splitting dimension of each node is the one with the
+   largest spread and the left child gets the first half. */
+static void
+kdtree_flat_fill(struct kdtree_flat *f, size_t node, size_t lo,
+                 size_t hi)
+{
+  size_t i, j, mid, dim=0;
+  double v, min, max, spread=-1;
+
+  /* Nothing to do on a leaf or on the subtrees that are built on
+     separate threads (see 'gal_kdtree_flat_create'). */
+  if(node>=f->nleaf || node>=f->tasknode) return;
+
+  /* Find the dimension with the largest spread. */
+  for(j=0;j<f->ndim;++j)
+    {
+      min=INFINITY;
+      max=-INFINITY;
+      for(i=lo;i<hi;++i)
+        {
+          v=f->coords[i*f->ndim+j];
+          if(v<min) min=v;
+          if(v>max) max=v;
+        }
+      if(max-min>spread) { spread=max-min; dim=j; }
+    }
+
+  /* Put the median point in its place and keep the splitting plane. */
+  mid=lo+(hi-lo)/2;
+  kdtree_flat_select(f, lo, hi, mid, dim);
+  f->dim[node]=dim;
+  f->split[node]=f->coords[mid*f->ndim+dim];
+
+  /* Fill the two children. */
+  kdtree_flat_fill(f, 2*node,   lo,  mid);
+  kdtree_flat_fill(f, 2*node+1, mid, hi);
+}
+
+
+
+
+
+/* Worker function to build the subtrees of a flat tree that start at
+   'f->tasknode' (all at the same depth). The range of points in each
+   subtree only depends on the number of points, so it is found by
+   descending from the root. */
+static void *
+kdtree_flat_fill_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct kdtree_flat *f=(struct kdtree_flat *)tprm->params;
+
+  size_t i, t, node, bit, lo, hi;
+  struct kdtree_flat tf=*f;
+
+  /* Each subtree is built on a single thread. */
+  tf.tasknode=GAL_BLANK_SIZE_T;
+  for(i=0; (t=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      lo=0;
+      hi=f->npoint;
+      node=f->tasknode+t;
+      for(bit=f->tasknode/2; bit>0; bit/=2)
+        if(node & bit) lo=lo+(hi-lo)/2;
+        else           hi=lo+(hi-lo)/2;
+      kdtree_flat_fill(&tf, node, lo, hi);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Build a flat k-d tree of the given coordinates (see the comments at
+   the top of this section for the format). With more than one thread,
+   the top levels are built first and the subtrees under them are built
+   in parallel (at least four subtrees for each thread). The splits of
+   each node don't depend on the others, so the tree is identical for
+   any number of threads. */
+gal_data_t *
+gal_kdtree_flat_create(gal_data_t *coords_raw, size_t numthreads,
+                       size_t minmapsize, int quietmmap)
+{
+  size_t i, j;
+  size_t dsize[2];
+  struct kdtree_flat f;
+  gal_data_t *tmp, *col, *out=NULL;
+
+  /* If there are no coordinates, just return NULL. */
+  if(coords_raw==NULL || coords_raw->size==0) return NULL;
+
+  /* Basic sanity checks. */
+  f.ndim=gal_list_data_number(coords_raw);
+  f.npoint=coords_raw->size;
+  if(f.ndim>UINT8_MAX)
+    error(EXIT_FAILURE, 0, "%s: at most %d dimensions are supported",
+          __func__, UINT8_MAX);
+  for(tmp=coords_raw->next; tmp!=NULL; tmp=tmp->next)
+    if(tmp->size!=f.npoint)
+      error(EXIT_FAILURE, 0, "%s: all the coordinate columns must have "
+            "the same number of elements", __func__);
+
+  /* Number of leaves: the smallest power of two that keeps the number of
+     points in each leaf within the bucket size. */
+  for(f.nleaf=1;
+      (f.npoint+f.nleaf-1)/f.nleaf > GAL_KDTREE_FLAT_BUCKET;
+      f.nleaf*=2);
+
+  /* Allocate the output (the list is filled from the end). */
+  gal_list_data_add_alloc(&out, NULL, GAL_TYPE_UINT8, 1, &f.nleaf, NULL,
+                          1, minmapsize, quietmmap, "DIM", "counter",
+                          "Splitting dimension of each node.");
+  gal_list_data_add_alloc(&out, NULL, GAL_TYPE_FLOAT64, 1, &f.nleaf,
+                          NULL, 0, minmapsize, quietmmap, "SPLIT", NULL,
+                          "Splitting coordinate of each node.");
+  gal_list_data_add_alloc(&out, NULL, GAL_TYPE_SIZE_T, 1, &f.npoint,
+                          NULL, 0, minmapsize, quietmmap, "ROW",
+                          "counter", "Input row of each point.");
+  dsize[0]=f.npoint;
+  dsize[1]=f.ndim;
+  gal_list_data_add_alloc(&out, NULL, GAL_TYPE_FLOAT64, 2, dsize, NULL,
+                          0, minmapsize, quietmmap, "COORDS", NULL,
+                          "Coordinates of each point.");
+  f.coords=out->array;
+  f.rows=out->next->array;
+  f.split=out->next->next->array;
+  f.dim=out->next->next->next->array;
+
+  /* Copy the coordinates beside each other. */
+  for(j=0, tmp=coords_raw; tmp!=NULL; tmp=tmp->next, ++j)
+    {
+      col = ( tmp->type==GAL_TYPE_FLOAT64
+              ? tmp
+              : gal_data_copy_to_new_type(tmp, GAL_TYPE_FLOAT64) );
+      for(i=0;i<f.npoint;++i)
+        f.coords[i*f.ndim+j]=((double *)(col->array))[i];
+      if(col!=tmp) gal_data_free(col);
+    }
+  for(i=0;i<f.npoint;++i) f.rows[i]=i;
+
+  /* Nodes to start the parallel subtrees from (they are only useful when
+     they aren't leaves). */
+  for(f.tasknode=1; f.tasknode < 4*numthreads; f.tasknode*=2);
+  if(numthreads<=1 || f.tasknode>=f.nleaf) f.tasknode=GAL_BLANK_SIZE_T;
+
+  /* Build the tree. */
+  f.split[0]=NAN;
+  kdtree_flat_fill(&f, 1, 0, f.npoint);
+  if(f.tasknode!=GAL_BLANK_SIZE_T)
+    gal_threads_spin_off_dynamic(kdtree_flat_fill_worker, &f, f.tasknode,
+                                 numthreads);
+  return out;
+}
+
+
+
+
+
+/* Squared distances of all the points in a leaf to 'point'. The loops are
+   kept simple (with the common 2D case separate) so the compiler can
+   vectorize them. */
+static void
+kdtree_flat_leaf_dist(struct kdtree_flat *f, size_t lo, size_t hi,
+                      double *point, double *d)
+{
+  double t, t2;
+  size_t i, j, num=hi-lo, nd=f->ndim;
+  double *c=f->coords+lo*nd;
+
+  if(nd==2)
+    for(i=0;i<num;++i)
+      {
+        t  = c[2*i]   - point[0];
+        t2 = c[2*i+1] - point[1];
+        d[i] = t*t + t2*t2;
+      }
+  else
+    {
+      for(i=0;i<num;++i) d[i]=0.0f;
+      for(j=0;j<nd;++j)
+        for(i=0;i<num;++i)
+          {
+            t = c[i*nd+j] - point[j];
+            d[i] += t*t;
+          }
+    }
+}
+
+
+
+
+
+/* Nearest neighbour in a flat tree: same as 'kdtree_nearest_neighbour',
+   but 'out_nn' is the position of the point in the tree. */
+static void
+kdtree_flat_nearest_neighbour(struct kdtree_flat *f, size_t node,
+                              size_t lo, size_t hi, double *point,
+                              double *least_dist, size_t *out_nn)
+{
+  double dx, d[GAL_KDTREE_FLAT_BUCKET];
+  size_t i, near, far, mid=lo+(hi-lo)/2;
+
+  /* On a leaf, check all of its points. */
+  if(node>=f->nleaf)
+    {
+      kdtree_flat_leaf_dist(f, lo, hi, point, d);
+      for(i=0;i<hi-lo;++i)
+        if(d[i] < *least_dist) { *least_dist=d[i]; *out_nn=lo+i; }
+      return;
+    }
+
+  /* Search the child on the side of the point first, and the other only
+     if the splitting plane is closer than the nearest point. */
+  dx = point[f->dim[node]] - f->split[node];
+  near = dx<0 ? 2*node : 2*node+1;
+  far  = dx<0 ? 2*node+1 : 2*node;
+  kdtree_flat_nearest_neighbour(f, near, dx<0 ? lo : mid,
+                                dx<0 ? mid : hi, point, least_dist,
+                                out_nn);
+  if(dx*dx < *least_dist)
+    kdtree_flat_nearest_neighbour(f, far, dx<0 ? mid : lo,
+                                  dx<0 ? hi : mid, point, least_dist,
+                                  out_nn);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/****************************************************************
+ ********            Flat k-d tree index files            *******
+ ****************************************************************/
+/* A flat k-d tree can be written into a binary "index" file that is
+   later memory-mapped (read-only) by 'gal_kdtree_flat_index_read'. So
+   the tree doesn't need to be built or read again, the operating system
+   only reads the pages that are used in the search, and they are shared
+   between processes that use the same index. The file starts with the
+   header below, followed by the arrays of the four datasets of the flat
+   tree (in the same order). All the values are in the byte order of the
+   writing system. 'datasum' is the FITS DATASUM of the catalog that the
+   tree was built from and 'coordsum' is a checksum of the coordinates
+   that it was built on. So an index can't be used with another (or a
+   modified) catalog, or with other columns of the same catalog. */
+#define KDTREE_INDEX_MAGIC     "GALKDIDX"
+#define KDTREE_INDEX_BYTEORDER 0x0102030405060708
+struct kdtree_index_header
+{
+  char       magic[8];   /* Identifier of the format: KDTREE_INDEX_MAGIC. */
+  uint64_t  byteorder;   /* KDTREE_INDEX_BYTEORDER in the writer's order. */
+  uint64_t sizeofsize;   /* Number of bytes in the writer's 'size_t'.     */
+  uint64_t       ndim;   /* Number of dimensions.                         */
+  uint64_t     npoint;   /* Number of points.                             */
+  uint64_t      nleaf;   /* Number of leaves.                             */
+  uint64_t    datasum;   /* DATASUM of the source catalog.                */
+  uint64_t   coordsum;   /* Checksum of the coordinate values.            */
+  uint64_t   checksum;   /* Checksum of all the elements above.           */
+};
+
+
+
+
+
+/* Checksum of the header (all the elements before 'checksum'). */
+static uint64_t
+kdtree_index_checksum(struct kdtree_index_header *h)
+{
+  size_t i;
+  uint64_t w, sum=14695981039346656037ULL;
+  unsigned char *c=(unsigned char *)h;
+
+  for(i=0; i<offsetof(struct kdtree_index_header, checksum); i+=8)
+    {
+      memcpy(&w, c+i, 8);
+      sum = (sum ^ w) * 1099511628211ULL;
+    }
+  return sum;
+}
+
+
+
+
+
+/* Checksum of the values of all the coordinate columns (in the order of
+   the columns), also depending on their types and sizes. */
+static uint64_t
+kdtree_index_coordsum(gal_data_t *coords)
+{
+  gal_data_t *tmp;
+  unsigned char *c;
+  uint64_t w, sum=14695981039346656037ULL;
+  size_t i, nbytes;
+
+  for(tmp=coords; tmp!=NULL; tmp=tmp->next)
+    {
+      /* The type and size of this column. */
+      sum = (sum ^ (uint64_t)(tmp->type)) * 1099511628211ULL;
+      sum = (sum ^ (uint64_t)(tmp->size)) * 1099511628211ULL;
+
+      /* The values, as 8-byte words (the last word is padded by zeros). */
+      c=tmp->array;
+      nbytes=tmp->size*gal_type_sizeof(tmp->type);
+      for(i=0; i<nbytes; i+=8)
+        {
+          w=0;
+          memcpy(&w, c+i, nbytes-i<8 ? nbytes-i : 8);
+          sum = (sum ^ w) * 1099511628211ULL;
+        }
+    }
+  return sum;
+}
+
+
+
+
+
+/* Byte offsets of the four arrays within an index file (in the order of
+   the flat tree datasets). The total size of the file is returned. */
+static size_t
+kdtree_index_offsets(size_t ndim, size_t npoint, size_t nleaf,
+                     size_t *offsets)
+{
+  offsets[0] = sizeof(struct kdtree_index_header);
+  offsets[1] = offsets[0] + npoint * ndim * sizeof(double);
+  offsets[2] = offsets[1] + npoint * sizeof(size_t);
+  offsets[3] = offsets[2] + nleaf * sizeof(double);
+  return offsets[3] + nleaf * sizeof(uint8_t);
+}
+
+
+
+
+
+/* Write the given flat tree (built on 'coords') into an index file.
+   'kdtree' can be NULL (when there are no points), in this case only the
+   header is written. */
+void
+gal_kdtree_flat_index_write(gal_data_t *coords, gal_data_t *kdtree,
+                            unsigned long datasum, char *filename)
+{
+  FILE *fp;
+  gal_data_t *tmp;
+  struct kdtree_flat f={0};
+  struct kdtree_index_header h={0};
+
+  /* Prepare the header. */
+  if(kdtree) kdtree_flat_read(kdtree, &f);
+  memcpy(h.magic, KDTREE_INDEX_MAGIC, sizeof h.magic);
+  h.byteorder=KDTREE_INDEX_BYTEORDER;
+  h.sizeofsize=sizeof(size_t);
+  h.ndim=f.ndim;
+  h.npoint=f.npoint;
+  h.nleaf=f.nleaf;
+  h.datasum=datasum;
+  h.coordsum=kdtree_index_coordsum(coords);
+  h.checksum=kdtree_index_checksum(&h);
+
+  /* Write the header and the arrays. */
+  errno=0;
+  fp=fopen(filename, "wb");
+  if(fp==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't open for writing", filename);
+  if( fwrite(&h, sizeof h, 1, fp)!=1 )
+    error(EXIT_FAILURE, errno, "%s: couldn't write the header", filename);
+  for(tmp=kdtree; tmp!=NULL; tmp=tmp->next)
+    if( fwrite(tmp->array, gal_type_sizeof(tmp->type), tmp->size, fp)
+        !=tmp->size )
+      error(EXIT_FAILURE, errno, "%s: couldn't write the '%s' array",
+            filename, tmp->name ? tmp->name : "k-d tree");
+  if( fclose(fp)==EOF )
+    error(EXIT_FAILURE, errno, "%s: couldn't close the file", filename);
+}
+
+
+
+
+
+/* Memory-map the flat tree in the given index file. The datasets of the
+   output point to the (read-only) mapped file, so they should only be
+   freed with 'gal_kdtree_flat_index_free'. The index should have been
+   built on the given coordinates. If the index has no points, NULL is
+   returned (like 'gal_kdtree_flat_create'). */
+gal_data_t *
+gal_kdtree_flat_index_read(char *filename, gal_data_t *coords,
+                           unsigned long datasum)
+{
+  int fd;
+  char *map;
+  struct stat st;
+  struct kdtree_index_header h;
+  size_t npoint, nleaf, dsize[2], offsets[4], filesize;
+  gal_data_t *out=NULL;
+
+  /* Open the file and read the header. */
+  errno=0;
+  fd=open(filename, O_RDONLY);
+  if(fd==-1)
+    error(EXIT_FAILURE, errno, "%s: couldn't open the k-d tree index",
+          filename);
+  if( fstat(fd, &st)==-1 )
+    error(EXIT_FAILURE, errno, "%s: couldn't get the file size", filename);
+  if( (size_t)st.st_size < sizeof h
+      || read(fd, &h, sizeof h)!=sizeof h
+      || memcmp(h.magic, KDTREE_INDEX_MAGIC, sizeof h.magic) )
+    error(EXIT_FAILURE, 0, "%s: not a Gnuastro k-d tree index file",
+          filename);
+
+  /* Check the header. */
+  if(h.byteorder!=KDTREE_INDEX_BYTEORDER || h.sizeofsize!=sizeof(size_t))
+    error(EXIT_FAILURE, 0, "%s: the k-d tree index was written on a "
+          "system with a different byte order or integer size, please "
+          "build it again on this system", filename);
+  if(h.checksum!=kdtree_index_checksum(&h))
+    error(EXIT_FAILURE, 0, "%s: the header of the k-d tree index is "
+          "corrupted (its checksum doesn't match)", filename);
+  if(h.datasum!=datasum)
+    error(EXIT_FAILURE, 0, "%s: the k-d tree index was built from a "
+          "catalog with a different DATASUM (%lu, not %lu), so it can't "
+          "be used for this catalog. If the catalog has changed, please "
+          "build the index again", filename, (unsigned long)h.datasum,
+          datasum);
+  if(h.coordsum!=kdtree_index_coordsum(coords))
+    error(EXIT_FAILURE, 0, "%s: the k-d tree index was built on different "
+          "coordinates (for example, other columns of the same catalog), "
+          "so it can't be used for these coordinates", filename);
+  npoint=h.npoint;
+  nleaf=h.nleaf;
+  filesize=kdtree_index_offsets(h.ndim, npoint, nleaf, offsets);
+  if( (size_t)st.st_size!=filesize )
+    error(EXIT_FAILURE, 0, "%s: the k-d tree index has %zu bytes, but "
+          "its header requires %zu bytes", filename, (size_t)st.st_size,
+          filesize);
+
+  /* Map the file into memory (the file descriptor isn't necessary
+     after the mapping). */
+  if(npoint)
+    {
+      map=mmap(NULL, filesize, PROT_READ, MAP_SHARED, fd, 0);
+      if(map==MAP_FAILED)
+        error(EXIT_FAILURE, errno, "%s: couldn't map the k-d tree index "
+              "into memory", filename);
+
+      /* Build the datasets over the mapped arrays (the list is filled
+         from the end). */
+      gal_list_data_add_alloc(&out, map+offsets[3], GAL_TYPE_UINT8, 1,
+                              &nleaf, NULL, 0, -1, 1, "DIM", "counter",
+                              "Splitting dimension of each node.");
+      gal_list_data_add_alloc(&out, map+offsets[2], GAL_TYPE_FLOAT64, 1,
+                              &nleaf, NULL, 0, -1, 1, "SPLIT", NULL,
+                              "Splitting coordinate of each node.");
+      gal_list_data_add_alloc(&out, map+offsets[1], GAL_TYPE_SIZE_T, 1,
+                              &npoint, NULL, 0, -1, 1, "ROW",
+                              "counter", "Input row of each point.");
+      dsize[0]=npoint;
+      dsize[1]=h.ndim;
+      gal_list_data_add_alloc(&out, map+offsets[0], GAL_TYPE_FLOAT64, 2,
+                              dsize, NULL, 0, -1, 1, "COORDS", NULL,
+                              "Coordinates of each point.");
+    }
+
+  /* Clean up and return. */
+  if( close(fd)==-1 )
+    error(EXIT_FAILURE, errno, "%s: couldn't close the file", filename);
+  return out;
+}
+
+
+
+
+
+/* Free a flat tree that was read by 'gal_kdtree_flat_index_read'. */
+void
+gal_kdtree_flat_index_free(gal_data_t *kdtree)
+{
+  gal_data_t *tmp;
+  struct kdtree_flat f;
+  size_t offsets[4], filesize;
+
+  /* Nothing to do when there is no tree. */
+  if(kdtree==NULL) return;
+
+  /* Find the start and size of the mapping. */
+  kdtree_flat_read(kdtree, &f);
+  filesize=kdtree_index_offsets(f.ndim, f.npoint, f.nleaf, offsets);
+
+  /* Free the datasets (without their arrays) and remove the mapping. */
+  for(tmp=kdtree; tmp!=NULL; tmp=tmp->next) tmp->array=NULL;
+  gal_list_data_free(kdtree);
+  if( munmap((char *)(f.coords)-offsets[0], filesize)==-1 )
+    error(EXIT_FAILURE, errno, "%s: couldn't un-map the k-d tree index",
+          __func__);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 /****************************************************************
  ********          Nearest-Neighbour Search               *******
  ****************************************************************/
@@ -570,12 +1595,23 @@ gal_kdtree_nearest_neighbour(gal_data_t *coords_raw, gal_data_t *kdtree,
                              size_t root, double *point,
                              double *least_dist)
 {
+  struct kdtree_flat f;
   struct kdtree_params p={0};
   size_t out_nn=GAL_BLANK_SIZE_T;
 
+  /* In a flat tree, no preparation is necessary. */
+  *least_dist=DBL_MAX;
+  if( gal_kdtree_is_flat(kdtree) )
+    {
+      kdtree_flat_read(kdtree, &f);
+      kdtree_flat_nearest_neighbour(&f, 1, 0, f.npoint, point, least_dist,
+                                    &out_nn);
+      *least_dist = sqrt(*least_dist);
+      return out_nn==GAL_BLANK_SIZE_T ? out_nn : f.rows[out_nn];
+    }
+
   /* Initialisation. */
   p.left_col=kdtree;
-  *least_dist=DBL_MAX;
   kdtree_prepare(&p, coords_raw);
 
   /* Use the low-level function to find th nearest neighbour. */
@@ -595,3 +1631,606 @@ gal_kdtree_nearest_neighbour(gal_data_t *coords_raw, gal_data_t *kdtree,
   kdtree_cleanup(&p, coords_raw);
   return out_nn;
 }
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/****************************************************************
+ ********      K-nearest neighbours and range search      *******
+ ****************************************************************/
+/* Parameters for the multi-threaded k-nearest neighbour and range
+   searches. The prepared k-d tree ('kp' or 'flat') is only read by the
+   threads. */
+struct kdtree_search_params
+{
+  struct kdtree_params *kp;  /* The prepared k-d tree (read-only).     */
+  struct kdtree_flat *flat;  /* The flat k-d tree (read-only).         */
+  size_t              ndim;  /* Number of dimensions.                  */
+  size_t              root;  /* Index of the root node.                */
+  gal_data_t       **query;  /* Coordinates of the query points.       */
+  size_t            nquery;  /* Number of query points.                */
+
+  /* k-nearest neighbours. */
+  size_t                 k;  /* Number of neighbours to find.          */
+  size_t            *index;  /* Output neighbour indexs (nquery x k).  */
+  double             *dist;  /* Output distances (nquery x k).         */
+
+  /* Range search. */
+  double           radius2;  /* Square of the search radius.           */
+  size_t            *count;  /* Number of neighbours of each query.    */
+  struct kdtree_range_pair **pairs; /* Found pairs of each thread.     */
+  size_t           *npairs;  /* Number of pairs found by each thread.  */
+  size_t           *apairs;  /* Allocated pairs in each thread.        */
+};
+
+/* One pair found in the range search. */
+struct kdtree_range_pair
+{
+  size_t query;              /* Index of the query point.              */
+  size_t index;              /* Index of the neighbour in the tree.    */
+  double dist;               /* Square of the distance.                */
+};
+
+
+
+
+
+/* Prepare the tree (classic or flat) for the searches: this is done once
+   for all the threads. */
+static void
+kdtree_search_prepare(struct kdtree_search_params *p,
+                      struct kdtree_params *kp, struct kdtree_flat *f,
+                      gal_data_t *coords_raw, gal_data_t *kdtree)
+{
+  if( gal_kdtree_is_flat(kdtree) )
+    {
+      kdtree_flat_read(kdtree, f);
+      p->flat=f;
+      p->ndim=f->ndim;
+    }
+  else
+    {
+      kp->left_col=kdtree;
+      kdtree_prepare(kp, coords_raw);
+      p->kp=kp;
+      p->ndim=kp->ndim;
+    }
+}
+
+
+
+
+
+/* Convert the query coordinates to 'double' (if they aren't already) and
+   make sure they have the same dimensionality as the tree. */
+static gal_data_t **
+kdtree_search_query(size_t ndim, gal_data_t *query, size_t *nquery)
+{
+  size_t i;
+  gal_data_t *tmp, **out;
+
+  /* Basic sanity checks. */
+  if( gal_list_data_number(query)!=ndim )
+    error(EXIT_FAILURE, 0, "%s: the query points have %zu dimensions, "
+          "but the k-d tree has %zu dimensions", __func__,
+          gal_list_data_number(query), ndim);
+  for(tmp=query->next; tmp!=NULL; tmp=tmp->next)
+    if(tmp->size!=query->size)
+      error(EXIT_FAILURE, 0, "%s: all the query coordinate columns "
+            "must have the same number of elements", __func__);
+
+  /* Allocate the array of columns and fill it. */
+  errno=0;
+  out=malloc(ndim*sizeof *out);
+  if(out==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't allocate %zu bytes "
+          "for 'out'", __func__, ndim*sizeof *out);
+  for(i=0, tmp=query; tmp!=NULL; tmp=tmp->next, ++i)
+    out[i] = ( tmp->type==GAL_TYPE_FLOAT64
+               ? tmp
+               : gal_data_copy_to_new_type(tmp, GAL_TYPE_FLOAT64) );
+
+  /* Return the array of columns. */
+  *nquery=query->size;
+  return out;
+}
+
+
+
+
+
+/* Clean up the query columns and the prepared tree. */
+static void
+kdtree_search_free(struct kdtree_search_params *p, gal_data_t *coords_raw,
+                   gal_data_t *query)
+{
+  size_t i;
+  gal_data_t *tmp=query;
+
+  for(i=0; i<p->ndim; ++i)
+    {
+      if(p->query[i]!=tmp) gal_data_free(p->query[i]);
+      tmp=tmp->next;
+    }
+  free(p->query);
+  if(p->kp) kdtree_cleanup(p->kp, coords_raw);
+}
+
+
+
+
+
+/* Add a candidate neighbour to the bounded max-heap of size 'k'. If the
+   heap isn't full yet, it is added to the bottom, otherwise it replaces
+   the top (farthest) if it is nearer. */
+static void
+kdtree_knn_heap_add(size_t *hind, double *hdist, size_t *num, size_t k,
+                    size_t ind, double d)
+{
+  if(*num<k)
+    {
+      hind[*num]=ind;
+      hdist[*num]=d;
+      kdtree_knn_heap_up(hind, hdist, (*num)++);
+    }
+  else if(d<hdist[0])
+    {
+      hind[0]=ind;
+      hdist[0]=d;
+      kdtree_knn_heap_down(hind, hdist, k);
+    }
+}
+
+
+
+
+
+/* Find the 'k' nearest neighbours of 'point'. The neighbours found so far
+   are kept in a bounded max-heap of size 'k' (the farthest neighbour is
+   at the top of the heap): a branch is only searched if it can contain a
+   point that is nearer than the top of the full heap. This is the same
+   search as 'kdtree_nearest_neighbour', with the heap replacing the
+   single nearest node. */
+static void
+kdtree_knn(struct kdtree_params *p, uint32_t node_current, double *point,
+           size_t k, size_t *hind, double *hdist, size_t *num,
+           size_t depth)
+{
+  double dx;
+  size_t axis=depth % p->ndim;
+  double *coordinates=p->coords[axis]->array;
+
+  /* If no subtree present, don't search further. */
+  if(node_current==GAL_BLANK_UINT32) return;
+
+  /* Add this node to the heap. */
+  kdtree_knn_heap_add(hind, hdist, num, k, node_current,
+                      kdtree_distance_find(p, node_current, point));
+
+  /* Search the subtree on the same side of the plane. */
+  dx = coordinates[node_current]-point[axis];
+  kdtree_knn(p, dx > 0 ? p->left[node_current] : p->right[node_current],
+             point, k, hind, hdist, num, depth+1);
+
+  /* The other side is only necessary if the heap isn't full, or if the
+     plane is nearer than the farthest neighbour. */
+  if( *num==k && dx*dx >= hdist[0] ) return;
+  kdtree_knn(p, dx > 0 ? p->right[node_current] : p->left[node_current],
+             point, k, hind, hdist, num, depth+1);
+}
+
+
+
+
+
+/* Same as 'kdtree_knn', but on a flat tree (the heap keeps the position
+   of the points in the tree). */
+static void
+kdtree_flat_knn(struct kdtree_flat *f, size_t node, size_t lo, size_t hi,
+                double *point, size_t k, size_t *hind, double *hdist,
+                size_t *num)
+{
+  double dx, d[GAL_KDTREE_FLAT_BUCKET];
+  size_t i, near, far, mid=lo+(hi-lo)/2;
+
+  /* On a leaf, check all of its points. */
+  if(node>=f->nleaf)
+    {
+      kdtree_flat_leaf_dist(f, lo, hi, point, d);
+      for(i=0;i<hi-lo;++i)
+        kdtree_knn_heap_add(hind, hdist, num, k, lo+i, d[i]);
+      return;
+    }
+
+  /* Search the child on the side of the point, then the other. */
+  dx = point[f->dim[node]] - f->split[node];
+  near = dx<0 ? 2*node : 2*node+1;
+  far  = dx<0 ? 2*node+1 : 2*node;
+  kdtree_flat_knn(f, near, dx<0 ? lo : mid, dx<0 ? mid : hi, point, k,
+                  hind, hdist, num);
+  if( *num==k && dx*dx >= hdist[0] ) return;
+  kdtree_flat_knn(f, far, dx<0 ? mid : lo, dx<0 ? hi : mid, point, k,
+                  hind, hdist, num);
+}
+
+
+
+
+
+/* Worker function for 'gal_kdtree_knn'. */
+static void *
+kdtree_knn_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct kdtree_search_params *p=(struct kdtree_search_params *)tprm->params;
+
+  double td, *hdist;
+  size_t i, j, q, num, ti, *hind;
+  size_t k=p->k, ndim=p->ndim;
+  double *point=gal_pointer_allocate(GAL_TYPE_FLOAT64, ndim, 0, __func__,
+                                     "point");
+
+  /* Go over the query points. The heap of each query point is directly
+     written into its row of the output. */
+  for(i=0; (q=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Set the point and its heap. */
+      hind=p->index+q*k;
+      hdist=p->dist+q*k;
+      for(j=0;j<ndim;++j) point[j]=((double *)(p->query[j]->array))[q];
+
+      /* Find the neighbours. */
+      num=0;
+      if(p->flat)
+        kdtree_flat_knn(p->flat, 1, 0, p->flat->npoint, point, k, hind,
+                        hdist, &num);
+      else
+        kdtree_knn(p->kp, p->root, point, k, hind, hdist, &num, 0);
+
+      /* Sort the heap (by popping the farthest to the end), so the
+         nearest neighbour is first. */
+      for(j=num; j>1; --j)
+        {
+          td=hdist[0]; hdist[0]=hdist[j-1]; hdist[j-1]=td;
+          ti=hind[0];  hind[0]=hind[j-1];   hind[j-1]=ti;
+          kdtree_knn_heap_down(hind, hdist, j-1);
+        }
+
+      /* Convert the squared distances to distances (and positions in a
+         flat tree to input rows) and set blank values when there were
+         less than 'k' points in the tree. */
+      for(j=0;j<num;++j)
+        {
+          hdist[j]=sqrt(hdist[j]);
+          if(p->flat) hind[j]=p->flat->rows[hind[j]];
+        }
+      for(j=num;j<k;++j) { hind[j]=GAL_BLANK_SIZE_T; hdist[j]=NAN; }
+    }
+
+  /* Clean up, wait for other threads to finish and return. */
+  free(point);
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Find the 'k' nearest neighbours of each query point in the k-d tree
+   (which can also be a flat tree).
+
+   Return: a 2D 'size_t' dataset (one row for each query point and 'k'
+           columns) with the indexs of the neighbours (sorted by
+           distance). Its 'next' element is a 2D 'double' dataset with
+           the same size that contains the distances. When the tree has
+           less than 'k' points, the extra elements are blank. */
+gal_data_t *
+gal_kdtree_knn(gal_data_t *coords_raw, gal_data_t *kdtree, size_t root,
+               gal_data_t *query, size_t k, size_t numthreads,
+               size_t minmapsize, int quietmmap)
+{
+  size_t dsize[2];
+  gal_data_t *out;
+  struct kdtree_flat f;
+  struct kdtree_params kp={0};
+  struct kdtree_search_params p={0};
+
+  /* Sanity checks. */
+  if(k==0)
+    error(EXIT_FAILURE, 0, "%s: the number of neighbours ('k') cannot "
+          "be zero", __func__);
+  if(kdtree==NULL || coords_raw->size==0)
+    error(EXIT_FAILURE, 0, "%s: the k-d tree is empty", __func__);
+
+  /* Prepare the tree (only once for all the threads) and the queries. */
+  kdtree_search_prepare(&p, &kp, &f, coords_raw, kdtree);
+  p.query=kdtree_search_query(p.ndim, query, &p.nquery);
+
+  /* Allocate the outputs. */
+  dsize[0]=p.nquery;
+  dsize[1]=k;
+  out=gal_data_alloc(NULL, GAL_TYPE_SIZE_T, 2, dsize, NULL, 0,
+                     minmapsize, quietmmap, "KNN_ROW", "counter",
+                     "Row of neighbour in the k-d tree (counting from 0).");
+  out->next=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 2, dsize, NULL, 0,
+                           minmapsize, quietmmap, "KNN_DIST", NULL,
+                           "Distance to neighbour.");
+
+  /* Do the search. */
+  p.k=k;
+  p.root=root;
+  p.index=out->array;
+  p.dist=out->next->array;
+  gal_threads_spin_off_dynamic(kdtree_knn_worker, &p, p.nquery,
+                               numthreads);
+
+  /* Clean up and return. */
+  kdtree_search_free(&p, coords_raw, query);
+  return out;
+}
+
+
+
+
+
+/* Add a pair to the list of pairs of this thread (allocating more space
+   if necessary). */
+static void
+kdtree_range_add(struct kdtree_search_params *sp, size_t tid,
+                 size_t query, size_t index, double d)
+{
+  struct kdtree_range_pair *pair;
+
+  if(sp->npairs[tid]==sp->apairs[tid])
+    {
+      sp->apairs[tid] = sp->apairs[tid] ? 2*sp->apairs[tid] : 1024;
+      errno=0;
+      sp->pairs[tid]=realloc(sp->pairs[tid],
+                             sp->apairs[tid]*sizeof *sp->pairs[tid]);
+      if(sp->pairs[tid]==NULL)
+        error(EXIT_FAILURE, errno, "%s: couldn't allocate %zu bytes "
+              "for the pairs of thread %zu", __func__,
+              sp->apairs[tid]*sizeof *sp->pairs[tid], tid);
+    }
+  pair=&sp->pairs[tid][ sp->npairs[tid]++ ];
+  pair->query=query;
+  pair->index=index;
+  pair->dist=d;
+  ++sp->count[query];
+}
+
+
+
+
+
+/* Find all the nodes that are within the radius of the point and add
+   them to the pairs of this thread. */
+static void
+kdtree_range(struct kdtree_search_params *sp, uint32_t node_current,
+             double *point, size_t query, size_t tid, size_t depth)
+{
+  double d, dx;
+  struct kdtree_params *p=sp->kp;
+  size_t axis=depth % p->ndim;
+  double *coordinates=p->coords[axis]->array;
+
+  /* If no subtree present, don't search further. */
+  if(node_current==GAL_BLANK_UINT32) return;
+
+  /* If this node is within the radius, add it to the list of pairs. */
+  d = kdtree_distance_find(p, node_current, point);
+  if(d < sp->radius2) kdtree_range_add(sp, tid, query, node_current, d);
+
+  /* Search the subtree on the same side of the plane, and the other side
+     only when the plane is within the radius. */
+  dx = coordinates[node_current]-point[axis];
+  kdtree_range(sp, dx > 0 ? p->left[node_current] : p->right[node_current],
+               point, query, tid, depth+1);
+  if(dx*dx >= sp->radius2) return;
+  kdtree_range(sp, dx > 0 ? p->right[node_current] : p->left[node_current],
+               point, query, tid, depth+1);
+}
+
+
+
+
+
+/* Same as 'kdtree_range', but on a flat tree. */
+static void
+kdtree_flat_range(struct kdtree_search_params *sp, size_t node, size_t lo,
+                  size_t hi, double *point, size_t query, size_t tid)
+{
+  struct kdtree_flat *f=sp->flat;
+  double dx, d[GAL_KDTREE_FLAT_BUCKET];
+  size_t i, near, far, mid=lo+(hi-lo)/2;
+
+  /* On a leaf, check all of its points. */
+  if(node>=f->nleaf)
+    {
+      kdtree_flat_leaf_dist(f, lo, hi, point, d);
+      for(i=0;i<hi-lo;++i)
+        if(d[i] < sp->radius2)
+          kdtree_range_add(sp, tid, query, f->rows[lo+i], d[i]);
+      return;
+    }
+
+  /* Search the child on the side of the point, then the other. */
+  dx = point[f->dim[node]] - f->split[node];
+  near = dx<0 ? 2*node : 2*node+1;
+  far  = dx<0 ? 2*node+1 : 2*node;
+  kdtree_flat_range(sp, near, dx<0 ? lo : mid, dx<0 ? mid : hi, point,
+                    query, tid);
+  if(dx*dx >= sp->radius2) return;
+  kdtree_flat_range(sp, far, dx<0 ? mid : lo, dx<0 ? hi : mid, point,
+                    query, tid);
+}
+
+
+
+
+
+/* For sorting the pairs of one query point by distance. */
+static int
+kdtree_range_pair_cmp(const void *a, const void *b)
+{
+  double da=((struct kdtree_range_pair *)a)->dist;
+  double db=((struct kdtree_range_pair *)b)->dist;
+  return da<db ? -1 : (da>db ? 1 : 0);
+}
+
+
+
+
+
+/* Worker function for 'gal_kdtree_range'. */
+static void *
+kdtree_range_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct kdtree_search_params *p=(struct kdtree_search_params *)tprm->params;
+
+  size_t i, j, q, start, ndim=p->ndim;
+  double *point=gal_pointer_allocate(GAL_TYPE_FLOAT64, ndim, 0, __func__,
+                                     "point");
+
+  /* Go over the query points. */
+  for(i=0; (q=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Set the point and find its neighbours. */
+      start=p->npairs[tprm->id];
+      for(j=0;j<ndim;++j) point[j]=((double *)(p->query[j]->array))[q];
+      if(p->flat)
+        kdtree_flat_range(p, 1, 0, p->flat->npoint, point, q, tprm->id);
+      else
+        kdtree_range(p, p->root, point, q, tprm->id, 0);
+
+      /* Sort the neighbours of this point by distance. */
+      if(p->count[q]>1)
+        qsort(p->pairs[tprm->id]+start, p->count[q],
+              sizeof *p->pairs[tprm->id], kdtree_range_pair_cmp);
+    }
+
+  /* Clean up, wait for other threads to finish and return. */
+  free(point);
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Find all the points in the k-d tree (which can also be a flat tree)
+   that are within 'radius' of each query point.
+
+   Return: a list of three 1D columns (one row for each pair): the index
+           of the query point ('size_t'), the index of the neighbour in
+           the tree ('size_t') and their distance ('double'). The rows
+           are sorted by the query index, and the distance within each
+           query. When no pair is found, NULL is returned. */
+gal_data_t *
+gal_kdtree_range(gal_data_t *coords_raw, gal_data_t *kdtree, size_t root,
+                 gal_data_t *query, double radius, size_t numthreads,
+                 size_t minmapsize, int quietmmap)
+{
+  double *odist;
+  gal_data_t *out=NULL;
+  struct kdtree_flat f;
+  struct kdtree_params kp={0};
+  struct kdtree_range_pair *pair;
+  struct kdtree_search_params p={0};
+  size_t i, t, npairs, sum, tmp, *oquery, *oindex;
+
+  /* Sanity checks. */
+  if( !(radius>0) )
+    error(EXIT_FAILURE, 0, "%s: the radius (%g) must be positive",
+          __func__, radius);
+  if(numthreads==0)
+    error(EXIT_FAILURE, 0, "%s: the number of threads cannot be zero",
+          __func__);
+  if(kdtree==NULL || coords_raw->size==0) return NULL;
+
+  /* Prepare the tree (only once for all the threads) and the queries. */
+  kdtree_search_prepare(&p, &kp, &f, coords_raw, kdtree);
+  p.query=kdtree_search_query(p.ndim, query, &p.nquery);
+
+  /* Allocate the per-thread and per-query arrays. */
+  p.root=root;
+  p.radius2=radius*radius;
+  p.count=gal_pointer_allocate(GAL_TYPE_SIZE_T, p.nquery, 1, __func__,
+                               "p.count");
+  p.npairs=gal_pointer_allocate(GAL_TYPE_SIZE_T, numthreads, 1, __func__,
+                                "p.npairs");
+  p.apairs=gal_pointer_allocate(GAL_TYPE_SIZE_T, numthreads, 1, __func__,
+                                "p.apairs");
+  errno=0;
+  p.pairs=calloc(numthreads, sizeof *p.pairs);
+  if(p.pairs==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't allocate %zu bytes for "
+          "'p.pairs'", __func__, numthreads*sizeof *p.pairs);
+
+  /* Do the search. */
+  gal_threads_spin_off_dynamic(kdtree_range_worker, &p, p.nquery,
+                               numthreads);
+
+  /* Convert the counts into the starting row of each query in the
+     output (the pairs of each query are contiguous in the output). */
+  sum=0;
+  for(i=0;i<p.nquery;++i) { tmp=p.count[i]; p.count[i]=sum; sum+=tmp; }
+  npairs=sum;
+
+  /* Allocate and fill the output. */
+  if(npairs)
+    {
+      gal_list_data_add_alloc(&out, NULL, GAL_TYPE_FLOAT64, 1, &npairs,
+                              NULL, 0, minmapsize, quietmmap,
+                              "RANGE_DIST", NULL, "Distance to neighbour.");
+      gal_list_data_add_alloc(&out, NULL, GAL_TYPE_SIZE_T, 1, &npairs,
+                              NULL, 0, minmapsize, quietmmap, "RANGE_ROW",
+                              "counter", "Row of neighbour in the k-d "
+                              "tree (counting from 0).");
+      gal_list_data_add_alloc(&out, NULL, GAL_TYPE_SIZE_T, 1, &npairs,
+                              NULL, 0, minmapsize, quietmmap,
+                              "QUERY_ROW", "counter", "Row of query "
+                              "point (counting from 0).");
+      oquery=out->array;
+      oindex=out->next->array;
+      odist=out->next->next->array;
+      for(t=0;t<numthreads;++t)
+        for(i=0;i<p.npairs[t];++i)
+          {
+            pair=&p.pairs[t][i];
+            tmp=p.count[pair->query]++;
+            oquery[tmp]=pair->query;
+            oindex[tmp]=pair->index;
+            odist[tmp]=sqrt(pair->dist);
+          }
+    }
+
+  /* Clean up and return. */
+  for(t=0;t<numthreads;++t) free(p.pairs[t]);
+  free(p.pairs);
+  free(p.count);
+  free(p.npairs);
+  free(p.apairs);
+  kdtree_search_free(&p, coords_raw, query);
+  return out;
+}
@@ -1405,6 +1405,175 @@ gal_list_dosizet_free(gal_list_dosizet_t *largest)
 
 
 
+/****************************************************************
+ ******************   Heap (priority queue)   *******************
+ *****************           size_t          ********************
+ ****************************************************************/
+/* A binary heap of size_t values that are ordered by a 'float'. Adding
+   and popping an element are O(log(n)), unlike the ordered lists above
+   (where adding is O(n)). So it should be used when the queue can become
+   large (for example in a nearest-neighbor search over an image).
+
+   All the added values (and their sort parameter) are kept in 'v' and
+   's' in the order they were added (until the heap is emptied). The heap
+   itself ('heap') only contains the indexs of the elements in 'v' and
+   's'. This is done for two reasons: 1) when two elements have the same
+   sort parameter, the one that was added first is popped first (like
+   'gal_list_dosizet_pop_smallest'). 2) After the popping is finished,
+   the caller can see all the elements that were added (for example to
+   reset their flags) and empty the heap (with 'gal_list_hsizet_empty')
+   to use its allocated space again. */
+gal_list_hsizet_t *
+gal_list_hsizet_alloc(size_t allocated)
+{
+  gal_list_hsizet_t *out;
+
+  /* Allocate the structure. */
+  errno=0;
+  out=malloc(sizeof *out);
+  if(out==NULL)
+    error(EXIT_FAILURE, errno, "%s: %zu bytes for 'out'", __func__,
+          sizeof *out);
+
+  /* Allocate the arrays. */
+  out->size=out->added=0;
+  out->allocated = allocated ? allocated : 16;
+  out->s=gal_pointer_allocate(GAL_TYPE_FLOAT32, out->allocated, 0,
+                              __func__, "out->s");
+  out->v=gal_pointer_allocate(GAL_TYPE_SIZE_T, out->allocated, 0,
+                              __func__, "out->v");
+  out->heap=gal_pointer_allocate(GAL_TYPE_SIZE_T, out->allocated, 0,
+                                 __func__, "out->heap");
+  return out;
+}
+
+
+
+
+
+/* Element 'A' of the heap should be popped before element 'B'. */
+#define LIST_HSIZET_BEFORE(A, B) ( s[A]<s[B] || (s[A]==s[B] && A<B) )
+
+void
+gal_list_hsizet_add(gal_list_hsizet_t *heap, size_t value, float tosort)
+{
+  float *s;
+  size_t i, p, n, *h;
+
+  /* Make sure there is enough space (double the space when necessary). */
+  if(heap->added==heap->allocated)
+    {
+      heap->allocated*=2;
+      errno=0;
+      heap->s=realloc(heap->s, heap->allocated*sizeof *heap->s);
+      heap->v=realloc(heap->v, heap->allocated*sizeof *heap->v);
+      heap->heap=realloc(heap->heap, heap->allocated*sizeof *heap->heap);
+      if(heap->s==NULL || heap->v==NULL || heap->heap==NULL)
+        error(EXIT_FAILURE, errno, "%s: couldn't re-allocate the heap "
+              "for %zu elements", __func__, heap->allocated);
+    }
+
+  /* Keep the new element. */
+  n=heap->added++;
+  s=heap->s;
+  h=heap->heap;
+  s[n]=tosort;
+  heap->v[n]=value;
+
+  /* Move the parents that should be popped after the new element down,
+     until the new element's place is found. */
+  i=heap->size++;
+  while(i)
+    {
+      p=(i-1)/2;
+      if( LIST_HSIZET_BEFORE(h[p], n) ) break;
+      h[i]=h[p];
+      i=p;
+    }
+  h[i]=n;
+}
+
+
+
+
+
+/* Pop the element with the smallest sort parameter. When the heap is
+   empty, 'GAL_BLANK_SIZE_T' is returned and 'tosort' will be NaN. */
+size_t
+gal_list_hsizet_pop_smallest(gal_list_hsizet_t *heap, float *tosort)
+{
+  float *s=heap->s;
+  size_t i, c, last, top, *h=heap->heap;
+
+  /* If the heap is empty, return a blank value. */
+  if(heap->size==0)
+    {
+      *tosort=NAN;
+      return GAL_BLANK_SIZE_T;
+    }
+
+  /* Keep the top, then move the smaller child up from the top (until the
+     place of the last element is found). */
+  top=h[0];
+  last=h[--heap->size];
+  i=0;
+  while( (c=2*i+1) < heap->size )
+    {
+      if( c+1<heap->size && LIST_HSIZET_BEFORE(h[c+1], h[c]) ) ++c;
+      if( LIST_HSIZET_BEFORE(last, h[c]) ) break;
+      h[i]=h[c];
+      i=c;
+    }
+  h[i]=last;
+
+  /* Return the value of the top element. */
+  *tosort=s[top];
+  return heap->v[top];
+}
+
+
+
+
+
+/* Remove all the elements (but keep the allocated space). */
+void
+gal_list_hsizet_empty(gal_list_hsizet_t *heap)
+{
+  heap->size=heap->added=0;
+}
+
+
+
+
+
+void
+gal_list_hsizet_free(gal_list_hsizet_t *heap)
+{
+  free(heap->s);
+  free(heap->v);
+  free(heap->heap);
+  free(heap);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 /*********************************************************************/
 /*************    Data structure as a linked list   ******************/
 /*********************************************************************/
@@ -23,13 +23,13 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 **********************************************************************/
 #include <config.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <errno.h>
 #include <error.h>
 #include <float.h>
 #include <stdlib.h>
-
-#include <gsl/gsl_sort.h>
+#include <string.h>
 
 #include <gnuastro/box.h>
 #include <gnuastro/list.h>
@@ -606,18 +606,167 @@ match_sort_based_sanity_check(gal_data_t *coord1, gal_data_t *coord2,
 
 
 
+/* For sorting the first coordinate on multiple threads: each thread
+   sorts a "run" of (value, index) pairs, then neighbouring runs are
+   merged (in parallel) until there is only one run. Equal values are
+   sorted by their index, so the permutation doesn't depend on the
+   number of threads. */
+struct match_sort_pair
+{
+  double                  v;  /* Value of the element.                */
+  size_t                  i;  /* Index of the element.                */
+};
+
+struct match_sort_params
+{
+  struct match_sort_pair *in; /* Pairs to sort or merge.              */
+  struct match_sort_pair *out;/* Output of the merges.                */
+  size_t            *bounds;  /* Start of each run ('nruns+1' values). */
+  size_t              nruns;  /* Number of runs.                      */
+  size_t              width;  /* Runs on each side of a merge.        */
+};
+
+
+
+
+
+static int
+match_sort_pair_cmp(const void *a, const void *b)
+{
+  const struct match_sort_pair *pa=a, *pb=b;
+  if(pa->v!=pb->v) return pa->v<pb->v ? -1 : 1;
+  return pa->i<pb->i ? -1 : (pa->i>pb->i);
+}
+
+
+
+
+
+/* Sort the runs that are given to this thread. */
+static void *
+match_sort_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct match_sort_params *p=(struct match_sort_params *)tprm->params;
+
+  size_t i, r;
+
+  for(i=0; (r=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    qsort(p->in+p->bounds[r], p->bounds[r+1]-p->bounds[r],
+          sizeof *p->in, match_sort_pair_cmp);
+
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Merge the neighbouring groups of runs that are given to this thread
+   (each side has 'p->width' runs, the last group may have no right
+   side, in this case it is just copied). */
+static void *
+match_merge_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct match_sort_params *p=(struct match_sort_params *)tprm->params;
+
+  size_t i, j, l, le, r, re, o;
+
+  for(i=0; (j=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* The two sides of this merge. */
+      o = l = p->bounds[ 2*j*p->width ];
+      le = r = p->bounds[ (2*j+1)*p->width < p->nruns
+                          ? (2*j+1)*p->width : p->nruns ];
+      re = p->bounds[ (2*j+2)*p->width < p->nruns
+                      ? (2*j+2)*p->width : p->nruns ];
+
+      /* Merge them. */
+      while(l<le && r<re)
+        p->out[o++] = ( match_sort_pair_cmp(p->in+r, p->in+l)<0
+                        ? p->in[r++] : p->in[l++] );
+      while(l<le) p->out[o++]=p->in[l++];
+      while(r<re) p->out[o++]=p->in[r++];
+    }
+
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Return the permutation that sorts the given array (in increasing
+   order), sorting on 'numthreads' threads. */
+static size_t *
+match_sort_based_index(double *arr, size_t size, size_t numthreads,
+                       size_t minmapsize, int quietmmap)
+{
+  size_t i, *perm;
+  struct match_sort_params p;
+  struct match_sort_pair *tmp, *in, *out;
+  char *mmapin=NULL, *mmapout=NULL;
+
+  /* Allocate the pairs and the boundaries of the runs (there are a few
+     runs for each thread, so the threads remain busy). */
+  p.nruns = numthreads>1 ? 4*numthreads : 1;
+  if(p.nruns>size) p.nruns = size ? size : 1;
+  p.in=gal_pointer_allocate_ram_or_mmap(GAL_TYPE_UINT8,
+                                        size*sizeof *p.in, 0, minmapsize,
+                                        &mmapin, quietmmap, __func__,
+                                        "p.in");
+  p.out=gal_pointer_allocate_ram_or_mmap(GAL_TYPE_UINT8,
+                                         size*sizeof *p.out, 0,
+                                         minmapsize, &mmapout, quietmmap,
+                                         __func__, "p.out");
+  p.bounds=gal_pointer_allocate(GAL_TYPE_SIZE_T, p.nruns+1, 0, __func__,
+                                "p.bounds");
+  in=p.in;
+  out=p.out;
+  for(i=0;i<=p.nruns;++i) p.bounds[i]=i*size/p.nruns;
+  for(i=0;i<size;++i) { p.in[i].v=arr[i]; p.in[i].i=i; }
+
+  /* Sort each run, then merge them (the output of each round of merges
+     is the input of the next). */
+  gal_threads_spin_off_dynamic(match_sort_worker, &p, p.nruns, numthreads);
+  for(p.width=1; p.width<p.nruns; p.width*=2)
+    {
+      gal_threads_spin_off_dynamic(match_merge_worker, &p,
+                                   (p.nruns+2*p.width-1)/(2*p.width),
+                                   numthreads);
+      tmp=p.in; p.in=p.out; p.out=tmp;
+    }
+
+  /* Write the permutation. */
+  perm=gal_pointer_allocate(GAL_TYPE_SIZE_T, size, 0, __func__, "perm");
+  for(i=0;i<size;++i) perm[i]=p.in[i].i;
+
+  /* Clean up and return ('p.in' and 'p.out' may have been swapped). */
+  if(mmapin)  gal_pointer_mmap_free(&mmapin, quietmmap);  else free(in);
+  if(mmapout) gal_pointer_mmap_free(&mmapout, quietmmap); else free(out);
+  free(p.bounds);
+  return perm;
+}
+
+
+
+
+
 /* To keep things clean, the sorting of each input array will be done in
    this function. */
 static size_t *
-match_sort_based_prepare_sort(gal_data_t *coords, size_t minmapsize)
+match_sort_based_prepare_sort(gal_data_t *coords, size_t numthreads,
+                              size_t minmapsize, int quietmmap)
 {
   size_t i;
   double *darr;
   gal_data_t *tmp;
-  size_t *permutation=gal_pointer_allocate(GAL_TYPE_SIZE_T, coords->size,
-                                           0, __func__, "permutation");
+  size_t *permutation;
 
-  /* Unfortunately 'gsl_sort_index' doesn't account for NaN elements. So we
+  /* The comparison of the sort doesn't account for NaN elements. So we
      need to set them to the maximum possible floating point value. */
   if( gal_blank_present(coords, 1) )
     {
@@ -628,7 +777,8 @@ match_sort_based_prepare_sort(gal_data_t *coords, size_t minmapsize)
 
   /* Get the permutation necessary to sort all the columns (based on the
      first column). */
-  gsl_sort_index(permutation, coords->array, 1, coords->size);
+  permutation=match_sort_based_index(coords->array, coords->size,
+                                     numthreads, minmapsize, quietmmap);
 
   /* For a check.
   if(coords->size>1)
@@ -668,7 +818,8 @@ match_sort_based_prepare(gal_data_t *coord1, gal_data_t *coord2,
                           int sorted_by_first, int inplace, int allf64,
                           gal_data_t **A_out, gal_data_t **B_out,
                           size_t **A_perm, size_t **B_perm,
-                          size_t minmapsize)
+                          size_t numthreads, size_t minmapsize,
+                          int quietmmap)
 {
   gal_data_t *c, *tmp, *A=NULL, *B=NULL;
 
@@ -716,8 +867,10 @@ match_sort_based_prepare(gal_data_t *coord1, gal_data_t *coord2,
         }
 
       /* Sort each dataset by the first coordinate. */
-      *A_perm = match_sort_based_prepare_sort(*A_out, minmapsize);
-      *B_perm = match_sort_based_prepare_sort(*B_out, minmapsize);
+      *A_perm = match_sort_based_prepare_sort(*A_out, numthreads,
+                                              minmapsize, quietmmap);
+      *B_perm = match_sort_based_prepare_sort(*B_out, numthreads,
+                                              minmapsize, quietmmap);
     }
 }
 
@@ -725,34 +878,66 @@ match_sort_based_prepare(gal_data_t *coord1, gal_data_t *coord2,
 
 
 
+/* Parameters of the sort-based match (for the threads). */
+struct match_sort_based_params
+{
+  size_t               ndim;  /* Number of dimensions.                */
+  size_t                 ar;  /* Number of rows in first catalog.     */
+  size_t                 br;  /* Number of rows in second catalog.    */
+  double          *aperture;  /* Acceptable aperture for match.       */
+  int              iscircle;  /* If the aperture is circular.         */
+  double               c[3];  /* Fixed cos(), for elliptical dist.    */
+  double               s[3];  /* Fixed sin(), for elliptical dist.    */
+  double            dist[3];  /* Half-width of aperture's box.        */
+  double              *a[3];  /* Direct pointers to column arrays.    */
+  double              *b[3];  /* Direct pointers to column arrays.    */
+  struct match_sfll  **bina;  /* Second cat. items in first.          */
+  size_t            nchunks;  /* Number of chunks of first catalog.   */
+};
+
+
+
+
+
 /* Go through both catalogs and find which records/rows in the second
    catalog (catalog b) are within the acceptable distance of each record in
-   the first (a). */
+   the first (a), for the rows 'ai_start' to 'ai_end' (not inclusive) of
+   the first catalog. */
 static void
-match_sort_based_second_in_first(gal_data_t *A, gal_data_t *B,
-                                  double *aperture,
-                                  struct match_sfll **bina)
+match_sort_based_second_in_first_chunk(struct match_sort_based_params *p,
+                                       size_t ai_start, size_t ai_end)
 {
   /* To keep things easy to read, all variables related to catalog 1 start
      with an 'a' and things related to catalog 2 are marked with a 'b'. The
      redundant variables (those that equal a previous value) are only
      defined to make it easy to read the code.*/
-  int iscircle=0;
-  size_t i, ar=A->size, br=B->size;
-  size_t ai, bi, blow=0, prevblow=0;
-  size_t ndim=gal_list_data_number(A);
-  double r, c[3]={NAN, NAN, NAN}, s[3]={NAN, NAN, NAN};
-  double dist[3]={NAN, NAN, NAN}, delta[3]={NAN, NAN, NAN};
-  double *a[3]={NULL, NULL, NULL}, *b[3]={NULL, NULL, NULL};
-
-  /* Necessary preperations. */
-  match_aperture_prepare(A, B, aperture,  ndim, a, b, dist,
-                         c, s, &iscircle);
+  int iscircle=p->iscircle;
+  size_t i, br=p->br, ndim=p->ndim;
+  size_t ai, bi, blow, prevblow, lo, hi;
+  struct match_sfll **bina=p->bina;
+  double r, *c=p->c, *s=p->s, *aperture=p->aperture;
+  double *dist=p->dist, delta[3]={NAN, NAN, NAN};
+  double **a=p->a, **b=p->b;
+
+  /* The first row of the second catalog that may be within the aperture
+     of the first row in this chunk (the same value that 'blow' would
+     have when reaching this row in a single pass over the first
+     catalog). */
+  blow=0;
+  if(ai_start<ai_end && !isnan(a[0][ai_start]))
+    {
+      lo=0; hi=br;
+      while(lo<hi)
+        if( b[0][(lo+hi)/2] < a[0][ai_start]-dist[0] ) lo=(lo+hi)/2+1;
+        else                                           hi=(lo+hi)/2;
+      blow=lo;
+    }
+  prevblow=blow;
 
   /* For each row/record of catalog 'a', make a list of the nearest records
      in catalog b within the maximum distance. Note that both catalogs are
      sorted by their first axis coordinate.*/
-  for(ai=0;ai<ar;++ai)
+  for(ai=ai_start;ai<ai_end;++ai)
     if( !isnan(a[0][ai]) && blow<br)
       {
         /* Initialize 'bina'. */
@@ -865,6 +1050,69 @@ match_sort_based_second_in_first(gal_data_t *A, gal_data_t *B,
 
 
 
+/* The first catalog is divided into contiguous chunks that are given to
+   the threads: each chunk only writes the 'bina' of its own rows, and
+   the start of each chunk in the (sorted) second catalog is found with
+   a binary search. The ranges of the second catalog that neighbouring
+   chunks parse overlap (by the aperture), but each pair of rows is only
+   checked once. */
+static void *
+match_sort_based_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct match_sort_based_params *p=
+    (struct match_sort_based_params *)tprm->params;
+
+  size_t i, chunk;
+
+  /* Go over the chunks that are given to this thread. */
+  for(i=0; (chunk=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    match_sort_based_second_in_first_chunk(p, chunk*p->ar/p->nchunks,
+                                           (chunk+1)*p->ar/p->nchunks);
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Prepare the parameters and match the chunks of the first catalog on
+   multiple threads. */
+static void
+match_sort_based_second_in_first(gal_data_t *A, gal_data_t *B,
+                                  double *aperture,
+                                  struct match_sfll **bina,
+                                  size_t numthreads)
+{
+  struct match_sort_based_params p={0};
+
+  /* Necessary preperations. */
+  p.ar=A->size;
+  p.br=B->size;
+  p.bina=bina;
+  p.aperture=aperture;
+  p.ndim=gal_list_data_number(A);
+  match_aperture_prepare(A, B, aperture, p.ndim, p.a, p.b, p.dist,
+                         p.c, p.s, &p.iscircle);
+
+  /* There are a few chunks for each thread (the density of points can
+     be very different), but each chunk should be large enough for the
+     search of its start to be negligible. */
+  p.nchunks = numthreads>1 ? 16*numthreads : 1;
+  if(p.nchunks > p.ar/1000+1) p.nchunks = p.ar/1000+1;
+
+  /* Do the match. */
+  gal_threads_spin_off_dynamic(match_sort_based_worker, &p, p.nchunks,
+                               numthreads);
+}
+
+
+
+
+
 /* Match two positions: the two inputs ('coord1' and 'coord2') should be
    lists of coordinates (each is a list of datasets). To speed up the
    search, this function will sort the inputs by their first column. If
@@ -887,8 +1135,8 @@ match_sort_based_second_in_first(gal_data_t *A, gal_data_t *B,
 gal_data_t *
 gal_match_sort_based(gal_data_t *coord1, gal_data_t *coord2,
                       double *aperture, int sorted_by_first,
-                      int inplace, size_t minmapsize, int quietmmap,
-                      size_t *nummatched)
+                      int inplace, size_t numthreads, size_t minmapsize,
+                      int quietmmap, size_t *nummatched)
 {
   int allf64=1;
   gal_data_t *A, *B, *out;
@@ -901,7 +1149,7 @@ gal_match_sort_based(gal_data_t *coord1, gal_data_t *coord2,
                                  &allf64);
   match_sort_based_prepare(coord1, coord2, sorted_by_first, inplace,
                             allf64, &A, &B, &A_perm, &B_perm,
-                            minmapsize);
+                            numthreads, minmapsize, quietmmap);
 
 
   /* Allocate the 'bina' array (an array of lists). Let's call the first
@@ -916,7 +1164,7 @@ gal_match_sort_based(gal_data_t *coord1, gal_data_t *coord2,
 
 
   /* All records in 'b' that match each 'a' (possibly duplicate). */
-  match_sort_based_second_in_first(A, B, aperture, bina);
+  match_sort_based_second_in_first(A, B, aperture, bina, numthreads);
 
 
   /* Two re-arrangings will fix the issue. */
@@ -1067,7 +1315,7 @@ match_kdtree_A_coverage(struct match_kdtree_params *p)
 
           /* Generate the histogram of elements in this dimension. */
           bins=gal_statistics_regular_bins(tmp, range, numbins, NAN);
-          hist=gal_statistics_histogram(tmp, bins, 0, 0);
+          hist=gal_statistics_histogram(tmp, bins, 0, 0, 1);
 
           /* Set all histograms with atleast one element to 1 and convert
              it to 8-bit unsigned integer. */
@@ -1148,8 +1396,10 @@ match_kdtree_sanity_check(struct match_kdtree_params *p)
           gal_list_data_number(p->B),
           gal_list_data_number(p->A_kdtree));
 
-  /* Make sure that the k-d tree only has two columns. */
-  if( gal_list_data_number(p->A_kdtree)!=2 )
+  /* Make sure that the k-d tree only has two columns (a flat k-d tree
+     is checked in the k-d tree library). */
+  if( gal_kdtree_is_flat(p->A_kdtree)==0
+      && gal_list_data_number(p->A_kdtree)!=2 )
     error(EXIT_FAILURE, 0, "%s: the 'kdtree' argument should only "
           "two nodes/columns (elements in a simply linked list), "
           "but it has %zu nodes/columns", __func__,
@@ -1167,11 +1417,12 @@ match_kdtree_sanity_check(struct match_kdtree_params *p)
       error(EXIT_FAILURE, 0, "%s: the type of all columns in 'coord2' "
             "should be 'double', but at least one of them is '%s'",
             __func__, gal_type_name(tmp->type, 1));
-  for(tmp=p->A_kdtree; tmp!=NULL; tmp=tmp->next)
-    if( tmp->type!=GAL_TYPE_UINT32 )
-      error(EXIT_FAILURE, 0, "%s: the type of both columns in "
-            "'coord1_kdtree' should be 'uint32', but it is '%s'",
-            __func__, gal_type_name(tmp->type, 1));
+  if( gal_kdtree_is_flat(p->A_kdtree)==0 )
+    for(tmp=p->A_kdtree; tmp!=NULL; tmp=tmp->next)
+      if( tmp->type!=GAL_TYPE_UINT32 )
+        error(EXIT_FAILURE, 0, "%s: the type of both columns in "
+              "'coord1_kdtree' should be 'uint32', but it is '%s'",
+              __func__, gal_type_name(tmp->type, 1));
 
   /* Allocate and initialize the 'bina' array (an array of lists). Let's
      call the first catalog 'a' and the second 'b'. This array has
@@ -1380,3 +1631,433 @@ gal_match_kdtree(gal_data_t *coord1, gal_data_t *coord2,
   gal_list_data_free(p.Aexist);
   return out;
 }
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/********************************************************************/
+/*************            Partitioned matching          *************/
+/********************************************************************/
+/* In the partitioned match, the space of the first two coordinates is
+   divided into a regular grid of cells (each containing roughly
+   'MATCH_PARTITION_POINTS' points of the first input). Every point of the
+   first input is put in the bucket of its cell and every point of the
+   second input is put in the buckets of all the cells that are within
+   the aperture's largest semi-axis (the "margin") of it. The buckets are
+   kept in cell order (memory-mapped when they are larger than
+   'minmapsize'), so each bucket pair is a contiguous part of these arrays
+   and the threads only need one bucket pair at a time: very large
+   catalogs can be matched while only a small part of them is in RAM.
+
+   Each bucket pair is matched independently (with a flat k-d tree of the
+   first input's bucket) and the nearest neighbour of each second input
+   point is the nearest of those in its buckets. Since the margin is the
+   largest semi-axis of the aperture, any first input point that can
+   match is in one of the buckets, so the result is the same as
+   'gal_match_kdtree'. */
+#define MATCH_PARTITION_POINTS 50000
+#define MATCH_PARTITION_MAXCELLS 16777216
+struct match_partition_params
+{
+  /* Inputs. */
+  gal_data_t             *A;  /* First coordinate list.                */
+  gal_data_t             *B;  /* Second coordinate list.               */
+  size_t               ndim;  /* Number of dimensions.                 */
+  double             margin;  /* Largest semi-axis of the aperture.    */
+  size_t         minmapsize;  /* Minimum size to use memory-mapping.   */
+  int             quietmmap;  /* Don't print memory-mapping warnings.  */
+
+  /* The grid (over the first two dimensions). */
+  size_t              ngrid;  /* Number of partitioned dimensions.     */
+  double             min[2];  /* Lower edge of the grid.               */
+  double              width;  /* Width of each cell (on all axises).   */
+  size_t           ncell[2];  /* Number of cells along each axis.      */
+  size_t             ncells;  /* Total number of cells.                */
+
+  /* Buckets (in cell order). */
+  gal_data_t       *aoffset;  /* Start of each cell's first input.     */
+  gal_data_t       *boffset;  /* Start of each cell's second input.    */
+  gal_data_t          *arow;  /* First input row of each bucket point. */
+  gal_data_t          *brow;  /* Second input row of each bucket point.*/
+  gal_data_t     *acoord[3];  /* Bucketed coordinates of first input.  */
+  gal_data_t     *bcoord[3];  /* Bucketed coordinates of second input. */
+  gal_data_t       *nearest;  /* Nearest first input row (per bucket). */
+  gal_data_t          *dist;  /* Distance to the nearest (per bucket). */
+};
+
+
+
+
+
+/* Allocate a 1D dataset for the buckets (it will be memory-mapped when
+   it is larger than 'minmapsize'). */
+static gal_data_t *
+match_partition_alloc(struct match_partition_params *p, uint8_t type,
+                      size_t size, int clear)
+{
+  return gal_data_alloc(NULL, type, 1, &size, NULL, clear, p->minmapsize,
+                        p->quietmmap, NULL, NULL, NULL);
+}
+
+
+
+
+
+/* The grid: the cells are squares that are large enough to have
+   roughly 'MATCH_PARTITION_POINTS' first input points and are never
+   smaller than the aperture's diameter (so each second input point
+   is in at most two cells along each axis). */
+static void
+match_partition_grid(struct match_partition_params *p)
+{
+  size_t i, d;
+  gal_data_t *tmp;
+  double *x, area=1.0f, range[2], max[2], ntarget;
+
+  /* Range of the first input (blank coordinates are ignored). */
+  p->ngrid = p->ndim<2 ? p->ndim : 2;
+  for(d=0;d<p->ngrid;++d)
+    {
+      p->min[d]=INFINITY;
+      max[d]=-INFINITY;
+    }
+  for(d=0, tmp=p->A; d<p->ngrid; ++d, tmp=tmp->next)
+    {
+      x=tmp->array;
+      for(i=0;i<p->A->size;++i)
+        if( !isnan(x[i]) )
+          {
+            if(x[i]<p->min[d]) p->min[d]=x[i];
+            if(x[i]>max[d])    max[d]=x[i];
+          }
+      range[d] = p->min[d]<=max[d] ? max[d]-p->min[d] : 0.0f;
+      area *= range[d];
+    }
+
+  /* Width of the cells. */
+  ntarget = (double)(p->A->size)/MATCH_PARTITION_POINTS + 1;
+  p->width = p->ngrid==2 ? sqrt(area/ntarget) : range[0]/ntarget;
+  for(d=0;d<p->ngrid;++d)
+    if(p->width < range[d]/ntarget) p->width=range[d]/ntarget;
+  if(p->width < 2*p->margin) p->width=2*p->margin;
+  if(p->width==0.0f) p->width=1.0f;
+
+  /* Number of cells (the grid is made coarser if there are too many). */
+  do
+    {
+      p->ncells=1;
+      for(d=0;d<p->ngrid;++d)
+        {
+          p->ncell[d] = isinf(p->min[d]) ? 1 : range[d]/p->width + 1;
+          p->ncells *= p->ncell[d];
+        }
+      if(p->ncells>MATCH_PARTITION_MAXCELLS) p->width*=2;
+    }
+  while(p->ncells>MATCH_PARTITION_MAXCELLS);
+}
+
+
+
+
+
+/* The range of cells along dimension 'd' that are within 'margin' of
+   the coordinate 'x'. If it is outside the grid, 0 is returned. */
+static int
+match_partition_cells(struct match_partition_params *p, size_t d,
+                      double x, double margin, size_t *lo, size_t *hi)
+{
+  double l=floor( (x-margin-p->min[d])/p->width );
+  double h=floor( (x+margin-p->min[d])/p->width );
+
+  if( isnan(x) || h<0 || l>=p->ncell[d] ) return 0;
+  *lo = l<0 ? 0 : l;
+  *hi = h>=p->ncell[d] ? p->ncell[d]-1 : h;
+  return 1;
+}
+
+
+
+
+
+/* Put the points of one input into the buckets. For each point, the
+   cells within 'margin' of it are found. A first pass counts the
+   number of points in each cell and a second pass fills the
+   buckets. */
+static void
+match_partition_fill(struct match_partition_params *p, gal_data_t *in,
+                     double margin, gal_data_t **offset_out,
+                     gal_data_t **row_out, gal_data_t **coord_out)
+{
+  double *x[3];
+  gal_data_t *tmp;
+  int pass, inside;
+  size_t i, j, d, c, lo[2], hi[2], *offset, *row=NULL, *fill=NULL;
+
+  /* Pointers to the input columns. */
+  for(d=0, tmp=in; tmp!=NULL; tmp=tmp->next, ++d) x[d]=tmp->array;
+
+  /* Count the points in each cell (pass 0), then fill them (pass 1). */
+  *offset_out=match_partition_alloc(p, GAL_TYPE_SIZE_T, p->ncells+1, 1);
+  offset=(*offset_out)->array;
+  for(pass=0;pass<2;++pass)
+    {
+      /* Allocate the buckets after counting. */
+      if(pass==1)
+        {
+          for(c=0;c<p->ncells;++c) offset[c+1]+=offset[c];
+          *row_out=match_partition_alloc(p, GAL_TYPE_SIZE_T,
+                                         offset[p->ncells], 0);
+          for(d=0;d<p->ndim;++d)
+            coord_out[d]=match_partition_alloc(p, GAL_TYPE_FLOAT64,
+                                               offset[p->ncells], 0);
+          fill=gal_pointer_allocate(GAL_TYPE_SIZE_T, p->ncells, 0,
+                                    __func__, "fill");
+          memcpy(fill, offset, p->ncells*sizeof *fill);
+          row=(*row_out)->array;
+        }
+
+      /* Parse the points. */
+      for(i=0;i<in->size;++i)
+        {
+          /* Cells of this point (note that 'lo' and 'hi' are the same
+             when 'margin' is zero). */
+          inside=1;
+          for(d=0;d<p->ngrid;++d)
+            if( !match_partition_cells(p, d, x[d][i], margin, &lo[d],
+                                       &hi[d]) )
+              { inside=0; break; }
+          if(!inside) continue;
+          if(p->ngrid==1) lo[1]=hi[1]=0;
+
+          /* Add the point to the cells. */
+          for(j=lo[1];j<=hi[1];++j)
+            for(c=j*p->ncell[0]+lo[0]; c<=j*p->ncell[0]+hi[0]; ++c)
+              if(pass==0) ++offset[c+1];
+              else
+                {
+                  row[fill[c]]=i;
+                  for(d=0;d<p->ndim;++d)
+                    ((double *)(coord_out[d]->array))[fill[c]]=x[d][i];
+                  ++fill[c];
+                }
+        }
+    }
+
+  /* Clean up. */
+  free(fill);
+}
+
+
+
+
+
+/* Match the buckets of each cell: the nearest first input point (within
+   the cell) of every second input point in the cell. */
+static void *
+match_partition_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct match_partition_params *p=
+    (struct match_partition_params *)tprm->params;
+
+  double point[3], *dist=p->dist->array;
+  size_t *nearest=p->nearest->array, *arow=p->arow->array;
+  size_t *aoffset=p->aoffset->array, *boffset=p->boffset->array;
+  size_t i, c, d, e, na, ai, dsize[1];
+  gal_data_t *tmp, *cols, *tree;
+
+  /* Go over the cells that are given to this thread. */
+  for(i=0; (c=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* If either bucket is empty, there is nothing to do. */
+      na=aoffset[c+1]-aoffset[c];
+      for(e=boffset[c];e<boffset[c+1];++e) nearest[e]=GAL_BLANK_SIZE_T;
+      if(na==0 || boffset[c+1]==boffset[c]) continue;
+
+      /* Columns of this cell's first input (pointing to the buckets),
+         and their k-d tree. */
+      cols=NULL;
+      dsize[0]=na;
+      for(d=p->ndim;d>0;--d)
+        gal_list_data_add_alloc(&cols, ((double *)(p->acoord[d-1]->array))
+                                       + aoffset[c],
+                                GAL_TYPE_FLOAT64, 1, dsize, NULL, 0, -1, 1,
+                                NULL, NULL, NULL);
+      tree=gal_kdtree_flat_create(cols, 1, -1, 1);
+
+      /* Nearest neighbour of the second input points of this cell. */
+      for(e=boffset[c];e<boffset[c+1];++e)
+        {
+          for(d=0;d<p->ndim;++d)
+            point[d]=((double *)(p->bcoord[d]->array))[e];
+          ai=gal_kdtree_nearest_neighbour(cols, tree, 0, point, &dist[e]);
+          if(ai!=GAL_BLANK_SIZE_T) nearest[e]=arow[aoffset[c]+ai];
+        }
+
+      /* Clean up (the columns don't own their arrays). */
+      for(tmp=cols;tmp!=NULL;tmp=tmp->next) tmp->array=NULL;
+      gal_list_data_free(cols);
+      gal_list_data_free(tree);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Find the nearest first input point of each second input point (among
+   all its buckets), and keep it as a match if it is within the
+   aperture. */
+static void
+match_partition_second_in_first(struct match_partition_params *p,
+                                double *aperture, struct match_sfll **bina)
+{
+  int iscircle;
+  double r, *bd, *bestd, delta[3], dist[3], c[3], s[3], *a[3], *b[3];
+  size_t e, j, ai, bi, *best, *brow=p->brow->array;
+  size_t *nearest=p->nearest->array;
+  gal_data_t *bestd_d, *best_d;
+
+  /* Prepare the aperture (to check the distance of the matches). */
+  match_aperture_prepare(p->A, p->B, aperture, p->ndim, a, b, dist, c,
+                         s, &iscircle);
+
+  /* The nearest point over all the buckets of each second input point
+     (on equal distances, the smaller row is used, so the output
+     doesn't depend on the order of the buckets). */
+  best_d=match_partition_alloc(p, GAL_TYPE_SIZE_T, p->B->size, 0);
+  bestd_d=match_partition_alloc(p, GAL_TYPE_FLOAT64, p->B->size, 0);
+  best=best_d->array;
+  bestd=bestd_d->array;
+  for(bi=0;bi<p->B->size;++bi) { best[bi]=GAL_BLANK_SIZE_T;
+                                 bestd[bi]=INFINITY; }
+  bd=p->dist->array;
+  for(e=0;e<p->brow->size;++e)
+    if( nearest[e]!=GAL_BLANK_SIZE_T )
+      {
+        bi=brow[e];
+        if( bd[e]<bestd[bi]
+            || (bd[e]==bestd[bi] && nearest[e]<best[bi]) )
+          { bestd[bi]=bd[e]; best[bi]=nearest[e]; }
+      }
+
+  /* Keep the nearest points that are within the aperture. */
+  for(bi=0;bi<p->B->size;++bi)
+    if( (ai=best[bi])!=GAL_BLANK_SIZE_T )
+      {
+        for(j=0;j<p->ndim;++j) delta[j]=b[j][bi]-a[j][ai];
+        r=match_distance(delta, iscircle, p->ndim, aperture, c, s);
+        if(r<aperture[0]) match_add_to_sfll(&bina[ai], bi, r);
+      }
+
+  /* Clean up. */
+  gal_data_free(best_d);
+  gal_data_free(bestd_d);
+}
+
+
+
+
+
+gal_data_t *
+gal_match_partitioned(gal_data_t *coord1, gal_data_t *coord2,
+                      double *aperture, size_t numthreads,
+                      size_t minmapsize, int quietmmap,
+                      size_t *nummatched)
+{
+  size_t d;
+  gal_data_t *tmp, *out=NULL;
+  struct match_sfll **bina;
+  struct match_partition_params p={0};
+
+  /* If either input is empty, there is no match. */
+  *nummatched=0;
+  if(coord1==NULL || coord2==NULL || coord1->size==0 || coord2->size==0)
+    return NULL;
+
+  /* Basic sanity checks. */
+  p.A=coord1;
+  p.B=coord2;
+  p.minmapsize=minmapsize;
+  p.quietmmap=quietmmap;
+  p.ndim=gal_list_data_number(coord1);
+  if( p.ndim!=gal_list_data_number(coord2) || p.ndim>3 )
+    error(EXIT_FAILURE, 0, "%s: 'coord1' and 'coord2' should have the "
+          "same number of columns (at most 3), but they have %zu and %zu "
+          "columns", __func__, p.ndim, gal_list_data_number(coord2));
+  for(tmp=coord1; tmp!=NULL; tmp=tmp->next)
+    if( tmp->type!=GAL_TYPE_FLOAT64 || tmp->size!=coord1->size )
+      error(EXIT_FAILURE, 0, "%s: all the columns of 'coord1' should "
+            "have a 'double' type and the same size", __func__);
+  for(tmp=coord2; tmp!=NULL; tmp=tmp->next)
+    if( tmp->type!=GAL_TYPE_FLOAT64 || tmp->size!=coord2->size )
+      error(EXIT_FAILURE, 0, "%s: all the columns of 'coord2' should "
+            "have a 'double' type and the same size", __func__);
+
+  /* The margin is the largest semi-axis of the aperture (the axis ratios
+     are not larger than one). */
+  p.margin=aperture[0];
+
+  /* Build the grid and fill the buckets. */
+  match_partition_grid(&p);
+  match_partition_fill(&p, coord1, 0.0f, &p.aoffset, &p.arow, p.acoord);
+  match_partition_fill(&p, coord2, p.margin, &p.boffset, &p.brow,
+                       p.bcoord);
+
+  /* Match the bucket pairs on multiple threads (the cells are given to
+     the threads dynamically, because they can have very different
+     numbers of points). */
+  p.nearest=match_partition_alloc(&p, GAL_TYPE_SIZE_T, p.brow->size, 0);
+  p.dist=match_partition_alloc(&p, GAL_TYPE_FLOAT64, p.brow->size, 0);
+  gal_threads_spin_off_dynamic(match_partition_worker, &p, p.ncells,
+                               numthreads);
+
+  /* Find the best match for each item and write the output (same as
+     'gal_match_kdtree'). */
+  errno=0;
+  bina=calloc(coord1->size, sizeof *bina);
+  if(bina==NULL)
+    error(EXIT_FAILURE, errno, "%s: %zu bytes for 'bina'",
+          __func__, coord1->size*sizeof *bina);
+  match_partition_second_in_first(&p, aperture, bina);
+  match_rearrange(coord1, coord2, bina);
+  out=match_output(coord1, coord2, NULL, NULL, bina, minmapsize,
+                   quietmmap);
+  *nummatched = out ?  out->next->next->size : 0;
+
+  /* Clean up and return. */
+  for(d=0;d<p.ndim;++d)
+    {
+      gal_data_free(p.acoord[d]);
+      gal_data_free(p.bcoord[d]);
+    }
+  gal_data_free(p.aoffset);
+  gal_data_free(p.boffset);
+  gal_data_free(p.nearest);
+  gal_data_free(p.arow);
+  gal_data_free(p.brow);
+  gal_data_free(p.dist);
+  free(bina);
+  return out;
+}
@@ -35,8 +35,8 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 #include <gnuastro/tile.h>
 #include <gnuastro/fits.h>
 #include <gnuastro/blank.h>
-#include <gnuastro/qsort.h>
 #include <gnuastro/pointer.h>
+#include <gnuastro/threads.h>
 #include <gnuastro/arithmetic.h>
 #include <gnuastro/statistics.h>
 
@@ -54,6 +54,136 @@ along with Gnuastro. If not, see <http://www.gnu.org/licenses/>.
 /****************************************************************
  ********               Simple statistics                 *******
  ****************************************************************/
+/* Large datasets that are contiguous in memory are divided into one part
+   for each thread in the simple statistics and histograms below. Each
+   part is given to the 'operate' function of the caller as a 1D dataset
+   that points to the respective range of the input's array (nothing is
+   copied). It keeps the partial result of part 'r' in the 'partial'
+   array, and the partial results are merged on the calling thread after
+   all the parts are done. The number of parts is only a function of the
+   number of threads, so the result doesn't depend on the scheduling. */
+#define STATISTICS_PARTS_MIN 100000
+
+struct statistics_parts_params
+{
+  gal_data_t       *input;   /* Input dataset.                          */
+  gal_data_t        *bins;   /* Bins (for histograms).                  */
+  int                list;   /* Also divide the other inputs in list.   */
+  size_t         numparts;   /* Number of parts.                        */
+  void           *partial;   /* Partial result of each part.            */
+  void          (*operate)(gal_data_t *, struct statistics_parts_params *,
+                           size_t);
+};
+
+
+
+
+
+/* Number of parts for the given input: tiles (which are not contiguous
+   in memory) and small datasets are done in one part. */
+static size_t
+statistics_parts_number(gal_data_t *input, size_t numthreads, int list)
+{
+  gal_data_t *tmp;
+
+  if(numthreads<2 || input->size<STATISTICS_PARTS_MIN) return 1;
+  for(tmp=input; tmp!=NULL; tmp=list ? tmp->next : NULL)
+    if(tmp->block) return 1;
+  return numthreads;
+}
+
+
+
+
+
+/* A 1D dataset over the 'size' elements of the input's array that start
+   from 'start'. The flags of the input are also valid for the part (for
+   example if the input has no blank values, no part will have any). When
+   'list!=0', the same is done on the other datasets in the list. */
+static gal_data_t *
+statistics_parts_wrap(gal_data_t *input, size_t start, size_t size,
+                      int list)
+{
+  gal_data_t *out;
+
+  out=gal_data_alloc(gal_pointer_increment(input->array, start,
+                                           input->type),
+                     input->type, 1, &size, NULL, 0, input->minmapsize,
+                     input->quietmmap, NULL, NULL, NULL);
+  out->flag=input->flag;
+  if(list && input->next)
+    out->next=statistics_parts_wrap(input->next, start, size, list);
+  return out;
+}
+
+
+
+
+
+/* Free the wrappers of 'statistics_parts_wrap' (not the array they point
+   to). */
+static void
+statistics_parts_unwrap(gal_data_t *part)
+{
+  gal_data_t *tmp;
+  while(part!=NULL)
+    {
+      tmp=part->next;
+      part->array=NULL;
+      gal_data_free(part);
+      part=tmp;
+    }
+}
+
+
+
+
+
+static void *
+statistics_parts_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct statistics_parts_params *p=tprm->params;
+
+  gal_data_t *part;
+  size_t i, r, s, e, n=p->numparts, size=p->input->size;
+  for(i=0; (r=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      /* Boundaries of this part. */
+      s = size/n*r     + ( r   < size%n ? r   : size%n );
+      e = size/n*(r+1) + ( r+1 < size%n ? r+1 : size%n );
+
+      /* Do the operation on this part. */
+      part=statistics_parts_wrap(p->input, s, e-s, p->list);
+      p->operate(part, p, r);
+      statistics_parts_unwrap(part);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Do the operation on all the parts (on the calling thread when there is
+   only one part). */
+static void
+statistics_parts_run(struct statistics_parts_params *p)
+{
+  if(p->numparts==1)
+    p->operate(p->input, p, 0);
+  else
+    gal_threads_spin_off_dynamic(statistics_parts_worker, p, p->numparts,
+                                 p->numparts);
+}
+
+
+
+
+
 /* Return the number of non-blank elements in an array as a single element,
    'size_t' type data structure. */
 gal_data_t *
@@ -140,6 +270,87 @@ gal_statistics_maximum(gal_data_t *input)
 
 
 
+/* Find the minimum and maximum of one part. The minimum and maximum of
+   part 'r' are written in elements '2*r' and '2*r+1' of the 'partial'
+   dataset (which has the same type as the input). */
+static void
+statistics_minmax_operate(gal_data_t *input,
+                          struct statistics_parts_params *p, size_t r)
+{
+  size_t n=0;
+  gal_data_t *out=statistics_parts_wrap(p->partial, 2*r, 2, 0);
+  void *max=gal_pointer_increment(out->array, 1, out->type);
+
+  /* Initialize the minimum with the maximum possible value and the
+     maximum with the minimum possible value. */
+  gal_type_max(out->type, out->array);
+  gal_type_min(out->type, max);
+
+  /* Parse the input. */
+  if(input->size)
+    GAL_TILE_PARSE_OPERATE(input, out, 0, 1,
+                           {
+                             if(*i<*o)   o[0]=*i;
+                             if(*i>o[1]) o[1]=*i;
+                             ++n;
+                           });
+
+  /* If there were no usable elements, set both to blank. */
+  if(n==0)
+    {
+      gal_blank_write(out->array, out->type);
+      gal_blank_write(max, out->type);
+    }
+  statistics_parts_unwrap(out);
+}
+
+
+
+
+
+/* Return the minimum and maximum (non-blank) values of a dataset in one
+   run, as a two element dataset with the same type as the input. Large
+   (contiguous) datasets are parsed on 'numthreads' threads. */
+gal_data_t *
+gal_statistics_minmax(gal_data_t *input, size_t numthreads)
+{
+  size_t dsize=2;
+  gal_data_t *partial;
+  struct statistics_parts_params p={0};
+  gal_data_t *out=gal_data_alloc(NULL, gal_tile_block(input)->type, 1,
+                                 &dsize, NULL, 0, -1, 1, NULL, NULL, NULL);
+
+  /* Find the minimum and maximum of each part. */
+  p.input=input;
+  p.operate=statistics_minmax_operate;
+  p.numparts=statistics_parts_number(input, numthreads, 0);
+  if(p.numparts==1) p.partial=out;
+  else
+    {
+      dsize=2*p.numparts;
+      p.partial=gal_data_alloc(NULL, out->type, 1, &dsize, NULL, 0, -1, 1,
+                               NULL, NULL, NULL);
+    }
+  statistics_parts_run(&p);
+
+  /* The minimum and maximum of the parts (blank values of parts without
+     any usable elements are ignored). */
+  if(p.numparts>1)
+    {
+      partial=p.partial;
+      p.partial=out;
+      statistics_minmax_operate(partial, &p, 0);
+      gal_data_free(partial);
+    }
+
+  /* Return the output. */
+  return out;
+}
+
+
+
+
+
 /* Return the sum of the input dataset as a single element dataset of type
    float64. */
 gal_data_t *
@@ -268,56 +479,275 @@ gal_statistics_std(gal_data_t *input)
 
 
 
+/* Add 'V' to the compensated (Kahan) sum 'S' with compensation 'C'. */
+#define STATISTICS_KAHAN(S, C, V) {                                     \
+    y=(V)-C; t=S+y; C=(t-S)-y; S=t;                                     \
+  }
+
+/* Measure the number, mean and sum of squared differences from the mean
+   of one part and put them in elements '3*r' to '3*r+2' of the 'partial'
+   array. The sums are shifted by the first element (to avoid the
+   catastrophic cancellation of the sum of squares when the mean is much
+   larger than the scatter) and compensated. Its important to put each
+   value into a 'double' before the multiplication because the
+   multiplication of integer types close to their limits will overflow. */
+static void
+statistics_mean_std_operate(gal_data_t *input,
+                            struct statistics_parts_params *p, size_t r)
+{
+  size_t n=0;
+  double *pr=(double *)(p->partial)+3*r;
+  double d, t, y, k=0.0f, s=0.0f, sc=0.0f, s2=0.0f, s2c=0.0f;
+
+  /* Parse the input. */
+  if(input->size)
+    GAL_TILE_PARSE_OPERATE(input, NULL, 0, 1,
+                           {
+                             if(n++==0) k=*i;
+                             d=*i-k;
+                             STATISTICS_KAHAN(s, sc, d);
+                             STATISTICS_KAHAN(s2, s2c, d*d);
+                           });
+
+  /* Write the partial result. When all the points have an identical
+     value (within floating point errors), 's2' can be slightly smaller
+     than 's*s/n', so the sum of squared differences is set to zero. */
+  pr[0]=n;
+  pr[1]=n ? k+s/n : 0.0f;
+  pr[2]=n && s2>s*s/n ? s2-s*s/n : 0.0f;
+}
+
+
+
+
+
 /* Return the mean and standard deviation of a dataset in one run in type
    float64. The output is a two element data structure, with the first
-   value being the mean and the second value the standard deviation. */
+   value being the mean and the second value the standard deviation. Large
+   (contiguous) datasets are parsed on 'numthreads' threads and the
+   moments of the parts are merged in order (so the result doesn't depend
+   on the scheduling of the threads). */
 gal_data_t *
-gal_statistics_mean_std(gal_data_t *input)
+gal_statistics_mean_std(gal_data_t *input, size_t numthreads)
 {
-  size_t dsize=2, n=0;
-  double v, *o, s=0.0f, s2=0.0f;
+  size_t r, dsize=2;
+  struct statistics_parts_params p={0};
+  double *o, *pr, n=0.0f, mean=0.0f, m2=0.0f, delta, total;
   gal_data_t *out=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &dsize,
                                  NULL, 1, -1, 1, NULL, NULL, NULL);
 
-  /* See if the input actually has any elements. */
+  /* Measure the moments of each part. */
+  p.input=input;
+  p.operate=statistics_mean_std_operate;
+  p.numparts=statistics_parts_number(input, numthreads, 0);
+  p.partial=pr=gal_pointer_allocate(GAL_TYPE_FLOAT64, 3*p.numparts, 0,
+                                    __func__, "p.partial");
+  statistics_parts_run(&p);
+
+  /* Merge the moments of the parts. */
+  for(r=0;r<p.numparts;++r)
+    if(pr[3*r])
+      {
+        total = n + pr[3*r];
+        delta = pr[3*r+1] - mean;
+        mean += delta * pr[3*r] / total;
+        m2   += pr[3*r+2] + delta * delta * (n * pr[3*r] / total);
+        n     = total;
+      }
+  free(pr);
+
+  /* Write the output. When there are no usable elements, both are blank.
+     When we only have a single element, theoretically the standard
+     deviation should be 0. But due to floating-point errors, it will
+     probably not be. So we'll manually set it to zero. */
   o=out->array;
-  switch(input->size)
+  if(n==0) o[0]=o[1]=GAL_BLANK_FLOAT64;
+  else
     {
-    /* No inputs. */
-    case 0: o[0]=o[1]=GAL_BLANK_FLOAT64; break;
+      o[0]=mean;
+      o[1]= n==1 ? 0.0f : sqrt(m2/n);
+    }
 
-    /* When we only have a single element, theoretically the standard
-       deviation should be 0. But due to floating-point errors, it will
-       probably not be. So we'll manually set it to zero. */
-    case 1:
-      GAL_TILE_PARSE_OPERATE(input, out, 0, 1, {s+=*i;});
-      o[0]=s; o[1]=0;
-      break;
+  /* Return the output dataset. */
+  return out;
+}
 
-    /* More than one element. */
-    default:
 
-      /* Parse the data. Its important to put each value into a 'double'
-         type variable ('v') before multiplying (for 's2') because the
-         multiplication of integer types close to their limits will cause
-         overflow and thus an unreasonable output). */
-      GAL_TILE_PARSE_OPERATE(input, out, 0, 1,
-                             {++n; v=*i; s+=v; s2+=v*v;});
 
-      /* Write the mean. */
-      o[0]=s/n;
 
-      /* Write the standard deviation. If the square of the average value
-         is bigger than the average of the squares of the values, we have a
-         floating-point error (due to all the points having an identical
-         value, within floating point erros). So we should just set the
-         standard deviation to zero. */
-      o[1] = gal_statistics_std_from_sums(s, s2, n);
-      break;
+
+/* Return a contiguous dataset with no blank values that can be modified
+   (when 'inplace==0' or the input is a tile, it is a copy). It is used in
+   the functions that don't need the whole dataset to be sorted (see
+   'gal_statistics_no_blank_sorted'). */
+static gal_data_t *
+statistics_no_blank(gal_data_t *input, int inplace)
+{
+  gal_data_t *contig, *noblank;
+
+  /* A zero-sized input can't be copied. */
+  if(input->size==0)
+    return ( inplace
+             ? input
+             : gal_data_alloc(NULL, input->type, 0, NULL, input->wcs, 0,
+                              input->minmapsize, input->quietmmap,
+                              NULL, NULL, NULL) );
+
+  /* If this is a tile, then first we have to copy it into a contiguous
+     piece of memory (which can be modified). */
+  if(input->block) { contig=gal_data_copy(input); inplace=1; }
+  else               contig=input;
+
+  /* Remove the blank values (if there are any). */
+  noblank = inplace ? contig : gal_data_copy(contig);
+  if( gal_blank_present(noblank, 1) ) gal_blank_remove(noblank);
+  return noblank;
+}
+
+
+
+
+
+/* Re-order the input (that has no blank values) so the elements at the
+   (increasing) indices in 'ks' are the same as they would be in the
+   sorted (increasing) array, all the elements before them are smaller or
+   equal and all the elements after them are larger or equal. This is the
+   same as sorting for the requested indices, but its cost is linear in
+   the number of elements (for a small number of indices).
+
+   The ranges containing a requested index are partitioned around the
+   median of three elements and only the parts that contain a requested
+   index are followed. The partitioning is done without any branch that
+   depends on the values (which the CPU can't predict on noisy data): each
+   element is swapped with the first element that is not smaller than the
+   pivot and the position of that element is incremented when the element
+   was smaller. When the smaller part is very small (for example, the
+   pivot is repeated many times), the larger part is partitioned again to
+   separate the elements that are equal to the pivot, which are already in
+   their sorted position. Small ranges are sorted with an insertion sort.
+   In case the pivots are bad (the ranges don't shrink fast enough), the
+   range is sorted with a heap sort (to guarantee an O(n log n) worst
+   case, like "introselect"). */
+#define STATISTICS_SELECT_SMALL 16
+struct statistics_select_range
+{
+  size_t lo;             /* First element of the range.                */
+  size_t hi;             /* One after the last element of the range.   */
+  size_t ka;             /* First requested index in range (in 'ks').  */
+  size_t kb;             /* One after last requested index in range.   */
+  size_t depth;          /* Number of partitions until this range.     */
+};
+
+#define STATISTICS_SELECT_SWAP(X, Y) { t=a[X]; a[X]=a[Y]; a[Y]=t; }
+#define STATISTICS_SELECT_PUSH(LO, HI, KA, KB, DEPTH) {                 \
+    stack[ns].lo=(LO); stack[ns].hi=(HI);                               \
+    stack[ns].ka=(KA); stack[ns].kb=(KB);                               \
+    stack[ns++].depth=(DEPTH);                                          \
+  }
+#define STATISTICS_SELECT_SIFT(R, N) {                                  \
+    for(s=(R); (c=2*s+1)<(N); s=c)                                      \
+      {                                                                 \
+        if(c+1<(N) && h[c]<h[c+1]) ++c;                                 \
+        if(h[s]<h[c]) { t=h[s]; h[s]=h[c]; h[c]=t; } else break;        \
+      }                                                                 \
+  }
+#define STATISTICS_SELECT(IT) {                                         \
+    IT *a=data->array, *h, p, t;                                        \
+    size_t i, j, m, e, s, c, n;                                         \
+    while(ns)                                                           \
+      {                                                                 \
+        r=stack[--ns];                                                  \
+        if(r.ka>=r.kb) continue;                                        \
+                                                                        \
+        /* Small ranges: insertion sort. */                             \
+        if(r.hi-r.lo<=STATISTICS_SELECT_SMALL)                          \
+          {                                                             \
+            for(i=r.lo+1;i<r.hi;++i)                                    \
+              {                                                         \
+                p=a[i];                                                 \
+                for(j=i; j>r.lo && a[j-1]>p; --j) a[j]=a[j-1];          \
+                a[j]=p;                                                 \
+              }                                                         \
+            continue;                                                   \
+          }                                                             \
+                                                                        \
+        /* Bad pivots: heap sort. */                                    \
+        if(r.depth>=maxdepth)                                           \
+          {                                                             \
+            h=a+r.lo; n=r.hi-r.lo;                                      \
+            for(i=n/2;i>0;--i) STATISTICS_SELECT_SIFT(i-1, n);          \
+            for(i=n-1;i>0;--i)                                          \
+              { t=h[0]; h[0]=h[i]; h[i]=t; STATISTICS_SELECT_SIFT(0, i); } \
+            continue;                                                   \
+          }                                                             \
+                                                                        \
+        /* Put the median of the first, middle and last elements in */ \
+        /* the first element, and use it as the pivot. */               \
+        m=r.lo+(r.hi-r.lo)/2;                                           \
+        if(a[m]<a[r.lo])      STATISTICS_SELECT_SWAP(m, r.lo);          \
+        if(a[r.hi-1]<a[r.lo]) STATISTICS_SELECT_SWAP(r.hi-1, r.lo);     \
+        if(a[r.hi-1]<a[m])    STATISTICS_SELECT_SWAP(r.hi-1, m);        \
+        STATISTICS_SELECT_SWAP(r.lo, m);                                \
+                                                                        \
+        /* Partition: afterwards '[lo, m)' are smaller than the */      \
+        /* pivot, it is in 'm' and '[m+1, hi)' are not smaller. */      \
+        p=a[r.lo];                                                      \
+        for(j=i=r.lo+1; i<r.hi; ++i)                                    \
+          { t=a[i]; a[i]=a[j]; a[j]=t; j+=t<p; }                        \
+        m=j-1; a[r.lo]=a[m]; a[m]=p;                                    \
+                                                                        \
+        /* When the smaller part is very small, separate the */         \
+        /* elements equal to the pivot (they will be in '[m, e)'). */   \
+        e=m+1;                                                          \
+        if( m-r.lo < (r.hi-r.lo)/8 )                                    \
+          for(i=e; i<r.hi; ++i)                                         \
+            { t=a[i]; a[i]=a[e]; a[e]=t; e+=t==p; }                     \
+                                                                        \
+        /* Divide the requested indices between the two parts (the */   \
+        /* indices within '[m, e)' are already in place). */            \
+        for(i=r.ka; i<r.kb && ks[i]<m; ++i) {}                          \
+        for(j=i;    j<r.kb && ks[j]<e; ++j) {}                          \
+        STATISTICS_SELECT_PUSH(e,    r.hi, j,    r.kb, r.depth+1);     \
+        STATISTICS_SELECT_PUSH(r.lo, m,    r.ka, i,    r.depth+1);     \
+      }                                                                 \
+  }
+static void
+statistics_select(gal_data_t *data, size_t *ks, size_t nk)
+{
+  struct statistics_select_range r, *stack;
+  size_t ns, maxdepth=2*( (size_t)log2(data->size+1) + 1 );
+
+  /* The stack will not need more than 'maxdepth+1' elements: each range
+     is replaced by at most two ranges with a larger depth. */
+  stack=malloc((maxdepth+1)*sizeof *stack);
+  if(stack==NULL)
+    error(EXIT_FAILURE, errno, "%s: couldn't allocate %zu bytes for "
+          "'stack'", __func__, (maxdepth+1)*sizeof *stack);
+  ns=0;
+  STATISTICS_SELECT_PUSH(0, data->size, 0, nk, 0);
+
+  /* Do the selection. */
+  switch(data->type)
+    {
+    case GAL_TYPE_UINT8:     STATISTICS_SELECT( uint8_t  );    break;
+    case GAL_TYPE_INT8:      STATISTICS_SELECT( int8_t   );    break;
+    case GAL_TYPE_UINT16:    STATISTICS_SELECT( uint16_t );    break;
+    case GAL_TYPE_INT16:     STATISTICS_SELECT( int16_t  );    break;
+    case GAL_TYPE_UINT32:    STATISTICS_SELECT( uint32_t );    break;
+    case GAL_TYPE_INT32:     STATISTICS_SELECT( int32_t  );    break;
+    case GAL_TYPE_UINT64:    STATISTICS_SELECT( uint64_t );    break;
+    case GAL_TYPE_INT64:     STATISTICS_SELECT( int64_t  );    break;
+    case GAL_TYPE_FLOAT32:   STATISTICS_SELECT( float    );    break;
+    case GAL_TYPE_FLOAT64:   STATISTICS_SELECT( double   );    break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, data->type);
     }
 
-  /* Return the output dataset. */
-  return out;
+  /* The dataset is no longer sorted (if it was), and clean up. */
+  data->flag &= ~( GAL_DATA_FLAG_SORT_CH | GAL_DATA_FLAG_SORTED_I
+                   | GAL_DATA_FLAG_SORTED_D );
+  free(stack);
 }
 
 
@@ -362,26 +792,75 @@ statistics_median_in_sorted_no_blank(gal_data_t *sorted, void *median)
 
 
 
+/* The input has no blank values (but isn't necessarily sorted). When it
+   isn't sorted, the element at the middle is selected (see
+   'statistics_select') and when the number of elements is even, the other
+   middle element is the largest element before it. */
+#define MED_IN_SELECTED(IT) {                                           \
+    IT *a=nb->array, *m=a, *p=a, *pf=a+k;                               \
+    do if(*p>*m) m=p; while(++p<pf);                                    \
+    *(IT *)median = (a[k]+*m)/2;                                        \
+  }
+static void
+statistics_median_in_no_blank(gal_data_t *nb, void *median)
+{
+  size_t k=nb->size/2;
+
+  /* When the input is sorted, there is no need to select. */
+  if( nb->size==0 || gal_statistics_is_sorted(nb, 1) )
+    {
+      statistics_median_in_sorted_no_blank(nb, median);
+      return;
+    }
+
+  /* Select the middle element. */
+  statistics_select(nb, &k, 1);
+  if(nb->size%2)
+    memcpy(median, gal_pointer_increment(nb->array, k, nb->type),
+           gal_type_sizeof(nb->type));
+  else
+    switch(nb->type)
+      {
+      case GAL_TYPE_UINT8:     MED_IN_SELECTED( uint8_t  );    break;
+      case GAL_TYPE_INT8:      MED_IN_SELECTED( int8_t   );    break;
+      case GAL_TYPE_UINT16:    MED_IN_SELECTED( uint16_t );    break;
+      case GAL_TYPE_INT16:     MED_IN_SELECTED( int16_t  );    break;
+      case GAL_TYPE_UINT32:    MED_IN_SELECTED( uint32_t );    break;
+      case GAL_TYPE_INT32:     MED_IN_SELECTED( int32_t  );    break;
+      case GAL_TYPE_UINT64:    MED_IN_SELECTED( uint64_t );    break;
+      case GAL_TYPE_INT64:     MED_IN_SELECTED( int64_t  );    break;
+      case GAL_TYPE_FLOAT32:   MED_IN_SELECTED( float    );    break;
+      case GAL_TYPE_FLOAT64:   MED_IN_SELECTED( double   );    break;
+      default:
+        error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+              __func__, nb->type);
+      }
+}
+
+
+
+
+
 /* Return the median value of the dataset in the same type as the input as
    a one element dataset. If the 'inplace' flag is set, the input data
-   structure will be modified: it will have no blank values and will be
-   sorted (increasing). */
+   structure will be modified: it will have no blank values and its
+   elements will be re-ordered (it will not necessarily be sorted). */
 gal_data_t *
 gal_statistics_median(gal_data_t *input, int inplace)
 {
   size_t dsize=1;
-  gal_data_t *nbs=gal_statistics_no_blank_sorted(input, inplace);
-  gal_data_t *out=gal_data_alloc(NULL, nbs->type, 1, &dsize, NULL, 1, -1,
+  gal_data_t *nb=statistics_no_blank(input, inplace);
+  gal_data_t *out=gal_data_alloc(NULL, nb->type, 1, &dsize, NULL, 1, -1,
                                  1, NULL, NULL, NULL);
 
   /* Write the median. */
-  if(nbs->size)
-    statistics_median_in_sorted_no_blank(nbs, out->array);
+  if(nb->size)
+    statistics_median_in_no_blank(nb, out->array);
   else
     gal_blank_write(out->array, out->type);
 
   /* Clean up (if necessary), then return the output. */
-  if(nbs!=input) gal_data_free(nbs);
+  if(nb!=input) gal_data_free(nb);
   return out;
 }
 
@@ -456,6 +935,78 @@ statistics_mad_in_sorted_no_blank(gal_data_t *sorted, gal_data_t *med,
 
 
 
+/* The input is sorted (increasing or decreasing) and has no blank values:
+   the MAD is found without any copy or allocation. In a sorted array, the
+   distance of the elements from the median decreases until the median
+   and increases after it. So the 'w' elements that are closest to the
+   median are a contiguous window of width 'w' and the largest distance in
+   that window (at one of its two ends) is the 'w'-th smallest distance.
+   Therefore the 'w'-th smallest distance is the smallest of the largest
+   distances of all the windows of width 'w'. Moving the window forward,
+   the distance of its first element decreases and that of its last
+   element increases, so the best window is found with a binary search:
+   it is either the first window where the first element isn't farther
+   than the last, or the one just before it. */
+#define STATISTICS_MAD_DIST(X) ( (X)>m ? (X)-m : m-(X) )
+#define MAD_IN_SORTED(IT) {                                             \
+    IT *a=sorted->array, m=*(IT *)med, d[2], dl, dr;                    \
+    for(j=0; j<(n%2?1:2); ++j)                                          \
+      {                                                                 \
+        /* First window with a first element that is not farther. */    \
+        w=n/2+1-j;                                                      \
+        lo=0;                                                           \
+        hi=n-w;                                                         \
+        while(lo<hi)                                                    \
+          {                                                             \
+            l=lo+(hi-lo)/2;                                             \
+            dl=STATISTICS_MAD_DIST(a[l]);                               \
+            dr=STATISTICS_MAD_DIST(a[l+w-1]);                           \
+            if(dl>dr) lo=l+1; else hi=l;                                \
+          }                                                             \
+                                                                        \
+        /* Largest distance in this window and the one before it. */    \
+        dl=STATISTICS_MAD_DIST(a[lo]);                                  \
+        dr=STATISTICS_MAD_DIST(a[lo+w-1]);                              \
+        d[j] = dl>dr ? dl : dr;                                         \
+        if(lo)                                                          \
+          {                                                             \
+            dl=STATISTICS_MAD_DIST(a[lo-1]);                            \
+            if(dl<d[j]) d[j]=dl;                                        \
+          }                                                             \
+      }                                                                 \
+    *(IT *)mad = n%2 ? d[0] : (d[0]+d[1])/2;                            \
+  }
+static void
+statistics_mad_in_sorted_window(gal_data_t *sorted, void *med, void *mad)
+{
+  size_t j, w, l, lo, hi, n=sorted->size;
+
+  /* Do the processing if there are actually any elements. */
+  if(n)
+    switch(sorted->type)
+      {
+      case GAL_TYPE_UINT8:     MAD_IN_SORTED( uint8_t  );    break;
+      case GAL_TYPE_INT8:      MAD_IN_SORTED( int8_t   );    break;
+      case GAL_TYPE_UINT16:    MAD_IN_SORTED( uint16_t );    break;
+      case GAL_TYPE_INT16:     MAD_IN_SORTED( int16_t  );    break;
+      case GAL_TYPE_UINT32:    MAD_IN_SORTED( uint32_t );    break;
+      case GAL_TYPE_INT32:     MAD_IN_SORTED( int32_t  );    break;
+      case GAL_TYPE_UINT64:    MAD_IN_SORTED( uint64_t );    break;
+      case GAL_TYPE_INT64:     MAD_IN_SORTED( int64_t  );    break;
+      case GAL_TYPE_FLOAT32:   MAD_IN_SORTED( float    );    break;
+      case GAL_TYPE_FLOAT64:   MAD_IN_SORTED( double   );    break;
+      default:
+        error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+              __func__, sorted->type);
+      }
+  else
+    gal_blank_write(mad, sorted->type);
+}
+
+
+
+
+
 /* Return the median and median absolute deviation. */
 static gal_data_t *
 statistics_median_mad(gal_data_t *input, int inplace, int onlymad)
@@ -557,49 +1108,68 @@ gal_statistics_quantile_index(size_t size, double quantile)
 
 
 
-/* Return a single element dataset of the same type as input keeping the
-   value that has the given quantile. */
+/* Return a dataset of the same type as input keeping the values at the
+   given quantiles (one element for each quantile). When the input isn't
+   already sorted, the elements at all the quantiles are selected together
+   (see 'statistics_select') without sorting the whole dataset. */
 gal_data_t *
-gal_statistics_quantile(gal_data_t *input, double quantile, int inplace)
+gal_statistics_quantiles(gal_data_t *input, double *quantiles,
+                         size_t numquantiles, int inplace)
 {
-  void *blank;
   int increasing;
-  size_t dsize=1, index;
-  gal_data_t *nbs=gal_statistics_no_blank_sorted(input, inplace);
-  gal_data_t *out=gal_data_alloc(NULL, nbs->type, 1, &dsize,
+  size_t i, j, t, *ks, *sks;
+  gal_data_t *nb=statistics_no_blank(input, inplace);
+  gal_data_t *out=gal_data_alloc(NULL, nb->type, 1, &numquantiles,
                                  NULL, 1, -1, 1, NULL, NULL, NULL);
 
   /* Only continue processing if there are non-blank elements. */
-  if(nbs->size)
+  if(nb->size)
     {
-      /* Set the increasing value. */
-      increasing = nbs->flag & GAL_DATA_FLAG_SORTED_I;
-
-      /* Find the index of the quantile, note that if it sorted in
-         decreasing order, then we'll need to get the index of the inverse
-         quantile. */
-      index=gal_statistics_quantile_index(nbs->size,
-                                          ( increasing
-                                            ? quantile
-                                            : (1.0f - quantile) ) );
-
-      /* Write the value at this index into the output. */
-      if(index==GAL_BLANK_SIZE_T)
+      /* Allocate the indices (and a sorted copy of them). */
+      ks=gal_pointer_allocate(GAL_TYPE_SIZE_T, 2*numquantiles, 0,
+                              __func__, "ks");
+      sks=ks+numquantiles;
+
+      /* When the input is already sorted, the elements can be read
+         directly. Note that if it sorted in decreasing order, then we'll
+         need to get the index of the inverse quantile. */
+      if( gal_statistics_is_sorted(nb, 1) )
         {
-          blank=gal_pointer_allocate(nbs->type, 1, 0, __func__, "blank");
-          memcpy(out->array, blank, gal_type_sizeof(nbs->type));
-          free(blank);
+          increasing = nb->flag & GAL_DATA_FLAG_SORTED_I;
+          for(i=0;i<numquantiles;++i)
+            ks[i]=gal_statistics_quantile_index(nb->size,
+                                                ( increasing
+                                                  ? quantiles[i]
+                                                  : (1.0f - quantiles[i]) ));
         }
+
+      /* Not sorted: select the elements at the indices of all the
+         quantiles together (the indices have to be sorted for this). */
       else
-        memcpy(out->array,
-               gal_pointer_increment(nbs->array, index, nbs->type),
-               gal_type_sizeof(nbs->type));
+        {
+          for(i=0;i<numquantiles;++i)
+            {
+              t=ks[i]=gal_statistics_quantile_index(nb->size, quantiles[i]);
+              for(j=i; j>0 && sks[j-1]>t; --j) sks[j]=sks[j-1];
+              sks[j]=t;
+            }
+          statistics_select(nb, sks, numquantiles);
+        }
+
+      /* Write the values into the output. */
+      for(i=0;i<numquantiles;++i)
+        memcpy(gal_pointer_increment(out->array, i, out->type),
+               gal_pointer_increment(nb->array, ks[i], nb->type),
+               gal_type_sizeof(nb->type));
+      free(ks);
     }
   else
-    gal_blank_write(out->array, out->type);
+    for(i=0;i<numquantiles;++i)
+      gal_blank_write(gal_pointer_increment(out->array, i, out->type),
+                      out->type);
 
   /* Clean up and return. */
-  if(nbs!=input) gal_data_free(nbs);
+  if(nb!=input) gal_data_free(nb);
   return out;
 }
 
@@ -607,6 +1177,18 @@ gal_statistics_quantile(gal_data_t *input, double quantile, int inplace)
 
 
 
+/* Return a single element dataset of the same type as input keeping the
+   value that has the given quantile. */
+gal_data_t *
+gal_statistics_quantile(gal_data_t *input, double quantile, int inplace)
+{
+  return gal_statistics_quantiles(input, &quantile, 1, inplace);
+}
+
+
+
+
+
 /* Return the index of the (first) point in the sorted dataset that has the
    closest value to 'value' (which has to be the same type as the 'input'
    dataset). */
@@ -642,14 +1224,34 @@ gal_statistics_quantile(gal_data_t *input, double quantile, int inplace)
     /* Set the difference if the value is actually in the range. */     \
     if(parsed && a<af) index = a-r;                                     \
   }
+
+/* When the dataset isn't sorted, the index in the sorted (increasing)
+   dataset is the number of elements that are smaller or equal to the
+   value ('n'). The elements on the two sides of it in the sorted dataset
+   are the largest element that is smaller or equal to the value ('lo')
+   and the smallest element that is larger than it ('hi'). */
+#define STATS_QFUNC_IND_NOT_SORTED(IT) {                                \
+    IT *a=nbs->array, *af=a+nbs->size, v=*((IT *)(value->array));       \
+    IT lo=0, hi=0;                                                      \
+    size_t n=0, nhi=0;                                                  \
+    do                                                                  \
+      if(*a<=v) { if(n++==0   || *a>lo) lo=*a; }                        \
+      else      { if(nhi++==0 || *a<hi) hi=*a; }                        \
+    while(++a<af);                                                      \
+    if(n && nhi) index = v - lo < hi - v ? n-1 : n;                     \
+  }
+#define STATS_QFUNC_IND_ANY(IT) {                                       \
+    if(sorted) STATS_QFUNC_IND(IT)                                      \
+    else       STATS_QFUNC_IND_NOT_SORTED(IT)                           \
+  }
 size_t
 gal_statistics_quantile_function_index(gal_data_t *input,
                                        gal_data_t *invalue, int inplace)
 {
-  int parsed=0;
+  int parsed=0, sorted;
   gal_data_t *value;
   size_t index=GAL_BLANK_SIZE_T;
-  gal_data_t *nbs=gal_statistics_no_blank_sorted(input, inplace);
+  gal_data_t *nbs=statistics_no_blank(input, inplace);
 
   /* Make sure the value has the same type. */
   if(invalue->size>1)
@@ -659,25 +1261,30 @@ gal_statistics_quantile_function_index(gal_data_t *input,
             ? invalue
             : gal_data_copy_to_new_type(invalue, nbs->type) );
 
-  /* Only continue processing if we have non-blank elements. */
+  /* Only continue processing if we have non-blank elements. When the
+     dataset is sorted, we can stop as soon as the value is reached,
+     otherwise, all the elements have to be parsed once (which is much
+     faster than sorting them). */
   if(nbs->size)
-    /* Find the result: */
-    switch(nbs->type)
-      {
-      case GAL_TYPE_UINT8:     STATS_QFUNC_IND( uint8_t  );     break;
-      case GAL_TYPE_INT8:      STATS_QFUNC_IND( int8_t   );     break;
-      case GAL_TYPE_UINT16:    STATS_QFUNC_IND( uint16_t );     break;
-      case GAL_TYPE_INT16:     STATS_QFUNC_IND( int16_t  );     break;
-      case GAL_TYPE_UINT32:    STATS_QFUNC_IND( uint32_t );     break;
-      case GAL_TYPE_INT32:     STATS_QFUNC_IND( int32_t  );     break;
-      case GAL_TYPE_UINT64:    STATS_QFUNC_IND( uint64_t );     break;
-      case GAL_TYPE_INT64:     STATS_QFUNC_IND( int64_t  );     break;
-      case GAL_TYPE_FLOAT32:   STATS_QFUNC_IND( float    );     break;
-      case GAL_TYPE_FLOAT64:   STATS_QFUNC_IND( double   );     break;
-      default:
-        error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
-              __func__, nbs->type);
-      }
+    {
+      sorted = nbs->size>1 && gal_statistics_is_sorted(nbs, 1);
+      switch(nbs->type)
+        {
+        case GAL_TYPE_UINT8:     STATS_QFUNC_IND_ANY( uint8_t  );   break;
+        case GAL_TYPE_INT8:      STATS_QFUNC_IND_ANY( int8_t   );   break;
+        case GAL_TYPE_UINT16:    STATS_QFUNC_IND_ANY( uint16_t );   break;
+        case GAL_TYPE_INT16:     STATS_QFUNC_IND_ANY( int16_t  );   break;
+        case GAL_TYPE_UINT32:    STATS_QFUNC_IND_ANY( uint32_t );   break;
+        case GAL_TYPE_INT32:     STATS_QFUNC_IND_ANY( int32_t  );   break;
+        case GAL_TYPE_UINT64:    STATS_QFUNC_IND_ANY( uint64_t );   break;
+        case GAL_TYPE_INT64:     STATS_QFUNC_IND_ANY( int64_t  );   break;
+        case GAL_TYPE_FLOAT32:   STATS_QFUNC_IND_ANY( float    );   break;
+        case GAL_TYPE_FLOAT64:   STATS_QFUNC_IND_ANY( double   );   break;
+        default:
+          error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+                __func__, nbs->type);
+        }
+    }
   else
     {
       error(0, 0, "%s: no non-blank elements. The quantile function is not "
@@ -695,35 +1302,41 @@ gal_statistics_quantile_function_index(gal_data_t *input,
 
 
 
-/* Return the quantile function of the given value as float64. */
+/* Return the quantile function of the given value as float64. When the
+   index couldn't be found, the value is either smaller than the minimum
+   (-INFINITY) or not smaller than the maximum (INFINITY). Note that the
+   value has the same type as the dataset here. */
 #define STATS_QFUNC(IT) {                                               \
-    IT *a=nbs->array, v=*((IT *)(value->array));                        \
-                                                                        \
-    /* Increasing array: */                                             \
-    if( *a < *(a+1) )                                                   \
-      d[0] = v<*a ? -INFINITY : INFINITY;                               \
-                                                                        \
-    /* Decreasing array. */                                             \
-    else                                                                \
-      d[0] = v>*a ? INFINITY : -INFINITY;                               \
+    IT *a=nbs->array, *af=a+nbs->size, m=*a, v=*((IT *)(value->array)); \
+    do if(*a<m) m=*a; while(++a<af);                                    \
+    d[0] = v>m ? INFINITY : -INFINITY;                                  \
   }
 gal_data_t *
-gal_statistics_quantile_function(gal_data_t *input, gal_data_t *value,
+gal_statistics_quantile_function(gal_data_t *input, gal_data_t *invalue,
                                  int inplace)
 {
   double *d;
+  gal_data_t *value;
   size_t ind, dsize=1;
-  gal_data_t *nbs=gal_statistics_no_blank_sorted(input, inplace);
+  gal_data_t *nbs=statistics_no_blank(input, inplace);
   gal_data_t *out=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &dsize,
                                  NULL, 1, -1, 1, NULL, NULL, NULL);
 
   /* Sanity checks. */
-  if(value->size>1)
+  if(invalue->size>1)
     error(EXIT_FAILURE, 0, "%s: the 'value' argument must only have "
           "one element", __func__);
 
-  /* Calculate the index of the value. */
-  ind=gal_statistics_quantile_function_index(input, value, inplace);
+  /* Make sure the value has the same type. */
+  value = ( (nbs->type==invalue->type)
+            ? invalue
+            : gal_data_copy_to_new_type(invalue, nbs->type) );
+
+  /* Calculate the index of the value ('nbs' is already free of blank
+     values and can be used in place). */
+  ind = ( nbs->size
+          ? gal_statistics_quantile_function_index(nbs, value, 1)
+          : GAL_BLANK_SIZE_T );
   //printf("ind: %zu (%zu)\n", ind, input->size);
 
   /* Only continue processing if there are non-blank values. */
@@ -760,6 +1373,7 @@ gal_statistics_quantile_function(gal_data_t *input, gal_data_t *value,
     gal_blank_write(out->array, out->type);
 
   /* Clean up and return. */
+  if(value!=invalue) gal_data_free(value);
   if(nbs!=input) gal_data_free(nbs);
   return out;
 }
@@ -1488,7 +2102,7 @@ gal_statistics_mode_mirror_plots(gal_data_t *input, gal_data_t *value,
 
   /* Make the histogram: set it's maximum value to 1 for a nice comparison
      with the CDF. */
-  hist=gal_statistics_histogram(mirror, bins, 0, 1);
+  hist=gal_statistics_histogram(mirror, bins, 0, 1, 1);
 
 
   /* Make the cumulative frequency plot. */
@@ -1618,42 +2232,363 @@ gal_statistics_is_sorted(gal_data_t *input, int updateflags)
 
 
 
-/* This function is ignorant to blank values, if you want to make sure
-   there is no blank values, you can call 'gal_blank_remove' first. */
-#define STATISTICS_SORT(QSORT_F) {                                      \
-    qsort(input->array, input->size, gal_type_sizeof(input->type), QSORT_F); \
+/* Sorting is done with a radix sort on unsigned integer "keys" that have
+   the same width as the input type and the same ordering as the input
+   values (see 'statistics_sort_keys'). Radix sort doesn't need any
+   comparisons (that would be done through a function pointer in 'qsort')
+   and its cost is linear in the number of elements.
+
+   For small arrays, the overhead of the radix sort's histograms is
+   significant, so an insertion sort is used on the keys. Large arrays are
+   divided into one run for each thread, each run is sorted independently
+   and the sorted runs are then merged in parallel (pair by pair). */
+#define STATISTICS_SORT_RADIX_MIN    64
+#define STATISTICS_SORT_PARALLEL_MIN 100000
+
+struct statistics_sort_params
+{
+  void             *in;      /* Array of keys to sort or merge.         */
+  void            *out;      /* Scratch space (output of merging).      */
+  size_t        nbytes;      /* Number of bytes in each element.        */
+  uint8_t         type;      /* Type of the original data.              */
+  size_t       *bounds;      /* Boundaries of the runs (nruns+1).       */
+  size_t         nruns;      /* Number of runs.                         */
+  size_t         width;      /* Number of runs in each merged group.    */
+};
+
+
+
+
+
+/* Convert the values into unsigned integers (of the same width) with the
+   same order (when 'forward' is non-zero), or the reverse. Signed integers
+   just need their sign bit to be flipped. For floating point numbers
+   (which are stored as sign and magnitude), positive numbers also need
+   their sign bit flipped, but all the bits of negative numbers have to be
+   flipped (so larger magnitudes become smaller). NaN elements have already
+   been removed at this stage (see 'statistics_sort_nan_to_end'). */
+#define STATISTICS_SORT_KEYS_INT(UT) {                                  \
+    UT *u=keys, *uf=u+size, s=(UT)1<<(8*sizeof(UT)-1);                  \
+    if(size) do *u^=s; while(++u<uf);                                   \
   }
-void
-gal_statistics_sort_increasing(gal_data_t *input)
+#define STATISTICS_SORT_KEYS_FLT(UT) {                                  \
+    UT *u=keys, *uf=u+size, s=(UT)1<<(8*sizeof(UT)-1);                  \
+    if(size)                                                            \
+      {                                                                 \
+        if(forward) do *u = *u & s ? ~*u : *u|s;  while(++u<uf);        \
+        else        do *u = *u & s ? *u^s : ~*u;  while(++u<uf);        \
+      }                                                                 \
+  }
+static void
+statistics_sort_keys(void *keys, size_t size, uint8_t type, int forward)
 {
-  /* Do the sorting. */
-  if(input->size)
+  switch(type)
+    {
+    case GAL_TYPE_UINT8:
+    case GAL_TYPE_UINT16:
+    case GAL_TYPE_UINT32:
+    case GAL_TYPE_UINT64:                                        break;
+    case GAL_TYPE_INT8:    STATISTICS_SORT_KEYS_INT( uint8_t  ); break;
+    case GAL_TYPE_INT16:   STATISTICS_SORT_KEYS_INT( uint16_t ); break;
+    case GAL_TYPE_INT32:   STATISTICS_SORT_KEYS_INT( uint32_t ); break;
+    case GAL_TYPE_INT64:   STATISTICS_SORT_KEYS_INT( uint64_t ); break;
+    case GAL_TYPE_FLOAT32: STATISTICS_SORT_KEYS_FLT( uint32_t ); break;
+    case GAL_TYPE_FLOAT64: STATISTICS_SORT_KEYS_FLT( uint64_t ); break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, type);
+    }
+}
+
+
+
+
+
+/* Least significant digit radix sort (with 8-bit digits) of the 'size'
+   keys in 'keys' using 'tmp' (with the same size) as scratch space. The
+   histograms of all the digits are found in one pass over the keys and
+   digits that are identical in all the keys are skipped. */
+#define STATISTICS_SORT_RADIX(UT) {                                     \
+    UT *a=keys, *b=tmp, *t, v;                                          \
+    if(size<STATISTICS_SORT_RADIX_MIN)                                  \
+      {                                                                 \
+        for(i=1;i<size;++i)                                             \
+          {                                                             \
+            v=a[i];                                                     \
+            for(j=i; j>0 && a[j-1]>v; --j) a[j]=a[j-1];                 \
+            a[j]=v;                                                     \
+          }                                                             \
+        break;                                                          \
+      }                                                                 \
+    size_t c[sizeof(UT)][256]={{0}};                                    \
+    for(i=0;i<size;++i)                                                 \
+      for(d=0;d<sizeof(UT);++d)                                         \
+        ++c[d][ (a[i]>>(8*d)) & 0xff ];                                 \
+    for(d=0;d<sizeof(UT);++d)                                           \
+      {                                                                 \
+        if( c[d][ (a[0]>>(8*d)) & 0xff ]==size ) continue;              \
+        for(sum=j=0;j<256;++j) { n=c[d][j]; c[d][j]=sum; sum+=n; }      \
+        for(i=0;i<size;++i) b[ c[d][ (a[i]>>(8*d)) & 0xff ]++ ]=a[i];   \
+        t=a; a=b; b=t;                                                  \
+      }                                                                 \
+    if(a!=keys) memcpy(keys, a, size*sizeof(UT));                       \
+  }
+static void
+statistics_sort_radix(void *keys, void *tmp, size_t size, size_t nbytes)
+{
+  size_t i, j, d, n, sum;
+  if(size<2) return;
+  switch(nbytes)
+    {
+    case 1: STATISTICS_SORT_RADIX( uint8_t  ); break;
+    case 2: STATISTICS_SORT_RADIX( uint16_t ); break;
+    case 4: STATISTICS_SORT_RADIX( uint32_t ); break;
+    case 8: STATISTICS_SORT_RADIX( uint64_t ); break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+            "the problem. %zu bytes per element not recognized", __func__,
+            PACKAGE_BUGREPORT, nbytes);
+    }
+}
+
+
+
+
+
+/* Merge the two sorted arrays of keys 'a' (with 'na' elements) and 'b'
+   (with 'nb' elements) into 'o'. */
+#define STATISTICS_SORT_MERGE(UT) {                                     \
+    UT *aa=a, *bb=b, *oo=o, *af=aa+na, *bf=bb+nb;                       \
+    while(aa<af && bb<bf) *oo++ = *bb<*aa ? *bb++ : *aa++;              \
+    while(aa<af) *oo++=*aa++;                                           \
+    while(bb<bf) *oo++=*bb++;                                           \
+  }
+static void
+statistics_sort_merge(void *a, size_t na, void *b, size_t nb, void *o,
+                      size_t nbytes)
+{
+  switch(nbytes)
+    {
+    case 1: STATISTICS_SORT_MERGE( uint8_t  ); break;
+    case 2: STATISTICS_SORT_MERGE( uint16_t ); break;
+    case 4: STATISTICS_SORT_MERGE( uint32_t ); break;
+    case 8: STATISTICS_SORT_MERGE( uint64_t ); break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: a bug! Please contact us at %s to fix "
+            "the problem. %zu bytes per element not recognized", __func__,
+            PACKAGE_BUGREPORT, nbytes);
+    }
+}
+
+
+
+
+
+/* Convert one run into keys and sort it (on one thread). */
+static void *
+statistics_sort_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct statistics_sort_params *p=tprm->params;
+
+  size_t i, r, start, size;
+  for(i=0; (r=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      start=p->bounds[r];
+      size=p->bounds[r+1]-start;
+      statistics_sort_keys((char *)p->in+start*p->nbytes, size, p->type, 1);
+      statistics_sort_radix((char *)p->in+start*p->nbytes,
+                            (char *)p->out+start*p->nbytes, size,
+                            p->nbytes);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Merge two neighboring groups of 'width' runs (on one thread). The last
+   group may not have a neighbor, in that case, it is just copied. */
+static void *
+statistics_sort_merge_worker(void *in_prm)
+{
+  struct gal_threads_params *tprm=(struct gal_threads_params *)in_prm;
+  struct statistics_sort_params *p=tprm->params;
+
+  size_t i, g, s, m, e, nb=p->nbytes;
+  for(i=0; (g=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T; ++i)
+    {
+      m=(2*g+1)*p->width;
+      e=(2*g+2)*p->width;
+      s=p->bounds[ 2*g*p->width ];
+      m=p->bounds[ m<p->nruns ? m : p->nruns ];
+      e=p->bounds[ e<p->nruns ? e : p->nruns ];
+      statistics_sort_merge((char *)p->in+s*nb, m-s,
+                            (char *)p->in+m*nb, e-m,
+                            (char *)p->out+s*nb, nb);
+    }
+
+  /* Wait for all the other threads to finish, then return. */
+  if(tprm->b) pthread_barrier_wait(tprm->b);
+  return NULL;
+}
+
+
+
+
+
+/* Sort the first 'size' elements of 'input' (that have no NaN elements)
+   into increasing order. */
+static void
+statistics_sort_radix_increasing(gal_data_t *input, size_t size,
+                                 size_t numthreads)
+{
+  void *tmp, *t;
+  char *mmapname=NULL;
+  struct statistics_sort_params p;
+  size_t r, nruns, nbytes=gal_type_sizeof(input->type);
+
+  /* Allocate the scratch space (not necessary for small arrays). */
+  tmp = ( size<STATISTICS_SORT_RADIX_MIN
+          ? NULL
+          : gal_pointer_allocate_ram_or_mmap(input->type, size, 0,
+                                             input->minmapsize, &mmapname,
+                                             input->quietmmap, __func__,
+                                             "tmp") );
+
+  /* Small arrays (or a single thread): sort in one run. */
+  if(numthreads<2 || size<STATISTICS_SORT_PARALLEL_MIN)
+    {
+      statistics_sort_keys(input->array, size, input->type, 1);
+      statistics_sort_radix(input->array, tmp, size, nbytes);
+    }
+
+  /* Large arrays: sort one run on each thread, then merge the runs (two
+     at a time) on all the threads until there is only one run. */
+  else
+    {
+      /* Set the boundaries of the runs. */
+      nruns=numthreads;
+      p.bounds=gal_pointer_allocate(GAL_TYPE_SIZE_T, nruns+1, 0,
+                                    __func__, "p.bounds");
+      for(r=0;r<=nruns;++r)
+        p.bounds[r] = size/nruns*r + ( r<size%nruns ? r : size%nruns );
+
+      /* Sort each run. */
+      p.in=input->array;
+      p.out=tmp;
+      p.nruns=nruns;
+      p.nbytes=nbytes;
+      p.type=input->type;
+      gal_threads_spin_off_dynamic(statistics_sort_worker, &p, nruns,
+                                   numthreads);
+
+      /* Merge the runs. */
+      for(p.width=1; p.width<nruns; p.width*=2)
+        {
+          gal_threads_spin_off_dynamic(statistics_sort_merge_worker, &p,
+                                       (nruns+2*p.width-1)/(2*p.width),
+                                       numthreads);
+          t=p.in; p.in=p.out; p.out=t;
+        }
+
+      /* If the final merge was into the scratch space, copy it back. */
+      if(p.in!=input->array) memcpy(input->array, p.in, size*nbytes);
+      free(p.bounds);
+    }
+
+  /* Convert the keys back into values and clean up. */
+  statistics_sort_keys(input->array, size, input->type, 0);
+  if(mmapname) gal_pointer_mmap_free(&mmapname, input->quietmmap);
+  else         free(tmp);
+}
+
+
+
+
+
+/* Floating point NaN elements can't be sorted by their bits, so move them
+   to the end of the array (that is where 'qsort' with the 'gal_qsort_'
+   functions also puts them). The returned value is the number of non-NaN
+   elements. */
+#define STATISTICS_SORT_NAN_TO_END(IT) {                                \
+    IT *a=input->array, *f=a+input->size, *o=a;                         \
+    do if(!isnan(*a)) *o++=*a; while(++a<f);                            \
+    out=o-(IT *)(input->array);                                         \
+    while(o<f) *o++=NAN;                                                \
+  }
+static size_t
+statistics_sort_nan_to_end(gal_data_t *input)
+{
+  size_t out=input->size;
+  switch(input->type)
+    {
+    case GAL_TYPE_FLOAT32: STATISTICS_SORT_NAN_TO_END( float  ); break;
+    case GAL_TYPE_FLOAT64: STATISTICS_SORT_NAN_TO_END( double ); break;
+    }
+  return out;
+}
+
+
+
+
+
+/* Reverse the first 'size' elements of the input. */
+#define STATISTICS_SORT_REVERSE(IT) {                                   \
+    IT t, *a=input->array, *b=a+size-1;                                 \
+    while(a<b) { t=*a; *a++=*b; *b--=t; }                               \
+  }
+static void
+statistics_sort_reverse(gal_data_t *input, size_t size)
+{
+  if(size)
     switch(input->type)
       {
-      case GAL_TYPE_UINT8:
-        STATISTICS_SORT(gal_qsort_uint8_i);    break;
-      case GAL_TYPE_INT8:
-        STATISTICS_SORT(gal_qsort_int8_i);     break;
-      case GAL_TYPE_UINT16:
-        STATISTICS_SORT(gal_qsort_uint16_i);   break;
-      case GAL_TYPE_INT16:
-        STATISTICS_SORT(gal_qsort_int16_i);    break;
-      case GAL_TYPE_UINT32:
-        STATISTICS_SORT(gal_qsort_uint32_i);   break;
-      case GAL_TYPE_INT32:
-        STATISTICS_SORT(gal_qsort_int32_i);    break;
-      case GAL_TYPE_UINT64:
-        STATISTICS_SORT(gal_qsort_uint64_i);   break;
-      case GAL_TYPE_INT64:
-        STATISTICS_SORT(gal_qsort_int64_i);    break;
-      case GAL_TYPE_FLOAT32:
-        STATISTICS_SORT(gal_qsort_float32_i);  break;
-      case GAL_TYPE_FLOAT64:
-        STATISTICS_SORT(gal_qsort_float64_i);  break;
+      case GAL_TYPE_UINT8:   STATISTICS_SORT_REVERSE( uint8_t  ); break;
+      case GAL_TYPE_INT8:    STATISTICS_SORT_REVERSE( int8_t   ); break;
+      case GAL_TYPE_UINT16:  STATISTICS_SORT_REVERSE( uint16_t ); break;
+      case GAL_TYPE_INT16:   STATISTICS_SORT_REVERSE( int16_t  ); break;
+      case GAL_TYPE_UINT32:  STATISTICS_SORT_REVERSE( uint32_t ); break;
+      case GAL_TYPE_INT32:   STATISTICS_SORT_REVERSE( int32_t  ); break;
+      case GAL_TYPE_UINT64:  STATISTICS_SORT_REVERSE( uint64_t ); break;
+      case GAL_TYPE_INT64:   STATISTICS_SORT_REVERSE( int64_t  ); break;
+      case GAL_TYPE_FLOAT32: STATISTICS_SORT_REVERSE( float    ); break;
+      case GAL_TYPE_FLOAT64: STATISTICS_SORT_REVERSE( double   ); break;
       default:
         error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
               __func__, input->type);
       }
+}
+
+
+
+
+
+/* This function is ignorant to blank values, if you want to make sure
+   there is no blank values, you can call 'gal_blank_remove' first. The
+   NaN elements (if any) are kept at the end for both increasing and
+   decreasing orders. */
+static void
+statistics_sort(gal_data_t *input, int increasing, size_t numthreads)
+{
+  size_t size=statistics_sort_nan_to_end(input);
+  statistics_sort_radix_increasing(input, size, numthreads);
+  if(increasing==0) statistics_sort_reverse(input, size);
+}
+
+
+
+
+
+void
+gal_statistics_sort_increasing(gal_data_t *input, size_t numthreads)
+{
+  /* Do the sorting. */
+  if(input->size) statistics_sort(input, 1, numthreads);
 
   /* Set the flags. */
   input->flag |=  GAL_DATA_FLAG_SORT_CH;
@@ -1667,36 +2602,10 @@ gal_statistics_sort_increasing(gal_data_t *input)
 
 /* See explanations above 'gal_statistics_sort_increasing'. */
 void
-gal_statistics_sort_decreasing(gal_data_t *input)
+gal_statistics_sort_decreasing(gal_data_t *input, size_t numthreads)
 {
   /* Do the sorting. */
-  if(input->size)
-    switch(input->type)
-      {
-      case GAL_TYPE_UINT8:
-        STATISTICS_SORT(gal_qsort_uint8_d);    break;
-      case GAL_TYPE_INT8:
-        STATISTICS_SORT(gal_qsort_int8_d);     break;
-      case GAL_TYPE_UINT16:
-        STATISTICS_SORT(gal_qsort_uint16_d);   break;
-      case GAL_TYPE_INT16:
-        STATISTICS_SORT(gal_qsort_int16_d);    break;
-      case GAL_TYPE_UINT32:
-        STATISTICS_SORT(gal_qsort_uint32_d);   break;
-      case GAL_TYPE_INT32:
-        STATISTICS_SORT(gal_qsort_int32_d);    break;
-      case GAL_TYPE_UINT64:
-        STATISTICS_SORT(gal_qsort_uint64_d);   break;
-      case GAL_TYPE_INT64:
-        STATISTICS_SORT(gal_qsort_int64_d);    break;
-      case GAL_TYPE_FLOAT32:
-        STATISTICS_SORT(gal_qsort_float32_d);  break;
-      case GAL_TYPE_FLOAT64:
-        STATISTICS_SORT(gal_qsort_float64_d);  break;
-      default:
-        error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
-              __func__, input->type);
-      }
+  if(input->size) statistics_sort(input, 0, numthreads);
 
   /* Set the flags. */
   input->flag |=  GAL_DATA_FLAG_SORT_CH;
@@ -1770,7 +2679,7 @@ gal_statistics_no_blank_sorted(gal_data_t *input, int inplace)
                   else
                     sorted=gal_data_copy(noblank);
                 }
-              gal_statistics_sort_increasing(sorted);
+              gal_statistics_sort_increasing(sorted, 1);
             }
         }
       else
@@ -1921,18 +2830,13 @@ gal_statistics_regular_bins(gal_data_t *input, gal_data_t *inrange,
       if(range!=inrange) gal_data_free(range);
     }
 
-  /* No range was given, find the minimum and maximum. */
+  /* No range was given, find the minimum and maximum (in one pass). */
   else
     {
-      tmp=gal_data_copy_to_new_type_free(gal_statistics_minimum(input),
+      tmp=gal_data_copy_to_new_type_free(gal_statistics_minmax(input, 1),
                                          GAL_TYPE_FLOAT64);
-      min=*((double *)(tmp->array));
-      gal_data_free(tmp);
-      tmp=gal_data_copy_to_new_type_free(gal_statistics_maximum(input),
-                                         GAL_TYPE_FLOAT64);
-      max=*((double *)(tmp->array));
-
-      /* Clean up. */
+      min=((double *)(tmp->array))[0];
+      max=((double *)(tmp->array))[1];
       gal_data_free(tmp);
     }
 
@@ -1986,7 +2890,13 @@ gal_statistics_regular_bins(gal_data_t *input, gal_data_t *inrange,
    'gal_statistics_regular_bins'). 'inbins' is not mandatory, if you pass a
    NULL pointer, the bins structure will be built within this function
    based on the 'numbins' input. As a result, when you have already defined
-   the bins, 'numbins' is not used. */
+   the bins, 'numbins' is not used.
+
+   The counts are added to the (already existing) histogram in
+   'gal_statistics_histogram_add', so the histogram of a dataset that is
+   given in many pieces (for example blocks of an image that is read in
+   parts, or the parts that are given to each thread) can be built
+   without having the whole dataset in memory. */
 
 #define HISTOGRAM_TYPESET(IT) {                                         \
     IT *a=input->array, *af=a+input->size;                              \
@@ -2003,19 +2913,9 @@ gal_statistics_regular_bins(gal_data_t *input, gal_data_t *inrange,
     while(++a<af);                                                      \
   }
 
-gal_data_t *
-gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
-                         int maxone)
+static void
+statistics_histogram_check_bins(gal_data_t *bins)
 {
-  float *f, *ff;
-  size_t *h, h_i;
-  gal_data_t *hist;
-  double *d, min, max, ref=NAN, binwidth;
-
-
-  /* Check if the bins are regular or not. For irregular bins, we can
-     either use the old implementation, or GSL's histogram
-     functionality. */
   if(bins==NULL)
     error(EXIT_FAILURE, 0, "%s: 'bins' is NULL", __func__);
   if(bins->size==1)
@@ -2024,23 +2924,33 @@ gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
   if(bins->status!=GAL_STATISTICS_BINS_REGULAR)
     error(EXIT_FAILURE, 0, "%s: the input bins are not regular. Currently "
           "it is only implemented for regular bins", __func__);
-  if(input->size==0)
-    error(EXIT_FAILURE, 0, "%s: input's size is 0", __func__);
+}
+
 
 
-  /* Check if normalize and 'maxone' are not called together. */
-  if(normalize && maxone)
-    error(EXIT_FAILURE, 0, "%s: only one of 'normalize' and 'maxone' may "
-          "be given", __func__);
 
 
-  /* Allocate the histogram (note that we are clearning it so all values
-     are zero. */
-  hist=gal_data_alloc(NULL, GAL_TYPE_SIZE_T, bins->ndim, bins->dsize,
-                      NULL, 1, input->minmapsize, input->quietmmap,
-                      "hist_number", "counts",
-                      "Number of data points within each bin.");
+gal_data_t *
+gal_statistics_histogram_add(gal_data_t *input, gal_data_t *bins,
+                             gal_data_t *hist)
+{
+  size_t *h, h_i;
+  double *d, min, max, binwidth;
 
+  /* Sanity checks. */
+  statistics_histogram_check_bins(bins);
+  if( hist && (hist->type!=GAL_TYPE_SIZE_T || hist->size!=bins->size) )
+    error(EXIT_FAILURE, 0, "%s: 'hist' has to have a 'size_t' type and "
+          "the same number of elements as 'bins'", __func__);
+
+  /* Allocate the histogram if it wasn't given (note that we are clearing
+     it so all values are zero). */
+  if(hist==NULL)
+    hist=gal_data_alloc(NULL, GAL_TYPE_SIZE_T, bins->ndim, bins->dsize,
+                        NULL, 1, input->minmapsize, input->quietmmap,
+                        "hist_number", "counts",
+                        "Number of data points within each bin.");
+  if(input->size==0) return hist;
 
   /* Set the minimum and maximum range of the histogram from the bins. */
   d=bins->array;
@@ -2048,7 +2958,6 @@ gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
   min = d[ 0      ] - binwidth/2;
   max = d[ bins->size-1 ] + binwidth/2;
 
-
   /* Go through all the elements and find out which bin they belong to. */
   h=hist->array;
   switch(input->type)
@@ -2068,7 +2977,6 @@ gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
             __func__, input->type);
     }
 
-
   /* For a check:
   {
     size_t i, *hh=hist->array;
@@ -2076,6 +2984,28 @@ gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
   }
   */
 
+  /* Return the histogram. */
+  return hist;
+}
+
+
+
+
+
+/* Normalize the given histogram (with a 'size_t' type, it will be freed)
+   so the sum of the bins is one (when 'normalize!=0') or its maximum is
+   one (when 'maxone!=0'). If neither are given, the input is returned. */
+gal_data_t *
+gal_statistics_histogram_normalize(gal_data_t *hist, int normalize,
+                                   int maxone)
+{
+  float *f, *ff;
+  double ref=NAN;
+
+  /* Check if normalize and 'maxone' are not called together. */
+  if(normalize && maxone)
+    error(EXIT_FAILURE, 0, "%s: only one of 'normalize' and 'maxone' may "
+          "be given", __func__);
 
   /* Find the reference to correct the histogram if necessary. */
   if(normalize)
@@ -2109,14 +3039,75 @@ gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
                                  &hist->comment);
     }
 
+  /* Correct the histogram if necessary. */
+  if( !isnan(ref) )
+    { ff=(f=hist->array)+hist->size; do *f++ /= ref;   while(f<ff); }
+
+  /* Return the histogram. */
+  return hist;
+}
+
+
+
+
+
+/* Count the elements of one part into its own histogram. */
+static void
+statistics_histogram_operate(gal_data_t *input,
+                             struct statistics_parts_params *p, size_t r)
+{
+  gal_data_t **hist=p->partial;
+  hist[r]=gal_statistics_histogram_add(input, p->bins, hist[r]);
+}
+
 
-  /* Correct the histogram if necessary. */
-  if( !isnan(ref) )
-    { ff=(f=hist->array)+hist->size; do *f++ /= ref;   while(f<ff); }
 
 
-  /* Return the histogram. */
-  return hist;
+
+/* Large (contiguous) datasets are counted on 'numthreads' threads, each
+   into its own histogram, and the histograms are added at the end. */
+gal_data_t *
+gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
+                         int maxone, size_t numthreads)
+{
+  size_t r, j, *h, *ph;
+  gal_data_t *hist, **parts;
+  struct statistics_parts_params p={0};
+
+  /* Check if the bins are regular or not. For irregular bins, we can
+     either use the old implementation, or GSL's histogram
+     functionality. */
+  statistics_histogram_check_bins(bins);
+  if(input->size==0)
+    error(EXIT_FAILURE, 0, "%s: input's size is 0", __func__);
+  if(normalize && maxone)
+    error(EXIT_FAILURE, 0, "%s: only one of 'normalize' and 'maxone' may "
+          "be given", __func__);
+
+  /* Allocate the array that keeps the histogram of each part. */
+  p.bins=bins;
+  p.input=input;
+  p.operate=statistics_histogram_operate;
+  p.numparts=statistics_parts_number(input, numthreads, 0);
+  errno=0;
+  p.partial=parts=calloc(p.numparts, sizeof *parts);
+  if(parts==NULL)
+    error(EXIT_FAILURE, errno, "%s: %zu bytes for 'parts'", __func__,
+          p.numparts * sizeof *parts);
+
+  /* Count the elements in each bin (of each part), add the histograms of
+     the parts, then normalize if necessary. */
+  statistics_parts_run(&p);
+  hist=parts[0];
+  h=hist->array;
+  for(r=1;r<p.numparts;++r)
+    {
+      ph=parts[r]->array;
+      for(j=0;j<hist->size;++j) h[j]+=ph[j];
+      gal_data_free(parts[r]);
+    }
+  free(parts);
+  return gal_statistics_histogram_normalize(hist, normalize, maxone);
 }
 
 
@@ -2166,14 +3157,60 @@ gal_statistics_histogram(gal_data_t *input, gal_data_t *bins, int normalize,
       }                                                                 \
   }
 
+/* Count the elements of one part into its own 2D histogram (the
+   'uint32_t' array of part 'r' in 'partial'). */
+static void
+statistics_histogram2d_operate(gal_data_t *input,
+                               struct statistics_parts_params *p, size_t r)
+{
+  size_t i, j;
+  gal_data_t *bins=p->bins;
+  uint32_t *h=((uint32_t **)(p->partial))[r];
+  double *da=bins->array, *db=bins->next->array;
+  size_t bsizea=bins->size, bsizeb=bins->next->size;
+  double mina, minb, maxa, maxb, binwidtha, binwidthb;
+
+  /* Set the minimum and maximum range of the histogram from the bins. */
+  binwidtha=da[1]-da[0];
+  binwidthb=db[1]-db[0];
+  mina=da[0]-binwidtha/2;
+  minb=db[0]-binwidthb/2;
+  maxa=da[ bsizea - 1 ] + binwidtha/2;
+  maxb=db[ bsizeb - 1 ] + binwidthb/2;
+
+  /* Fill the histogram. */
+  switch(input->type)
+    {
+    case GAL_TYPE_UINT8:     HISTOGRAM2D_TYPESET_A(uint8_t);     break;
+    case GAL_TYPE_INT8:      HISTOGRAM2D_TYPESET_A(int8_t);      break;
+    case GAL_TYPE_UINT16:    HISTOGRAM2D_TYPESET_A(uint16_t);    break;
+    case GAL_TYPE_INT16:     HISTOGRAM2D_TYPESET_A(int16_t);     break;
+    case GAL_TYPE_UINT32:    HISTOGRAM2D_TYPESET_A(uint32_t);    break;
+    case GAL_TYPE_INT32:     HISTOGRAM2D_TYPESET_A(int32_t);     break;
+    case GAL_TYPE_UINT64:    HISTOGRAM2D_TYPESET_A(uint64_t);    break;
+    case GAL_TYPE_INT64:     HISTOGRAM2D_TYPESET_A(int64_t);     break;
+    case GAL_TYPE_FLOAT32:   HISTOGRAM2D_TYPESET_A(float);       break;
+    case GAL_TYPE_FLOAT64:   HISTOGRAM2D_TYPESET_A(double);      break;
+    default:
+      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+            __func__, input->type);
+    }
+}
+
+
+
+
+
 gal_data_t *
-gal_statistics_histogram2d(gal_data_t *input, gal_data_t *bins)
+gal_statistics_histogram2d(gal_data_t *input, gal_data_t *bins,
+                           size_t numthreads)
 {
-  uint32_t *h;
   double *o1, *o2;
+  uint32_t *h, **parts;
   gal_data_t *tmp, *out;
-  size_t i, j, bsizea, bsizeb, outsize;
-  double *da, *db, binwidtha, binwidthb, mina, minb, maxa, maxb;
+  struct statistics_parts_params p={0};
+  size_t i, j, r, bsizea, bsizeb, outsize;
+  double *da, *db;
 
   /* Basic sanity checks. */
   if(input->next==NULL)
@@ -2230,31 +3267,30 @@ gal_statistics_histogram2d(gal_data_t *input, gal_data_t *bins)
         o2[i*bsizeb+j]=db[j];
       }
 
-  /* Set the minimum and maximum range of the histogram from the bins. */
-  binwidtha=da[1]-da[0];
-  binwidthb=db[1]-db[0];
-  mina=da[0]-binwidtha/2;
-  minb=db[0]-binwidthb/2;
-  maxa=da[ bins->size - 1      ] + binwidtha/2;
-  maxb=db[ bins->next->size - 1] + binwidthb/2;
-
-  /* Fill the histogram column. */
-  switch(input->type)
+  /* Fill the histogram column: the first part is counted directly into
+     the output and the other parts (if any) into their own arrays, which
+     are then added to it. */
+  p.bins=bins;
+  p.list=1;
+  p.input=input;
+  p.operate=statistics_histogram2d_operate;
+  p.numparts=statistics_parts_number(input, numthreads, 1);
+  errno=0;
+  p.partial=parts=malloc(p.numparts * sizeof *parts);
+  if(parts==NULL)
+    error(EXIT_FAILURE, errno, "%s: %zu bytes for 'parts'", __func__,
+          p.numparts * sizeof *parts);
+  parts[0]=h;
+  for(r=1;r<p.numparts;++r)
+    parts[r]=gal_pointer_allocate(GAL_TYPE_UINT32, outsize, 1, __func__,
+                                  "parts[r]");
+  statistics_parts_run(&p);
+  for(r=1;r<p.numparts;++r)
     {
-    case GAL_TYPE_UINT8:     HISTOGRAM2D_TYPESET_A(uint8_t);     break;
-    case GAL_TYPE_INT8:      HISTOGRAM2D_TYPESET_A(int8_t);      break;
-    case GAL_TYPE_UINT16:    HISTOGRAM2D_TYPESET_A(uint16_t);    break;
-    case GAL_TYPE_INT16:     HISTOGRAM2D_TYPESET_A(int16_t);     break;
-    case GAL_TYPE_UINT32:    HISTOGRAM2D_TYPESET_A(uint32_t);    break;
-    case GAL_TYPE_INT32:     HISTOGRAM2D_TYPESET_A(int32_t);     break;
-    case GAL_TYPE_UINT64:    HISTOGRAM2D_TYPESET_A(uint64_t);    break;
-    case GAL_TYPE_INT64:     HISTOGRAM2D_TYPESET_A(int64_t);     break;
-    case GAL_TYPE_FLOAT32:   HISTOGRAM2D_TYPESET_A(float);       break;
-    case GAL_TYPE_FLOAT64:   HISTOGRAM2D_TYPESET_A(double);      break;
-    default:
-      error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
-            __func__, input->type);
+      for(i=0;i<outsize;++i) h[i]+=parts[r][i];
+      free(parts[r]);
     }
+  free(parts);
 
   /* Return the final output. */
   return out;
@@ -2294,14 +3330,15 @@ gal_statistics_cfp(gal_data_t *input, gal_data_t *bins, int normalize)
   if(bins->status!=GAL_STATISTICS_BINS_REGULAR)
     error(EXIT_FAILURE, 0, "%s: the input bins are not regular. Currently "
           "it is only implemented for regular bins", __func__);
-  if(input->size==0)
-    error(EXIT_FAILURE, 0, "%s: input's size is 0", __func__);
+  if( input ? input->size==0 : bins->next==NULL )
+    error(EXIT_FAILURE, 0, "%s: input's size is 0 (or it is NULL and no "
+          "histogram is given in 'bins->next')", __func__);
 
 
   /* Prepare the histogram. */
   hist = ( bins->next
            ? bins->next
-           : gal_statistics_histogram(input, bins, 0, 0) );
+           : gal_statistics_histogram(input, bins, 0, 0, 1) );
 
 
   /* If the histogram has float32 type it was given by the user and is
@@ -2313,13 +3350,18 @@ gal_statistics_cfp(gal_data_t *input, gal_data_t *bins, int normalize)
       sum=0.0f;
       ff=(f=hist->array)+hist->size; do sum += *f++;   while(f<ff);
       if(sum!=1.0f)
-        hist=gal_statistics_histogram(input, bins, 0, 0);
+        {
+          if(input==NULL)
+            error(EXIT_FAILURE, 0, "%s: the histogram in 'bins->next' "
+                  "isn't normalized, so 'input' is necessary", __func__);
+          hist=gal_statistics_histogram(input, bins, 0, 0, 1);
+        }
     }
 
 
   /* Allocate the cumulative frequency plot's necessary space. */
   cfp=gal_data_alloc( NULL, hist->type, bins->ndim, bins->dsize,
-                      NULL, 1, input->minmapsize, input->quietmmap,
+                      NULL, 1, hist->minmapsize, hist->quietmmap,
                       ( hist->type==GAL_TYPE_FLOAT32
                         ? "cfp_normalized" : "cfp_number" ),
                       ( hist->type==GAL_TYPE_FLOAT32
@@ -2586,7 +3628,7 @@ statistics_clip_stats_extra(gal_data_t *nbs, float *oa, uint8_t extrastats)
   /* Mean and Standard deviation. */
   if(imean && istd)
     {
-      tmp=gal_statistics_mean_std(nbs);
+      tmp=gal_statistics_mean_std(nbs, 1);
       oa[ GAL_STATISTICS_CLIP_OUTCOL_STD  ] = ((double *)(tmp->array))[1];
       oa[ GAL_STATISTICS_CLIP_OUTCOL_MEAN ] = ((double *)(tmp->array))[0];
       gal_data_free(tmp);
@@ -2625,32 +3667,65 @@ statistics_clip_stats_extra(gal_data_t *nbs, float *oa, uint8_t extrastats)
 
 /* Sigma-cilp a given distribution. The way this function works is very
    simple: first it will sort the input (if it isn't sorted). Afterwards,
-   it will recursively change the starting point of the array and its size,
-   calcluating the basic statistics in each round to define the new
-   starting point and size. */
+   it will recursively change the first and last elements of the window
+   over the sorted array ('lo' and 'hi'), calcluating the basic statistics
+   in each round to define the new window.
+
+   Since the clipped elements are always at the two ends of the window,
+   nothing is copied or re-sorted in each round: the median is the middle
+   element(s) of the window, the MAD is found with a binary search over
+   the window (see 'statistics_mad_in_sorted_window') and the sum and sum
+   of squares (for the standard deviation) are kept and only the clipped
+   elements are subtracted from them. The clipped elements are usually the
+   outliers that can be orders of magnitude larger than the rest, so the
+   sums are compensated (Neumaier's variant of Kahan summation) to avoid
+   losing the small values under the rounding errors of the large ones.
+   Also, the values are shifted by the initial median to avoid losing
+   precision when subtracting the square of the mean from the mean of the
+   squares. When more elements are clipped than remain, the sums over the
+   remaining elements are re-calculated (which is faster). */
 #define CLIPALL(IT) {                                                   \
-    IT *a  = nbs->array, *af = a  + nbs->size;                          \
-    IT *bf = nbs->array, *b  = bf + nbs->size - 1;                      \
-                                                                        \
-    /* Remove all out-of-range elements from the start of the array. */ \
-    if( nbs->flag & GAL_DATA_FLAG_SORTED_I )                            \
-      do if( *a > (center - (multip * spread)) )                        \
-           { start=a; break; }                                          \
-      while(++a<af);                                                    \
-    else                                                                \
-      do if( *a < (center + (multip * spread)) )                        \
-           { start=a; break; }                                          \
-      while(++a<af);                                                    \
+    IT *a=nbs_array;                                                    \
+    double low=center-multip*spread, high=center+multip*spread;         \
                                                                         \
-    /* Remove all out-of-range elements from the end of the array. */   \
+    /* Remove all out-of-range elements from the two ends. */           \
     if( nbs->flag & GAL_DATA_FLAG_SORTED_I )                            \
-      do if( *b < (center + (multip * spread)) )                        \
-           { size=b-a+1; break; }                                       \
-      while(--b>=bf);                                                   \
+      {                                                                 \
+        while( lo<hi && a[lo]   <= low  ) ++lo;                         \
+        while( hi>lo && a[hi-1] >= high ) --hi;                         \
+      }                                                                 \
     else                                                                \
-      do if( *b > (center - (multip * spread)) )                        \
-           { size=b-a+1; break; }                                       \
-      while(--b>=bf);                                                   \
+      {                                                                 \
+        while( lo<hi && a[lo]   >= high ) ++lo;                         \
+        while( hi>lo && a[hi-1] <= low  ) --hi;                         \
+      }                                                                 \
+  }
+#define CLIPSUM_ADD(S, C, V) {                                          \
+    t=(S)+(V);                                                          \
+    (C) += fabs(S)>=fabs(V) ? ((S)-t)+(V) : ((V)-t)+(S);                \
+    (S)=t;                                                              \
+  }
+#define CLIPSUM_RANGE(A, B, SIGN) {                                     \
+    for(i=(A);i<(B);++i)                                                \
+      {                                                                 \
+        v=a[i]-shift;                                                   \
+        CLIPSUM_ADD(s,  cs,  SIGN v  );                                 \
+        CLIPSUM_ADD(s2, cs2, SIGN v*v);                                 \
+      }                                                                 \
+  }
+#define CLIPSTATS(IT) {                                                 \
+    IT *a=nbs_array;                                                    \
+    center=*(IT *)(center_i->array);                                    \
+    if(sig1_mad0)                                                       \
+      {                                                                 \
+        if(num==0) shift=center;                                        \
+        if( num==0 || (lo-olo)+(ohi-hi) > hi-lo )                       \
+          { s=cs=s2=cs2=0.0f; CLIPSUM_RANGE(lo, hi, +); }               \
+        else                                                            \
+          { CLIPSUM_RANGE(olo, lo, -); CLIPSUM_RANGE(hi, ohi, -); }     \
+        spread=gal_statistics_std_from_sums(s+cs, s2+cs2, hi-lo);       \
+      }                                                                 \
+    else spread=*(IT *)(spread_i->array);                               \
   }
 
 static gal_data_t *
@@ -2658,16 +3733,16 @@ statistics_clip(gal_data_t *input, float multip, float param,
                 uint8_t extrastats, int inplace, int quiet, int sig1_mad0)
 {
   float *oa;
+  void *nbs_array;
   char *colnames;
-  gal_data_t *spread_d;
-  void *start, *nbs_array;
-  size_t i, num=0, size, oldsize;
+  gal_data_t *fcopy, *center_i, *spread_i, *out;
   uint8_t type=gal_tile_block(input)->type;
   uint8_t bytolerance = param>=1.0f ? 0 : 1;
   double center=NAN, spread=NAN, oldspread=NAN;
-  gal_data_t *fcopy, *center_i, *center_d, *spread_i, *out;
   gal_data_t *nbs=gal_statistics_no_blank_sorted(input, inplace);
   size_t maxnum = param>=1.0f?param:GAL_STATISTICS_CLIP_MAX_CONVERGE;
+  size_t i, num=0, size, lo=0, hi=0, olo=0, ohi=0;
+  double t, v, s=0.0f, cs=0.0f, s2=0.0f, cs2=0.0f, shift=0.0f;
 
   /* Do sanity checks and allocate space for the output. */
   out=statistics_clip_prepare(input, nbs, multip, param, quiet, sig1_mad0,
@@ -2716,20 +3791,17 @@ statistics_clip(gal_data_t *input, float multip, float param,
     /* More than one element. */
     default:
 
-      /* Do the clipping, but first initialize the values that will be
-         changed during the clipping: the start of the array and the
-         array's size. */
-      size=nbs->size;
-      start=nbs->array;
+      /* Do the clipping, but first initialize the window that will be
+         changed during the clipping: the whole array. */
+      hi=size=nbs->size;
       while(num<maxnum && size)
         {
-          /* 'start' and 'size' will be different in the next round
-             (updated within 'CLIPALL'). We are also setting 'dsize[0]'
-             because the 'nbs' dataset is one dimensional and for future
-             steps (like writing values in a table); dsize[0] is
-             important.*/
-          nbs->array = start;
-          nbs->dsize[0] = nbs->size = oldsize = size;
+          /* The window will be different in the next round (updated
+             within 'CLIPALL'). We are also setting 'dsize[0]' because
+             the 'nbs' dataset is one dimensional and for future steps
+             (like writing values in a table); dsize[0] is important.*/
+          nbs->array = gal_pointer_increment(nbs_array, lo, type);
+          nbs->dsize[0] = nbs->size = size;
 
           /* For a detailed check, just correct the type).
           if(!quiet)
@@ -2743,16 +3815,25 @@ statistics_clip(gal_data_t *input, float multip, float param,
 
           /* Find the center and disperson. */
           statistics_median_in_sorted_no_blank(nbs, center_i->array);
-          if(sig1_mad0) spread_i=gal_statistics_std(nbs);
-          else statistics_mad_in_sorted_no_blank(nbs, center_i,
-                                                 spread_i->array);
-          center_d=gal_data_copy_to_new_type(center_i, GAL_TYPE_FLOAT64);
-          spread_d=gal_data_copy_to_new_type(spread_i, GAL_TYPE_FLOAT64);
-          if(sig1_mad0) { gal_data_free(spread_i); spread_i=NULL; }
-
-          /* Put them in usable (with a type) pointers. */
-          center = ((double *)(center_d->array))[0];
-          spread = ((double *)(spread_d->array))[0];
+          if(sig1_mad0==0)
+            statistics_mad_in_sorted_window(nbs, center_i->array,
+                                            spread_i->array);
+          switch(type)
+            {
+            case GAL_TYPE_UINT8:    CLIPSTATS( uint8_t  );   break;
+            case GAL_TYPE_INT8:     CLIPSTATS( int8_t   );   break;
+            case GAL_TYPE_UINT16:   CLIPSTATS( uint16_t );   break;
+            case GAL_TYPE_INT16:    CLIPSTATS( int16_t  );   break;
+            case GAL_TYPE_UINT32:   CLIPSTATS( uint32_t );   break;
+            case GAL_TYPE_INT32:    CLIPSTATS( int32_t  );   break;
+            case GAL_TYPE_UINT64:   CLIPSTATS( uint64_t );   break;
+            case GAL_TYPE_INT64:    CLIPSTATS( int64_t  );   break;
+            case GAL_TYPE_FLOAT32:  CLIPSTATS( float    );   break;
+            case GAL_TYPE_FLOAT64:  CLIPSTATS( double   );   break;
+            default:
+              error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
+                    __func__, type);
+            }
 
           /* If the user wanted to view the steps, show it to them. */
           if(!quiet)
@@ -2775,13 +3856,14 @@ statistics_clip(gal_data_t *input, float multip, float param,
             if( spread==0 || ((oldspread - spread) / spread) < param )
               {
                 if(spread==0) oldspread=spread;
-                gal_data_free(spread_d); gal_data_free(center_d);
                 break;
               }
 
           /* Clip all the elements outside of the desired range: since the
-             array is sorted, this means to just change the starting
-             pointer and size of the array. */
+             array is sorted, this means to just move the first and last
+             elements of the window. */
+          olo=lo;
+          ohi=hi;
           switch(type)
             {
             case GAL_TYPE_UINT8:    CLIPALL( uint8_t  );   break;
@@ -2798,15 +3880,12 @@ statistics_clip(gal_data_t *input, float multip, float param,
               error(EXIT_FAILURE, 0, "%s: type code %d not recognized",
                     __func__, type);
             }
+          size=hi-lo;
 
           /* Set the values from this round in the old elements, so the
              next round can compare with, and return then if necessary. */
           oldspread  = spread;
           ++num;
-
-          /* Clean up: */
-          gal_data_free(spread_d);
-          gal_data_free(center_d);
         }
 
       /* If we were in tolerance mode and 'num' and 'maxnum' are equal (the
@@ -3109,3 +4188,463 @@ gal_statistics_outlier_flat_cfp(gal_data_t *input, size_t numprev,
   gal_data_free(prev);
   return out;
 }
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/****************************************************************
+ *****************      Streaming sketch     ********************
+ ****************************************************************/
+/* A summary of a distribution that is built in one pass over its elements
+   (that can be given in any number of pieces) and that can be merged with
+   other sketches (for example from the other threads or other files).
+   The number, minimum, maximum, sum, mean and standard deviation are
+   exact, but the quantiles are approximate (within a known error).
+
+   The mean and standard deviation are kept as the mean and sum of squared
+   differences from the mean: for each piece they are found in two passes
+   (which are cheap, the piece is already in memory), and the pieces are
+   merged with the formula of Chan, Golub & LeVeque (1979). This is much
+   more accurate than the sum of squares (it doesn't subtract two large
+   numbers), especially over billions of elements.
+
+   For the quantiles, the elements are kept in levels that have a capacity
+   of 'k' elements: each element in level 'h' stands for 2^h input
+   elements. New elements are put in level 0, and when a level is full,
+   it is sorted and one element of each consecutive pair (randomly the
+   first or the second in each compaction) is moved to the next level
+   (like the sketch of Karnin, Lang & Liberty 2016, but with the same
+   capacity for all the levels). For any value, the number of elements
+   before it (its rank) changes by 0, or +2^h or -2^h (with equal
+   probability) in each compaction of level 'h'. So the errors of the
+   compactions are independent with a mean of zero, and the sum of their
+   squared maximums (4^h) is kept in 'variance'. By Hoeffding's
+   inequality, with 99% probability, the rank error is smaller than
+   3.26*sqrt(variance) (returned as a fraction of the number of elements
+   by 'gal_statistics_sketch_error'). In practice, this is about 4/k
+   (0.05% for the default 'k'), independent of the number of elements
+   ('n'). When 'n' is smaller than 'k', the quantiles are exact. The used
+   memory is about 2*k*log2(n/k) double precision numbers. */
+struct gal_statistics_sketch *
+gal_statistics_sketch_alloc(size_t k)
+{
+  struct gal_statistics_sketch *sk;
+
+  /* The capacity of each level should be even and larger than 1. */
+  if(k<2) k=2;
+  if(k%2) ++k;
+
+  /* Allocate and initialize the sketch. */
+  errno=0;
+  sk=malloc(sizeof *sk);
+  if(sk==NULL)
+    error(EXIT_FAILURE, errno, "%s: allocating %zu bytes for 'sk'",
+          __func__, sizeof *sk);
+  sk->k=k;
+  sk->numlevels=0;
+  sk->levels=NULL;
+  sk->sizes=NULL;
+  sk->number=0;
+  sk->minimum=NAN;
+  sk->maximum=NAN;
+  sk->sum=sk->sumc=0.0f;
+  sk->mean=sk->m2=0.0f;
+  sk->variance=0.0f;
+  sk->seed=0x9e3779b97f4a7c15;
+  sk->tmp=gal_pointer_allocate(GAL_TYPE_FLOAT64, 2*k, 0, __func__,
+                               "sk->tmp");
+  return sk;
+}
+
+
+
+
+
+void
+gal_statistics_sketch_free(struct gal_statistics_sketch *sk)
+{
+  size_t h;
+  if(sk==NULL) return;
+  for(h=0;h<sk->numlevels;++h) free(sk->levels[h]);
+  free(sk->levels);
+  free(sk->sizes);
+  free(sk->tmp);
+  free(sk);
+}
+
+
+
+
+
+/* Add a new (empty) level to the top of the sketch. */
+static void
+statistics_sketch_add_level(struct gal_statistics_sketch *sk)
+{
+  size_t h=sk->numlevels++;
+
+  /* Re-allocate the arrays keeping the levels. */
+  errno=0;
+  sk->levels=realloc(sk->levels, sk->numlevels*sizeof *sk->levels);
+  sk->sizes=realloc(sk->sizes, sk->numlevels*sizeof *sk->sizes);
+  if(sk->levels==NULL || sk->sizes==NULL)
+    error(EXIT_FAILURE, errno, "%s: re-allocating the levels", __func__);
+
+  /* Allocate the new level: the levels are compacted when they have 'k'
+     elements, but up to 'k' elements may be added to them at once. */
+  sk->sizes[h]=0;
+  sk->levels[h]=gal_pointer_allocate(GAL_TYPE_FLOAT64, 2*sk->k, 0,
+                                     __func__, "sk->levels[h]");
+}
+
+
+
+
+
+/* Sort the elements of the given level (into increasing order). */
+static void
+statistics_sketch_sort_level(struct gal_statistics_sketch *sk, size_t h)
+{
+  statistics_sort_keys(sk->levels[h], sk->sizes[h], GAL_TYPE_FLOAT64, 1);
+  statistics_sort_radix(sk->levels[h], sk->tmp, sk->sizes[h], 8);
+  statistics_sort_keys(sk->levels[h], sk->sizes[h], GAL_TYPE_FLOAT64, 0);
+}
+
+
+
+
+
+/* Add 'n' elements (all standing for 2^h input elements) to level 'h' of
+   the sketch, and compact it when it is full. */
+static void statistics_sketch_compact(struct gal_statistics_sketch *sk,
+                                      size_t h);
+static void
+statistics_sketch_insert(struct gal_statistics_sketch *sk, size_t h,
+                         double *values, size_t n)
+{
+  size_t m;
+  while(n)
+    {
+      /* Add the levels that don't exist yet. */
+      while(h>=sk->numlevels) statistics_sketch_add_level(sk);
+
+      /* Copy as many elements as the level can keep. */
+      m = 2*sk->k-sk->sizes[h];
+      if(m>n) m=n;
+      memcpy(sk->levels[h]+sk->sizes[h], values, m*sizeof *values);
+      sk->sizes[h]+=m;
+      values+=m;
+      n-=m;
+
+      /* Compact the level if it is full. */
+      if(sk->sizes[h]>=sk->k) statistics_sketch_compact(sk, h);
+    }
+}
+
+
+
+
+
+/* Move one element of each (sorted) pair of elements in level 'h' into
+   level 'h+1'. When the number of elements is odd, the largest is kept in
+   the level. The random bit is taken from a 'xorshift64*' generator (so
+   the output only depends on the order of the inputs). */
+static void
+statistics_sketch_compact(struct gal_statistics_sketch *sk, size_t h)
+{
+  size_t i, np, offset;
+  double last, *a=sk->levels[h];
+
+  /* Sort the level and find the number of pairs. */
+  statistics_sketch_sort_level(sk, h);
+  np=sk->sizes[h]/2;
+  last=a[sk->sizes[h]-1];
+
+  /* Pick one element of each pair (in place). */
+  sk->seed ^= sk->seed >> 12;
+  sk->seed ^= sk->seed << 25;
+  sk->seed ^= sk->seed >> 27;
+  offset = (sk->seed * 0x2545f4914f6cdd1d) >> 63;
+  for(i=0;i<np;++i) a[i]=a[2*i+offset];
+
+  /* Add the picked elements to the next level, and keep the remaining
+     element (if there was any). The higher level doesn't touch the
+     elements of this level, so they can be read directly from here. */
+  sk->variance += ldexp(1.0f, 2*h);
+  statistics_sketch_insert(sk, h+1, a, np);
+  if(sk->sizes[h]%2) { a[0]=last; sk->sizes[h]=1; }
+  else                            sk->sizes[h]=0;
+}
+
+
+
+
+
+/* Merge the moments of a new piece (with 'n' elements) into the sketch. */
+static void
+statistics_sketch_moments(struct gal_statistics_sketch *sk, size_t n,
+                          double sum, double mean, double m2, double min,
+                          double max)
+{
+  double t, delta, total;
+
+  /* If the piece is empty, there is nothing to merge. */
+  if(n==0) return;
+
+  /* Minimum and maximum. */
+  if(sk->number==0 || min<sk->minimum) sk->minimum=min;
+  if(sk->number==0 || max>sk->maximum) sk->maximum=max;
+
+  /* Compensated (Neumaier) sum. */
+  t=sk->sum+sum;
+  sk->sumc += ( fabs(sk->sum)>=fabs(sum)
+                ? (sk->sum-t)+sum : (sum-t)+sk->sum );
+  sk->sum=t;
+
+  /* Mean and sum of squared differences from the mean. */
+  total=sk->number+n;
+  delta=mean-sk->mean;
+  sk->mean += delta*n/total;
+  sk->m2   += m2 + delta*delta*((double)sk->number*n/total);
+  sk->number+=n;
+}
+
+
+
+
+
+/* Add all the (non-blank) elements of the input dataset (which can also
+   be a tile) into the sketch. */
+void
+gal_statistics_sketch_add(struct gal_statistics_sketch *sk,
+                          gal_data_t *input)
+{
+  size_t n=0, k=sk->k;
+  double v, s=0.0f, m2=0.0f, mean, min=INFINITY, max=-INFINITY;
+
+  /* Empty inputs don't change the sketch. */
+  if(input->size==0) return;
+  if(sk->numlevels==0) statistics_sketch_add_level(sk);
+
+  /* Find the sum, minimum and maximum, and add the elements to the first
+     level of the sketch (compacting it when it is full). */
+  GAL_TILE_PARSE_OPERATE(input, NULL, 0, 1,
+                         {
+                           v=*i; ++n; s+=v;
+                           if(v<min) min=v;
+                           if(v>max) max=v;
+                           if(sk->sizes[0]>=k)
+                             statistics_sketch_compact(sk, 0);
+                           sk->levels[0][ sk->sizes[0]++ ]=v;
+                         });
+  if(n==0) return;
+
+  /* Find the sum of squared differences from the mean of this piece. */
+  mean=s/n;
+  GAL_TILE_PARSE_OPERATE(input, NULL, 0, 1,
+                         { v=*i-mean; m2+=v*v; });
+
+  /* Merge the moments into the sketch. */
+  statistics_sketch_moments(sk, n, s, mean, m2, min, max);
+}
+
+
+
+
+
+/* Add all the information in 'in' into 'out' ('in' isn't changed). */
+void
+gal_statistics_sketch_merge(struct gal_statistics_sketch *out,
+                            struct gal_statistics_sketch *in)
+{
+  size_t h;
+
+  /* Merge the elements of each level. */
+  for(h=0;h<in->numlevels;++h)
+    if(in->sizes[h])
+      statistics_sketch_insert(out, h, in->levels[h], in->sizes[h]);
+
+  /* Merge the moments and the variance of the rank errors. */
+  statistics_sketch_moments(out, in->number, in->sum+in->sumc, in->mean,
+                            in->m2, in->minimum, in->maximum);
+  out->variance += in->variance;
+}
+
+
+
+
+
+/* Return the maximum error of the rank (as a fraction of the number of
+   elements) of the quantiles from this sketch, with 99% probability. */
+double
+gal_statistics_sketch_error(struct gal_statistics_sketch *sk)
+{
+  return ( sk->number
+           ? 3.26f*sqrt(sk->variance)/sk->number
+           : NAN );
+}
+
+
+
+
+
+/* Merge all the levels (sorted) into one array of values ('*values') and
+   the cumulative number of input elements until each value ('*cum'). The
+   returned value is the number of elements in the two arrays. */
+static size_t
+statistics_sketch_cumulative(struct gal_statistics_sketch *sk,
+                             double **values, size_t **cum)
+{
+  double *v;
+  size_t h, i, j, best, c=0, n=0, *pos, *cu;
+
+  /* Sort all the levels and count the number of elements. */
+  for(h=0;h<sk->numlevels;++h)
+    {
+      statistics_sketch_sort_level(sk, h);
+      n+=sk->sizes[h];
+    }
+
+  /* Allocate the output arrays. */
+  v=*values=gal_pointer_allocate(GAL_TYPE_FLOAT64, n, 0, __func__,
+                                 "values");
+  cu=*cum=gal_pointer_allocate(GAL_TYPE_SIZE_T, n, 0, __func__, "cum");
+  pos=gal_pointer_allocate(GAL_TYPE_SIZE_T, sk->numlevels, 1, __func__,
+                           "pos");
+
+  /* Merge the levels: in each step, the smallest of the first remaining
+     elements of the levels is used (there are only a few levels). */
+  for(i=0;i<n;++i)
+    {
+      best=GAL_BLANK_SIZE_T;
+      for(j=0;j<sk->numlevels;++j)
+        if( pos[j]<sk->sizes[j]
+            && ( best==GAL_BLANK_SIZE_T
+                 || sk->levels[j][pos[j]] < sk->levels[best][pos[best]] ) )
+          best=j;
+      v[i]=sk->levels[best][pos[best]++];
+      c += (size_t)1<<best;
+      cu[i]=c;
+    }
+
+  /* Clean up and return. */
+  free(pos);
+  return n;
+}
+
+
+
+
+
+/* Return the values at the given quantiles (as a 'float64' dataset). The
+   index of each quantile is found like 'gal_statistics_quantile' (over
+   all the input elements), and the returned value is the element of the
+   sketch that stands for that index. */
+gal_data_t *
+gal_statistics_sketch_quantiles(struct gal_statistics_sketch *sk,
+                                double *quantiles, size_t numquantiles)
+{
+  gal_data_t *out;
+  double *o, *values;
+  size_t i, n, lo, hi, mid, index, *cum;
+
+  /* Allocate the output. */
+  out=gal_data_alloc(NULL, GAL_TYPE_FLOAT64, 1, &numquantiles, NULL, 0,
+                     -1, 1, NULL, NULL, NULL);
+  o=out->array;
+
+  /* If there are no elements, the output is blank. */
+  if(sk->number==0)
+    {
+      for(i=0;i<numquantiles;++i) o[i]=NAN;
+      return out;
+    }
+
+  /* Find the first value in the sketch whose cumulative number is larger
+     than the index of each quantile. */
+  n=statistics_sketch_cumulative(sk, &values, &cum);
+  for(i=0;i<numquantiles;++i)
+    {
+      /* The first and last elements are known exactly. */
+      index=gal_statistics_quantile_index(sk->number, quantiles[i]);
+      if(index==0)            { o[i]=sk->minimum; continue; }
+      if(index==sk->number-1) { o[i]=sk->maximum; continue; }
+
+      /* Find the element that stands for this index. */
+      lo=0;
+      hi=n-1;
+      while(lo<hi)
+        {
+          mid=lo+(hi-lo)/2;
+          if(cum[mid]>index) hi=mid; else lo=mid+1;
+        }
+      o[i]=values[lo];
+    }
+
+  /* Clean up and return. */
+  free(cum);
+  free(values);
+  return out;
+}
+
+
+
+
+
+/* Return the quantile of the given value (similar to
+   'gal_statistics_quantile_function'). The boundaries are also the same:
+   a value that is smaller than the minimum is below the range and a value
+   that is not smaller than the maximum is above it (unless it is also
+   the minimum: when all the inputs are equal, for example with a single
+   input). So there are always two or more inputs when the quantile is
+   calculated. */
+double
+gal_statistics_sketch_quantile_function(struct gal_statistics_sketch *sk,
+                                        double value)
+{
+  double *values, out;
+  size_t n, lo, hi, mid, index, *cum;
+
+  /* Values that are outside of the range of the inputs. */
+  if(sk->number==0 || isnan(value)) return NAN;
+  if(value<sk->minimum) return -INFINITY;
+  if(value>=sk->maximum) return value>sk->minimum ? INFINITY : -INFINITY;
+
+  /* Find the sketch values that are smaller or equal to 'value' ('lo' is
+     their number). Like the exact function, the index of the nearest
+     input on the two sides of 'value' is used: the last that is smaller
+     or equal to it, or the first that is larger. */
+  n=statistics_sketch_cumulative(sk, &values, &cum);
+  lo=0;
+  hi=n;
+  while(lo<hi)
+    {
+      mid=lo+(hi-lo)/2;
+      if(values[mid]>value) hi=mid; else lo=mid+1;
+    }
+  if(lo==0)      index=0;
+  else if(lo==n) index=cum[n-1]-1;
+  else index = ( value-values[lo-1] < values[lo]-value
+                 ? cum[lo-1]-1 : cum[lo-1] );
+  out = (double)index / ((double)(sk->number - 1));
+
+  /* Clean up and return. */
+  free(cum);
+  free(values);
+  return out;
+}
@@ -262,6 +262,199 @@ gal_threads_attr_barrier_init(pthread_attr_t *attr, pthread_barrier_t *b,
 
 
 
+/*******************************************************************/
+/************         Persistent pool of threads      **************/
+/*******************************************************************/
+/* Creating (and finishing) threads is expensive, and some programs (for
+   example NoiseChisel and Segment) call 'gal_threads_spin_off' many times
+   for each input. So the threads are not finished after each call: they
+   are kept in a process-wide pool and wait for the next task. Each task
+   is one call of the worker function (for one thread's list of
+   actions). All the tasks are kept in one queue (a linked list) that
+   all the threads of the pool take tasks from.
+
+   The thread that calls 'gal_threads_spin_off' doesn't just wait for its
+   tasks to finish: if any of its tasks are still in the queue (because
+   all the threads of the pool are busy), it will take it from the queue
+   and run it itself. Therefore nested calls (a worker that calls
+   'gal_threads_spin_off' itself) or simultaneous calls from different
+   threads can't cause a dead-lock, and in the worst case (for example
+   in a forked child process that doesn't have the pool's threads), the
+   tasks will be run serially.
+
+   Since the pool (not the worker) reports that a task is finished, the
+   barrier of each thread's parameters ('b') is 'NULL' (like the single
+   thread case). */
+struct threads_pool_task
+{
+  void                *(*worker)(void *); /* Function to run.          */
+  struct gal_threads_params       *prm;   /* Argument to 'worker'.     */
+  size_t                    *remaining;   /* Call's unfinished tasks.  */
+  struct threads_pool_task       *next;   /* Next task in the queue.   */
+};
+
+static struct
+{
+  pthread_mutex_t              mutex;  /* For all the elements below.  */
+  pthread_cond_t             newtask;  /* A task was added to queue.   */
+  pthread_cond_t            finished;  /* A task was finished.         */
+  struct threads_pool_task     *head;  /* First task in the queue.     */
+  struct threads_pool_task     *tail;  /* Last task in the queue.      */
+  size_t                  numthreads;  /* Number of threads in pool.   */
+} threads_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                   PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+
+
+
+
+/* Run the given task (which was already removed from the queue) and
+   announce that it has finished. Must be called when the pool's mutex
+   is locked (it will be locked when this function returns). */
+static void
+threads_pool_run(struct threads_pool_task *task)
+{
+  pthread_mutex_unlock(&threads_pool.mutex);
+  task->worker(task->prm);
+  pthread_mutex_lock(&threads_pool.mutex);
+  if( --*task->remaining == 0 )
+    pthread_cond_broadcast(&threads_pool.finished);
+}
+
+
+
+
+
+/* Function that the threads of the pool run: wait for a task, run it
+   and wait for the next. */
+static void *
+threads_pool_on_thread(void *in_prm)
+{
+  struct threads_pool_task *task;
+
+  pthread_mutex_lock(&threads_pool.mutex);
+  while(1)
+    {
+      /* Wait until there is a task in the queue. */
+      while(threads_pool.head==NULL)
+        pthread_cond_wait(&threads_pool.newtask, &threads_pool.mutex);
+
+      /* Take the task from the queue and run it. */
+      task=threads_pool.head;
+      threads_pool.head=task->next;
+      if(threads_pool.head==NULL) threads_pool.tail=NULL;
+      threads_pool_run(task);
+    }
+
+  /* Control should not reach here. */
+  pthread_mutex_unlock(&threads_pool.mutex);
+  return NULL;
+}
+
+
+
+
+
+/* Make sure the pool has at least 'numthreads' threads. Must be called
+   when the pool's mutex is locked. */
+static void
+threads_pool_grow(size_t numthreads)
+{
+  int err;
+  pthread_t t;
+  pthread_attr_t attr;
+
+  /* If the pool already has enough threads, there is nothing to do. */
+  if(threads_pool.numthreads>=numthreads) return;
+
+  /* Create the new threads (they are detached: they will never finish
+     and nothing needs to wait for them). */
+  err=pthread_attr_init(&attr);
+  if(err) error(EXIT_FAILURE, 0, "%s: thread attr not initialized",
+                __func__);
+  err=pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if(err) error(EXIT_FAILURE, 0, "%s: thread attr not detached", __func__);
+  for(; threads_pool.numthreads<numthreads; ++threads_pool.numthreads)
+    {
+      err=pthread_create(&t, &attr, threads_pool_on_thread, NULL);
+      if(err)
+        {
+          fprintf(stderr, "can't create thread %zu",
+                  threads_pool.numthreads);
+          exit(EXIT_FAILURE);
+        }
+    }
+  pthread_attr_destroy(&attr);
+}
+
+
+
+
+
+/* Run the 'numtasks' tasks on the pool's threads and return when all of
+   them have finished. */
+static void
+threads_pool_spin_off(struct threads_pool_task *tasks, size_t numtasks)
+{
+  size_t i, remaining=numtasks;
+  struct threads_pool_task *task, *prev;
+
+  /* Put the tasks in the queue. The calling thread will also run tasks,
+     so the pool only needs 'numtasks-1' threads. */
+  pthread_mutex_lock(&threads_pool.mutex);
+  for(i=0;i<numtasks;++i)
+    {
+      tasks[i].next=NULL;
+      tasks[i].remaining=&remaining;
+      if(threads_pool.tail) threads_pool.tail->next=&tasks[i];
+      else                  threads_pool.head=&tasks[i];
+      threads_pool.tail=&tasks[i];
+    }
+  threads_pool_grow(numtasks-1);
+  pthread_cond_broadcast(&threads_pool.newtask);
+
+  /* Until all the tasks of this call are finished, run any of them that
+     are still in the queue, or wait for another one to finish. */
+  while(remaining)
+    {
+      /* Find one of this call's tasks in the queue. */
+      for(prev=NULL, task=threads_pool.head; task!=NULL;
+          prev=task, task=task->next)
+        if(task->remaining==&remaining) break;
+
+      /* If one was found, remove it from the queue and run it. */
+      if(task)
+        {
+          if(prev) prev->next=task->next;
+          else     threads_pool.head=task->next;
+          if(threads_pool.tail==task) threads_pool.tail=prev;
+          threads_pool_run(task);
+        }
+      else
+        pthread_cond_wait(&threads_pool.finished, &threads_pool.mutex);
+    }
+  pthread_mutex_unlock(&threads_pool.mutex);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 /*******************************************************************/
 /************     Run a function on multiple threads  **************/
 /*******************************************************************/
@@ -339,13 +532,10 @@ gal_threads_spin_off(void *(*worker)(void *), void *caller_params,
                      size_t numactions, size_t numthreads,
                      size_t minmapsize, int quietmmap)
 {
-  int err;
-  pthread_t t;          /* All thread ids saved in this, not used. */
   char *mmapname=NULL;
-  pthread_attr_t attr;
-  pthread_barrier_t b;
   struct gal_threads_params *prm;
-  size_t i, *indexs, thrdcols, numbarriers;
+  struct threads_pool_task *tasks;
+  size_t i, *indexs, thrdcols, numtasks=0;
 
   /* If there are no actions, then just return. */
   if(numactions==0) return;
@@ -370,47 +560,48 @@ gal_threads_spin_off(void *(*worker)(void *), void *caller_params,
                                        quietmmap, &indexs, &thrdcols);
 
   /* Do the job: when only one thread is necessary, there is no need to
-     spin-off one thread, just call the workerfunction directly (spinning
-     off threads is expensive). This is for the generic thread spinner
-     function, not this simple function where 'numthreads' is a
-     constant. */
+     use the pool of threads, just call the worker function directly. */
   if(numthreads==1)
     {
       prm[0].id=0;
       prm[0].b=NULL;
+      prm[0].next=NULL;
       prm[0].indexs=indexs;
       prm[0].params=caller_params;
+      prm[0].numactions=numactions;
       worker(&prm[0]);
     }
   else
     {
-      /* Initialize the attributes. Note that this running thread
-         (that spins-off the nt threads) is also a thread, so the
-         number the barriers should be one more than the number of
-         threads spinned off. */
-      numbarriers = (numactions<numthreads ? numactions : numthreads) + 1;
-      gal_threads_attr_barrier_init(&attr, &b, numbarriers);
-
-      /* Spin-off the threads: */
+      /* Allocate the tasks. */
+      errno=0;
+      tasks=malloc(numthreads*sizeof *tasks);
+      if(tasks==NULL)
+        {
+          fprintf(stderr, "%zu bytes could not be allocated for tasks.",
+                  numthreads*sizeof *tasks);
+          exit(EXIT_FAILURE);
+        }
+
+      /* Set the parameters of each task (the threads that don't have
+         any actions aren't necessary). */
       for(i=0;i<numthreads;++i)
         if(indexs[i*thrdcols]!=GAL_BLANK_SIZE_T)
           {
             prm[i].id=i;
-            prm[i].b=&b;
+            prm[i].b=NULL;
+            prm[i].next=NULL;
             prm[i].params=caller_params;
+            prm[i].numactions=numactions;
             prm[i].indexs=&indexs[i*thrdcols];
-            err=pthread_create(&t, &attr, worker, &prm[i]);
-            if(err)
-              {
-                fprintf(stderr, "can't create thread %zu", i);
-                exit(EXIT_FAILURE);
-              }
+            tasks[numtasks].prm=&prm[i];
+            tasks[numtasks++].worker=worker;
           }
 
-      /* Wait for all threads to finish and free the spaces. */
-      pthread_barrier_wait(&b);
-      pthread_attr_destroy(&attr);
-      pthread_barrier_destroy(&b);
+      /* Run the tasks on the pool of threads (this returns when all the
+         tasks are finished). */
+      threads_pool_spin_off(tasks, numtasks);
+      free(tasks);
     }
 
   /* If 'mmapname' is NULL, then 'indexs' is in RAM and we can safely
@@ -423,3 +614,126 @@ gal_threads_spin_off(void *(*worker)(void *), void *caller_params,
   /* Clean up. */
   free(prm);
 }
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*******************************************************************/
+/************            Dynamic scheduling           **************/
+/*******************************************************************/
+/* When the processing time of each action is very different (for
+   example objects of very different sizes), the static distribution of
+   the actions between the threads (in 'gal_threads_spin_off') can make
+   one thread finish much later than the rest. With this function, the
+   actions are not distributed before starting: each thread takes the
+   next un-processed action (using a shared counter) when it finishes
+   its previous one. The worker function should get its actions with
+   'gal_threads_next_action' (for example with the loop below), so it
+   can be used with both this function and 'gal_threads_spin_off'.
+
+     for(i=0; (ind=gal_threads_next_action(tprm, i))!=GAL_BLANK_SIZE_T;
+         ++i)
+       { ... }
+*/
+void
+gal_threads_spin_off_dynamic(void *(*worker)(void *), void *caller_params,
+                             size_t numactions, size_t numthreads)
+{
+  size_t i, next=0;
+  struct gal_threads_params *prm;
+  struct threads_pool_task *tasks;
+
+  /* If there are no actions, then just return. */
+  if(numactions==0) return;
+
+  /* Sanity check. */
+  if(numthreads==0)
+    error(EXIT_FAILURE, 0, "%s: the number of threads ('numthreads') "
+          "cannot be zero", __func__);
+
+  /* More threads than actions are not necessary. */
+  if(numthreads>numactions) numthreads=numactions;
+
+  /* Allocate the parameters and tasks. */
+  errno=0;
+  prm=malloc(numthreads*sizeof *prm);
+  tasks=malloc(numthreads*sizeof *tasks);
+  if(prm==NULL || tasks==NULL)
+    {
+      fprintf(stderr, "%zu bytes could not be allocated for prm and "
+              "tasks.", numthreads*(sizeof *prm + sizeof *tasks));
+      exit(EXIT_FAILURE);
+    }
+
+  /* Set the parameters of each thread: all of them share the same
+     counter. */
+  for(i=0;i<numthreads;++i)
+    {
+      prm[i].id=i;
+      prm[i].b=NULL;
+      prm[i].next=&next;
+      prm[i].indexs=NULL;
+      prm[i].params=caller_params;
+      prm[i].numactions=numactions;
+      tasks[i].prm=&prm[i];
+      tasks[i].worker=worker;
+    }
+
+  /* Do the job (see 'gal_threads_spin_off'). */
+  if(numthreads==1) worker(&prm[0]);
+  else              threads_pool_spin_off(tasks, numthreads);
+
+  /* Clean up. */
+  free(tasks);
+  free(prm);
+}
+
+
+
+
+
+/* Return the index of the next action that the worker should do (or
+   'GAL_BLANK_SIZE_T' when there are no more actions). 'i' is the number
+   of actions that this thread has already done. It is only used when
+   the actions were distributed statically (by 'gal_threads_spin_off'),
+   when the worker was called by 'gal_threads_spin_off_dynamic', the
+   shared counter is incremented. */
+#ifndef __ATOMIC_RELAXED
+static pthread_mutex_t threads_next_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+size_t
+gal_threads_next_action(struct gal_threads_params *tprm, size_t i)
+{
+  size_t n;
+
+  /* Static distribution. */
+  if(tprm->next==NULL) return tprm->indexs[i];
+
+  /* Dynamic: when the compiler has atomic operations, they are used,
+     otherwise a mutex is necessary. */
+#ifdef __ATOMIC_RELAXED
+  n=__atomic_fetch_add(tprm->next, 1, __ATOMIC_RELAXED);
+#else
+  pthread_mutex_lock(&threads_next_mutex);
+  n=(*tprm->next)++;
+  pthread_mutex_unlock(&threads_next_mutex);
+#endif
+  return n<tprm->numactions ? n : GAL_BLANK_SIZE_T;
+}
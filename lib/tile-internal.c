@@ -341,11 +341,9 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
   uint8_t *b, *bf, *bb;
   gal_list_void_t *tvll;
   size_t ngb_counter, pind;
-  gal_list_dosizet_t *lQ, *sQ;
   gal_data_t *tin, *tnear, *nearest=NULL;
   float dist, pdist, *tnarr, *marr=prm->measure->array;
-  size_t i, index, fullind, chstart=0, ndim=input->ndim;
-  size_t size = (correct_index ? tl->tottilesinch : input->size);
+  size_t i, j, index, fullind, chstart=0, ndim=input->ndim;
   size_t *dsize = (correct_index ? tl->numtilesinch : input->dsize);
   size_t *icoord=gal_pointer_allocate(GAL_TYPE_SIZE_T, ndim, 0, __func__,
                                       "icoord");
@@ -355,6 +353,7 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
 
   /* Based on the above. */
   size_t *dinc=gal_dimension_increment(ndim, dsize);
+  gal_list_hsizet_t *queue=gal_list_hsizet_alloc(4*prm->numneighbors);
 
   /* Initialize the flags array. We need two flags during this processing:
      1) to see if there are blanks. 2) to see if a neighbor has been
@@ -420,25 +419,21 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
         }
 
 
-      /* Reset all checked bits in the flags array to 0. */
+      /* No neighbors have been found for this element yet. */
       ngb_counter=0;
-      bf=(b=flag)+size;
-      do *b &= ~(TILEINTERNAL_OUTLIER_FLAGS_NGB_CHECKED); while(++b<bf);
 
 
       /* Get the coordinates of this pixel (to be interpolated). */
       gal_dimension_index_to_coord(index, ndim, dsize, icoord);
 
 
-      /* Start parsing the neighbors. We will use a two-way ordered linked
-         list structure. To start from the nearest and go out to the
-         farthest. */
-      lQ=sQ=NULL;
-      gal_list_dosizet_add(&lQ, &sQ, index, 0.0f);
-      while(sQ)
+      /* Start parsing the neighbors. We will use a priority queue (heap)
+         to start from the nearest and go out to the farthest. */
+      gal_list_hsizet_add(queue, index, 0.0f);
+      while(queue->size)
         {
           /* Pop-out (p) an index from the queue: */
-          pind=gal_list_dosizet_pop_smallest(&lQ, &sQ, &pdist);
+          pind=gal_list_hsizet_pop_smallest(queue, &pdist);
 
           /* If this isn't a blank value then add its values to the list of
              neighbor values. Note that we didn't check whether the values
@@ -456,13 +451,8 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
                   tin=tin->next;
                 }
 
-              /* If we have filled all the elements clean up the linked
-                 list and break out. */
-              if(++ngb_counter>=prm->numneighbors)
-                {
-                  if(lQ) gal_list_dosizet_free(lQ);
-                  break;
-                }
+              /* If we have filled all the elements, break out. */
+              if(++ngb_counter>=prm->numneighbors) break;
             }
 
           /* Go over all the neighbors of this popped pixel and add them to
@@ -482,7 +472,7 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
                  dist=prm->metric(icoord, ncoord, ndim);
 
                  /* Add this neighbor to the list. */
-                 gal_list_dosizet_add(&lQ, &sQ, nind, dist);
+                 gal_list_hsizet_add(queue, nind, dist);
 
                  /* Flag this neighbor as checked. */
                  flag[nind] |= TILEINTERNAL_OUTLIER_FLAGS_NGB_CHECKED;
@@ -493,13 +483,20 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
              shows, there were not enough points for
              interpolation. Normally, this loop should only be exited
              through the 'currentnum>=numnearest' check above. */
-          if(sQ==NULL)
+          if(queue->size==0)
             error(EXIT_FAILURE, 0, "%s: only %zu neighbors found while "
                   "you had asked to use %zu neighbors for outlier "
                   "rejection (value to '%s')", __func__, ngb_counter,
                   prm->numneighbors, prm->optionname);
         }
 
+      /* Reset the checked flags of all the elements that were added to
+         the queue (the only ones that were checked), and empty the queue
+         for the next element. */
+      for(j=0;j<queue->added;++j)
+        flag[ queue->v[j] ] &= ~(TILEINTERNAL_OUTLIER_FLAGS_NGB_CHECKED);
+      gal_list_hsizet_empty(queue);
+
       /* Calculate the desired statistic, and write it in the output. */
       for(tnear=nearest; tnear!=NULL; tnear=tnear->next)
         {
@@ -515,7 +512,7 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
              maximium and the value that is just after the minimum. We are
              doing this because the scatter in the minimum can be large. */
           tnarr=tnear->array;
-          gal_statistics_sort_increasing(tnear);
+          gal_statistics_sort_increasing(tnear, 1);
           marr[fullind] = tnarr[tnear->size-1]-tnarr[1];
         }
     }
@@ -524,6 +521,7 @@ gal_tileinternal_no_outlier_local_on_thread(void *in_prm)
   /* Clean up. */
   for(tnear=nearest; tnear!=NULL; tnear=tnear->next) tnear->array=NULL;
   gal_list_data_free(nearest);
+  gal_list_hsizet_free(queue);
   free(icoord);
   free(ncoord);
   free(dinc);
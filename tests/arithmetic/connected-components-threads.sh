@@ -0,0 +1,92 @@
+# Find the connected components of a large random image on threads.
+#
+# Large inputs are labeled in strips (one for each thread) and the labels
+# that touch across the strip boundaries are then merged. So the labels
+# should not depend on the number of threads. The random binary images
+# (with blank pixels) are large enough to be divided into four strips.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=arithmetic
+execname=../bin/$prog/ast$prog
+fitsprog=$progbdir/astfits
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname ]; then echo "$execname not created."; exit 77; fi
+if [ ! -f $fitsprog ]; then echo "$fitsprog not created."; exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+#
+# The binary images are one where the random values are above 0.3 (so
+# with connectivity 1 there are many small components and with a larger
+# connectivity most of them are merged into large ones). The elements
+# where the random values are above 2.5 are blank.
+for dims in "1000 1000 2" "100 100 100 3"; do
+
+    # Build the binary image.
+    ndim=$(echo $dims | $AWK '{print $NF}')
+    img=connected-components-threads-$ndim.fits
+    $execname $dims makenew 1 mknoise-sigma set-n \
+              n 0.3 gt n 2.5 gt nan where --output=$img || exit 1
+
+    # Label it with all the connectivities on 1 and 4 threads.
+    conn=1
+    while [ $conn -le $ndim ]; do
+        for nt in 1 4; do
+            $check_with_program $execname $img $conn connected-components \
+                                --numthreads=$nt \
+                                --output=connected-components-$nt.fits \
+                || exit 1
+        done
+        s1=$($fitsprog connected-components-1.fits -h1 --datasum)
+        s4=$($fitsprog connected-components-4.fits -h1 --datasum)
+        echo "$ndim dimensions, connectivity $conn: $s1 $s4"
+        if [ "x$s1" = x ] || [ "x$s1" != "x$s4" ]; then
+            echo "Labels are different with 4 threads."; exit 1
+        fi
+        conn=$((conn+1))
+    done
+done
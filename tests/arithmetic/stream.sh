@@ -0,0 +1,69 @@
+# Process an image in blocks with '--stream' and check that the result is
+# identical to processing the whole image at once.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=arithmetic
+execname=../bin/$prog/ast$prog
+img=convolve_spatial_noised.fits
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname ]; then echo "$execname not created."; exit 77; fi
+if [ ! -f $img      ]; then echo "$img does not exist.";   exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+#
+# The block size is deliberately small (and not a multiple of the image
+# width), so the image is read and written in many blocks.
+$check_with_program $execname $img 2 x 10 + abs sqrt $img + -g1 \
+                    --stream=1000 --output=stream.fits
+$check_with_program $execname $img 2 x 10 + abs sqrt $img + -g1 \
+                    --output=stream-not.fits
+
+# The two outputs should be identical.
+diff=$($execname stream.fits stream-not.fits - abs maxvalue -g1 -q)
+echo "Maximum absolute difference: $diff"
+echo "$diff" | $AWK '{exit ($1==0 ? 0 : 1)}'
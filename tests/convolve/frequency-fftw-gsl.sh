@@ -0,0 +1,86 @@
+# Compare frequency-domain convolution with FFTW and with GSL.
+#
+# When Gnuastro is built with FFTW, frequency-domain convolution is done
+# with FFTW's single-precision transforms. The intermediate steps (with
+# '--checkfreqsteps') are only available with the GSL-based
+# implementation, so in that case the output is made with GSL. The two
+# outputs should be identical within single-precision floating point
+# errors.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+psf=psf.fits
+prog=convolve
+img=mkprofcat1.fits
+execname=../bin/$prog/ast$prog
+arithname=$progbdir/astarithmetic
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are three
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed),
+#
+#   - FFTW wasn't found at configure time (so both outputs would be made
+#     with GSL).
+if [ ! -f $execname  ]; then echo "$execname not created.";  exit 77; fi
+if [ ! -f $arithname ]; then echo "$arithname not created."; exit 77; fi
+if [ ! -f $img       ]; then echo "$img does not exist.";    exit 77; fi
+if [ ! -f $psf       ]; then echo "$psf does not exist.";    exit 77; fi
+if [ "x$hasfftw" != "xyes" ]; then echo "FFTW not present.";  exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+$check_with_program $execname $img --kernel=$psf --domain=frequency \
+                              --output=convolve_frequency_fftw.fits
+$check_with_program $execname $img --kernel=$psf --domain=frequency \
+                              --checkfreqsteps \
+                              --output=convolve_frequency_gsl.fits
+
+# The maximum absolute difference should be less than 1e-5 times the
+# maximum absolute value of the output (single precision floating point
+# has roughly 7 significant digits, but the errors of the transforms
+# accumulate).
+diff=$($arithname convolve_frequency_fftw.fits convolve_frequency_gsl.fits \
+                  - abs maxvalue -g1 -q)
+max=$($arithname convolve_frequency_gsl.fits abs maxvalue -h1 -q)
+echo "Maximum absolute difference: $diff (maximum absolute value: $max)"
+echo "$diff $max" | $AWK '{exit ($1<=1e-5*$2 ? 0 : 1)}'
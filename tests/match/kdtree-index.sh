@@ -0,0 +1,98 @@
+# Match with a memory-mapped k-d tree index of the first catalog.
+#
+# The first catalog is converted to FITS (the index is tied to the
+# DATASUM of its HDU), its index is built and then used for the match.
+# The output should be identical to the output of matching with a k-d
+# tree in a FITS file (from 'kdtree-separate.sh'). The index should not
+# be usable with other coordinate columns of the same catalog.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=match
+execname=../bin/$prog/ast$prog
+tableprog=$progbdir/asttable
+cat1=$topsrc/tests/$prog/positions-1.txt
+cat2=$topsrc/tests/$prog/positions-2.txt
+separate=match-kdtree-separate.fits
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname  ]; then echo "$execname not created.";   exit 77; fi
+if [ ! -f $tableprog ]; then echo "$tableprog not created.";  exit 77; fi
+if [ ! -f $separate  ]; then echo "$separate does not exist."; exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+$tableprog $cat1 --output=match-positions-1.fits
+$check_with_program $execname match-positions-1.fits --ccol1=2,3 \
+                              --kdtree=build-index \
+                              --output=match-kdtree.kdidx
+$check_with_program $execname match-positions-1.fits $cat2 --ccol1=2,3 \
+                              --ccol2=2,3 --aperture=0.5 \
+                              --kdtree=match-kdtree.kdidx \
+                              --output=match-kdtree-index.fits
+
+# Both matched tables should be identical to those of the match with the
+# k-d tree in a FITS file. The values are printed in the same format, so
+# the comparison doesn't depend on the display format of the columns
+# (which is kept in the FITS version of the first catalog).
+for hdu in 1 2; do
+    $tableprog match-kdtree-index.fits --hdu=$hdu \
+        | $AWK '{for(i=1;i<=NF;++i) printf "%.15g ", $i; print ""}' \
+        > match-index.txt
+    $tableprog $separate --hdu=$hdu \
+        | $AWK '{for(i=1;i<=NF;++i) printf "%.15g ", $i; print ""}' \
+        > match-separate.txt
+    if ! cmp match-index.txt match-separate.txt; then
+        echo "Table in HDU $hdu is different."; exit 1
+    fi
+done
+
+# The index was built on columns 2 and 3, so it shouldn't be used with
+# the coordinates in another order (the match should fail).
+if $execname match-positions-1.fits $cat2 --ccol1=3,2 --ccol2=2,3 \
+             --aperture=0.5 --kdtree=match-kdtree.kdidx \
+             --output=match-kdtree-index-wrong.fits; then
+    echo "Index was used with other coordinate columns."; exit 1
+fi
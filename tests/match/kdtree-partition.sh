@@ -0,0 +1,120 @@
+# Match in partitions (a grid of cells) and compare with the k-d tree.
+#
+# The first match is on the same catalogs as 'kdtree-internal.sh'. They
+# are small and thus only have a single cell. For the second, a first
+# catalog is made that is large enough to be divided into 2x2 cells and
+# many points of the second catalog are placed around the cell borders
+# (where their nearest neighbour can be in another cell). In both cases,
+# the matches should be identical to the k-d tree matches.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=match
+execname=../bin/$prog/ast$prog
+tableprog=$progbdir/asttable
+cat1=$topsrc/tests/$prog/positions-1.txt
+cat2=$topsrc/tests/$prog/positions-2.txt
+internal=match-kdtree-internal.fits
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname  ]; then echo "$execname not created.";   exit 77; fi
+if [ ! -f $tableprog ]; then echo "$tableprog not created.";  exit 77; fi
+if [ ! -f $internal  ]; then echo "$internal does not exist."; exit 77; fi
+
+
+
+
+
+# Small catalogs (single cell)
+# ============================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+$check_with_program $execname $cat1 $cat2 --aperture=0.5 \
+                              --ccol1=2,3 --ccol2=2,3 --kdtree=partition \
+                              --output=match-kdtree-partition.fits
+for hdu in 1 2; do
+    $tableprog match-kdtree-partition.fits --hdu=$hdu \
+               > match-partition.txt
+    $tableprog $internal --hdu=$hdu > match-internal.txt
+    if ! cmp match-partition.txt match-internal.txt; then
+        echo "Table in HDU $hdu is different."; exit 1
+    fi
+done
+
+
+
+
+
+# Points around cell borders
+# ==========================
+#
+# The first catalog is a 230x230 grid of points with integer coordinates.
+# With roughly 50000 first catalog points in each cell, the grid of cells
+# is 2x2 and the cell borders are near 159.6 on both axes. The second
+# catalog has random points over the full grid and in a strip of width 5
+# around the cell borders on each axis. The first column of both is the
+# row number.
+grid=match-partition-grid.txt
+rand=match-partition-rand.txt
+$AWK 'BEGIN{for(i=0;i<230;++i) for(j=0;j<230;++j)
+              printf "%d %d %d\n", i*230+j+1, i, j}' > $grid
+$AWK 'BEGIN{srand(1);
+            for(i=1;i<=4000;++i)
+              printf "%d %.6f %.6f\n", i, 229*rand(), 229*rand();
+            for(i=4001;i<=6000;++i)
+              printf "%d %.6f %.6f\n", i, 157+5*rand(), 229*rand();
+            for(i=6001;i<=8000;++i)
+              printf "%d %.6f %.6f\n", i, 229*rand(), 157+5*rand()}' \
+     > $rand
+
+# Match with the internal k-d tree and in partitions and compare the
+# matched rows (written as 'ROW2-ROW1' and sorted).
+for method in internal partition; do
+    $check_with_program $execname $grid $rand --aperture=0.5 \
+                                  --ccol1=2,3 --ccol2=2,3 \
+                                  --kdtree=$method --outcols=b1,a1 \
+                                  --output=match-border-$method.txt \
+        || exit 1
+    $AWK '!/^#/{printf "%d-%d\n", $1, $2}' match-border-$method.txt \
+         | sort > match-border-$method-rows.txt
+done
+nmatch=$(cat match-border-internal-rows.txt | wc -l)
+echo "Number of matches: $nmatch"
+if [ $nmatch = 0 ]; then echo "No matches found."; exit 1; fi
+cmp match-border-internal-rows.txt match-border-partition-rows.txt
@@ -0,0 +1,73 @@
+# Find all the rows of the first catalog that are within an aperture
+# around each row of the second with the k-d tree.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=match
+execname=../bin/$prog/ast$prog
+cat1=$topsrc/tests/$prog/positions-1.txt
+cat2=$topsrc/tests/$prog/positions-2.txt
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname ]; then echo "$execname not created."; exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+$check_with_program $execname $cat1 $cat2 --ccol1=2,3 --ccol2=2,3 \
+                              --range --aperture=1.6 --outcols=b1,a1 \
+                              --output=match-range.txt
+
+# Each row of the second catalog should be matched with all the rows of
+# the first catalog that are within the aperture (the second row has no
+# neighbour within it). Some rows of the first catalog are neighbours of
+# more than one row of the second, so they should be repeated in the
+# output. Each output row is written as 'ROW2-ROW1' and they are sorted,
+# so the order of neighbours with equal distances doesn't matter.
+expected="1-7 1-8 1-9 3-4 3-5 3-6 4-4 4-5 4-6 5-1 6-5 6-6 6-7 7-1 7-2"
+result=$($AWK '!/^#/{printf "%d-%d\n", $1, $2}' match-range.txt \
+              | sort -t- -k1,1n -k2,2n | tr '\n' ' ' | sed -e's/ $//')
+echo "Expected: $expected"
+echo "Result:   $result"
+[ "x$result" = "x$expected" ]
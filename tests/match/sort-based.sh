@@ -25,6 +25,7 @@
 # file exists (basicchecks.sh is in the source tree).
 prog=match
 execname=../bin/$prog/ast$prog
+tableprog=$progbdir/asttable
 cat1=$topsrc/tests/$prog/positions-1.txt
 cat2=$topsrc/tests/$prog/positions-2.txt
 
@@ -42,7 +43,8 @@ cat2=$topsrc/tests/$prog/positions-2.txt
 #
 #   - The input data was not made (for example the test that created the
 #     data file failed).
-if [ ! -f $execname ]; then echo "$execname not created."; exit 77; fi
+if [ ! -f $execname  ]; then echo "$execname not created.";  exit 77; fi
+if [ ! -f $tableprog ]; then echo "$tableprog not created."; exit 77; fi
 
 
 
@@ -56,4 +58,52 @@ if [ ! -f $execname ]; then echo "$execname not created."; exit 77; fi
 # debugging when the developer doesn't have access to the user's system.
 $check_with_program $execname $cat1 $cat2 --aperture=0.5  \
                               --ccol1=2,3 --ccol2=2,3 --kdtree=disable \
-                              --output=match-sort-based.fits
+                              --numthreads=1 --output=match-sort-based.fits \
+    || exit 1
+
+# The sort and the search are done in parallel on multiple threads, but
+# the output should not depend on the number of threads.
+$check_with_program $execname $cat1 $cat2 --aperture=0.5  \
+                              --ccol1=2,3 --ccol2=2,3 --kdtree=disable \
+                              --numthreads=4 \
+                              --output=match-sort-based-threads.fits \
+    || exit 1
+for hdu in 1 2; do
+    $tableprog match-sort-based.fits --hdu=$hdu > match-sort-based.txt
+    $tableprog match-sort-based-threads.fits --hdu=$hdu \
+               > match-sort-based-threads.txt
+    if ! cmp match-sort-based.txt match-sort-based-threads.txt; then
+        echo "Table in HDU $hdu is different with 4 threads."; exit 1
+    fi
+done
+
+# The catalogs above are too small to be searched in more than one chunk
+# (each chunk has at least 1000 rows of the first catalog). So the same
+# comparison is done on two larger random catalogs. The first coordinate
+# is rounded, so many rows have the same value around the chunk borders.
+$AWK 'BEGIN{ srand(1);
+             for(i=1;i<=5000;++i)
+               printf "%d %.1f %.4f\n", i, 100*rand(), 100*rand() }' \
+     > match-sort-based-large-1.txt
+$AWK 'BEGIN{ srand(2);
+             for(i=1;i<=3000;++i)
+               printf "%d %.4f %.4f\n", i, 100*rand(), 100*rand() }' \
+     > match-sort-based-large-2.txt
+for nt in 1 4; do
+    $check_with_program $execname match-sort-based-large-1.txt \
+                        match-sort-based-large-2.txt --aperture=0.5 \
+                        --ccol1=2,3 --ccol2=2,3 --kdtree=disable \
+                        --numthreads=$nt \
+                        --output=match-sort-based-large-nt$nt.fits \
+        || exit 1
+done
+for hdu in 1 2; do
+    $tableprog match-sort-based-large-nt1.fits --hdu=$hdu \
+               > match-sort-based.txt
+    $tableprog match-sort-based-large-nt4.fits --hdu=$hdu \
+               > match-sort-based-threads.txt
+    if ! [ -s match-sort-based.txt ] \
+            || ! cmp match-sort-based.txt match-sort-based-threads.txt; then
+        echo "Large table in HDU $hdu is different with 4 threads."; exit 1
+    fi
+done
@@ -0,0 +1,101 @@
+# Sigma-clipping and MAD-clipping on boundary cases.
+#
+# The clipping results are compared with their analytic values in three
+# cases: very large outliers (where the sums over the remaining elements
+# are much smaller than the clipped ones), a constant input (where the
+# standard deviation and MAD are zero) and only two elements. The
+# results are single precision floating points, so they are compared
+# within its precision.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=statistics
+execname=../bin/$prog/ast$prog
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname ]; then echo "$execname not created."; exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# Each case is given the input values (one per line on the standard
+# input) and the expected number, median, mean, standard deviation and
+# MAD (in this order) after clipping. The clipping type ('sig' or 'mad')
+# is the first argument and its parameters are the second. The
+# difference of each value with the expected value should be less than
+# 1e-6 of the expected value (the output is printed with 7 significant
+# digits).
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+check () {
+    if [ $1 = sig ]; then params=--sclipparams=$2
+    else                  params=--mclipparams=$2
+    fi
+    result=$($check_with_program $execname $params --$1clip-number \
+                  --$1clip-median --$1clip-mean --$1clip-std --$1clip-mad)
+    echo "$1-clipping ($2): expected '$3', result '$result'"
+    echo "$3 $result" \
+        | $AWK '{ if(NF!=10) exit 1;
+                  for(i=1;i<=5;++i)
+                    { d = $i - $(i+5);   d = d<0 ? -d : d;
+                      e = $i<0 ? -$i : $i;
+                      if(d > 1e-6*e) exit 1 } }'
+}
+
+# The integers 1 to 20 with two outliers at +1e12 and -1e12: the
+# outliers are clipped in the first round and the standard deviation of
+# the rest is sqrt(399/12).
+outliers () { $AWK 'BEGIN{for(i=1;i<=20;++i) print i;
+                          print 1e12; print -1e12}'; }
+outliers | check sig 3,0.1 "20 10.5 10.5 5.766281297 5" || exit 1
+outliers | check mad 3,0.1 "20 10.5 10.5 5.766281297 5" || exit 1
+outliers | check sig 3,5   "20 10.5 10.5 5.766281297 5" || exit 1
+
+# A constant input: nothing should be clipped.
+constant () { $AWK 'BEGIN{for(i=1;i<=10;++i) print 42}'; }
+constant | check sig 3,0.1 "10 42 42 0 0" || exit 1
+constant | check mad 3,0.1 "10 42 42 0 0" || exit 1
+
+# Only two elements.
+printf "3\n7\n" | check sig 3,0.1 "2 5 5 2 2" || exit 1
+printf "3\n7\n" | check mad 3,0.1 "2 5 5 2 2"
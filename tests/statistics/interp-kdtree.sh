@@ -0,0 +1,100 @@
+# Interpolate blank tiles with and without '--interpkdtree'.
+#
+# The k-d tree and the default methods of finding the nearest neighbors
+# can only choose different neighbors when several are at exactly the same
+# distance on the last (furthest) neighbor. So here the blank tiles are
+# isolated (far from each other and the edges) and the number of neighbors
+# covers the full ring(s) of tiles around them. The interpolated values
+# should then be identical.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=statistics
+execname=../bin/$prog/ast$prog
+fitsprog=$progbdir/astfits
+converttprog=$progbdir/astconvertt
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname     ]; then echo "$execname not created.";     exit 77; fi
+if [ ! -f $fitsprog     ]; then echo "$fitsprog not created.";     exit 77; fi
+if [ ! -f $converttprog ]; then echo "$converttprog not created."; exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+#
+# A 60x60 image (12x12 tiles of 5x5 pixels) with a non-symmetric
+# gradient, so different neighbors give different medians. The pixels of
+# six tiles (at least three tiles from each other and two from the edges)
+# are blank.
+img=interp-kdtree.fits
+$AWK 'BEGIN{ blank["2 2"]=blank["2 6"]=blank["6 3"]=1;
+             blank["6 8"]=blank["9 5"]=blank["9 9"]=1;
+             for(y=0;y<60;++y)
+               { for(x=0;x<60;++x)
+                   { t=int(x/5) " " int(y/5);
+                     printf "%s ", ( t in blank ? "nan" \
+                                     : x*3.1 + y*y*0.07 + (x*y)%17 ) }
+                 printf "\n" } }' > interp-kdtree.txt
+$converttprog interp-kdtree.txt --output=$img || exit 1
+
+# With the radial metric, the 4 and 8 nearest neighbors are the tiles
+# sharing a side and all the tiles touching the blank tile. With the
+# Manhattan metric, the 4 and 12 nearest neighbors are those within a
+# distance of 1 and 2.
+for ngb in radial,4 radial,8 manhattan,4 manhattan,12; do
+    metric=$(echo $ngb | $AWK -F, '{print $1}')
+    numngb=$(echo $ngb | $AWK -F, '{print $2}')
+    opts="--ontile --median --tilesize=5,5 --numchannels=1,1 --interpolate"
+    opts="$opts --interponlyblank --interpmetric=$metric"
+    opts="$opts --interpnumngb=$numngb"
+    $check_with_program $execname $img $opts \
+                        --output=interp-default.fits || exit 1
+    $check_with_program $execname $img $opts --interpkdtree \
+                        --output=interp-kdtree-out.fits || exit 1
+    sdef=$($fitsprog interp-default.fits    -h1 --datasum)
+    skdt=$($fitsprog interp-kdtree-out.fits -h1 --datasum)
+    echo "$metric ($numngb neighbors): $sdef $skdt"
+    if [ "x$sdef" = x ] || [ "x$sdef" != "x$skdt" ]; then exit 1; fi
+done
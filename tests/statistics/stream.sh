@@ -0,0 +1,143 @@
+# Compare Statistics' streamed measurements with the non-streamed ones.
+#
+# With '--stream', the image is read in blocks. The histogram (with and
+# without a manual bin range), number of elements, mean and standard
+# deviation should be identical to the non-streamed results (within the
+# precision of the printed values). The quantiles come from a sketch of
+# the distribution: each should be between the exact quantiles that are
+# the reported maximum error below and above it. At the boundaries, the
+# quantile function should be identical to the exact one.
+#
+# See the Tests subsection of the manual for a complete explanation
+# (in the Installing gnuastro section).
+#
+# Original author:
+#     Mohammad Akhlaghi <mohammad@akhlaghi.org>
+# Contributing author(s):
+# Copyright (C) 2024 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+
+
+
+# Preliminaries
+# =============
+#
+# Set the variables (The executable is in the build tree). Do the
+# basic checks to see if the executable is made or if the defaults
+# file exists (basicchecks.sh is in the source tree).
+prog=statistics
+execname=../bin/$prog/ast$prog
+arithprog=$progbdir/astarithmetic
+img=convolve_spatial_scaled_noised.fits
+
+
+
+
+
+# Skip?
+# =====
+#
+# If the dependencies of the test don't exist, then skip it. There are two
+# types of dependencies:
+#
+#   - The executable was not made (for example due to a configure option),
+#
+#   - The input data was not made (for example the test that created the
+#     data file failed).
+if [ ! -f $execname  ]; then echo "$execname not created.";  exit 77; fi
+if [ ! -f $arithprog ]; then echo "$arithprog not created."; exit 77; fi
+if [ ! -f $img       ]; then echo "$img does not exist.";    exit 77; fi
+
+
+
+
+
+# Actual test script
+# ==================
+#
+# 'check_with_program' can be something like Valgrind or an empty
+# string. Such programs will execute the command if present and help in
+# debugging when the developer doesn't have access to the user's system.
+#
+# The histograms (with the bin range from the data, which needs a second
+# pass in streaming mode, and with a manual bin range) should be
+# identical.
+for range in "" "-g9500 -l11000 --manualbinrange"; do
+    $check_with_program $execname $img $range --histogram --numbins=50 \
+                        --stream=1000 --output=stream-hist.txt || exit 1
+    $check_with_program $execname $img $range --histogram --numbins=50 \
+                        --output=stream-hist-not.txt || exit 1
+    if ! cmp stream-hist.txt stream-hist-not.txt; then
+        echo "Histograms (range: '$range') are different."; exit 1
+    fi
+done
+
+# The number, mean and standard deviation are exact in streaming mode.
+exact=$($execname $img --number --mean --std)
+streamed=$($check_with_program $execname $img --number --mean --std \
+                               --stream=1000 --quiet)
+echo "Exact:    $exact"
+echo "Streamed: $streamed"
+echo "$exact $streamed" \
+    | $AWK '{ if(NF!=6) exit 1;
+              for(i=1;i<=3;++i)
+                { d = $i - $(i+3);   d = d<0 ? -d : d;
+                  e = $i<0 ? -$i : $i;
+                  if(d > 1e-6*e) exit 1 } }' || exit 1
+
+# The streamed quantiles (the maximum error is printed on standard error).
+quants="0.1,0.25,0.5,0.75,0.9"
+streamed=$($check_with_program $execname $img --quantile=$quants \
+                               --stream=1000 2> stream-error.txt)
+err=$(sed -n -e's/.*maximum error of \([^ ]*\) in.*/\1/p' stream-error.txt)
+n=$(echo "$exact" | $AWK '{print $1}')
+echo "Streamed quantiles: $streamed (maximum error: $err)"
+if [ "x$err" = x ]; then echo "Maximum error not reported."; exit 1; fi
+
+# Exact quantiles at the maximum error below and above each quantile
+# (two elements are added to the error to account for the rounding of
+# the quantile to an element).
+qlo=$(echo $quants | $AWK -F, -vn=$n -ve=$err \
+           '{for(i=1;i<=NF;++i) { q=$i-e-2/n; if(q<0) q=0;
+                                  printf "%s%g", (i>1 ? "," : ""), q }}')
+qhi=$(echo $quants | $AWK -F, -vn=$n -ve=$err \
+           '{for(i=1;i<=NF;++i) { q=$i+e+2/n; if(q>1) q=1;
+                                  printf "%s%g", (i>1 ? "," : ""), q }}')
+lo=$($execname $img --quantile=$qlo)
+hi=$($execname $img --quantile=$qhi)
+echo "Exact quantiles below: $lo"
+echo "Exact quantiles above: $hi"
+echo "$lo $streamed $hi" \
+    | $AWK '{ n=NF/3; if(n!=5) exit 1;
+              for(i=1;i<=n;++i)
+                { l=$i; v=$(i+n); h=$(i+2*n);
+                  tl = 1e-6*(l<0?-l:l);   th = 1e-6*(h<0?-h:h);
+                  if(v < l-tl || v > h+th) exit 1 } }' || exit 1
+
+# At the boundaries of the inputs (a single input and the minimum and
+# maximum), the quantile function of the sketch should be identical to
+# the exact quantile function (the inputs are also few enough for the
+# sketch to be exact between them). The first image has the values 0 to
+# 99 and the second only has a single value of 3.
+$arithprog 10 10 2 makenew indexonly float32 \
+           --output=stream-qfunc.fits || exit 1
+$arithprog 1 1 2 makenew 3 + float32 --output=stream-qfunc-1.fits || exit 1
+for check in stream-qfunc.fits,-1 stream-qfunc.fits,0 \
+             stream-qfunc.fits,50 stream-qfunc.fits,50.4 \
+             stream-qfunc.fits,99 stream-qfunc.fits,100 \
+             stream-qfunc-1.fits,2 stream-qfunc-1.fits,3 \
+             stream-qfunc-1.fits,4; do
+    in=$(echo $check | $AWK -F, '{print $1}')
+    v=$(echo $check | $AWK -F, '{print $2}')
+    exact=$($execname $in --quantfunc=$v)
+    streamed=$($check_with_program $execname $in --quantfunc=$v \
+                                   --stream=1000 --quiet)
+    echo "Quantile function of $v in $in: $exact $streamed"
+    if [ "x$exact" = x ] || [ "x$exact" != "x$streamed" ]; then exit 1; fi
+done